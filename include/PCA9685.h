@@ -154,19 +154,41 @@ typedef union  uPCA9685_REG__DUTY {
 #define		MODE_SLEEP_MASK			0x10
 #define		PCA9685_MODE1_RESTART	0x80
 #define		PCA9685_MODE1_AUTO_INC  0x20
+#define		PCA9685_MODE1_ALLCALL	0x01
+
+//  LED output channels : 4 registers each (ON_L, ON_H, OFF_L, OFF_H)
+
+#define		PCA9685_NOS_CHANNELS	16
+#define		PCA9685_CHANNEL_REGS	4
+#define		PCA9685_NOS_REGS		(PCA9685__TestMode + 1)
+
+//  Per-board state : register cache (LEDn_ON/OFF part is the servo shadow)
+
+struct PCA9685_board_s {
+	uint8_t		address;
+	bool		cache_valid;
+	uint32_t	resync_retries;		// left for "PCA9685_flush" while cache is invalid
+	uint32_t	LED_dirty;			// bit n set : channel n changed since last flush
+	uint8_t		cache[PCA9685_NOS_REGS];
+};
 
 //==============================================================================
 // function templates
 
 void init_PCA9685_servo_IO(void);
-void write_PCA9685_register(uint8_t reg_number, uint8_t data_byte);
-uint8_t read_PCA9685_register(uint8_t reg_number);
-void  PCA9685_set_sleep(bool mode);
-void  PCA9685_set_auto_increment(bool mode);
-void  PCA9685_reset(void);
-void PCA9685_set_servo_freq(void);
+void write_PCA9685_register(uint32_t board, uint8_t reg_number, uint8_t data_byte);
+void write_all_PCA9685_register(uint8_t reg_number, uint8_t data_byte);
+uint8_t read_PCA9685_register(uint32_t board, uint8_t reg_number);
+void  PCA9685_set_sleep(uint32_t board, bool mode);
+void  PCA9685_set_auto_increment(uint32_t board, bool mode);
+void  PCA9685_reset(uint32_t board);
+void PCA9685_set_servo_freq(uint32_t board);
 error_codes_te PCA9685_set_servo(uint32_t servo_no, int32_t position);
+error_codes_te PCA9685_set_servo_fixed(uint32_t servo_no, q16_t position);
+void PCA9685_build_servo_table(uint32_t servo_no);
 void  PCA9685_set_zero(uint32_t servo_no);
+error_codes_te PCA9685_flush(void);
+error_codes_te PCA9685_resync(uint32_t board);
 error_codes_te  set_servo_move(
 					uint8_t            servo_no,
                     servo_states_te    ervo_state,
@@ -185,5 +207,26 @@ error_codes_te	set_servo_state(
         			servo_states_te     servo_state,
 					uint8_t             enable_mode
 );
+error_codes_te  set_servo_profile_move( 
+					uint8_t                 servo_no,
+                    int16_t                 servo_angle,
+                    int16_t                 time_for_move,  // units of 100ms
+                    trajectory_profile_te   profile,
+                    bool                    servo_sync 
+);
+error_codes_te  set_servo_waypoint( 
+					uint8_t             servo_no,
+                    int16_t             servo_angle,
+                    int16_t             time_for_move   // units of 100ms
+);
+error_codes_te  set_servo_spline_move( 
+					uint8_t             servo_no,
+                    bool                servo_sync 
+);
+void  servo_tick(uint32_t servo_no);
+error_codes_te  set_servo_speed_limit( 
+					uint8_t             servo_no,
+                    int32_t             speed_limit     // deg/s
+);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+/**
+ * @file    binary_link.h
+ * @author  Jim Herd
+ * @brief   COBS framed binary command transport
+ */
+
+#ifndef __BINARY_LINK_H__
+#define __BINARY_LINK_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Structures
+//==============================================================================
+
+struct binary_command_s {
+    uint8_t     opcode;
+    uint8_t     sequence;
+    uint8_t     port;
+    uint32_t    nos_parameters;
+    int32_t     parameters[MAX_ARGC - 2];
+};
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+uint16_t crc16_ccitt(const uint8_t *data, uint32_t length);
+uint32_t cobs_encode(const uint8_t *in, uint32_t length, uint8_t *out);
+int32_t  cobs_decode(const uint8_t *in, uint32_t length, uint8_t *out);
+
+error_codes_te binary_unpack_frame(const uint8_t *frame, uint32_t length, struct binary_command_s *bin_cmd);
+void binary_send_reply(const struct reply_context_s *context, int32_t port, int32_t status, uint32_t nos_values, const int32_t *values);
+
+#endif  /* __BINARY_LINK_H__ */
@@ -0,0 +1,26 @@
+/**
+ * @file    cmd_queues.h
+ * @author  Jim Herd
+ * @brief   Per-subsystem command execution queues
+ */
+
+#ifndef __CMD_QUEUES_H__
+#define __CMD_QUEUES_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+#include    "FreeRTOS.h"
+#include    "queue.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+void init_cmd_queues(void);
+error_codes_te post_command(cmd_queue_te queue_index, struct cmd_message_s *cmd);
+bool receive_command(cmd_queue_te queue_index, TickType_t wait_ticks);
+
+void run_command_message(struct cmd_message_s *cmd);     // Task_run_cmd.c
+
+#endif  /* __CMD_QUEUES_H__ */
@@ -0,0 +1,20 @@
+/**
+ * @file    cmd_scheduler.h
+ * @author  Jim Herd
+ * @brief   Run commands at a given device time
+ */
+
+#ifndef __CMD_SCHEDULER_H__
+#define __CMD_SCHEDULER_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+void init_cmd_scheduler(void);
+error_codes_te schedule_command(cmd_queue_te queue_index, struct cmd_message_s *cmd, uint64_t due_uS);
+
+#endif  /* __CMD_SCHEDULER_H__ */
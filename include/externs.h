@@ -24,26 +24,38 @@ extern void Task_display_control(void *p);
 extern void Task_scan_touch_buttons(void *p);
 extern void Task_write_neopixels(void *p);
 extern void Task_scan_push_buttons(void *p);
+extern void Task_sys_control(void *p);
+extern void Task_run_script(void *p);
 
-extern QueueHandle_t       queue_print_string_buffers;
-extern QueueHandle_t       queue_free_buffers;
+extern void stepper_wake(uint32_t stepper_no);
+
+extern QueueHandle_t       queue_free_batches;
 
 extern EventGroupHandle_t eventgroup_uart_IO;
 
 extern SemaphoreHandle_t   gen4_uLCD_MUTEX_access;
 extern SemaphoreHandle_t   neopixel_data_MUTEX_access;
+extern SemaphoreHandle_t   uart_TX_MUTEX_access;
+extern SemaphoreHandle_t   uart_TX_space;
 
 //==============================================================================
 // data structures
 
 extern struct stepper_data_s        stepper_data[NOS_STEPPERS];
 extern struct command_limits_s      cmd_limits[NOS_COMMANDS];
-extern struct sm_profile_s          sequences[NOS_PROFILES];
-extern char                         print_string_buffers[NOS_PRINT_STRING_BUFFERS][MAX_PRINT_STRING_LENGTH];
 extern struct task_data_s           task_data[NOS_TASKS];
+extern struct uart_stats_s          uart_stats;
+extern struct schedule_stats_s      schedule_stats;
+extern struct i2c_stats_s           i2c_stats;
+extern struct PCA9685_stats_s       PCA9685_stats;
+extern struct stepper_stats_s       stepper_stats;
 extern const uint8_t                char_type[256];
+extern const struct lexer_entry_s   lexer_table[NOS_MODES][NOS_CHAR_TYPES];
 extern struct servo_data_s          servo_data[NOS_SERVOS];
-extern struct token_list_s          commands[NOS_COMMANDS];
+extern const int8_t                 servo_correction[NOS_SERVOS][SERVO_CORRECTION_POINTS];
+extern const struct servo_channel_s servo_channel_map[NOS_SERVOS];
+extern const uint8_t                PCA9685_board_address[PCA9685_NOS_BOARDS];
+extern const struct token_list_s    commands[NOS_COMMANDS];
 extern struct display_cmd_reply_data_s    display_cmd_info[NOS_GEN4_uLCD_CMDS];
 //extern touch_button_data_ts   button_data[GEN4_uLCD_MAX_NOS_BUTTONS];
 extern struct neopixel_data_s       neopixel_data[NOS_NEOPIXELS];
@@ -52,5 +64,7 @@ extern form_data_ts                 form_data[GEN4_uLCD_MAX_NOS_FORMS];
 extern nos_objects_per_form_te		nos_object[NOS_FORMS];
 extern form_data_ts                 form_data[GEN4_uLCD_MAX_NOS_FORMS];
 extern struct switch_data_s         switch_data;
+extern struct reply_context_s       reply_context;
+extern struct cmd_queue_s           cmd_queues[NOS_CMD_QUEUES];
 
 #endif  // __EXTERNS_H__
\ No newline at end of file
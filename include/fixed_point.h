@@ -0,0 +1,102 @@
+/**
+ * @file    fixed_point.h
+ * @author  Jim Herd
+ * @brief   Q16.16 fixed point arithmetic
+ * @note
+ *      The RP2040 has no FPU, so each float operation is a ROM library
+ *      call of 30-75 cycles. A Q16.16 add is 1 cycle and a multiply is
+ *      a 32x32->64 multiply and shift. Range is +/-32767.99998, with a
+ *      resolution of 1/65536.
+ * 
+ *      Conversions to int truncate towards zero, as a C cast of a float
+ *      does. Use "q16_round" for nearest.
+ */
+
+#ifndef __FIXED_POINT_H__
+#define __FIXED_POINT_H__
+
+#include    <stdint.h>
+
+typedef int32_t     q16_t;
+
+#define     Q16_SHIFT       16
+#define     Q16_ONE         (1 << Q16_SHIFT)
+#define     Q16_HALF        (1 << (Q16_SHIFT - 1))
+#define     Q16_FRACTION    (Q16_ONE - 1)
+
+#define     Q16(x)          ((q16_t)((x) * Q16_ONE))    // constants only
+
+//==============================================================================
+// Conversion
+
+// saturates outside the Q16.16 range rather than overflowing
+
+static inline q16_t int_to_q16(int32_t value)
+{
+    if (value > INT16_MAX) {
+        return INT32_MAX;
+    }
+    if (value < INT16_MIN) {
+        return INT32_MIN;
+    }
+    return (q16_t)(value * Q16_ONE);
+}
+
+// magnitudes are unsigned so INT32_MIN/MAX (saturated values) do not overflow
+
+static inline int32_t q16_to_int(q16_t value)
+{
+    return (value >= 0) ? (int32_t)((uint32_t)value >> Q16_SHIFT)
+                        : -(int32_t)((0u - (uint32_t)value) >> Q16_SHIFT);
+}
+
+static inline int32_t q16_round(q16_t value)
+{
+    return (value >= 0) ? (int32_t)(((uint32_t)value + Q16_HALF) >> Q16_SHIFT)
+                        : -(int32_t)(((0u - (uint32_t)value) + Q16_HALF) >> Q16_SHIFT);
+}
+
+//==============================================================================
+// Arithmetic
+
+static inline q16_t q16_add(q16_t a, q16_t b)
+{
+    return a + b;
+}
+
+static inline q16_t q16_sub(q16_t a, q16_t b)
+{
+    return a - b;
+}
+
+static inline q16_t q16_mul(q16_t a, q16_t b)
+{
+    return (q16_t)(((int64_t)a * b) >> Q16_SHIFT);
+}
+
+static inline q16_t q16_mul_int(q16_t a, int32_t b)
+{
+    return a * b;               // caller ensures result is in range
+}
+
+static inline int32_t q16_mul_int_to_int(q16_t a, int32_t b)
+{
+int64_t     product;
+
+    product = (int64_t)a * b;   // full range : e.g. steps/degree x degrees
+    return (int32_t)((product >= 0) ? (product >> Q16_SHIFT) : -((-product) >> Q16_SHIFT));
+}
+
+static inline q16_t q16_div(q16_t a, q16_t b)
+{
+    return (q16_t)(((int64_t)a << Q16_SHIFT) / b);
+}
+
+// numerator/denominator of two integers, e.g. degrees per tick
+
+static inline q16_t q16_ratio(int32_t numerator, int32_t denominator)
+{
+    return (q16_t)(((int64_t)numerator << Q16_SHIFT) / denominator);
+}
+
+#endif  /* __FIXED_POINT_H__ */
@@ -0,0 +1,43 @@
+/**
+ * @file    i2c_engine.h
+ * @author  Jim Herd
+ * @brief   Interrupt driven I2C transfers on I2C_PORT
+ */
+
+#ifndef __I2C_ENGINE_H__
+#define __I2C_ENGINE_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+#include    "FreeRTOS.h"
+#include    "task.h"
+
+//==============================================================================
+// Structures
+//==============================================================================
+
+// A transfer writes "tx_length" bytes then, after a repeated START,
+// reads "rx_length" bytes. Either length may be 0 (not both).
+
+struct i2c_transfer_s {
+    uint8_t             address;
+    const uint8_t       *tx_data;
+    uint32_t            tx_length;
+    uint8_t             *rx_data;
+    uint32_t            rx_length;
+    TaskHandle_t        notify_task;    // notified when done (NULL = none)
+    volatile int32_t    status;         // I2C_PENDING, OK or I2C error
+};
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+void i2c_engine_init(uint32_t baudrate);
+error_codes_te i2c_submit(struct i2c_transfer_s *transfer);
+error_codes_te i2c_wait(struct i2c_transfer_s *transfer);
+error_codes_te i2c_transfer(uint8_t address, const uint8_t *tx_data, uint32_t tx_length, uint8_t *rx_data, uint32_t rx_length);
+void i2c_bus_recover(void);
+
+#endif  /* __I2C_ENGINE_H__ */
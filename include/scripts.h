@@ -0,0 +1,29 @@
+/**
+ * @file    scripts.h
+ * @author  Jim Herd
+ * @brief   Bytecode scripts stored in flash
+ */
+
+#ifndef __SCRIPTS_H__
+#define __SCRIPTS_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+#include    "FreeRTOS.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+void init_scripts(void);
+error_codes_te script_load(uint32_t script_id, uint32_t offset, const int32_t *words, uint32_t nos_words);
+error_codes_te script_save(void);
+error_codes_te script_start(uint32_t script_id, const int32_t *parameters, uint32_t nos_parameters, uint32_t seq_id);
+void script_stop(uint32_t script_id);
+void script_status(uint32_t script_id, int32_t *running, int32_t *pc, int32_t *error);
+TickType_t run_scripts(void);
+
+error_codes_te post_script_command(struct cmd_message_s *cmd);     // Task_run_cmd.c
+
+#endif  /* __SCRIPTS_H__ */
@@ -0,0 +1,24 @@
+/**
+ * @file    step_profile.h
+ * @author  Jim Herd
+ * @brief   Stepper motor acceleration profiles
+ */
+
+#ifndef __STEP_PROFILE_H__
+#define __STEP_PROFILE_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+error_codes_te step_profile_plan(struct step_profile_s *profile, int32_t distance, int32_t entry_speed, int32_t exit_speed,
+                                 int32_t max_speed, int32_t max_accel, int32_t max_jerk);
+void step_profile_follow(struct step_profile_s *profile, const struct step_profile_s *leader, int32_t distance);
+int32_t step_profile_reach(int32_t speed, int32_t distance, int32_t max_speed, int32_t max_accel, int32_t max_jerk);
+int32_t step_profile_exit(int32_t entry_speed, int32_t exit_limit, int32_t distance, int32_t max_speed, int32_t max_accel, int32_t max_jerk);
+bool step_profile_next(struct step_profile_s *profile, uint32_t *carry, uint32_t *nos_steps, uint32_t *period);
+
+#endif  /* __STEP_PROFILE_H__ */
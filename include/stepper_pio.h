@@ -0,0 +1,28 @@
+/**
+ * @file    stepper_pio.h
+ * @author  Jim Herd
+ * @brief   PIO step pulse generation for stepper motors
+ */
+
+#ifndef __STEPPER_PIO_H__
+#define __STEPPER_PIO_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+void stepper_pio_init(void);
+void stepper_pio_load(uint32_t stepper_no);
+void stepper_pio_start(uint32_t stepper_no);
+void stepper_pio_start_group(uint32_t stepper_mask);
+void stepper_pio_service(uint32_t stepper_no);
+bool stepper_pio_done(uint32_t stepper_no);
+uint32_t stepper_pio_sent_segments(uint32_t stepper_no);
+void stepper_pio_stop(uint32_t stepper_no);
+int32_t stepper_pio_halt(uint32_t stepper_no);
+void stepper_pio_step(uint32_t stepper_no, sm_direction direction);
+
+#endif  /* __STEPPER_PIO_H__ */
@@ -0,0 +1,25 @@
+/**
+ * @file    stepper_queue.h
+ * @author  Jim Herd
+ * @brief   Queue of stepper motor moves with look-ahead speed planning
+ */
+
+#ifndef __STEPPER_QUEUE_H__
+#define __STEPPER_QUEUE_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+error_codes_te stepper_queue_add(uint32_t stepper_no, int32_t nos_steps, uint32_t seq_id);
+int32_t stepper_queue_end(uint32_t stepper_no);
+struct stepper_move_s *stepper_queue_head(uint32_t stepper_no);
+void stepper_queue_begin(uint32_t stepper_no);
+void stepper_queue_flush(uint32_t stepper_no);
+void stepper_queue_report(uint32_t stepper_no, uint32_t sent_segments, bool run_ended);
+bool stepper_queue_next(uint32_t stepper_no, uint32_t *nos_steps, uint32_t *period, sm_direction *direction);
+
+#endif  /* __STEPPER_QUEUE_H__ */
@@ -17,6 +17,13 @@
 
 void update_task_execution_time(task_et task, uint32_t start_time, uint32_t end_time);
 void print_error(int32_t port, error_codes_te sys_error);
+void print_reply(int32_t port, int32_t status, uint32_t nos_values, ...);
+void prime_free_batch_queue(void);
+struct reply_batch_s *begin_reply_batch(void);
+int32_t add_reply_batch_slot(struct reply_batch_s *batch);
+void end_reply_batch(struct reply_batch_s *batch);
+void flush_reply_batch(void);
+void print_move_done(uint32_t *seq_id, int32_t status);
 void software_reset(void);
 
 
@@ -11,6 +11,7 @@
 
 #include    "pico/stdlib.h"
 #include    "Pico_IO.h"
+#include    "fixed_point.h"
 
 #include    "FreeRTOS.h"
 #include    "semphr.h"
@@ -69,9 +70,11 @@
 #define     MAX_STRING_SIZE   48
 
 struct string_buffer {
-    char        buffer[MAX_STRING_SIZE];
+    char        *buffer;        // "store" or space reserved elsewhere
+    uint32_t    limit;          // buffer is full at this index
     uint32_t    char_pt;
     bool        full;
+    char        store[MAX_STRING_SIZE];
 };
 
 //==============================================================================
@@ -119,6 +122,26 @@ typedef enum  {
     GEN4_UNKNOWN_DISPLAY_SUB_COMMAND = -137,
     GEN4_uLCD_BAD_REPLY_CHECKSUM     = -138,
     BAD_NEOPIXEL_NUMBER              = -139,
+    BAD_FRAME_ENCODING               = -140,
+    BAD_FRAME_CRC                    = -141,
+    BAD_FRAME_LENGTH                 = -142,
+    CMD_QUEUE_FULL                   = -143,
+    TOO_MANY_COMMANDS                = -144,
+    MOVE_SUPERSEDED                  = -145,
+    SCRIPT_EMPTY                     = -146,
+    SCRIPT_BAD_OPCODE                = -147,
+    SCRIPT_NO_RUNNER                 = -148,
+    SCRIPT_BAD_ADDRESS               = -149,
+    SCRIPT_LOOP_ERROR                = -150,
+    BAD_SCRIPT_COMMAND               = -151,
+    SCHEDULE_FULL                    = -152,
+    SCHEDULE_NOT_ALLOWED             = -153,
+    I2C_NAK                          = -154,
+    I2C_ABORT                        = -155,
+    I2C_TIMEOUT                      = -156,
+    I2C_QUEUE_FULL                   = -157,
+    TOO_MANY_WAYPOINTS               = -158,
+    NO_WAYPOINTS                     = -159,
 } error_codes_te;
 
 
@@ -133,7 +156,26 @@ typedef enum  {
 
 #define UART0_BAUD_RATE 115200
 
-#define LINE_AVAILABLE  0   // bit in eventgroup_uart_IO
+#define UART0_TX_DMA_CHANNEL    1       // channel 0 is used by the neopixel driver
+#define UART0_RX_DMA_CHANNEL    2
+#define UART0_RX_DMA_RING_BITS  8       // 256 byte receive ring
+#define UART0_RX_DMA_RING_SIZE  (1 << UART0_RX_DMA_RING_BITS)
+#define UART0_RX_POLL_TICKS     1       // receive scan (idle-line) interval
+#define UART0_RX_IDLE_POLL_TICKS 5      // scan interval once the line is quiet
+#define UART0_RX_IDLE_SCANS     100     // empty scans before the line is quiet
+
+struct uart_stats_s {
+    uint32_t    rx_overflows;       // lines cut short by a full receive ring
+    uint32_t    rx_dropped_lines;   // lines lost (overflow or line queue full)
+    uint32_t    rx_dropped_frames;  // binary frames lost to overrun
+    uint32_t    rx_ring_overruns;   // receive DMA ring lapped before it was scanned
+    uint32_t    tx_stalls;          // replies that waited for TX buffer space
+    uint32_t    rx_bytes;           // bytes received
+    uint32_t    rx_scan_uS;         // time in scans that found data
+};
+
+#define LINE_AVAILABLE   0   // bits in eventgroup_uart_IO
+#define FRAME_AVAILABLE  1
 
 #define     RETURN      '\r'
 #define     NEWLINE     '\n'
@@ -144,20 +186,101 @@ typedef enum  {
 #define     STRING_NULL '\0'
 #define     PERCENT     '%'
 
-#define     MAX_STRING_LENGTH       80
+#define     MAX_STRING_LENGTH       120
 #define     MAX_GEN4_uLCD_WRITE_STR_SIZE    40
 
-#define     MAX_COMMAND_LENGTH      100
+#define     MAX_COMMAND_LENGTH      128
+
+#define     ATOMIC_PREFIX           '!'     // "!cmd; cmd; ..." : release moves together
+#define     SEQUENCE_PREFIX         '#'     // "#id cmd" : send "done id status" when move ends
+#define     SCHEDULE_PREFIX         '@'     // "@t cmd" / "@+t cmd" : run at/after time t (uS)
+#define     RELATIVE_TIME_PREFIX    '+'
 
 #define     MAX_ARGC  8
 
-enum modes_e {MODE_U, MODE_I, MODE_R, MODE_W, MODE_S} ;  // defines modes as scan progresses
+enum modes_e {MODE_U, MODE_I, MODE_R, MODE_W, MODE_S, NOS_MODES} ;  // defines modes as scan progresses
 
-enum {LETTER, NUMBER, DOT, PLUSMINUS, END, QUOTE, SEPARATOR, OTHER};
+enum {LETTER, NUMBER, DOT, PLUSMINUS, END, QUOTE, SEPARATOR, CMD_SEPARATOR, OTHER, NOS_CHAR_TYPES};
+
+//==============================================================================
+// Command lexer : transition table indexed by [mode][character type]
+
+typedef enum {
+    LEX_NONE,               // stay in mode, ignore character
+    LEX_START_WORD,
+    LEX_START_NUMBER,       // digit or sign starts an integer
+    LEX_START_STRING,
+    LEX_DIGIT,              // accumulate integer digit
+    LEX_POINT,              // integer becomes fixed point real
+    LEX_FRACTION_DIGIT,     // accumulate fractional digit
+    LEX_END_ARG,            // store argument and terminate its string
+    LEX_END_LINE,
+    LEX_END_COMMAND,        // ';' : more commands follow on this line
+    LEX_LETTER_ERROR,
+    LEX_DOT_ERROR,
+    LEX_PLUSMINUS_ERROR,
+    LEX_QUOTE_ERROR,
+} lexer_action_te;
+
+struct lexer_entry_s {
+    uint8_t     next_mode;
+    uint8_t     action;
+};
+
+#define     MAX_FRACTION_DIGITS     6       // further digits are ignored
 
 enum {BASE_10 = 10, BASE_16 = 16};
 enum {UPPER_CASE, LOWER_CASE};
 
+//==============================================================================
+// Binary command frames (COBS encoded with CRC16) on UART0
+//
+// Frame before encoding
+//      request : opcode, sequence, port, int32 parameters (LE), CRC16 (LE)
+//      reply   : opcode, sequence, port, int16 status (LE), int32 values (LE), CRC16 (LE)
+// On the wire each encoded frame is bracketed by FRAME_DELIMITER bytes.
+// The leading delimiter is required : encoded bytes can include NEWLINE,
+// so a frame with only the usual trailing COBS delimiter is taken as ASCII
+// text. Back-to-back frames are therefore separated by two delimiters.
+// Opcode is a TOKENIZER_* value and parameters load into int_parameters[2..]
+
+#define     FRAME_DELIMITER         0x00
+#define     MAX_FRAME_SIZE          64      // encoded size excluding delimiters
+#define     FRAME_HEADER_SIZE        3
+#define     REPLY_HEADER_SIZE        5
+#define     FRAME_CRC_SIZE           2
+#define     CRC16_INIT              0xFFFF  // CRC-16/CCITT-FALSE
+
+#define     MAX_REPLY_VALUES         6
+
+typedef enum {TRANSPORT_ASCII, TRANSPORT_BINARY, TRANSPORT_NONE} transport_te;
+
+struct reply_context_s {
+    transport_te    transport;
+    uint8_t         opcode;
+    uint8_t         sequence;
+    uint8_t         batch_slot;
+    struct reply_batch_s  *batch;     // NULL unless part of a multi-command line
+};
+
+#define     REPLY_CONTEXT_TLS_INDEX  0      // FreeRTOS thread local storage slot
+
+//==============================================================================
+// Replies to a multi-command line are collected and sent as one line
+
+#define     MAX_CMDS_PER_LINE       12
+#define     MAX_BATCH_REPLY_SIZE    24
+#define     NOS_REPLY_BATCHES        2
+
+struct reply_batch_s {
+    uint32_t    nos_cmds;
+    uint32_t    nos_done;
+    bool        closed;         // no more commands will be added
+    bool        sent;
+    uint8_t     length[MAX_CMDS_PER_LINE];
+    char        reply[MAX_CMDS_PER_LINE][MAX_BATCH_REPLY_SIZE];
+};
+
 //==============================================================================
 // Serial display port (UART) - 4D System display
 //==============================================================================
@@ -348,6 +471,22 @@ enum {SRC_HARDWARE, SRC_FORM_DATA};
 #define I2C_PORT    i2c0
 #define I2C_SDA     GP8
 #define I2C_SCL     GP9
+#define I2C_IRQ     I2C0_IRQ
+
+#define I2C_BAUDRATE            (1000 * 1000)   // Fast-mode Plus : needs ~1k pull-ups
+#define I2C_QUEUE_SIZE          4               // transfers waiting for the bus
+#define I2C_TIMEOUT_TICKS       10              // longest transfer is ~0.4mS at 1MHz
+#define I2C_NOTIFY_INDEX        1               // task notification used for transfer done
+#define I2C_RECOVERY_CLOCKS     9
+#define I2C_PENDING             1               // transfer status until done
+
+struct i2c_stats_s {
+    uint32_t    transfers;
+    uint32_t    naks;               // address or data not acknowledged
+    uint32_t    aborts;             // other controller aborts
+    uint32_t    timeouts;
+    uint32_t    recoveries;         // bus clocked free and controller reset
+};
 
 //==============================================================================
 // log and blink pins
@@ -368,7 +507,34 @@ typedef enum {SOFT_RESET} sys_commands_te;
 //servo motor interface (PCA9685A)
 //==============================================================================
 
-#define     PCA9685_address     0x40
+// Servos are spread over one or more PCA9685 boards (16 channels each) by
+// "servo_channel_map". Board addresses are set by the A0-A5 links.
+
+#define     PCA9685_NOS_BOARDS          1
+#define     PCA9685_BASE_ADDRESS        0x40
+#define     PCA9685_ALLCALL_ADDRESS     0x70        // power-on default
+#define     PCA9685_USE_ALLCALL         true        // no other device at 0x70
+#define     PCA9685_FLUSH_BUDGET        200         // bytes/servo tick : ~2mS at 1MHz
+#define     PCA9685_RESYNC_RETRIES      5           // flush resyncs after an I2C error, then give up
+
+struct servo_channel_s {
+    uint8_t     board;
+    uint8_t     channel;
+};
+
+struct PCA9685_stats_s {
+    uint32_t    writes_issued;      // I2C write transactions
+    uint32_t    writes_suppressed;  // register/channel writes of an unchanged value
+    uint32_t    reads_issued;       // I2C read transactions
+    uint32_t    reads_cached;       // register reads served from cache
+    uint32_t    resyncs;
+    uint32_t    flushes;            // servo ticks flushed
+    uint32_t    flush_bytes;        // budget bytes used, all flushes
+    uint32_t    flush_uS;           // time in flushes, including I2C waits
+    uint32_t    max_flush_bytes;
+    uint32_t    max_flush_uS;
+    uint32_t    flushes_deferred;   // flushes that left boards for the next tick
+};
 
 #define		PCA9685_servo_frequency		 50  // hertz
 #define		PCA9685_50Hz_PRE_SCALER		138  // TUNED : calc = 123
@@ -381,16 +547,60 @@ typedef enum {SOFT_RESET} sys_commands_te;
 #define		COUNT_1mS			205
 #define		MAX_ANGLE			 90
 
+// Per-servo angle to PWM OFF count tables : flip, limits, trim and a
+// correction curve are folded in when the table is built
+
+#define     SERVO_TABLE_STEPS_PER_DEGREE    2       // 0.5 degree : 1 PWM count = 0.44 degree
+#define     SERVO_TABLE_CENTRE              (MAX_ANGLE * SERVO_TABLE_STEPS_PER_DEGREE)
+#define     SERVO_TABLE_SIZE                ((2 * SERVO_TABLE_CENTRE) + 1)
+#define     SERVO_CORRECTION_POINTS         5       // -90, -45, 0, +45, +90 degrees
+#define     SERVO_CORRECTION_SPACING        ((2 * SERVO_TABLE_CENTRE) / (SERVO_CORRECTION_POINTS - 1))
+
 enum {R_EYE_LR, R_EYE_UD, R_EYE_LID, R_EYE_BROW, L_EYE_LR, L_EYE_UD, L_EYE_LID, L_EYE_BROW, MOUTH};
 
 #define		NOS_SERVOS	(MOUTH + 1)
 
 typedef enum  {SERVO, MOTOR} servo_type_te;
 
-typedef enum {ABS_MOVE, ABS_MOVE_SYNC, SPEED_MOVE, SPEED_MOVE_SYNC, RUN_SYNC_MOVES, T_DELAY, STOP, STOP_ALL, ENABLE} servo_commands_te;
-typedef enum {DISABLED, DORMANT, DELAY, MOVE, TIMED_MOVE} servo_states_te;
+typedef enum {ABS_MOVE, ABS_MOVE_SYNC, SPEED_MOVE, SPEED_MOVE_SYNC, RUN_SYNC_MOVES, T_DELAY, STOP, STOP_ALL, ENABLE,
+              PROFILE_MOVE, PROFILE_MOVE_SYNC, ADD_WAYPOINT, SPLINE_MOVE, SET_SPEED_LIMIT,
+              SPLINE_MOVE_SYNC} servo_commands_te;
+typedef enum {DISABLED, DORMANT, DELAY, MOVE, TIMED_MOVE, TRAJECTORY_MOVE} servo_states_te;
+
+enum {SYS_INFO, SERVO_INFO, STEPPER_INFO, QUEUE_INFO, UART_INFO, SCHEDULE_INFO, I2C_INFO, PCA9685_INFO,
+      PCA9685_FLUSH_INFO};
 
-enum {SYS_INFO, SERVO_INFO, STEPPER_INFO};
+//==============================================================================
+// Servo trajectories
+//==============================================================================
+// Moves are sampled once per servo task tick. Normalised time "s" runs
+// 0->1 over a move (or spline segment) and the profile maps it to the
+// fraction of the move completed. All in Q16.16.
+
+#define     MAX_WAYPOINTS           8
+#define     SERVO_SPEED_UNLIMITED   0       // deg/s
+
+typedef enum {TRAJ_LINEAR, TRAJ_MIN_JERK, TRAJ_TRAPEZOID, TRAJ_SPLINE, TRAJ_BLEND} trajectory_profile_te;
+
+struct waypoint_s {
+    int32_t         angle;
+    uint32_t        ticks;          // time from previous point
+};
+
+struct trajectory_s {
+    trajectory_profile_te   profile;
+    q16_t           s, ds;          // normalised time and step per tick
+    uint32_t        tick, nos_ticks;
+    q16_t           start, delta;   // degrees
+    q16_t           m0, m1;         // spline/blend : end tangents x segment time (degrees)
+    q16_t           position;       // last output (degrees)
+    q16_t           velocity;       // last change of output (degrees/tick)
+    int32_t         origin;         // spline : angle at start of spline
+    uint32_t        segment;
+    uint32_t        nos_waypoints;
+    bool            waypoints_used; // next "add" starts a new spline
+    struct waypoint_s   waypoints[MAX_WAYPOINTS];
+};
 
 struct servo_data_s {
     servo_states_te	state;
@@ -398,16 +608,18 @@ struct servo_data_s {
     servo_type_te	type;
     int32_t			angle;			// current value
     int32_t			angle_target;
-    int32_t			speed_value;
+    int32_t			speed_value;    // deg/s limit (0 = unlimited)
     int32_t			init_angle;		// power-on state
     bool			flip;
     int32_t			angle_min, angle_max;
     uint32_t		pulse_offset;
     uint32_t        mS_per_degree;
     uint32_t		counter;
-    float			gradient;
-    float   		y_intercept;
+    q16_t			gradient;		// degrees per tick (MOVE : estimated slew)
+    q16_t   		y_intercept;
     uint32_t		t_end;
+    uint32_t        seq_id;         // pending "done" notification (0 = none)
+    struct trajectory_s trajectory;
 };
 
 //==============================================================================
@@ -415,16 +627,31 @@ struct servo_data_s {
 //==============================================================================
 
 #define     NOS_STEPPERS        1
-#define     MAX_ST_STEP_CMDS   16
-#define     ST_SEQUENCES        8
 
 #define     MAX_STEPS           1000
-#define     MIN_STEP_MOVE       4    // ignore very small stepper motor moves
 
-#define     NOS_PROFILES        5
-#define     NO_PROFILE          -1
+#define     CALIBRATE_CLEAR_PERIOD_uS   1000    // stepping off a limit switch
+#define     STEPPER_POLL_uS         1000    // end of move check while moving
+#define     STEPPER_IDLE            UINT32_MAX      // no further service until a command
+#define     STEPPER_DONE_POLL_TICKS 5       // check for finished moves (mS)
+
+//
+// step pulses are generated by a PIO state machine fed (direction/step count,
+// period) segments by DMA from a double buffer refilled by the stepper task
+
+#define     STEPPER_PIO_UNIT        pio1            // pio0 drives the neopixels
+#define     STEPPER_PIO_FREQUENCY   10000000        // 0.1uS step timing resolution
+#define     STEPPER_MIN_PERIOD      20              // PIO cycles (500kHz)
+#define     STEPPER_DMA_CHANNEL     3               // + stepper number : 0-2 used by neopixel/UART
+#define     STEPPER_FEED_SEGMENTS   32              // segments in each half of the DMA buffer
 
-#define     CALIBRATE_SPEED_DELAY   5       // number of mS between calibrate step pulses
+//
+// acceleration profile is evaluated once per time slice
+
+#define     STEP_SLICE_uS           1000
+#define     STEP_SLICES_PER_SEC     (1000000 / STEP_SLICE_uS)
+#define     STEP_SLICE_CYCLES       (STEPPER_PIO_FREQUENCY / STEP_SLICES_PER_SEC)
+#define     STEP_MAX_DISTANCE       1000000         // bound for 64-bit profile arithmetic
  
 typedef enum {CLOCKWISE = 0, ANTI_CLOCKWISE = 1} sm_direction;
 enum {CLOCKWISE_COUNT_VALUE = +1, ANTI_CLOCKWISE_COUNT_VALUE = -1};
@@ -432,19 +659,103 @@ enum {CLOCKWISE_COUNT_VALUE = +1, ANTI_CLOCKWISE_COUNT_VALUE = -1};
 enum {OFF, ON};
 enum {ASSERTED_LOW=0, ASSERTED_HIGH=1};
 
-typedef enum {SM_REL_MOVE, SM_ABS_MOVE, SM_REL_MOVE_SYNC, SM_ABS_MOVE_SYNC, SM_CALIBRATE} stepper_commands_te;
-    #define NOS_STEPPER_CMDS        (SM_CALIBRATE + 1)
-typedef enum {SM_ACCEL, SM_COAST, SM_DECEL, SM_SKIP, SM_END , SM_DELAY} sm_command_type_et;
+//
+// Limit switches interrupt on their asserted edge. The first edge of each
+// switch latches the position and, during a run of moves, the first edge
+// stops the step pulses at once. Contact bounce can't move a latched
+// position until the state machine clears the latch.
+
+enum {L_LIMIT_LATCH = 0x01, R_LIMIT_LATCH = 0x02};
+
+typedef enum {SM_REL_MOVE, SM_ABS_MOVE, SM_REL_MOVE_SYNC, SM_ABS_MOVE_SYNC, SM_CALIBRATE,
+              SM_REL_MOVE_COORD, SM_ABS_MOVE_COORD} stepper_commands_te;
+    #define NOS_STEPPER_CMDS        (SM_ABS_MOVE_COORD + 1)
+
+//
+// Coordinated moves (SM_xxx_MOVE_COORD) are held like SYNC moves. On "sync"
+// the axis with most steps is planned within the limits of every axis,
+// scaled by its share of the move, and each other axis follows the same
+// slice timing with its own distance, so all start and finish together.
 
 // Stepper motor run state machine states
 
+//
+// Calibration homes on each limit switch in turn : a fast approach (a
+// profile move, stopped by the switch edge), a backoff move, then a slow
+// re-approach of single steps that sets the position. The motor then moves
+// to the centre of its travel at full speed.
+// Moves of the homing sequence are loaded by the task (CALIB_LOAD), run
+// (CALIB_START, CALIB_RUN) and then the sequence goes on at "calib_next".
+
 typedef enum {
     STATE_SM_UNCALIBRATED, STATE_SM_DORMANT, STATE_SM_INIT, STATE_SM_RUNNING, STATE_SM_FAULT, STATE_SM_SYNC,
-    STATE_SM_CALIB_S0, STATE_SM_CALIB_S1, STATE_SM_CALIB_S2, STATE_SM_CALIB_S3, STATE_SM_CALIB_S4,
-    STATE_SM_CALIB_S5, STATE_SM_CALIB_S6, STATE_SM_CALIB_S7, STATE_SM_CALIB_S8, STATE_SM_CALIB_S9, 
-    STATE_SM_CALIB_S10, STATE_SM_CALIB_S11,
+    STATE_SM_CALIB_S0,                  // step off the origin (LEFT) switch
+    STATE_SM_CALIB_HOME_L, STATE_SM_CALIB_BACKOFF_L, STATE_SM_CALIB_SLOW_L, STATE_SM_CALIB_ORIGIN,
+    STATE_SM_CALIB_HOME_R, STATE_SM_CALIB_BACKOFF_R, STATE_SM_CALIB_SLOW_R, STATE_SM_CALIB_END,
+    STATE_SM_CALIB_DONE,
+    STATE_SM_CALIB_LOAD, STATE_SM_CALIB_START, STATE_SM_CALIB_RUN,     // homing move
+    STATE_SM_CALIB_EDGE,                // homing move stopped by a switch
+    STATE_SM_CALIB_SLOW,                // single steps to a switch
 } sm_profile_exec_state_te;
 
+//
+// S-curve move planned as whole time slices :
+//      ramp from entry speed to peak speed (Ta, with jerk for Tja at each end),
+//      cruise for Tc slices and Tf PIO cycles, then ramp from peak to exit
+//      speed (Tb, jerk for Tjb).
+// Tj = 0 gives a trapezoid and Tc = 0 a triangular (short move) profile.
+// Speeds, accelerations and jerks of the generator are steps per slice
+// (per slice^2, slice^3) in 32.32 fixed point.
+
+struct step_profile_s {
+    int32_t     distance;           // steps
+    int32_t     lead_distance;      // steps of the profile generated : distance, or leader's
+    int32_t     entry_speed, exit_speed;    // steps/sec
+    uint32_t    Ta, Tja;            // slices
+    uint32_t    Tc, Tf;
+    uint32_t    Tb, Tjb;
+    uint32_t    nos_slices;         // Ta + Tc + Tb, + 1 for a part slice
+    int64_t     peak;               // cruise speed
+    uint32_t    slice;              // slices generated
+    int64_t     p, v, a, j;         // position, speed, acceleration, jerk
+    int32_t     position;           // steps generated so far
+};
+
+//
+// Moves wait in a queue per stepper. A move's entry and exit speeds are
+// planned when its first segment is needed, looking ahead over the moves
+// queued behind it : consecutive moves in the same direction run on without
+// stopping, as fast as still lets every later move stop at the end of the
+// queue. A change of direction stops the motor.
+
+#define     STEPPER_QUEUE_DEPTH     8       // moves, including the one running
+
+struct stepper_move_s {
+    int32_t     steps;              // +ve clockwise
+    bool        planned;            // profile set : speeds now fixed
+    int32_t     entry_limit;        // steps/sec, from the last look-ahead used
+    uint32_t    seq_id;             // "done" notification (0 = none)
+    struct step_profile_s   profile;
+};
+
+struct stepper_sent_move_s {        // move whose segments have all been generated
+    uint32_t    seq_id;
+    uint32_t    segments;           // segment count at its end
+};
+
+struct stepper_queue_s {
+    struct stepper_move_s   moves[STEPPER_QUEUE_DEPTH];
+    uint32_t    head;               // move being sent to the PIO
+    uint32_t    count;
+    int32_t     end_step_count;     // position after the last queued move
+    int32_t     entry_speed;        // steps/sec at the start of the head move
+    int32_t     sent_steps;         // of whole moves sent since the PIO was loaded
+    uint32_t    carry;              // PIO cycles not yet allocated to a step
+    int32_t     speed_limit;        // steps/sec below "max_speed" (0 = none)
+    uint32_t    segments;           // generated since the PIO was loaded
+    struct stepper_sent_move_s  sent[STEPPER_QUEUE_DEPTH];  // waiting for "done"
+    uint32_t    sent_head, sent_count;
+};
 
 // Stepper motor data structure
 
@@ -453,38 +764,45 @@ struct stepper_data_s {
     int32_t     steps_per_rev;
     int32_t     gearbox_ratio;
     int32_t     microstep_value;
-    float       steps_per_degree;   //calculated at run time
+    q16_t       steps_per_degree;   //calculated at run time
     uint32_t    step_pin, direction_pin, R_limit_pin, L_limit_pin;
     sm_direction direction;
     bool        flip_direction;     // default is +ve for clockwise
     int32_t     init_step_position; // initial position from origin
+    int32_t     max_speed;          // steps/sec
+    int32_t     max_accel;          // steps/sec/sec
+    int32_t     max_jerk;           // steps/sec/sec/sec (0 = trapezoidal moves)
+    int32_t     home_fast_speed;    // steps/sec : approach to a limit switch
+    int32_t     home_slow_speed;    // steps/sec : re-approach after backoff
+    int32_t     home_backoff;       // steps back from a switch before re-approach
   // set when motor is calibrated
     bool        calibrated;
     int32_t     max_step_count;
     int32_t     soft_left_limit, soft_right_limit;   // in angle for 0 centre
   // set per move
-    int32_t     sm_profile;         // index of trapezoidal sm_profile
     int32_t     target_step_count;  // from command
+    bool        coordinated;        // held for a coordinated start
     error_codes_te error;   
   // dynamic data changed as motor moves
     sm_profile_exec_state_te   state;
-    int32_t     cmd_index;          // points to current command
-    int32_t     cmd_step_cnt;       // number of steps at a fixed speed
-    int32_t     coast_step_count;   // sm_profiles always have this set to 0
     int32_t     current_step_count; // from origin point
-    int32_t     current_step_delay, current_step_delay_count; 
     int32_t     temp_count;
+    uint32_t    seq_id;             // pending "done" of a calibration (0 = none)
+    sm_profile_exec_state_te   calib_next;     // after the homing move or single steps
+    uint32_t    home_switch;        // latch bit homed on (0 = plain move)
+    int32_t     home_speed;         // speed limit of the homing move (0 = none)
+    volatile uint32_t   limit_latch;    // L_LIMIT_LATCH/R_LIMIT_LATCH edges seen
+    int32_t     limit_step_count;   // position at the last switch to latch
+    struct stepper_queue_s  queue;
 };
 
-struct sm_step_cmd_s {      // single step motor command
-    sm_command_type_et     sm_command_type;
-    int32_t                sm_cmd_step_cnt;
-    uint32_t               sm_delay;
-};
-
-struct sm_profile_s {      // single stepper motor seqence
-    uint32_t    nos_sm_cmds;
-    struct      sm_step_cmd_s  cmds[MAX_ST_STEP_CMDS];
+struct stepper_stats_s {
+    uint32_t    moves;
+    uint32_t    segments;           // (step count, period) pairs sent to the PIO
+    uint32_t    underruns;          // DMA found no refilled buffer half
+    uint32_t    max_move_mS;        // longest planned move
+    uint32_t    blends;             // moves run on from the last without stopping
+    uint32_t    alarms;             // state machine service interrupts
 };
 
 //==============================================================================
@@ -591,8 +909,9 @@ struct switch_data_s {
 // Freertos : task rates
 //==============================================================================
 
-#define     TASK_SERVO_CONTROL_FREQUENCY                 10  // Hz
+#define     TASK_SERVO_CONTROL_FREQUENCY                 50  // Hz : max = PWM frame rate
 #define     TASK_SERVO_CONTROL_FREQUENCY_TICK_COUNT      ((1000/TASK_SERVO_CONTROL_FREQUENCY) * portTICK_PERIOD_MS)
+#define     SERVO_TICKS_PER_100mS                        (TASK_SERVO_CONTROL_FREQUENCY / 10)
 
 
 #define     TASK_SCAN_TOUCH_BUTTONS_FREQUENCY             5  // Hz
@@ -622,8 +941,8 @@ struct switch_data_s {
 // Print task information
 //==============================================================================
 
-#define     NOS_PRINT_STRING_BUFFERS   8
-#define     MAX_PRINT_STRING_LENGTH   128
+#define     UART0_TX_BUFFER_SIZE      512     // bip-buffer shared by all replies
+#define     MAX_PRINT_STRING_LENGTH   128     // largest single reservation
 
 //==============================================================================
 // Command string index values for the parameter list
@@ -637,6 +956,19 @@ struct switch_data_s {
 
 #define     SYS_SUB_CMD_INDEX           2
 
+// script command indices
+
+#define     SCRIPT_SUB_CMD_INDEX        2
+#define     SCRIPT_ID_INDEX             3
+#define     SCRIPT_OFFSET_INDEX         4   // SCRIPT_LOAD
+#define     SCRIPT_DATA_INDEX           5   // SCRIPT_LOAD : up to 3 words of 4 bytes
+#define     SCRIPT_PARAMETER_INDEX      4   // SCRIPT_RUN : up to NOS_SCRIPT_PARAMETERS values
+
+// get command indices
+
+#define     GET_SUB_CMD_INDEX           2
+#define     GET_QUEUE_INDEX             3
+
 // Stepper command indicies
 
 #define     STEP_MOTOR_SUB_CMD_INDEX    2
@@ -650,6 +982,8 @@ struct switch_data_s {
 #define     SERVO_NUMBER_INDEX      3
 #define     SERVO_ANGLE_INDEX       4
 #define     SERVO_SPEED_INDEX       5
+#define     SERVO_TIME_INDEX        5
+#define     SERVO_PROFILE_INDEX     6
 
 // display command indicies
 
@@ -676,13 +1010,15 @@ struct switch_data_s {
 // Ping command
 
 #define     PING_VALUE_INDEX        2
+#define     PING_CLOCK_INDEX        3       // 1 = add device receive/transmit times to reply
 
 //==============================================================================
 // 
 
 typedef enum {
     TASK_UART, TASK_RUN_CMD, TASK_SERVO_CONTROL, TASK_STEPPER_CONTROL,
-    TASK_DISPLAY, TASK_SCAN_TOUCH_BUTTONS, TASK_WRITE_NEOPIXELS, TASK_SCAN_PUSH_BUTTONS, TASK_BLINK,
+    TASK_DISPLAY, TASK_SCAN_TOUCH_BUTTONS, TASK_WRITE_NEOPIXELS, TASK_SCAN_PUSH_BUTTONS, TASK_RUN_SCRIPT,
+    TASK_BLINK,
 } task_et;
 
 #define     NOS_TASKS   (TASK_BLINK + 1)
@@ -710,6 +1046,8 @@ struct error_list_s {
     char        *error_string;
 };
 
+#define MAX_KEYWORD_LENGTH  8
+
 struct token_list_s {
     char      *keyword;
     uint32_t  token;
@@ -745,10 +1083,133 @@ enum {
     TOKENIZER_DISPLAY,
     TOKENIZER_NEOPIXEL,
     TOKENIZER_SWITCH,
+    TOKENIZER_SCRIPT,
     TOKENIZER_ERROR,
 };
 
-#define NOS_COMMANDS   (TOKENIZER_SWITCH + 1)
+#define NOS_COMMANDS   (TOKENIZER_SCRIPT + 1)
+
+//==============================================================================
+// Command execution queues
+//
+// Parsed commands are passed to the task that owns the subsystem so that a
+// slow command (e.g. a display read) does not hold up other subsystems.
+
+typedef enum {
+    CMD_QUEUE_SYS, CMD_QUEUE_SERVO, CMD_QUEUE_STEPPER, CMD_QUEUE_NEOPIXEL, CMD_QUEUE_DISPLAY,
+    CMD_QUEUE_SCRIPT,
+    NOS_CMD_QUEUES,
+    CMD_QUEUE_NONE = NOS_CMD_QUEUES,    // run directly by "Task_run_cmd"
+} cmd_queue_te;
+
+#define     SYS_CMD_QUEUE_LENGTH         4
+#define     SERVO_CMD_QUEUE_LENGTH      16
+#define     STEPPER_CMD_QUEUE_LENGTH     8
+#define     NEOPIXEL_CMD_QUEUE_LENGTH    8
+#define     DISPLAY_CMD_QUEUE_LENGTH     4
+#define     SCRIPT_CMD_QUEUE_LENGTH      4
+
+struct cmd_message_s {
+    int32_t     token;
+    uint32_t    argc;
+    int32_t     int_parameters[MAX_ARGC];
+    char        string[MAX_GEN4_uLCD_WRITE_STR_SIZE];
+    struct reply_context_s  reply;
+    uint32_t    queued_time;        // uS
+    uint32_t    stage;              // commands passed between tasks
+    uint32_t    seq_id;             // move completion ID (0 = none)
+};
+
+struct cmd_queue_s {
+    QueueHandle_t   queue;
+    uint32_t        length;
+    uint32_t        max_depth;
+    uint32_t        nos_cmds;
+    uint32_t        last_latency_uS;    // queued to start of execution
+    uint32_t        max_latency_uS;
+};
+
+//==============================================================================
+// Timed command scheduling
+//==============================================================================
+// Commands with a "@t" prefix wait in a timer wheel of WHEEL_SLOTS slots,
+// each WHEEL_TICK_US long. Each wheel tick moves the commands due before
+// the end of the next tick onto a short time ordered list, which a
+// hardware alarm releases to the subsystem queues at the due time.
+
+#define     WHEEL_TICK_SHIFT        10      // 1024uS wheel tick
+#define     WHEEL_TICK_US           (1 << WHEEL_TICK_SHIFT)
+#define     WHEEL_SLOTS             256     // power of two : ~262mS per revolution
+#define     WHEEL_MASK              (WHEEL_SLOTS - 1)
+#define     NOS_SCHEDULED_CMDS      16
+
+struct scheduled_cmd_s {
+    uint64_t                due_uS;         // time since boot
+    cmd_queue_te            queue;
+    struct scheduled_cmd_s  *next;
+    struct cmd_message_s    cmd;
+};
+
+struct schedule_stats_s {
+    uint32_t    pending;
+    uint32_t    released;
+    uint32_t    late;               // due time passed before command was scheduled
+    uint32_t    queue_full;         // lost : subsystem queue full at due time
+    uint32_t    max_lateness_uS;    // release time after due time
+};
+
+//==============================================================================
+// Script engine
+//==============================================================================
+// Scripts are bytecode kept in the last sector of flash, one slot per script.
+// A slot starts with a 16-bit code length (0xFFFF = erased slot) followed by
+// the code. Multi-byte values are little endian.
+//
+//   OP_END
+//   OP_CMD     token, nos_args, subst_mask, nos_args x int16
+//                  args load int_parameters[2..]. If bit n of "subst_mask"
+//                  is set, arg n is the number of a SCRIPT_RUN parameter.
+//   OP_WAIT    axis type, axis number (ALL_AXES = every axis of that type)
+//                  wait until the axis has finished moving
+//   OP_DELAY   uint16 mS : wait relative to the previous timing point
+//   OP_LOOP    uint16 count (0 = forever)
+//   OP_NEXT    end of loop body
+
+#define     NOS_SCRIPTS             8
+#define     SCRIPT_SLOT_SIZE        512     // NOS_SCRIPTS slots fill one flash sector
+#define     SCRIPT_HEADER_SIZE      2
+#define     SCRIPT_EMPTY_LENGTH     0xFFFF
+#define     ALL_SCRIPTS             NOS_SCRIPTS
+#define     NOS_SCRIPT_RUNNERS      4       // scripts running at the same time
+#define     NOS_SCRIPT_PARAMETERS   4
+#define     MAX_SCRIPT_LOOP_DEPTH   4
+#define     MAX_SCRIPT_STEPS        32      // instructions per runner per pass
+#define     SCRIPT_WAIT_POLL_TICKS  10      // OP_WAIT check interval
+#define     ALL_AXES                0xFF
+
+typedef enum {SCRIPT_LOAD, SCRIPT_SAVE, SCRIPT_RUN, SCRIPT_STOP, SCRIPT_STATUS} script_commands_te;
+typedef enum {OP_END, OP_CMD, OP_WAIT, OP_DELAY, OP_LOOP, OP_NEXT} script_opcodes_te;
+typedef enum {AXIS_SERVO, AXIS_STEPPER} script_axis_te;
+typedef enum {RUNNER_IDLE, RUNNER_RUNNING} script_runner_state_te;
+
+struct script_loop_s {
+    uint32_t    start_pc;
+    uint32_t    count;              // 0 = forever
+};
+
+struct script_runner_s {
+    script_runner_state_te  state;
+    uint32_t        script_id;
+    const uint8_t   *code;          // in flash
+    uint32_t        length;
+    uint32_t        pc;
+    TickType_t      time_point;     // OP_DELAY is relative to this
+    int32_t         parameters[NOS_SCRIPT_PARAMETERS];
+    struct script_loop_s    loops[MAX_SCRIPT_LOOP_DEPTH];
+    uint32_t        loop_depth;
+    uint32_t        seq_id;         // "done" notification when script ends
+    int32_t         error;
+};
 
 //==============================================================================
 // Structure to hold button/form data
@@ -34,7 +34,7 @@
 #include    "system.h"
 
 
-uint32_t string_to_token(struct token_list_s *tk_list, char *string);
+uint32_t string_to_token(const struct token_list_s *tk_list, const char *string);
 // void tokenizer_init(const char *program);
 // void tokenizer_next(void);
 // int tokenizer_token(void);
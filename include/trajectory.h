@@ -0,0 +1,25 @@
+/**
+ * @file    trajectory.h
+ * @author  Jim Herd
+ * @brief   Smooth servo trajectories
+ */
+
+#ifndef __TRAJECTORY_H__
+#define __TRAJECTORY_H__
+
+#include    "pico/stdlib.h"
+#include    "system.h"
+
+//==============================================================================
+// Function prototypes
+//==============================================================================
+
+uint32_t trajectory_limit_ticks(trajectory_profile_te profile, int32_t delta_angle, uint32_t nos_ticks, int32_t speed_limit);
+uint32_t trajectory_blend_limit_ticks(q16_t delta, q16_t from_velocity, uint32_t nos_ticks, int32_t speed_limit);
+void trajectory_start(struct trajectory_s *traj, int32_t from_angle, int32_t to_angle, uint32_t nos_ticks, trajectory_profile_te profile);
+error_codes_te trajectory_add_waypoint(struct trajectory_s *traj, int32_t angle, uint32_t nos_ticks);
+error_codes_te trajectory_start_spline(struct trajectory_s *traj, int32_t from_angle, int32_t speed_limit);
+void trajectory_blend(struct trajectory_s *traj, q16_t from_angle, q16_t from_velocity, int32_t to_angle, uint32_t nos_ticks);
+bool trajectory_step(struct trajectory_s *traj, q16_t *angle);
+
+#endif  /* __TRAJECTORY_H__ */
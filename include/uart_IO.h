@@ -15,33 +15,63 @@
     #define UART_IRQ    UART0_IRQ
 #endif
 
-#define     RING_BUFF_SIZE  256 
+#define     RING_BUFF_SIZE      256     // must be a power of two
+#define     RING_BUFF_MASK      (RING_BUFF_SIZE - 1)
+#define     RX_LINE_QUEUE_SIZE  8       // must be a power of two
+#define     RX_LINE_QUEUE_MASK  (RX_LINE_QUEUE_SIZE - 1)
+
+#if ((RING_BUFF_SIZE & RING_BUFF_MASK) != 0) || ((RX_LINE_QUEUE_SIZE & RX_LINE_QUEUE_MASK) != 0)
+    #error "UART receive ring sizes must be powers of two"
+#endif
 
 //==============================================================================
 // Structures 
 //==============================================================================
 
+// Single producer (receive scan) / single consumer (command task) ring.
+// Indices run freely and are masked on use, so no shared count is needed.
+
 struct ring_buffer_s {
-    uint32_t    in_pt;
-    uint32_t    out_pt;
-    uint32_t    count;
-    char        buffer[RING_BUFF_SIZE];
+    volatile uint32_t   in_pt;      // written by producer only
+    volatile uint32_t   out_pt;     // written by consumer only
+    char                buffer[RING_BUFF_SIZE];
+};
+
+struct rx_line_s {
+    uint32_t    offset;             // free running ring index of first character
+    uint32_t    length;             // NEWLINE not included
+};
+
+struct line_queue_s {
+    volatile uint32_t   head;       // written by producer only
+    volatile uint32_t   tail;       // written by consumer only
+    struct rx_line_s    line[RX_LINE_QUEUE_SIZE];
+};
+
+typedef enum {FRAME_IDLE, FRAME_RECEIVE, FRAME_DISCARD} frame_state_te;
+
+struct frame_buffer_s {
+    frame_state_te  state;
+    bool            ready;          // complete frame waiting to be read
+    uint32_t        count;
+    uint8_t         buffer[MAX_FRAME_SIZE];
 };
 
 //==============================================================================
 // Function prototypes
 //==============================================================================
 
-static void uart_interrupt_handler(void);
+static void uart_tx_dma_handler(void);
+static uint32_t uart_rx_scan(void);
+static void uart_tx_start(void);
 
 void uart0_sys_init(void);
-void uart_println(char *str);
-char uart_getchar(void);
 int32_t uart_readline(char *string);
-void uart_putstring(char *string);
-void uart_Write_string_buffer(uint32_t string_index);
-static bool uart_putchar(const char ch);
-void prime_free_buffer_queue(void);
+uint32_t uart_read_frame(uint8_t *frame);
+char *uart_tx_reserve(uint32_t size);
+void uart_tx_commit(uint32_t length);
+void uart_putstring(const char *string);
+void uart_putbytes(const uint8_t *data, uint32_t count);
 
 void print_string(const char *format, ...);
 
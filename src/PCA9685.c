@@ -9,12 +9,13 @@
  */
 
 #include  "stdlib.h"
+#include  <string.h>
 
 #include  "system.h"
 #include  "PCA9685.h"
 #include  "externs.h"
-
-#include "hardware/i2c.h"
+#include  "i2c_engine.h"
+#include  "trajectory.h"
 
 //==============================================================================
 // Function templates
@@ -33,116 +34,493 @@
 // };
 uPCA9685_REG__MODE1     PCA9685_reg_mode1;
 
+#if (PCA9685_FLUSH_BUDGET < (1 + (PCA9685_NOS_CHANNELS * PCA9685_CHANNEL_REGS)))
+    #error "PCA9685_FLUSH_BUDGET must allow at least one full board per tick"
+#endif
+
+//==============================================================================
+// Write-through copy of the register file of each PCA9685 board. Reads are
+// served from the cache and writes of an unchanged value are not sent.
+// The cache is loaded by "PCA9685_resync", which must be called after a
+// device reset. After an I2C write error the cache is invalid and
+// "PCA9685_flush" resyncs the board, up to PCA9685_RESYNC_RETRIES times.
+//
+// The LEDn_ON/OFF part of the cache is the shadow for servo updates.
+// Servo updates during a tick only change the shadow; "PCA9685_flush"
+// then writes the changed channels of each board in one auto-increment
+// transaction.
+
+#define     PCA9685_RESYNC_BYTES    (PCA9685__LED15_OFF_H + 3)  // MODE1, MODE1->LED15_OFF_H, PRE_SCALE
+
+static struct PCA9685_board_s   PCA9685_boards[PCA9685_NOS_BOARDS];
+static uint32_t                 flush_first_board;      // round robin start
+
+struct PCA9685_stats_s  PCA9685_stats;
+
+//==============================================================================
+// Angle to PWM OFF count for each servo, in SERVO_TABLE_STEPS_PER_DEGREE
+// steps from -MAX_ANGLE to +MAX_ANGLE. Built by "PCA9685_build_servo_table".
+
+static uint16_t  servo_PWM_table[NOS_SERVOS][SERVO_TABLE_SIZE];
+
+//==============================================================================
+/**
+ * @brief Test if a register is held in the cache
+ * @note  ALL_LED registers are write only and TestMode is not used
+ */
+static inline bool PCA9685_cached(struct PCA9685_board_s *board_pt, uint8_t reg_number)
+{
+    return (board_pt->cache_valid == true) &&
+           ((reg_number <= PCA9685__LED15_OFF_H) || (reg_number == PCA9685__PRE_SCALE));
+}
+
 //==============================================================================
 /**
  * @brief write byte to PCA9685
  * 
+ * @param board         0->PCA9685_NOS_BOARDS-1
  * @param reg_number    PCA9685 register number
  * @param data_byte     8-bit value to be written to register
  */
-void write_PCA9685_register(uint8_t reg_number, uint8_t data_byte)
+void write_PCA9685_register(uint32_t board, uint8_t reg_number, uint8_t data_byte)
 {
-    uint8_t i2c_write_packet[2];
+struct PCA9685_board_s  *board_pt;
+uint8_t i2c_write_packet[2];
 
+    board_pt = &PCA9685_boards[board];
+    if ((PCA9685_cached(board_pt, reg_number) == true) && (board_pt->cache[reg_number] == data_byte)) {
+        PCA9685_stats.writes_suppressed++;
+        return;
+    }
     i2c_write_packet[0] = reg_number;
     i2c_write_packet[1] = data_byte;
 
-    i2c_write_blocking(I2C_PORT, PCA9685_address, i2c_write_packet, 2, false);
+    PCA9685_stats.writes_issued++;
+    if (i2c_transfer(board_pt->address, i2c_write_packet, 2, NULL, 0) == OK) {
+        board_pt->cache[reg_number] = data_byte;
+    } else if (PCA9685_cached(board_pt, reg_number) == true) {
+        board_pt->cache_valid = false;      // device state unknown : resync
+    }
     return;
 }
 
+//==============================================================================
+/**
+ * @brief write byte to the same register of every PCA9685
+ * 
+ * @param reg_number    PCA9685 register number
+ * @param data_byte     8-bit value to be written to register
+ * @note
+ *      With PCA9685_USE_ALLCALL, one write to the ALLCALL address reaches
+ *      every board at the same STOP condition. The boards must have
+ *      MODE1 ALLCALL set, and no other device may answer that address.
+ */
+void write_all_PCA9685_register(uint8_t reg_number, uint8_t data_byte)
+{
+uint8_t i2c_write_packet[2];
+error_codes_te  status;
+
+    if ((PCA9685_USE_ALLCALL == false) || (PCA9685_NOS_BOARDS == 1)) {
+        for (uint32_t board = 0; board < PCA9685_NOS_BOARDS; board++) {
+            write_PCA9685_register(board, reg_number, data_byte);
+        }
+        return;
+    }
+    i2c_write_packet[0] = reg_number;
+    i2c_write_packet[1] = data_byte;
+
+    PCA9685_stats.writes_issued++;
+    status = i2c_transfer(PCA9685_ALLCALL_ADDRESS, i2c_write_packet, 2, NULL, 0);
+    for (uint32_t board = 0; board < PCA9685_NOS_BOARDS; board++) {
+        if (status == OK) {
+            PCA9685_boards[board].cache[reg_number] = data_byte;
+        } else if (PCA9685_cached(&PCA9685_boards[board], reg_number) == true) {
+            PCA9685_boards[board].cache_valid = false;
+        }
+    }
+}
+
 //==============================================================================
 /**
  * @brief   read byte from PCA9685
  * 
+ * @param board         0->PCA9685_NOS_BOARDS-1
  * @param reg_number 
  * @return uint8_t 
  */
-uint8_t read_PCA9685_register(uint8_t reg_number)
+uint8_t read_PCA9685_register(uint32_t board, uint8_t reg_number)
 {
+struct PCA9685_board_s  *board_pt;
 uint8_t  data;
 
-    i2c_write_blocking(I2C_PORT, PCA9685_address, &reg_number, 1, false);
-    i2c_read_blocking(I2C_PORT, PCA9685_address, &data, 1, false);
+    board_pt = &PCA9685_boards[board];
+    if (PCA9685_cached(board_pt, reg_number) == true) {
+        PCA9685_stats.reads_cached++;
+        return board_pt->cache[reg_number];
+    }
+    data = 0;
+    PCA9685_stats.reads_issued++;
+    i2c_transfer(board_pt->address, &reg_number, 1, &data, 1);     // write register number, RESTART, read
 
     return  data;
 }
 
 //==============================================================================
 /**
- * @brief Initialise PCA9685 to drive RC servos
+ * @brief Initialise PCA9685 boards to drive RC servos
  * 
+ * @note
+ *      Each board is set up and left asleep, then all are woken by one
+ *      write (ALLCALL) so that their PWM frames start together. Moves
+ *      released by "sync" are sent in one flush, so reach every board
+ *      in the same PWM frame.
  */
 void init_PCA9685_servo_IO(void)
 {
 uint8_t  data;
 
-    PCA9685_set_sleep(true);
-    PCA9685_set_servo_freq();
-    PCA9685_set_auto_increment(true);
-    PCA9685_set_sleep(false);
+    for (uint32_t board = 0; board < PCA9685_NOS_BOARDS; board++) {
+        PCA9685_boards[board].address   = PCA9685_board_address[board];
+        PCA9685_boards[board].LED_dirty = 0;
+        PCA9685_boards[board].resync_retries = PCA9685_RESYNC_RETRIES;
+        PCA9685_resync(board);
+        PCA9685_set_sleep(board, true);
+        PCA9685_set_servo_freq(board);
+        PCA9685_set_auto_increment(board, true);
+        data = read_PCA9685_register(board, PCA9685__MODE1);
+        write_PCA9685_register(board, PCA9685__MODE1, (data | PCA9685_MODE1_ALLCALL | MODE_SLEEP_MASK));
+    }
+    data = read_PCA9685_register(0, PCA9685__MODE1);
+    write_all_PCA9685_register(PCA9685__MODE1, (data & ~MODE_SLEEP_MASK));     // wake all
+    flush_first_board = 0;
+    for (uint32_t i = 0; i < NOS_SERVOS; i++) {
+        PCA9685_build_servo_table(i);
+    }
     return;
 }
 
+//==============================================================================
+/**
+ * @brief Build the angle to PWM table of a servo
+ * 
+ * @param servo_no 
+ * @note
+ *      Call again after any change to the calibration of the servo
+ *      (flip, angle_min/max, pulse_offset, correction curve).
+ * 
+ *      Angles are clamped to the servo limits, then reversed if the servo
+ *      is flipped. Pulse is +/-1mS about the 1.5mS mid-point for +/-90
+ *      degrees, plus the correction curve, clamped to the trim limits.
+ */
+void PCA9685_build_servo_table(uint32_t servo_no)
+{
+struct servo_data_s  *servo_data_pt;
+const int8_t    *correction;
+int32_t     step, step_min, step_max, pulse_change, count, point, fraction;
+
+    servo_data_pt = &servo_data[servo_no];
+    correction    = servo_correction[servo_no];
+    step_min      = servo_data_pt->angle_min * SERVO_TABLE_STEPS_PER_DEGREE;
+    step_max      = servo_data_pt->angle_max * SERVO_TABLE_STEPS_PER_DEGREE;
+
+    for (int32_t i = 0; i < SERVO_TABLE_SIZE; i++) {
+        step = i - SERVO_TABLE_CENTRE;
+        if (step < step_min) {
+            step = step_min;
+        } else if (step > step_max) {
+            step = step_max;
+        }
+        if (servo_data_pt->flip == true) {
+            step = -step;
+        }
+        pulse_change = (abs(step) * COUNT_1mS) / SERVO_TABLE_CENTRE;
+        count = (step > 0) ? (MID_POINT_COUNT + pulse_change) : (MID_POINT_COUNT - pulse_change);
+
+        point    = (step + SERVO_TABLE_CENTRE) / SERVO_CORRECTION_SPACING;
+        fraction = (step + SERVO_TABLE_CENTRE) % SERVO_CORRECTION_SPACING;
+        count   += correction[point];
+        if (point < (SERVO_CORRECTION_POINTS - 1)) {
+            count += ((correction[point + 1] - correction[point]) * fraction) / SERVO_CORRECTION_SPACING;
+        }
+
+        if (count < SERVO_TRIM_MIN) {
+            count = SERVO_TRIM_MIN;
+        } else if (count > SERVO_TRIM_MAX) {
+            count = SERVO_TRIM_MAX;
+        }
+        servo_PWM_table[servo_no][i] = (uint16_t)(count + servo_data_pt->pulse_offset);
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Load the register cache of a board from the device
+ * @param board         0->PCA9685_NOS_BOARDS-1
+ * @return error_codes_te   OK or I2C error (cache is then left invalid)
+ * @note
+ *      Needed at start and after anything that changes device registers
+ *      behind the cache (reset, power loss, I2C failure). MODE1 to
+ *      LED15_OFF_H are read in one transfer if auto-increment is on,
+ *      otherwise one register at a time.
+ */
+error_codes_te PCA9685_resync(uint32_t board)
+{
+struct PCA9685_board_s  *board_pt;
+error_codes_te  status;
+uint8_t         reg_number;
+
+    board_pt = &PCA9685_boards[board];
+    board_pt->cache_valid = false;
+    reg_number = PCA9685__MODE1;
+    status = i2c_transfer(board_pt->address, &reg_number, 1, &board_pt->cache[PCA9685__MODE1], 1);
+    PCA9685_stats.reads_issued++;
+    if ((status == OK) && ((board_pt->cache[PCA9685__MODE1] & PCA9685_MODE1_AUTO_INC) != 0)) {
+        status = i2c_transfer(board_pt->address, &reg_number, 1, board_pt->cache, (PCA9685__LED15_OFF_H + 1));
+        PCA9685_stats.reads_issued++;
+    } else {
+        for (reg_number = PCA9685__MODE2; (status == OK) && (reg_number <= PCA9685__LED15_OFF_H); reg_number++) {
+            status = i2c_transfer(board_pt->address, &reg_number, 1, &board_pt->cache[reg_number], 1);
+            PCA9685_stats.reads_issued++;
+        }
+    }
+    if (status == OK) {
+        reg_number = PCA9685__PRE_SCALE;
+        status = i2c_transfer(board_pt->address, &reg_number, 1, &board_pt->cache[PCA9685__PRE_SCALE], 1);
+        PCA9685_stats.reads_issued++;
+    }
+    if (status != OK) {
+        return status;
+    }
+    board_pt->cache_valid = true;
+    board_pt->resync_retries = PCA9685_RESYNC_RETRIES;
+    PCA9685_stats.resyncs++;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Resync a board, keeping the servo shadow
+ * @param board         0->PCA9685_NOS_BOARDS-1
+ * @note
+ *      The LEDn_ON/OFF part of the cache holds the wanted servo pulses,
+ *      so it is put back after the resync. Channels where the device
+ *      differs are marked dirty and are rewritten by the flush.
+ */
+static void PCA9685_resync_shadow(uint32_t board)
+{
+struct PCA9685_board_s  *board_pt;
+uint8_t     shadow[PCA9685_NOS_CHANNELS * PCA9685_CHANNEL_REGS];
+uint8_t     *reg_pt;
+
+    board_pt = &PCA9685_boards[board];
+    board_pt->resync_retries--;
+    reg_pt = &board_pt->cache[PCA9685__LED0_ON_L];
+    memcpy(shadow, reg_pt, sizeof(shadow));
+    if (PCA9685_resync(board) != OK) {
+        memcpy(reg_pt, shadow, sizeof(shadow));
+        return;
+    }
+    for (uint32_t channel = 0; channel < PCA9685_NOS_CHANNELS; channel++) {
+        if (memcmp(&reg_pt[channel * PCA9685_CHANNEL_REGS], &shadow[channel * PCA9685_CHANNEL_REGS], PCA9685_CHANNEL_REGS) != 0) {
+            board_pt->LED_dirty |= (1 << channel);
+        }
+    }
+    memcpy(reg_pt, shadow, sizeof(shadow));
+}
+
+//==============================================================================
+/**
+ * @brief Set ON and OFF counts of a servo in the shadow registers
+ * 
+ * @param servo_no      mapped to a board and channel by "servo_channel_map"
+ * @param on_count      0->4095
+ * @param off_count     0->4095
+ */
+static void PCA9685_set_channel(uint32_t servo_no, uint32_t on_count, uint32_t off_count)
+{
+struct PCA9685_board_s  *board_pt;
+uint32_t  channel;
+uint8_t  *reg_pt;
+
+    board_pt = &PCA9685_boards[servo_channel_map[servo_no].board];
+    channel  = servo_channel_map[servo_no].channel;
+    reg_pt   = &board_pt->cache[PCA9685__LED0_ON_L + (channel * PCA9685_CHANNEL_REGS)];
+    if ((board_pt->cache_valid == true) &&
+            (reg_pt[0] == (on_count & 0xFF))  && (reg_pt[1] == ((on_count >> 8) & 0xFF)) &&
+            (reg_pt[2] == (off_count & 0xFF)) && (reg_pt[3] == ((off_count >> 8) & 0xFF))) {
+        PCA9685_stats.writes_suppressed++;  // e.g. end of a slow TIMED_MOVE, DISABLED motor
+        return;
+    }
+    reg_pt[0] = on_count & 0xFF;
+    reg_pt[1] = (on_count >> 8) & 0xFF;
+    reg_pt[2] = off_count & 0xFF;
+    reg_pt[3] = (off_count >> 8) & 0xFF;
+    board_pt->LED_dirty |= (1 << channel);
+}
+
+//==============================================================================
+/**
+ * @brief Write changed channels to the PCA9685 boards
+ * @return error_codes_te   OK or I2C error
+ * @note
+ *      Called once at the end of each servo tick. The changed channels of
+ *      each board, from the first to the last, are sent as one 
+ *      auto-increment write (unchanged channels in between are rewritten
+ *      with their current value). Writes to all boards are queued on the
+ *      I2C engine together and the calling task sleeps until all are done.
+ * 
+ *      Bus time is bounded by PCA9685_FLUSH_BUDGET bytes per tick. Boards
+ *      left over keep their changes and are sent first next tick, so no
+ *      board is starved however many channels are in use. Channels that
+ *      fail are also sent again next tick.
+ * 
+ *      A board whose cache was invalidated by an I2C error is resynced
+ *      first, and the bytes read count against the budget.
+ * 
+ *      Budget bytes used and time taken, including the I2C waits, are
+ *      kept in "PCA9685_stats" (get PCA9685_FLUSH_INFO).
+ */
+error_codes_te PCA9685_flush(void)
+{
+static uint8_t   PCA9685_i2c_packet[PCA9685_NOS_BOARDS][1 + (PCA9685_NOS_CHANNELS * PCA9685_CHANNEL_REGS)];
+struct i2c_transfer_s   transfers[PCA9685_NOS_BOARDS];
+uint32_t  sent_board[PCA9685_NOS_BOARDS], sent_mask[PCA9685_NOS_BOARDS];
+uint32_t  board, first, last, nos_bytes, nos_sent, budget, k, start_uS, used, elapsed_uS;
+struct PCA9685_board_s  *board_pt;
+error_codes_te  status, result;
+
+    start_uS = time_us_32();
+    result   = OK;
+    nos_sent = 0;
+    budget   = PCA9685_FLUSH_BUDGET;
+    for (k = 0; k < PCA9685_NOS_BOARDS; k++) {
+        board    = (flush_first_board + k) % PCA9685_NOS_BOARDS;
+        board_pt = &PCA9685_boards[board];
+        if ((board_pt->cache_valid == false) && (board_pt->resync_retries > 0) && (budget >= PCA9685_RESYNC_BYTES)) {
+            PCA9685_resync_shadow(board);
+            budget -= PCA9685_RESYNC_BYTES;
+        }
+        if (board_pt->LED_dirty == 0) {
+            continue;
+        }
+        first = __builtin_ctz(board_pt->LED_dirty);
+        last  = 31 - __builtin_clz(board_pt->LED_dirty);
+        nos_bytes = (last - first + 1) * PCA9685_CHANNEL_REGS;
+        if ((nos_bytes + 1) > budget) {
+            break;                          // rest next tick
+        }
+        PCA9685_i2c_packet[board][0] = PCA9685__LED0_ON_L + (first * PCA9685_CHANNEL_REGS);
+        memcpy(&PCA9685_i2c_packet[board][1], &board_pt->cache[PCA9685__LED0_ON_L + (first * PCA9685_CHANNEL_REGS)], nos_bytes);
+        transfers[nos_sent].address     = board_pt->address;
+        transfers[nos_sent].tx_data     = PCA9685_i2c_packet[board];
+        transfers[nos_sent].tx_length   = nos_bytes + 1;
+        transfers[nos_sent].rx_data     = NULL;
+        transfers[nos_sent].rx_length   = 0;
+        transfers[nos_sent].notify_task = xTaskGetCurrentTaskHandle();
+        if (i2c_submit(&transfers[nos_sent]) != OK) {
+            break;                          // engine queue full : rest next tick
+        }
+        PCA9685_stats.writes_issued++;
+        sent_board[nos_sent] = board;
+        sent_mask[nos_sent]  = ((1 << (last + 1)) - 1) & ~((1 << first) - 1);
+        nos_sent++;
+        budget -= (nos_bytes + 1);
+    }
+    if (k < PCA9685_NOS_BOARDS) {
+        flush_first_board = (flush_first_board + k) % PCA9685_NOS_BOARDS;
+        PCA9685_stats.flushes_deferred++;
+    }
+    for (k = 0; k < nos_sent; k++) {
+        status = i2c_wait(&transfers[k]);
+        if (status == OK) {
+            PCA9685_boards[sent_board[k]].LED_dirty &= ~sent_mask[k];
+        } else {
+            result = status;
+        }
+    }
+    used = PCA9685_FLUSH_BUDGET - budget;
+    PCA9685_stats.flushes++;
+    PCA9685_stats.flush_bytes += used;
+    if (used > PCA9685_stats.max_flush_bytes) {
+        PCA9685_stats.max_flush_bytes = used;
+    }
+    elapsed_uS = time_us_32() - start_uS;
+    PCA9685_stats.flush_uS += elapsed_uS;
+    if (elapsed_uS > PCA9685_stats.max_flush_uS) {
+        PCA9685_stats.max_flush_uS = elapsed_uS;
+    }
+    return result;
+}
+
 //==============================================================================
 /**
  * @brief set PCA9685 into its sleep mode
+ * @param board         0->PCA9685_NOS_BOARDS-1
  */
-void inline PCA9685_set_sleep(bool mode) 
+void inline PCA9685_set_sleep(uint32_t board, bool mode) 
 {
 uint8_t PCA9685_mode1_data;
 
-    PCA9685_mode1_data = read_PCA9685_register(PCA9685__MODE1);
+    PCA9685_mode1_data = read_PCA9685_register(board, PCA9685__MODE1);
     if (mode == true) {             // put to sleep
         PCA9685_mode1_data |= MODE_SLEEP_MASK;
-        write_PCA9685_register(PCA9685__MODE1, PCA9685_mode1_data);
+        write_PCA9685_register(board, PCA9685__MODE1, PCA9685_mode1_data);
         vTaskDelay(5);
     } else {                        // wakeup
         PCA9685_mode1_data &= ~MODE_SLEEP_MASK;
-        write_PCA9685_register(PCA9685__MODE1, PCA9685_mode1_data);
+        write_PCA9685_register(board, PCA9685__MODE1, PCA9685_mode1_data);
     }
 }
 
 //==============================================================================
 /**
  * @brief reset PCA968a device
+ * @param board         0->PCA9685_NOS_BOARDS-1
  */
-void inline PCA9685_reset(void)
+void inline PCA9685_reset(uint32_t board)
 {
-    write_PCA9685_register(PCA9685__MODE1, PCA9685_MODE1_RESTART);
+uint8_t  i2c_write_packet[2];
+
+    i2c_write_packet[0] = PCA9685__MODE1;       // always sent : not a cached write
+    i2c_write_packet[1] = PCA9685_MODE1_RESTART;
+    PCA9685_stats.writes_issued++;
+    i2c_transfer(PCA9685_boards[board].address, i2c_write_packet, 2, NULL, 0);
+    PCA9685_resync(board);
 }
 
 //==============================================================================
 /**
  * @brief enable/disable device autoincrement mode
  * 
+ * @param board         0->PCA9685_NOS_BOARDS-1
  * @param mode 
  */
-void  PCA9685_set_auto_increment(bool mode)
+void  PCA9685_set_auto_increment(uint32_t board, bool mode)
 {
     uint8_t PCA9685_mode1_data;
 
-    PCA9685_mode1_data = read_PCA9685_register(PCA9685__MODE1);
+    PCA9685_mode1_data = read_PCA9685_register(board, PCA9685__MODE1);
     if (mode == true) {             // put to sleep
         PCA9685_mode1_data |= PCA9685_MODE1_AUTO_INC;
-        write_PCA9685_register(PCA9685__MODE1, PCA9685_mode1_data);
+        write_PCA9685_register(board, PCA9685__MODE1, PCA9685_mode1_data);
         vTaskDelay(5);
     } else {                        // wakeup
         PCA9685_mode1_data &= ~PCA9685_MODE1_AUTO_INC;
-        write_PCA9685_register(PCA9685__MODE1, PCA9685_mode1_data);
+        write_PCA9685_register(board, PCA9685__MODE1, PCA9685_mode1_data);
     }
 }
 
 //==============================================================================
 /**
  * @brief Set frequency to 50Hz for use with servos
+ * @param board         0->PCA9685_NOS_BOARDS-1
  */
-void PCA9685_set_servo_freq(void){
+void PCA9685_set_servo_freq(uint32_t board){
 
-    PCA9685_reset();
-    PCA9685_set_sleep(true);
-    write_PCA9685_register(PCA9685__PRE_SCALE, PCA9685_50Hz_PRE_SCALER);
-    PCA9685_set_sleep(false);
+    PCA9685_reset(board);
+    PCA9685_set_sleep(board, true);
+    write_PCA9685_register(board, PCA9685__PRE_SCALE, PCA9685_50Hz_PRE_SCALER);
+    PCA9685_set_sleep(board, false);
 }
 
 //==============================================================================
@@ -161,15 +539,30 @@ void PCA9685_set_servo_freq(void){
  * +angle  =>  add to 1.5mS pulse
  * -angle  =>  subtract from 1.5mS pulse
  * Therefore need only calculate for abs(angle)
+ * The counts are precalculated per servo by "PCA9685_build_servo_table".
  * 
  * If the servo is of type MOTOR and the requested angle is 0 then set to DISABLED
  */
 error_codes_te  PCA9685_set_servo(uint32_t servo_no, int32_t angle)
 {
-uint8_t     PCA9685_i2c_packet[5];
-int32_t    PWM_ON_time, PWM_OFF_time, pulse_change;
+    return PCA9685_set_servo_fixed(servo_no, int_to_q16(angle));
+}
+
+//==============================================================================
+/**
+ * @brief As PCA9685_set_servo, with a Q16.16 angle
+ * 
+ * @param servo_no      0->15
+ * @param angle         -90.0 -> +90.0
+ * @note
+ *      One PWM count is 0.44 degree, so fractional angles from the 
+ *      trajectory generator give smoother slow moves than whole degrees.
+ *      The angle is rounded to the nearest step of the servo table.
+ */
+error_codes_te  PCA9685_set_servo_fixed(uint32_t servo_no, q16_t angle)
+{
+int32_t    PWM_ON_time, PWM_OFF_time, index;
 struct servo_data_s  *servo_data_pt;
-uint8_t     PCA9685_chan_address;
 
 
     servo_data_pt = &servo_data[servo_no];
@@ -180,16 +573,16 @@ uint8_t     PCA9685_chan_address;
     }
     if (servo_data_pt->state != DISABLED) {
 
-        servo_data_pt->angle = angle;               // log requested angle
+        servo_data_pt->angle = q16_round(angle);    // log requested angle
         
-        pulse_change = ((abs(angle) * COUNT_1mS)/MAX_ANGLE);
-        if (angle > 0) {
-            PWM_OFF_time = MID_POINT_COUNT + pulse_change;
-        } else {
-            PWM_OFF_time = MID_POINT_COUNT - pulse_change;
+        index = q16_round(q16_mul_int(angle, SERVO_TABLE_STEPS_PER_DEGREE)) + SERVO_TABLE_CENTRE;
+        if (index < 0) {
+            index = 0;
+        } else if (index >= SERVO_TABLE_SIZE) {
+            index = SERVO_TABLE_SIZE - 1;
         }
-        PWM_OFF_time += servo_data_pt->pulse_offset;  // set OFF time
-        PWM_ON_time = servo_data_pt->pulse_offset;    // set ON time
+        PWM_OFF_time = servo_PWM_table[servo_no][index];    // set OFF time
+        PWM_ON_time = servo_data_pt->pulse_offset;          // set ON time
     } else {
         return OK;
     }
@@ -198,28 +591,98 @@ uint8_t     PCA9685_chan_address;
         return OK;    // delay execution of the move until later sync command
     }
     //
-    // execute servo move
+    // execute servo move : written to device by next "PCA9685_flush"
     //
-    PCA9685_chan_address = PCA9685__LED0_ON_L + (servo_no << 2);
-    PCA9685_i2c_packet[0] = PCA9685_chan_address;
-    PCA9685_i2c_packet[1] = PWM_ON_time & 0xFF;
-    PCA9685_i2c_packet[2] = (PWM_ON_time >> 8) & 0xFF;
-    PCA9685_i2c_packet[3] = PWM_OFF_time & 0xFF;
-    PCA9685_i2c_packet[4] = (PWM_OFF_time >> 8) & 0xFF;
-    i2c_write_blocking(I2C_PORT, PCA9685_address, PCA9685_i2c_packet, 5, false);
+    PCA9685_set_channel(servo_no, PWM_ON_time, PWM_OFF_time);
+    return OK;
 }
 
 //==============================================================================
 void PCA9685_set_zero(uint32_t servo_no) 
 {
-uint8_t  PCA9685_i2c_packet[5];
-
-    PCA9685_i2c_packet[0] = (uint8_t) PCA9685__LED0_ON_L + (servo_no << 2);
-    PCA9685_i2c_packet[1] = 0x00;
-    PCA9685_i2c_packet[2] = 0x00;
-    PCA9685_i2c_packet[3] = 0x00;
-    PCA9685_i2c_packet[4] = 0x00;
-    i2c_write_blocking(I2C_PORT, PCA9685_address, PCA9685_i2c_packet, 5, false);
+    PCA9685_set_channel(servo_no, 0, 0);
+}
+
+//==============================================================================
+/**
+ * @brief Test if a servo is part way through a move
+ * 
+ * @param servo_data_pt 
+ * @return true     moving, and output has already changed
+ * @return false 
+ */
+static bool servo_in_flight(struct servo_data_s *servo_data_pt)
+{
+    if (servo_data_pt->sync == true) {
+        return false;               // held for "sync" : not yet started
+    }
+    switch (servo_data_pt->state) {
+        case DELAY :
+            return true;
+        case TIMED_MOVE :
+            return (servo_data_pt->counter > 0);
+        case TRAJECTORY_MOVE :
+            return (servo_data_pt->trajectory.tick > 0);
+        default :
+            return false;
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Position and velocity of a servo that is part way through a move
+ * 
+ * @param servo_data_pt 
+ * @param position      degrees
+ * @param velocity      degrees/tick
+ * @note
+ *      After an ABS_MOVE the output is already at the target, so the 
+ *      physical position is estimated from the slew rate of the servo 
+ *      and the time left in the DELAY state.
+ */
+static void servo_motion(struct servo_data_s *servo_data_pt, q16_t *position, q16_t *velocity)
+{
+    switch (servo_data_pt->state) {
+        case DELAY :
+            *velocity = servo_data_pt->gradient;
+            *position = int_to_q16(servo_data_pt->angle_target) - q16_mul_int(servo_data_pt->gradient, servo_data_pt->counter);
+            break;
+        case TIMED_MOVE :
+            *velocity = servo_data_pt->gradient;
+            *position = q16_mul_int(servo_data_pt->gradient, (servo_data_pt->counter - 1)) + servo_data_pt->y_intercept;
+            break;
+        case TRAJECTORY_MOVE :
+            *velocity = servo_data_pt->trajectory.velocity;
+            *position = servo_data_pt->trajectory.position;
+            break;
+        default :
+            *velocity = 0;
+            *position = int_to_q16(servo_data_pt->angle);
+            break;
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Blend a moving servo into a move to a new target
+ * 
+ * @param servo_data_pt 
+ * @param servo_angle   new target (degrees)
+ * @param nos_ticks     requested move time (servo task ticks)
+ * @param speed_limit   degrees/second (SERVO_SPEED_UNLIMITED = no limit)
+ * @note
+ *      The new move starts from the present position and velocity, so
+ *      there is no step in either.
+ */
+static void servo_retarget(struct servo_data_s *servo_data_pt, int16_t servo_angle, uint32_t nos_ticks, int32_t speed_limit)
+{
+q16_t       position, velocity;
+
+    servo_motion(servo_data_pt, &position, &velocity);
+    nos_ticks = trajectory_blend_limit_ticks((int_to_q16(servo_angle) - position), velocity, nos_ticks, speed_limit);
+    trajectory_blend(&servo_data_pt->trajectory, position, velocity, servo_angle, nos_ticks);
+    servo_data_pt->angle_target = servo_angle;
+    servo_data_pt->state        = TRAJECTORY_MOVE;
 }
 
 //==============================================================================
@@ -233,6 +696,9 @@ uint8_t  PCA9685_i2c_packet[5];
  * 
  * @note
  *      If servo type is MOTOR then ignore BUSY state
+ * 
+ *      A move to a servo that is part way through a move is blended in
+ *      at the slew rate of the servo, rather than rejected.
  */
 error_codes_te  set_servo_move (
     uint8_t             servo_no,
@@ -243,14 +709,24 @@ error_codes_te  set_servo_move (
 {
 struct servo_data_s  *servo_data_pt;
 error_codes_te volatile status;
+int32_t     slew_speed;
 
     servo_data_pt = &servo_data[servo_no];
 
     status = OK;
-    if ((servo_data_pt->state == DORMANT) || (servo_data_pt->state == DISABLED) || (servo_data_pt->type == MOTOR)) {
-        servo_data_pt->state = servo_state;
-        servo_data_pt->angle = servo_angle;
-        servo_data_pt->sync  = servo_sync;
+    if ((servo_data_pt->state == DORMANT) || (servo_data_pt->state == DISABLED) || (servo_data_pt->type == MOTOR) ||
+        ((servo_data_pt->state == MOVE) && (servo_data_pt->sync == false))) {     // not yet output : replace
+        servo_data_pt->state        = servo_state;
+        servo_data_pt->angle_target = servo_angle;
+        servo_data_pt->sync         = servo_sync;
+        return OK;
+    } else if ((servo_in_flight(servo_data_pt) == true) && (servo_sync == false)) {
+        slew_speed = (servo_data_pt->mS_per_degree == 0) ? SERVO_SPEED_UNLIMITED : (1000 / servo_data_pt->mS_per_degree);
+        if ((slew_speed == SERVO_SPEED_UNLIMITED) || 
+            ((servo_data_pt->speed_value != SERVO_SPEED_UNLIMITED) && (servo_data_pt->speed_value < slew_speed))) {
+            slew_speed = servo_data_pt->speed_value;
+        }
+        servo_retarget(servo_data_pt, servo_angle, 1, slew_speed);
         return OK;
     } else {
         status =  SERVO_BUSY;
@@ -284,6 +760,8 @@ struct servo_data_s  *servo_data_pt;
  * @param servo_angle       target angle
  * @param time_for_move     move time in units of 100mS
  * @param servo_sync        true/false
+ * @note
+ *      A servo that is already moving is blended into the new target.
  */
 error_codes_te    set_servo_speed_move (   
     uint8_t             servo_no,
@@ -294,22 +772,148 @@ error_codes_te    set_servo_speed_move (
     )
 {
 struct servo_data_s  *servo_data_pt;
+uint32_t    nos_ticks;
 
     servo_data_pt = &servo_data[servo_no];
+    if (time_for_move <= 0) {
+        return PARAMETER_OUTWITH_LIMITS;
+    }
     if (servo_data_pt->state == DORMANT) {
-        servo_data_pt->gradient    = ((float)(servo_angle - servo_data_pt->angle) / (float)time_for_move);
-        servo_data_pt->y_intercept = (float)servo_data_pt->angle;
-        servo_data_pt->state       = servo_state;
-        servo_data_pt->angle       = servo_angle;
-        servo_data_pt->sync        = servo_sync;
-        servo_data_pt->counter     = 0;
-        servo_data_pt->t_end       = time_for_move;
+        nos_ticks = trajectory_limit_ticks(TRAJ_LINEAR, (servo_angle - servo_data_pt->angle),
+                                           (time_for_move * SERVO_TICKS_PER_100mS), servo_data_pt->speed_value);
+        servo_data_pt->gradient     = q16_ratio((servo_angle - servo_data_pt->angle), nos_ticks);
+        servo_data_pt->y_intercept  = int_to_q16(servo_data_pt->angle);
+        servo_data_pt->state        = servo_state;
+        servo_data_pt->angle_target = servo_angle;
+        servo_data_pt->sync         = servo_sync;
+        servo_data_pt->counter      = 0;
+        servo_data_pt->t_end        = nos_ticks;
+        return OK;
+    } else if ((servo_in_flight(servo_data_pt) == true) && (servo_sync == false)) {
+        servo_retarget(servo_data_pt, servo_angle, (time_for_move * SERVO_TICKS_PER_100mS), servo_data_pt->speed_value);
         return OK;
     } else {
         return SERVO_BUSY;
     }
 }
 
+//==============================================================================
+/**
+ * @brief Start a smooth move with a selected profile
+ * 
+ * @param servo_no 
+ * @param servo_angle       target angle
+ * @param time_for_move     move time in units of 100mS
+ * @param profile           TRAJ_LINEAR, TRAJ_MIN_JERK or TRAJ_TRAPEZOID
+ * @param servo_sync        true/false
+ * @note
+ *      Move time is lengthened if needed to keep within the servo speed limit.
+ *      A servo that is already moving is blended into the new target.
+ */
+error_codes_te    set_servo_profile_move (   
+    uint8_t                 servo_no,
+    int16_t                 servo_angle,
+    int16_t                 time_for_move,
+    trajectory_profile_te   profile,
+    bool                    servo_sync 
+    )
+{
+struct servo_data_s  *servo_data_pt;
+uint32_t    nos_ticks;
+
+    servo_data_pt = &servo_data[servo_no];
+    if ((time_for_move <= 0) || (profile >= TRAJ_SPLINE)) {
+        return PARAMETER_OUTWITH_LIMITS;
+    }
+    if ((servo_in_flight(servo_data_pt) == true) && (servo_sync == false)) {
+        servo_retarget(servo_data_pt, servo_angle, (time_for_move * SERVO_TICKS_PER_100mS), servo_data_pt->speed_value);
+        return OK;
+    }
+    if (servo_data_pt->state != DORMANT) {
+        return SERVO_BUSY;
+    }
+    nos_ticks = trajectory_limit_ticks(profile, (servo_angle - servo_data_pt->angle),
+                                       (time_for_move * SERVO_TICKS_PER_100mS), servo_data_pt->speed_value);
+    trajectory_start(&servo_data_pt->trajectory, servo_data_pt->angle, servo_angle, nos_ticks, profile);
+    servo_data_pt->angle_target = servo_angle;
+    servo_data_pt->sync         = servo_sync;
+    servo_data_pt->state        = TRAJECTORY_MOVE;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Add a point to the spline of a servo
+ * 
+ * @param servo_no 
+ * @param servo_angle       waypoint angle
+ * @param time_for_move     time from previous waypoint in units of 100mS
+ */
+error_codes_te    set_servo_waypoint (   
+    uint8_t             servo_no,
+    int16_t             servo_angle,
+    int16_t             time_for_move
+    )
+{
+struct servo_data_s  *servo_data_pt;
+
+    servo_data_pt = &servo_data[servo_no];
+    if (time_for_move <= 0) {
+        return PARAMETER_OUTWITH_LIMITS;
+    }
+    if (servo_data_pt->state == TRAJECTORY_MOVE) {
+        return SERVO_BUSY;          // waypoints in use
+    }
+    return trajectory_add_waypoint(&servo_data_pt->trajectory, servo_angle, (time_for_move * SERVO_TICKS_PER_100mS));
+}
+
+//==============================================================================
+/**
+ * @brief Run a spline move through the waypoints of a servo
+ * 
+ * @param servo_no 
+ * @param servo_sync        true/false
+ */
+error_codes_te    set_servo_spline_move (   
+    uint8_t             servo_no,
+    bool                servo_sync
+    )
+{
+struct servo_data_s  *servo_data_pt;
+error_codes_te  status;
+
+    servo_data_pt = &servo_data[servo_no];
+    if (servo_data_pt->state != DORMANT) {
+        return SERVO_BUSY;
+    }
+    status = trajectory_start_spline(&servo_data_pt->trajectory, servo_data_pt->angle, servo_data_pt->speed_value);
+    if (status != OK) {
+        return status;
+    }
+    servo_data_pt->angle_target = servo_data_pt->trajectory.waypoints[servo_data_pt->trajectory.nos_waypoints - 1].angle;
+    servo_data_pt->sync         = servo_sync;
+    servo_data_pt->state        = TRAJECTORY_MOVE;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Set the speed limit of a servo
+ * 
+ * @param servo_no 
+ * @param speed_limit       degrees/second (SERVO_SPEED_UNLIMITED = no limit)
+ * @note
+ *      Applies to timed, profile and spline moves from the next move on.
+ */
+error_codes_te    set_servo_speed_limit (   
+    uint8_t             servo_no,
+    int32_t             speed_limit
+    )
+{
+    servo_data[servo_no].speed_value = speed_limit;
+    return OK;
+}
+
     
 
 
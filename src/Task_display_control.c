@@ -26,6 +26,7 @@
 #include    "string_IO.h"
 #include    "min_printf.h"
 #include    "gen4_uLCD.h"
+#include    "cmd_queues.h"
 
 bool    display_OK;
 
@@ -51,15 +52,8 @@ error_codes_te   status;
         status = uLCD_printf(GEN4_uLCD_FORM0, GEN4_uLCD_STRING0, "V%d.%d", MAJOR_VERSION, MINOR_VERSION);
     }
     
-    FOREVER {
-        if (display_OK == true){
-            //gen4_uLCD_WriteContrast(5);
-            vTaskDelay(2000);
-            //gen4_uLCD_WriteContrast(12);
-            vTaskDelay(2000);
-        } else {
-            vTaskDelay(10000);
-        }
+    FOREVER {       // display transactions can be slow : run on this task only
+        receive_command(CMD_QUEUE_DISPLAY, portMAX_DELAY);
     }
 }
 
@@ -12,6 +12,7 @@
 #include "sys_routines.h"
 #include "externs.h"
 #include "neopixel.h"
+#include "cmd_queues.h"
 
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
@@ -72,6 +73,9 @@ uint32_t    start_time, end_time;
     FOREVER {
         xWasDelayed = xTaskDelayUntil( &xLastWakeTime, TASK_NEOPIXELS_FREQUENCY_TICK_COUNT );
         start_time = time_us_32();
+        while (receive_command(CMD_QUEUE_NEOPIXEL, 0) == true) {
+            ;       // apply any new neopixel commands
+        }
 
 // Process LED data
 
@@ -1,12 +1,14 @@
 /**
  * @file Task_run_cmd.c
  * @author Jim Herd
- * @brief Read and execute command strings
+ * @brief Read and parse command strings and pass them to subsystem tasks
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "FreeRTOS.h"
+#include "event_groups.h"
 
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
@@ -18,16 +20,24 @@
 #include "sys_routines.h"
 #include "PCA9685.h"
 #include "tokenizer.h"
+#include "binary_link.h"
+#include "cmd_queues.h"
 #include  "Pico_IO.h"
 #include  "neopixel.h"
 #include  "gen4_uLCD.h"
+#include  "scripts.h"
+#include  "cmd_scheduler.h"
+#include  "step_profile.h"
+#include  "stepper_pio.h"
+#include  "stepper_queue.h"
 
 //***************************************************************************
 // Function prototypes
 
-error_codes_te parse_command (void);
-error_codes_te convert_tokens(void);
+error_codes_te parse_command (uint32_t *cmd_start);
 error_codes_te check_command(int32_t cmd_token);
+static error_codes_te check_limits(int32_t cmd_token, uint32_t nos_args, const int32_t *parameters, const uint32_t *types);
+error_codes_te read_binary_command(int32_t *cmd_token);
 
 //***************************************************************************
 // Global command and parsed data
@@ -36,588 +46,1239 @@ char        command[MAX_COMMAND_LENGTH];
 uint32_t    character_count;
 uint32_t    argc, arg_pt[MAX_ARGC], arg_type[MAX_ARGC];
 int32_t     int_parameters[MAX_ARGC];
-float       float_parameters[MAX_ARGC];
+
+uint32_t    sequence_id;        // from "#id" prefix of current command
+uint64_t    schedule_time;      // from "@t" prefix of current command (0 = run now)
+uint64_t    line_time;          // uS, when current command line was read
+
+struct reply_context_s  reply_context;
 
 //***************************************************************************
-// Get, parse, and execute UART received command
+// Command handlers : one per token, called through "cmd_handlers[]".
+// Handlers that send their own reply set "reply_done", otherwise
+// the returned status is sent as a "port status" reply.
 
-void Task_run_cmd(void *p) 
+//***************************************************************************
+// set_move_sequence_id : attach a move's "#id" to its axis
+//
+// A move that replaces one still in progress ends the old one early, so
+// its ID is reported as MOVE_SUPERSEDED.
+//
+static void set_move_sequence_id(uint32_t *axis_seq_id, uint32_t seq_id)
+{
+    print_move_done(axis_seq_id, MOVE_SUPERSEDED);
+    *axis_seq_id = seq_id;
+}
+
+//***************************************************************************
+// sys : system commands
+//
+static error_codes_te cmd_sys(struct cmd_message_s *cmd, bool *reply_done)
 {
-struct servo_data_s     *servo_pt;
 error_codes_te          status;
-static int32_t          token;
-bool                    reply_done;
-int32_t                 sm_number;
-int32_t                 rel_nos_steps, abs_nos_steps, move_count, move_angle;
-uint32_t                current_form, new_form, old_form, result, i, value, pressed_state;
 
     status = OK;
-    FOREVER {
-        character_count = uart_readline(command);
-        status = parse_command();
-        if (status != OK) {
-            print_error(UNDEFINED_PORT, status);
+    switch(cmd->int_parameters[SYS_SUB_CMD_INDEX]) {
+        case SOFT_RESET :    
+            // special : NO RETURN FROM THIS COMMAND
+            // Therefore send OK response BEFORE executing command to
+            // ensure that remote comuputer does not enter a hang state
+            print_reply(cmd->int_parameters[PORT_INDEX], status, 0);
+            flush_reply_batch();
+            software_reset();
+        default :
+            status = -9999;
+            break;
+    }
+    return status;
+}
+
+//***************************************************************************
+// servo : servo moves and configuration
+//
+// parameters needed by each servo sub-command (including command and port)
+
+static const uint8_t servo_cmd_argc[] = {
+    [ABS_MOVE]     = 5, [ABS_MOVE_SYNC]     = 5, [SPEED_MOVE]   = 6, [SPEED_MOVE_SYNC] = 6,
+    [RUN_SYNC_MOVES] = 5, [T_DELAY]         = 5, [STOP]         = 5, [STOP_ALL]        = 5,
+    [ENABLE]       = 5, [PROFILE_MOVE]      = 7, [PROFILE_MOVE_SYNC] = 7, [ADD_WAYPOINT] = 6,
+    [SPLINE_MOVE]  = 4, [SET_SPEED_LIMIT]   = 6, [SPLINE_MOVE_SYNC]  = 4,
+};
+
+static error_codes_te cmd_servo(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    status = OK;
+    if (cmd->argc < servo_cmd_argc[cmd->int_parameters[SERVO_SUB_CMD_INDEX]]) {
+        print_reply(cmd->int_parameters[PORT_INDEX], BAD_NOS_PARAMETERS, 0);
+        *reply_done = true;
+        return BAD_NOS_PARAMETERS;
+    }
+    switch (cmd->int_parameters[SERVO_SUB_CMD_INDEX]) {
+        case ABS_MOVE: 
+            status = set_servo_move( cmd->int_parameters[SERVO_NUMBER_INDEX], MOVE, cmd->int_parameters[SERVO_ANGLE_INDEX], false);
+            break;
+        case ABS_MOVE_SYNC: 
+            status = set_servo_move( cmd->int_parameters[SERVO_NUMBER_INDEX], MOVE, cmd->int_parameters[SERVO_ANGLE_INDEX], true);
+            break;
+        case SPEED_MOVE: 
+            status = set_servo_speed_move(cmd->int_parameters[SERVO_NUMBER_INDEX], TIMED_MOVE, cmd->int_parameters[SERVO_ANGLE_INDEX], cmd->int_parameters[SERVO_SPEED_INDEX], false);
+            break;
+        case SPEED_MOVE_SYNC: 
+            status = set_servo_speed_move(cmd->int_parameters[SERVO_NUMBER_INDEX], TIMED_MOVE, cmd->int_parameters[SERVO_ANGLE_INDEX], cmd->int_parameters[SERVO_SPEED_INDEX], true);
+            break;
+        case RUN_SYNC_MOVES: 
+            status = set_servo_move(cmd->int_parameters[SERVO_SUB_CMD_INDEX], cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], false);
+            break;
+        case STOP:
+            status = set_servo_move(cmd->int_parameters[SERVO_SUB_CMD_INDEX], cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], false);  
+            break;
+        case STOP_ALL: 
+            status = set_servo_move(cmd->int_parameters[SERVO_SUB_CMD_INDEX], cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], false);
+            break;
+        case ENABLE :
+            status = set_servo_state(cmd->int_parameters[SERVO_NUMBER_INDEX], DISABLED, cmd->int_parameters[SERVO_ANGLE_INDEX]);
+            break;
+        case PROFILE_MOVE :
+            status = set_servo_profile_move(cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], cmd->int_parameters[SERVO_TIME_INDEX], cmd->int_parameters[SERVO_PROFILE_INDEX], false);
+            break;
+        case PROFILE_MOVE_SYNC :
+            status = set_servo_profile_move(cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], cmd->int_parameters[SERVO_TIME_INDEX], cmd->int_parameters[SERVO_PROFILE_INDEX], true);
+            break;
+        case ADD_WAYPOINT :
+            status = set_servo_waypoint(cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_ANGLE_INDEX], cmd->int_parameters[SERVO_TIME_INDEX]);
+            break;
+        case SPLINE_MOVE :
+            status = set_servo_spline_move(cmd->int_parameters[SERVO_NUMBER_INDEX], false);
+            break;
+        case SPLINE_MOVE_SYNC :
+            status = set_servo_spline_move(cmd->int_parameters[SERVO_NUMBER_INDEX], true);
+            break;
+        case SET_SPEED_LIMIT :
+            status = set_servo_speed_limit(cmd->int_parameters[SERVO_NUMBER_INDEX], cmd->int_parameters[SERVO_SPEED_INDEX]);
+            break;
+        default:
+            status = BAD_SERVO_COMMAND;
+            break;
+    }  // end of inner switch
+    if ((status == OK) && ((cmd->int_parameters[SERVO_SUB_CMD_INDEX] <= SPEED_MOVE_SYNC) ||
+                           (cmd->int_parameters[SERVO_SUB_CMD_INDEX] == PROFILE_MOVE) ||
+                           (cmd->int_parameters[SERVO_SUB_CMD_INDEX] == PROFILE_MOVE_SYNC) ||
+                           (cmd->int_parameters[SERVO_SUB_CMD_INDEX] == SPLINE_MOVE) ||
+                           (cmd->int_parameters[SERVO_SUB_CMD_INDEX] == SPLINE_MOVE_SYNC))) {
+        set_move_sequence_id(&servo_data[cmd->int_parameters[SERVO_NUMBER_INDEX]].seq_id, cmd->seq_id);
+    }
+    print_reply(cmd->int_parameters[PORT_INDEX], status, 0);
+    *reply_done = true;
+    return status;
+}
+
+//***************************************************************************
+// stepper : stepper motor moves and calibration
+//
+// Moves are added to the stepper's move queue here, in the stepper task.
+// Plain moves are started by the task once every waiting command has been
+// queued, so that moves sent together run on into each other. SYNC moves
+// are loaded for the PIO at once, so the timer interrupt only has to start
+// them; coordinated moves are planned together when released by "sync".
+//
+static error_codes_te start_stepper_move(int32_t sm_number, int32_t nos_steps, stepper_commands_te sub_cmd, uint32_t seq_id)
+{
+struct stepper_data_s   *sm_ptr;
+error_codes_te          status;
+
+    sm_ptr = &stepper_data[sm_number];
+    if (nos_steps < 0) {
+        sm_ptr->direction = ANTI_CLOCKWISE;
+    } else {
+        sm_ptr->direction = CLOCKWISE;
+    }
+    sm_ptr->target_step_count = abs(nos_steps);
+    status = stepper_queue_add(sm_number, nos_steps, seq_id);     // "done" sent as the move ends
+    if (status != OK) {
+        return status;
+    }
+    if ((sub_cmd == SM_REL_MOVE_COORD) || (sub_cmd == SM_ABS_MOVE_COORD)) {
+        sm_ptr->coordinated = true;
+        sm_ptr->state = STATE_SM_SYNC;
+    } else if ((sub_cmd == SM_REL_MOVE_SYNC) || (sub_cmd == SM_ABS_MOVE_SYNC)) {
+        stepper_pio_load(sm_number);
+        sm_ptr->state = STATE_SM_SYNC;
+    }
+    return OK;
+}
+
+//
+// Step count of an angle : angles run from soft_left_limit to soft_right_limit
+//
+static int32_t stepper_angle_steps(struct stepper_data_s *sm_ptr, int32_t angle)
+{
+    return q16_mul_int_to_int(sm_ptr->steps_per_degree, (angle + sm_ptr->soft_right_limit));
+}
+
+//
+// Limit of the leading axis that keeps one axis within its own limit
+//
+static int64_t scaled_stepper_limit(int64_t leader_limit, int32_t axis_limit, int32_t leader_steps, int32_t axis_steps)
+{
+int64_t     limit;
+
+    limit = ((int64_t)axis_limit * leader_steps) / axis_steps;
+    if ((leader_limit == 0) || (limit < leader_limit)) {
+        return limit;
+    }
+    return leader_limit;
+}
+
+static void plan_coordinated_stepper_moves(void)
+{
+struct stepper_data_s   *sm_ptr, *leader;
+struct step_profile_s   *leader_profile;
+struct stepper_move_s   *move;
+error_codes_te          status;
+int64_t                 max_speed, max_accel, max_jerk;
+
+    leader = NULL;
+    leader_profile = NULL;
+    for (int32_t i=0 ; i < NOS_STEPPERS ; i++) {
+        sm_ptr = &stepper_data[i];
+        if ((sm_ptr->state == STATE_SM_SYNC) && (sm_ptr->coordinated == true)) {
+            if ((leader == NULL) || (sm_ptr->target_step_count > leader->target_step_count)) {
+                leader = sm_ptr;
+                leader_profile = &stepper_queue_head(i)->profile;
+            }
+        }
+    }
+    if (leader == NULL) {
+        return;
+    }
+    max_speed = max_accel = INT32_MAX;
+    max_jerk = 0;                       // 0 = no jerk limit on any axis
+    for (int32_t i=0 ; i < NOS_STEPPERS ; i++) {
+        sm_ptr = &stepper_data[i];
+        if ((sm_ptr->state != STATE_SM_SYNC) || (sm_ptr->coordinated == false) || (sm_ptr->target_step_count == 0)) {
             continue;
         }
-        status = convert_tokens();
-        if (status != OK) {
-            print_error(UNDEFINED_PORT, status);
+        max_speed = scaled_stepper_limit(max_speed, sm_ptr->max_speed, leader->target_step_count, sm_ptr->target_step_count);
+        max_accel = scaled_stepper_limit(max_accel, sm_ptr->max_accel, leader->target_step_count, sm_ptr->target_step_count);
+        if (sm_ptr->max_jerk != 0) {
+            max_jerk = scaled_stepper_limit(max_jerk, sm_ptr->max_jerk, leader->target_step_count, sm_ptr->target_step_count);
+        }
+    }
+    status = step_profile_plan(leader_profile, leader->target_step_count, 0, 0,
+                               (int32_t)max_speed, (int32_t)max_accel, (int32_t)max_jerk);
+    for (int32_t i=0 ; i < NOS_STEPPERS ; i++) {
+        sm_ptr = &stepper_data[i];
+        if ((sm_ptr->state != STATE_SM_SYNC) || (sm_ptr->coordinated == false)) {
             continue;
         }
-        token = string_to_token(commands, &command[arg_pt[0]]);
-        status = check_command(token);
         if (status != OK) {
-            print_error(int_parameters[PORT_INDEX], status);
+            sm_ptr->coordinated = false;
+            sm_ptr->error = status;
+            sm_ptr->state = STATE_SM_FAULT;     // reported as "done" with error
             continue;
         }
+        move = stepper_queue_head(i);
+        if (sm_ptr != leader) {
+            step_profile_follow(&move->profile, leader_profile, sm_ptr->target_step_count);
+        }
+        move->planned = true;
+        stepper_pio_load(i);
+    }
+}
 
-        reply_done = false;
-        status = OK;
-        switch (token) {
-            case TOKENIZER_SYS:
-                switch(int_parameters[2]) {  // SYS_SUB_CMD_INDEX
-                    case SOFT_RESET :    
-                        // special : NO RETURN FROM THIS COMMAND
-                        // Therefore send OK response BEFORE executing command to
-                        // ensure that remote comuputer does not enter a hang state
-                        print_string("%d %d\n", int_parameters[PORT_INDEX], status);
-                        software_reset();
-                    default :
-                        status = -9999;
-                        break;
-                break;
-                }
+static error_codes_te cmd_stepper(struct cmd_message_s *cmd, bool *reply_done)
+{
+struct stepper_data_s   *sm_ptr;
+error_codes_te          status;
+int32_t                 sm_number, sub_cmd;
+int32_t                 rel_nos_steps, abs_nos_steps, move_count, move_angle;
+bool                    busy;
+
+    status = OK;
+    if (stepper_data[cmd->int_parameters[STEP_MOTOR_NO_INDEX]].error != OK) {  // ensure motor is not in an error state
+        status = stepper_data[cmd->int_parameters[3]].error;
+        return status;
+    }
+    sm_number = cmd->int_parameters[STEP_MOTOR_NO_INDEX];
+    sm_ptr = &stepper_data[sm_number];
+    sub_cmd = cmd->int_parameters[STEP_MOTOR_SUB_CMD_INDEX];
+    if ((sub_cmd == SM_REL_MOVE) || (sub_cmd == SM_ABS_MOVE)) {     // join the move queue
+        busy = ((sm_ptr->state != STATE_SM_DORMANT) && (sm_ptr->state != STATE_SM_INIT) && (sm_ptr->state != STATE_SM_RUNNING))
+                || (sm_ptr->queue.count >= STEPPER_QUEUE_DEPTH);
+    } else {
+        busy = (sm_ptr->state != STATE_SM_DORMANT) || (sm_ptr->queue.count != 0);
+    }
+    if (busy == true) {
+        status = STEPPER_BUSY;      // queue full, or moves must finish first
+        print_reply(cmd->int_parameters[PORT_INDEX], status, 0);
+        *reply_done = true;
+        return status;
+    }
+    switch (sub_cmd) { 
 
-            case TOKENIZER_SERVO: 
-                switch (int_parameters[SERVO_SUB_CMD_INDEX]) {
-                    case ABS_MOVE: 
-                        status = set_servo_move( int_parameters[SERVO_NUMBER_INDEX], MOVE, int_parameters[SERVO_ANGLE_INDEX], false);
-                        break;
-                    case ABS_MOVE_SYNC: 
-                        status = set_servo_move( int_parameters[SERVO_NUMBER_INDEX], MOVE, int_parameters[SERVO_ANGLE_INDEX], true);
-                        break;
-                    case SPEED_MOVE: 
-                        status = set_servo_speed_move(int_parameters[SERVO_NUMBER_INDEX], TIMED_MOVE, int_parameters[SERVO_ANGLE_INDEX], int_parameters[SERVO_SPEED_INDEX], false);
-                        break;
-                    case SPEED_MOVE_SYNC: 
-                        status = set_servo_speed_move(int_parameters[SERVO_NUMBER_INDEX], TIMED_MOVE, int_parameters[SERVO_ANGLE_INDEX], int_parameters[SERVO_SPEED_INDEX], true);
-                        break;
-                    case RUN_SYNC_MOVES: 
-                        status = set_servo_move(int_parameters[SERVO_SUB_CMD_INDEX], int_parameters[SERVO_NUMBER_INDEX], int_parameters[SERVO_ANGLE_INDEX], false);
-                        break;
-                    case STOP:
-                        status = set_servo_move(int_parameters[SERVO_SUB_CMD_INDEX], int_parameters[SERVO_NUMBER_INDEX], int_parameters[SERVO_ANGLE_INDEX], false);  
-                        break;
-                    case STOP_ALL: 
-                        status = set_servo_move(int_parameters[SERVO_SUB_CMD_INDEX], int_parameters[SERVO_NUMBER_INDEX], int_parameters[SERVO_ANGLE_INDEX], false);
-                        break;
-                    case ENABLE :
-                        status = set_servo_state(int_parameters[SERVO_NUMBER_INDEX], DISABLED, int_parameters[SERVO_ANGLE_INDEX]);
-                        break;
-                    default:
-                        status = BAD_SERVO_COMMAND;
-                        break;
-                }  // end of inner switch
-                print_string("%d %d\n", int_parameters[PORT_INDEX], status);
-                reply_done = true;
+        case SM_REL_MOVE : 
+        case SM_REL_MOVE_SYNC :
+        case SM_REL_MOVE_COORD :
+            rel_nos_steps = q16_mul_int_to_int(sm_ptr->steps_per_degree, cmd->int_parameters[STEP_MOTOR_ANGLE_INDEX]);
+            move_count = stepper_queue_end(sm_number) + rel_nos_steps;      // after moves already queued
+            if ((move_count < 0) || (move_count > sm_ptr->max_step_count)
+                  || (move_count < stepper_angle_steps(sm_ptr, sm_ptr->soft_left_limit))
+                  || (move_count > stepper_angle_steps(sm_ptr, sm_ptr->soft_right_limit))) {
+                status = BAD_STEP_VALUE;
                 break;
+            }
+            status = start_stepper_move(sm_number, rel_nos_steps, sub_cmd, cmd->seq_id);
+            break;
 
-            case TOKENIZER_STEPPER: 
-                if (stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].state != STATE_SM_DORMANT) {
-                    status = STEPPER_BUSY;
-                }
-                if (stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].error != OK) {  // ensure motor is not in an error state
-                    status = stepper_data[int_parameters[3]].error;
-                    break;
-                }
-                sm_number = int_parameters[STEP_MOTOR_NO_INDEX];
-                switch (int_parameters[STEP_MOTOR_SUB_CMD_INDEX]) { 
-
-                    case SM_REL_MOVE : 
-                    case SM_REL_MOVE_SYNC :
-                        if (stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].error != OK) {  // ensure motor is not in an error state
-                            status = stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].error;
-                            break;  // existing error => abort move
-                        }
-                        sm_number = int_parameters[STEP_MOTOR_NO_INDEX];
-                        if (abs(int_parameters[STEP_MOTOR_ANGLE_INDEX]) < MIN_STEP_MOVE ) {
-                            status = SM_MOVE_TOO_SMALL;
-                            break;
-                        }
-
-                        rel_nos_steps = (int32_t)(stepper_data[sm_number].steps_per_degree * int_parameters[STEP_MOTOR_ANGLE_INDEX]);
-                        move_count = stepper_data[sm_number].current_step_count + rel_nos_steps;
-                        if ((move_count < 0) || (move_count > stepper_data[sm_number].max_step_count)) {
-                            status = BAD_STEP_VALUE;
-                            break;
-                        }
-                        if (rel_nos_steps < 0) {
-                            stepper_data[sm_number].direction = ANTI_CLOCKWISE;
-                        } else {
-                            stepper_data[sm_number].direction = CLOCKWISE;
-                        }
-                        if (stepper_data[sm_number].flip_direction == true) {
-                            FLIP_BOOLEAN(stepper_data[sm_number].direction);
-                        }
-                        stepper_data[sm_number].target_step_count = abs(rel_nos_steps);
-                        stepper_data[sm_number].sm_profile = 0;
-                        stepper_data[sm_number].coast_step_count = (abs(rel_nos_steps) - (sequences[sm_number].nos_sm_cmds - 1));
-                        stepper_data[sm_number].cmd_index = 0;
-                        if (int_parameters[STEP_MOTOR_SUB_CMD_INDEX] == SM_REL_MOVE) {
-                            stepper_data[sm_number].state = STATE_SM_INIT;
-                        } else {
-                            stepper_data[sm_number].state = STATE_SM_SYNC;
-                        }
-                        break;
-
-                    case SM_ABS_MOVE :
-                        if (stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].error != OK) {  // ensure motor is not in an error state
-                            status = stepper_data[int_parameters[STEP_MOTOR_NO_INDEX]].error;
-                            break;   // existing error => abort move
-                        }
-                        sm_number = int_parameters[STEP_MOTOR_NO_INDEX];
-                        move_angle = int_parameters[STEP_MOTOR_ANGLE_INDEX];
-                        if ((move_angle < stepper_data[sm_number].soft_left_limit) || (move_angle > stepper_data[sm_number].soft_right_limit)) {
-                            status = BAD_STEP_VALUE;
-                            break;
-                        }
-                        
-                        abs_nos_steps = (int32_t)(stepper_data[sm_number].steps_per_degree * (move_angle + stepper_data[sm_number].soft_right_limit));
-                        move_count = abs(stepper_data[sm_number].current_step_count - abs_nos_steps);
-                        if (abs_nos_steps < 0) {
-                            stepper_data[sm_number].direction = ANTI_CLOCKWISE;
-                        } else {
-                            stepper_data[sm_number].direction = CLOCKWISE;
-                        }
-                        if (stepper_data[sm_number].flip_direction == true) {
-                            FLIP_BOOLEAN(stepper_data[sm_number].direction);
-                        }
-                        stepper_data[sm_number].target_step_count = abs(move_count);
-                        stepper_data[sm_number].sm_profile = sm_number;
-                        stepper_data[sm_number].coast_step_count = abs(move_count - (sequences[sm_number].nos_sm_cmds - 1));
-                        stepper_data[sm_number].cmd_index = 0;
-                        if (int_parameters[STEP_MOTOR_NO_INDEX] == SM_ABS_MOVE) {
-                            stepper_data[sm_number].state = STATE_SM_INIT;
-                        } else {
-                            stepper_data[sm_number].state = STATE_SM_SYNC;
-                        }
-                        break;
-                    case SM_CALIBRATE : 
-                        stepper_data[sm_number].state = STATE_SM_UNCALIBRATED;
-                        break;  // set system to do a calibration on this motor
-                    default:
-                        status = BAD_STEPPER_COMMAND;
-                        break;
-                }
-                print_string("%d %d\n", int_parameters[PORT_INDEX], status);
-                reply_done = true;
+        case SM_ABS_MOVE :
+        case SM_ABS_MOVE_SYNC :
+        case SM_ABS_MOVE_COORD :
+            move_angle = cmd->int_parameters[STEP_MOTOR_ANGLE_INDEX];
+            if ((move_angle < sm_ptr->soft_left_limit) || (move_angle > sm_ptr->soft_right_limit)) {
+                status = BAD_STEP_VALUE;
                 break;
+            }
+            abs_nos_steps = stepper_angle_steps(sm_ptr, move_angle);
+            status = start_stepper_move(sm_number, (abs_nos_steps - stepper_queue_end(sm_number)), sub_cmd, cmd->seq_id);
+            break;
+        case SM_CALIBRATE : 
+            sm_ptr->seq_id = cmd->seq_id;       // stepper is idle : no move to supersede
+            sm_ptr->state = STATE_SM_UNCALIBRATED;
+            stepper_wake(sm_number);
+            break;  // set system to do a calibration on this motor
+        default:
+            status = BAD_STEPPER_COMMAND;
+            break;
+    }
+    print_reply(cmd->int_parameters[PORT_INDEX], status, 0);
+    *reply_done = true;
+    return status;
+}
 
-            case TOKENIZER_SYNC: 
-                for( int32_t i=0; i<NOS_SERVOS; i++) {
-                    servo_pt = &servo_data[i];
-                    servo_pt->sync = false;
-                }
-                for (int32_t i=0 ; i <NOS_STEPPERS;i++) {
-                    if (stepper_data[i].state == STATE_SM_SYNC) {
-                        stepper_data[i].state = STATE_SM_INIT;
-                    }
-                }
+//***************************************************************************
+// release_servo_sync_moves/release_stepper_sync_moves : start moves held for sync
+//
+static void release_servo_sync_moves(void)
+{
+struct servo_data_s     *servo_pt;
+
+    for( int32_t i=0; i<NOS_SERVOS; i++) {
+        servo_pt = &servo_data[i];
+        servo_pt->sync = false;
+    }
+}
+
+static void release_stepper_sync_moves(void)
+{
+    plan_coordinated_stepper_moves();
+    for (int32_t i=0 ; i <NOS_STEPPERS;i++) {
+        if (stepper_data[i].state == STATE_SM_SYNC) {
+            stepper_data[i].state = STATE_SM_INIT;
+            stepper_wake(i);
+        }
+    }
+}
+
+//***************************************************************************
+// sync : release servo and stepper moves flagged as synchronised
+//
+// Run first by the servo task, which then passes the command on to the
+// stepper task. Each task releases its own moves only after running any
+// moves queued ahead of the sync command.
+//
+static error_codes_te cmd_sync(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    if (cmd->stage == 0) {
+        release_servo_sync_moves();
+        cmd->stage++;
+        status = post_command(CMD_QUEUE_STEPPER, cmd);
+        if (status == OK) {
+            *reply_done = true;     // reply is sent by the stepper task
+        }
+        return status;
+    }
+    release_stepper_sync_moves();
+    return OK;
+}
+
+//***************************************************************************
+// set : configuration (not yet implemented)
+//
+static error_codes_te cmd_set(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    status = OK;
+    return status;
+}
+
+//***************************************************************************
+// get : system information
+//
+static error_codes_te cmd_get(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+struct cmd_queue_s      *queue_pt;
+uint32_t                nos_flushes;
+
+    status = OK;
+    switch (cmd->int_parameters[GET_SUB_CMD_INDEX]) {
+        case SYS_INFO:
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 2, NOS_SERVOS, NOS_STEPPERS);
+            *reply_done = true;
+            break;
+        case SERVO_INFO:
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 0);
+            *reply_done = true;
+            break;
+        case STEPPER_INFO:      // moves, PIO segments, DMA underruns, longest move (mS), alarms, blends
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 6,
+                        stepper_stats.moves, stepper_stats.segments,
+                        stepper_stats.underruns, stepper_stats.max_move_mS,
+                        stepper_stats.alarms, stepper_stats.blends);
+            *reply_done = true;
+            break;
+        case QUEUE_INFO:        // depth, max depth, max latency (uS), commands run
+            if (cmd->argc < 4) {
+                status = BAD_NOS_PARAMETERS;
                 break;
+            }
+            queue_pt = &cmd_queues[cmd->int_parameters[GET_QUEUE_INDEX]];
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 4,
+                        uxQueueMessagesWaiting(queue_pt->queue), queue_pt->max_depth,
+                        queue_pt->max_latency_uS, queue_pt->nos_cmds);
+            *reply_done = true;
+            break;
+        case UART_INFO:         // receive overflows, dropped lines, dropped frames, TX stalls, ring overruns, receive uS/KB
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 6,
+                        uart_stats.rx_overflows, uart_stats.rx_dropped_lines,
+                        uart_stats.rx_dropped_frames, uart_stats.tx_stalls,
+                        uart_stats.rx_ring_overruns,
+                        (uart_stats.rx_bytes == 0) ? 0 : (uint32_t)(((uint64_t)uart_stats.rx_scan_uS * 1024) / uart_stats.rx_bytes));
+            *reply_done = true;
+            break;
+        case SCHEDULE_INFO:     // pending, released, late, lost (queue full), max lateness (uS)
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 5,
+                        schedule_stats.pending, schedule_stats.released, schedule_stats.late,
+                        schedule_stats.queue_full, schedule_stats.max_lateness_uS);
+            *reply_done = true;
+            break;
+        case I2C_INFO:          // transfers, NAKs, aborts, timeouts, bus recoveries
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 5,
+                        i2c_stats.transfers, i2c_stats.naks, i2c_stats.aborts,
+                        i2c_stats.timeouts, i2c_stats.recoveries);
+            *reply_done = true;
+            break;
+        case PCA9685_INFO:      // writes issued, writes suppressed, reads issued, reads from cache, resyncs
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 5,
+                        PCA9685_stats.writes_issued, PCA9685_stats.writes_suppressed,
+                        PCA9685_stats.reads_issued, PCA9685_stats.reads_cached, PCA9685_stats.resyncs);
+            *reply_done = true;
+            break;
+        case PCA9685_FLUSH_INFO:    // flushes, mean and max bytes/flush, mean and max uS/flush, flushes deferred
+            nos_flushes = (PCA9685_stats.flushes == 0) ? 1 : PCA9685_stats.flushes;
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 6,
+                        PCA9685_stats.flushes,
+                        PCA9685_stats.flush_bytes / nos_flushes, PCA9685_stats.max_flush_bytes,
+                        PCA9685_stats.flush_uS / nos_flushes, PCA9685_stats.max_flush_uS,
+                        PCA9685_stats.flushes_deferred);
+            *reply_done = true;
+            break;
+        default:
+            break;
+    }
+    return status;
+}
+
+//***************************************************************************
+// ping : return value + 1
+//
+// "ping port value 1" also returns the device time at which the line was
+// read and at which the reply was made, for host clock offset and drift
+// estimation. Runs in "Task_run_cmd" so that no queue delay is added.
+//
+static error_codes_te cmd_ping(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+uint64_t                reply_time;
 
-            case TOKENIZER_SET: 
+    status = OK;
+    if ((cmd->argc > PING_CLOCK_INDEX) && (cmd->int_parameters[PING_CLOCK_INDEX] == 1)) {
+        reply_time = time_us_64();      // receive and reply times as seconds + uS
+        print_reply(cmd->int_parameters[PORT_INDEX], OK, 5, (cmd->int_parameters[PING_VALUE_INDEX] + 1),
+                    (int32_t)(line_time / 1000000), (int32_t)(line_time % 1000000),
+                    (int32_t)(reply_time / 1000000), (int32_t)(reply_time % 1000000));
+    } else {
+        print_reply(cmd->int_parameters[PORT_INDEX], OK, 1, (cmd->int_parameters[PING_VALUE_INDEX] + 1));
+    }
+    *reply_done = true;
+    return status;
+}
+
+//***************************************************************************
+// delay : pause command execution
+//
+static error_codes_te cmd_tdelay(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    status = OK;
+    vTaskDelay(cmd->int_parameters[2]);
+    return status;
+}
+
+//***************************************************************************
+// display : 4D Systems uLCD forms and objects
+//
+static error_codes_te cmd_display(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+uint32_t                current_form, new_form, result, i, value, pressed_state;
+
+    status = OK;
+    switch (cmd->int_parameters[DISPLAY_SUB_CMD_INDEX]) {
+        case SET_uLCD_FORM:
+            new_form = cmd->int_parameters[DISPLAY_FORM_INDEX];
+            if (new_form > NOS_FORMS) {
+                status = GEN4_uLCD_CMD_BAD_FORM_INDEX;
+                break;
+            } 
+            // scan any switches marked to be scanned and put their 
+            // values in the 'form_data' structure
+            status = scan_switches(get_uLCD_active_form(), &result);
+            if (status != OK) {
+                break;
+            }
+            new_form = cmd->int_parameters[DISPLAY_FORM_INDEX];
+            if (new_form > NOS_FORMS) {
+                status = GEN4_uLCD_CMD_BAD_FORM_INDEX;
+                break;
+            } 
+            status = change_uLCD_form(new_form);
+            if (status != OK) {
                 break;
+            }
+            // clear button states
+            for (i = 0; i < nos_object[new_form].nos_buttons; i++) {
+                clear_button_state(new_form, i);
+            }
+            // update any strings
+            for (i = 0; i < nos_object[new_form].nos_strings; i++) {
+                status = gen4_uLCD_WriteString(form_data[new_form].strings[i].global_object_id,
+                                  &form_data[new_form].strings[i].string[0]);
+            }
+            break;
 
-            case TOKENIZER_GET:
-                switch (int_parameters[2]) {
-                    case SYS_INFO:
-                        print_string("%d %d %d %d\n", int_parameters[PORT_INDEX], OK, NOS_SERVOS, NOS_STEPPERS);
-                        reply_done = true;
-                        break;
-                    case SERVO_INFO:
-                        print_string("%d %d\n", int_parameters[PORT_INDEX], OK);
-                        reply_done = true;
-                        break;
-                    case STEPPER_INFO:
-                        print_string("%d %d\n", int_parameters[PORT_INDEX], OK);
-                        reply_done = true;
-                        break;
-                    default:
-                        break;
-                }
+        case GET_uLCD_FORM:
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 1, get_uLCD_active_form());
+            *reply_done = true;
+            break;
+
+        case SET_uLCD_CONTRAST:
+            if (cmd->int_parameters[DISPLAY_CONTRAST_INDEX] < 0 || cmd->int_parameters[DISPLAY_CONTRAST_INDEX] > 100) {
+                status = GEN4_uLCD_WRITE_CONTRAST_BAD_VALUE;
                 break;
+            }
+            status = gen4_uLCD_WriteContrast(cmd->int_parameters[DISPLAY_CONTRAST_INDEX]);
+            break;
 
-            case TOKENIZER_PING: 
-                print_string("%d %d %d\n", int_parameters[PORT_INDEX], OK, (int_parameters[PING_VALUE_INDEX] + 1));
-                reply_done = true;
+        case READ_uLCD_BUTTON:   // read from 'form_data' structure
+            current_form = get_uLCD_active_form();
+            if (cmd->int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
+                status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
                 break;
+            } 
+            pressed_state = form_data[current_form].buttons[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].button_state;
+            value = form_data[current_form].buttons[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].button_value;
+            print_reply(cmd->int_parameters[PORT_INDEX], status, 2, value, pressed_state);
+            *reply_done = true;
+            break;
 
-            case TOKENIZER_DISPLAY:
-                switch (int_parameters[DISPLAY_SUB_CMD_INDEX]) {
-                    case SET_uLCD_FORM:
-                        new_form = int_parameters[DISPLAY_FORM_INDEX];
-                        if (new_form > NOS_FORMS) {
-                            status = GEN4_uLCD_CMD_BAD_FORM_INDEX;
-                            break;
-                        } 
-                        // scan any switches marked to be scanned and put their 
-                        // values in the 'form_data' structure
-                        status = scan_switches(get_uLCD_active_form(), &result);
-                        if (status != OK) {
-                            break;
-                        }
-                        new_form = int_parameters[DISPLAY_FORM_INDEX];
-                        if (new_form > NOS_FORMS) {
-                            status = GEN4_uLCD_CMD_BAD_FORM_INDEX;
-                            break;
-                        } 
-                        status = change_uLCD_form(new_form);
-                        if (status != OK) {
-                            break;
-                        }
-                        // clear button states
-                        for (i = 0; i < nos_object[new_form].nos_buttons; i++) {
-                            clear_button_state(new_form, i);
-                        }
-                        // update any strings
-                        for (i = 0; i < nos_object[new_form].nos_strings; i++) {
-                            status = gen4_uLCD_WriteString(form_data[new_form].strings[i].global_object_id,
-                                              &form_data[new_form].strings[i].string[0]);
-                        }
-                        break;
-
-                    case GET_uLCD_FORM:
-                        print_string("%d %d %d\n",int_parameters[PORT_INDEX], OK,  get_uLCD_active_form());
-                        reply_done = true;
-                        break;
-
-                    case SET_uLCD_CONTRAST:
-                        if (int_parameters[DISPLAY_CONTRAST_INDEX] < 0 || int_parameters[DISPLAY_CONTRAST_INDEX] > 100) {
-                            status = GEN4_uLCD_WRITE_CONTRAST_BAD_VALUE;
-                            break;
-                        }
-                        status = gen4_uLCD_WriteContrast(int_parameters[DISPLAY_CONTRAST_INDEX]);
-                        break;
-
-                    case READ_uLCD_BUTTON:   // read from 'form_data' structure
-                        current_form = get_uLCD_active_form();
-                        if (int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
-                            status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
-                            break;
-                        } 
-                        pressed_state = form_data[current_form].buttons[int_parameters[DISPLAY_LOCAL_ID_INDEX]].button_state;
-                        value = form_data[current_form].buttons[int_parameters[DISPLAY_LOCAL_ID_INDEX]].button_value;
-                        print_string("%d %d %d %d\n", int_parameters[PORT_INDEX], status, value, pressed_state);
-                        reply_done = true;
-                        break;
-
-                    case READ_uLCD_SWITCH:   // read from 'form_data' structure
-                        current_form = get_uLCD_active_form();
-                        if (int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
-                            status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
-                            break;
-                        } 
-                        if (int_parameters[DISPLAY_DATA_SOURCE_INDEX] == SRC_HARDWARE) {    // read from display hardware
-                            int32_t object_type = form_data[current_form].switches[int_parameters[DISPLAY_LOCAL_ID_INDEX]].object_type;
-                            int32_t global_object_id = form_data[current_form].switches[int_parameters[DISPLAY_LOCAL_ID_INDEX]].global_object_id;
-                            status = gen4_uLCD_ReadObject(object_type, 
-                                                            global_object_id, 
-                                                            &result);
-                            if (status != OK) {
-                                break;
-                            }
-                            // log result 
-		                    form_data[current_form].switches[int_parameters[DISPLAY_LOCAL_ID_INDEX]].switch_value = result;
-                        } else {      // read from 'form_data' structure
-                            result = form_data[current_form].switches[int_parameters[DISPLAY_LOCAL_ID_INDEX]].switch_value;
-                        }
-                        print_string("%d %d %d\n", int_parameters[PORT_INDEX], status, result);
-                        reply_done = true;
-                        break;
-
-                    case READ_uLCD_OBJECT:  //read from display hardware
-                        status = gen4_uLCD_ReadObject(int_parameters[DISPLAY_OBJECT_TYPE_INDEX],
-                                                      int_parameters[DISPLAY_GLOBAL_ID_INDEX],
-                                                      &result);
-                        print_string("%d %d %d\n", int_parameters[PORT_INDEX], status, result);
-                        break;
-
-                    case WRITE_uLCD_STRING:
-                        current_form = get_uLCD_active_form();
-                        if (int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
-                            status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
-                            break;
-                        } 
-                        status = gen4_uLCD_WriteString(form_data[current_form].strings[int_parameters[DISPLAY_LOCAL_ID_INDEX]].global_object_id,
-                                                       &command[arg_pt[DISPLAY_STRING_INDEX]]);
-
-                    case WRITE_uLCD_OBJECT :   // raw write to a screen object
-                            status = gen4_uLCD_WriteObject(int_parameters[DISPLAY_OBJECT_TYPE_INDEX], 
-                                                           int_parameters[DISPLAY_GLOBAL_ID_INDEX], 
-                                                           int_parameters[DISPLAY_WRITE_VALUE_INDEX]);
-                            break;
-
-                    case SCAN_uLCD_BUTTON_PRESSES:
-                        current_form = get_uLCD_active_form();
-                        if (int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
-                            status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
-                            break;
-                        } 
-                        for (i=0 ; i < nos_object[current_form].nos_buttons; i++) {
-                            if (form_data[current_form].buttons[i].object_mode != OBJECT_SCAN_ENABLED) {
-                                break;
-                            }
-                            if (form_data[current_form].buttons[i].button_state == PRESSED) {
-                                print_string("%d %d %d %d\n", int_parameters[PORT_INDEX] , OK, i, form_data[current_form].buttons[i].time_high);
-                                reply_done = true;
-                                // clear state to button data
-                                clear_button_state(current_form, i);
-                                break;
-                            }
-                        }
-                        if (reply_done != true) {
-                            print_string("%d %d %d\n", int_parameters[PORT_INDEX], OK, -1);
-                            reply_done = true;
-                        }
-                        break;
-
-                    case SCAN_uLCD_SWITCHES:
-                        status = scan_switches(get_uLCD_active_form(), &result);
-                        if (status == OK) {
-                            print_string("%d %d %d\n", int_parameters[PORT_INDEX], OK, result);
-                            reply_done = true;
-                            break;
-                        }
-                        break;
-                        
-                    default:
-                        status = GEN4_UNKNOWN_DISPLAY_SUB_COMMAND;
-                        break;
+        case READ_uLCD_SWITCH:   // read from 'form_data' structure
+            current_form = get_uLCD_active_form();
+            if (cmd->int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
+                status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
+                break;
+            } 
+            if (cmd->int_parameters[DISPLAY_DATA_SOURCE_INDEX] == SRC_HARDWARE) {    // read from display hardware
+                int32_t object_type = form_data[current_form].switches[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].object_type;
+                int32_t global_object_id = form_data[current_form].switches[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].global_object_id;
+                status = gen4_uLCD_ReadObject(object_type, 
+                                                global_object_id, 
+                                                &result);
+                if (status != OK) {
+                    break;
                 }
+                // log result 
+		                    form_data[current_form].switches[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].switch_value = result;
+            } else {      // read from 'form_data' structure
+                result = form_data[current_form].switches[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].switch_value;
+            }
+            print_reply(cmd->int_parameters[PORT_INDEX], status, 1, result);
+            *reply_done = true;
+            break;
+
+        case READ_uLCD_OBJECT:  //read from display hardware
+            status = gen4_uLCD_ReadObject(cmd->int_parameters[DISPLAY_OBJECT_TYPE_INDEX],
+                                          cmd->int_parameters[DISPLAY_GLOBAL_ID_INDEX],
+                                          &result);
+            print_reply(cmd->int_parameters[PORT_INDEX], status, 1, result);
+            break;
+
+        case WRITE_uLCD_STRING:
+            current_form = get_uLCD_active_form();
+            if (cmd->int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
+                status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
+                break;
+            } 
+            status = gen4_uLCD_WriteString(form_data[current_form].strings[cmd->int_parameters[DISPLAY_LOCAL_ID_INDEX]].global_object_id,
+                                           cmd->string);
+
+        case WRITE_uLCD_OBJECT :   // raw write to a screen object
+                status = gen4_uLCD_WriteObject(cmd->int_parameters[DISPLAY_OBJECT_TYPE_INDEX], 
+                                               cmd->int_parameters[DISPLAY_GLOBAL_ID_INDEX], 
+                                               cmd->int_parameters[DISPLAY_WRITE_VALUE_INDEX]);
                 break;
 
-            case TOKENIZER_NEOPIXEL:
-                switch (int_parameters[NEOPIXEL_SUB_CMD_INDEX]) {
-                    case NP_SET_PIXEL_ON:
-                        if (int_parameters[3] > NOS_NEOPIXELS) {
-                            status = BAD_NEOPIXEL_NUMBER;;
-                            break;
-                        }
-                        set_neopixel_on(int_parameters[3], int_parameters[4]);
-                        break;
-                    case NP_SET_PIXEL_OFF:
-                        set_neopixel_on(int_parameters[3], N_BLACK);
-                        break;
-                    case NP_SET_PIXEL_FLASH:
-                        set_neopixel_flash(int_parameters[3], int_parameters[4], int_parameters[5],
-                                           int_parameters[6], int_parameters[7]);
-                        break;
-                    case NP_SET_ALL:
-                        set_all_neopixels(int_parameters[3]);
-                        break;
-                    case NP_BLANK_ALL:
-                        set_all_neopixels(N_BLACK);
-                        break;
-                    default:
-                        break;
+        case SCAN_uLCD_BUTTON_PRESSES:
+            current_form = get_uLCD_active_form();
+            if (cmd->int_parameters[DISPLAY_FORM_INDEX] != current_form ) {
+                status = GEN4_uLCD_BUTTON_FORM_INACTIVE;
+                break;
+            } 
+            for (i=0 ; i < nos_object[current_form].nos_buttons; i++) {
+                if (form_data[current_form].buttons[i].object_mode != OBJECT_SCAN_ENABLED) {
+                    break;
                 }
+                if (form_data[current_form].buttons[i].button_state == PRESSED) {
+                    print_reply(cmd->int_parameters[PORT_INDEX], OK, 2, i, form_data[current_form].buttons[i].time_high);
+                    *reply_done = true;
+                    // clear state to button data
+                    clear_button_state(current_form, i);
+                    break;
+                }
+            }
+            if (*reply_done != true) {
+                print_reply(cmd->int_parameters[PORT_INDEX], OK, 1, -1);
+                *reply_done = true;
+            }
+            break;
+
+        case SCAN_uLCD_SWITCHES:
+            status = scan_switches(get_uLCD_active_form(), &result);
+            if (status == OK) {
+                print_reply(cmd->int_parameters[PORT_INDEX], OK, 1, result);
+                *reply_done = true;
                 break;
+            }
+            break;
+            
+        default:
+            status = GEN4_UNKNOWN_DISPLAY_SUB_COMMAND;
+            break;
+    }
+    return status;
+}
 
-            case TOKENIZER_SWITCH: 
-                print_string("%d %d %d\n", int_parameters[PORT_INDEX], OK, (switch_data.switch_value[int_parameters[2]]));
-                reply_done = true;
+//***************************************************************************
+// neopixel : set/flash LEDs
+//
+static error_codes_te cmd_neopixel(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    status = OK;
+    switch (cmd->int_parameters[NEOPIXEL_SUB_CMD_INDEX]) {
+        case NP_SET_PIXEL_ON:
+            if (cmd->int_parameters[3] > NOS_NEOPIXELS) {
+                status = BAD_NEOPIXEL_NUMBER;;
                 break;
+            }
+            set_neopixel_on(cmd->int_parameters[3], cmd->int_parameters[4]);
+            break;
+        case NP_SET_PIXEL_OFF:
+            set_neopixel_on(cmd->int_parameters[3], N_BLACK);
+            break;
+        case NP_SET_PIXEL_FLASH:
+            set_neopixel_flash(cmd->int_parameters[3], cmd->int_parameters[4], cmd->int_parameters[5],
+                               cmd->int_parameters[6], cmd->int_parameters[7]);
+            break;
+        case NP_SET_ALL:
+            set_all_neopixels(cmd->int_parameters[3]);
+            break;
+        case NP_BLANK_ALL:
+            set_all_neopixels(N_BLACK);
+            break;
+        default:
+            break;
+    }
+    return status;
+}
 
-            case TOKENIZER_TDELAY:
-                vTaskDelay(int_parameters[2]);
+//***************************************************************************
+// switch : read switch value
+//
+static error_codes_te cmd_switch(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+
+    status = OK;
+    print_reply(cmd->int_parameters[PORT_INDEX], OK, 1, (switch_data.switch_value[cmd->int_parameters[2]]));
+    *reply_done = true;
+    return status;
+}
+
+//***************************************************************************
+// script : load, save, run, stop and read status of flash scripts
+//
+static error_codes_te cmd_script(struct cmd_message_s *cmd, bool *reply_done)
+{
+error_codes_te          status;
+uint32_t                script_id;
+int32_t                 running, pc, error;
+
+    status = OK;
+    if ((cmd->int_parameters[SCRIPT_SUB_CMD_INDEX] != SCRIPT_SAVE) && (cmd->argc <= SCRIPT_ID_INDEX)) {
+        return BAD_NOS_PARAMETERS;
+    }
+    script_id = cmd->int_parameters[SCRIPT_ID_INDEX];
+    switch (cmd->int_parameters[SCRIPT_SUB_CMD_INDEX]) {
+        case SCRIPT_LOAD:
+            if (cmd->argc <= SCRIPT_DATA_INDEX) {
+                status = BAD_NOS_PARAMETERS;
                 break;
-                
-        }  // end of outer switch
-        if (reply_done == false) {
-            print_error(int_parameters[1], status);
+            }
+            status = script_load(script_id, cmd->int_parameters[SCRIPT_OFFSET_INDEX],
+                                 &cmd->int_parameters[SCRIPT_DATA_INDEX], (cmd->argc - SCRIPT_DATA_INDEX));
+            break;
+        case SCRIPT_SAVE:
+            status = script_save();
+            break;
+        case SCRIPT_RUN:
+            status = script_start(script_id, &cmd->int_parameters[SCRIPT_PARAMETER_INDEX],
+                                  (cmd->argc > SCRIPT_PARAMETER_INDEX) ? (cmd->argc - SCRIPT_PARAMETER_INDEX) : 0,
+                                  cmd->seq_id);
+            break;
+        case SCRIPT_STOP:
+            script_stop(script_id);
+            break;
+        case SCRIPT_STATUS:     // running, pc, last error
+            script_status(script_id, &running, &pc, &error);
+            print_reply(cmd->int_parameters[PORT_INDEX], OK, 3, running, pc, error);
+            *reply_done = true;
+            break;
+        default:
+            status = BAD_SCRIPT_COMMAND;
+            break;
+    }
+    return status;
+}
+
+//***************************************************************************
+// Dispatch table : handler and execution queue, indexed by token
+//
+// "delay" runs in "Task_run_cmd" so that it holds up the following commands.
+// "ping" runs there so that its clock reply is not delayed by a queue.
+
+typedef error_codes_te (*cmd_handler_ft)(struct cmd_message_s *cmd, bool *reply_done);
+
+struct cmd_dispatch_s {
+    cmd_handler_ft  handler;
+    cmd_queue_te    queue;
+};
+
+static const struct cmd_dispatch_s cmd_dispatch[NOS_COMMANDS] = {
+    [TOKENIZER_SYS]      = {cmd_sys,      CMD_QUEUE_SYS},
+    [TOKENIZER_SERVO]    = {cmd_servo,    CMD_QUEUE_SERVO},
+    [TOKENIZER_STEPPER]  = {cmd_stepper,  CMD_QUEUE_STEPPER},
+    [TOKENIZER_SYNC]     = {cmd_sync,     CMD_QUEUE_SERVO},
+    [TOKENIZER_SET]      = {cmd_set,      CMD_QUEUE_SYS},
+    [TOKENIZER_GET]      = {cmd_get,      CMD_QUEUE_SYS},
+    [TOKENIZER_PING]     = {cmd_ping,     CMD_QUEUE_NONE},
+    [TOKENIZER_TDELAY]   = {cmd_tdelay,   CMD_QUEUE_NONE},
+    [TOKENIZER_DISPLAY]  = {cmd_display,  CMD_QUEUE_DISPLAY},
+    [TOKENIZER_NEOPIXEL] = {cmd_neopixel, CMD_QUEUE_NEOPIXEL},
+    [TOKENIZER_SWITCH]   = {cmd_switch,   CMD_QUEUE_SYS},
+    [TOKENIZER_SCRIPT]   = {cmd_script,   CMD_QUEUE_SCRIPT},
+};
+
+//***************************************************************************
+// post_script_command : check a command from a script and queue it
+//
+// Script commands use the same limits and handlers as host commands.
+// Commands that run in "Task_run_cmd" itself (tdelay) are not allowed,
+// scripts have OP_DELAY instead.
+//
+error_codes_te post_script_command(struct cmd_message_s *cmd)
+{
+error_codes_te          status;
+
+    if ((cmd->token < 0) || (cmd->token >= NOS_COMMANDS) || (cmd_dispatch[cmd->token].queue == CMD_QUEUE_NONE)) {
+        return BAD_COMMAND;
+    }
+    status = check_limits(cmd->token, cmd->argc, cmd->int_parameters, NULL);
+    if (status != OK) {
+        return status;
+    }
+    return post_command(cmd_dispatch[cmd->token].queue, cmd);
+}
+
+//***************************************************************************
+// run_command_message : run a command in the calling task and reply
+//
+// Called by the task that owns the command's queue. The reply context of
+// the command is made visible to "print_reply" through thread local storage.
+//
+void run_command_message(struct cmd_message_s *cmd)
+{
+error_codes_te          status;
+bool                    reply_done;
+void                    *old_context;
+
+    old_context = pvTaskGetThreadLocalStoragePointer(NULL, REPLY_CONTEXT_TLS_INDEX);
+    vTaskSetThreadLocalStoragePointer(NULL, REPLY_CONTEXT_TLS_INDEX, &cmd->reply);
+    reply_done = false;
+    status = cmd_dispatch[cmd->token].handler(cmd, &reply_done);
+    if (reply_done == false) {
+        print_error(cmd->int_parameters[PORT_INDEX], status);
+    }
+    vTaskSetThreadLocalStoragePointer(NULL, REPLY_CONTEXT_TLS_INDEX, old_context);
+}
+
+//***************************************************************************
+// make_move_sync : convert a move into its SYNC form (atomic command lines)
+//
+static void make_move_sync(int32_t token)
+{
+    if (token == TOKENIZER_SERVO) {
+        if (int_parameters[SERVO_SUB_CMD_INDEX] == ABS_MOVE) {
+            int_parameters[SERVO_SUB_CMD_INDEX] = ABS_MOVE_SYNC;
+        } else if (int_parameters[SERVO_SUB_CMD_INDEX] == SPEED_MOVE) {
+            int_parameters[SERVO_SUB_CMD_INDEX] = SPEED_MOVE_SYNC;
+        } else if (int_parameters[SERVO_SUB_CMD_INDEX] == PROFILE_MOVE) {
+            int_parameters[SERVO_SUB_CMD_INDEX] = PROFILE_MOVE_SYNC;
+        } else if (int_parameters[SERVO_SUB_CMD_INDEX] == SPLINE_MOVE) {
+            int_parameters[SERVO_SUB_CMD_INDEX] = SPLINE_MOVE_SYNC;
+        }
+    } else if (token == TOKENIZER_STEPPER) {
+        if (int_parameters[STEP_MOTOR_SUB_CMD_INDEX] == SM_REL_MOVE) {
+            int_parameters[STEP_MOTOR_SUB_CMD_INDEX] = SM_REL_MOVE_SYNC;
+        } else if (int_parameters[STEP_MOTOR_SUB_CMD_INDEX] == SM_ABS_MOVE) {
+            int_parameters[STEP_MOTOR_SUB_CMD_INDEX] = SM_ABS_MOVE_SYNC;
         }
     }
 }
 
 //***************************************************************************
-// parse_command : analyse command string and convert into labelled strings
+// execute_command : check parameters and pass command to its subsystem
 //
-// Breaks the command string into a set of token strings that are 
-// labelled REAL, INTEGER or STRING.  
+static void execute_command(int32_t token)
+{
+error_codes_te          status;
+struct cmd_message_s    cmd;
+cmd_queue_te            queue;
+
+    status = check_command(token);
+    if (status != OK) {
+        print_error(int_parameters[PORT_INDEX], status);
+        return;
+    }
+    cmd.token = token;
+    cmd.argc  = argc;
+    cmd.stage = 0;
+    cmd.seq_id = sequence_id;
+    cmd.string[0] = STRING_NULL;
+    for (uint32_t i = 0; i < argc; i++) {
+        cmd.int_parameters[i] = int_parameters[i];
+        if ((arg_type[i] == MODE_S) && (cmd.string[0] == STRING_NULL)) {
+            strncpy(cmd.string, &command[arg_pt[i]], (MAX_GEN4_uLCD_WRITE_STR_SIZE - 1));
+            cmd.string[MAX_GEN4_uLCD_WRITE_STR_SIZE - 1] = STRING_NULL;
+        }
+    }
+    cmd.reply = reply_context;
+
+    queue = cmd_dispatch[token].queue;
+    if (schedule_time != 0) {
+        if (queue == CMD_QUEUE_NONE) {
+            status = SCHEDULE_NOT_ALLOWED;
+        } else {
+            cmd.reply.transport = TRANSPORT_NONE;   // reply now, run silently later
+            cmd.reply.batch = NULL;
+            status = schedule_command(queue, &cmd, schedule_time);
+        }
+        print_error(int_parameters[PORT_INDEX], status);
+        return;
+    }
+    if (queue == CMD_QUEUE_NONE) {
+        run_command_message(&cmd);
+        return;
+    }
+    status = post_command(queue, &cmd);
+    if (status != OK) {
+        print_error(int_parameters[PORT_INDEX], status);
+    }
+}
+
+//***************************************************************************
+// release_atomic_moves : queue a silent sync at the end of an atomic line
+//
+static void release_atomic_moves(void)
+{
+struct cmd_message_s    cmd;
+
+    cmd.token = TOKENIZER_SYNC;
+    cmd.argc  = 2;
+    cmd.stage = 0;
+    cmd.seq_id = 0;
+    cmd.string[0] = STRING_NULL;
+    cmd.int_parameters[PRIMARY_CMD_INDEX] = TOKENIZER_SYNC;
+    cmd.int_parameters[PORT_INDEX] = UNDEFINED_PORT;
+    cmd.reply.transport = TRANSPORT_NONE;
+    cmd.reply.batch = NULL;
+    post_command(cmd_dispatch[TOKENIZER_SYNC].queue, &cmd);
+}
+
+//***************************************************************************
+// end_of_line : true if only separators remain on the command line
 //
-// Code uses a STATE MACHINE to walkthrough the command string.  Refer
-// to associated documentation.  
+static bool end_of_line(uint32_t index)
+{
+    while (char_type[(uint8_t)command[index]] == SEPARATOR) {
+        index++;
+    }
+    return (char_type[(uint8_t)command[index]] == END);
+}
+
+//***************************************************************************
+// read_sequence_id : read an optional "#id" in front of a command
 //
-// defines modes as scan progresses : U=undefined, I=integer, R=real, S=string
+// Returns 0 if there is no ID. The index is moved past the ID.
 //
+static uint32_t read_sequence_id(uint32_t *index)
+{
+uint32_t    i, seq_id;
+
+    i = *index;
+    while (char_type[(uint8_t)command[i]] == SEPARATOR) {
+        i++;
+    }
+    if (command[i] != SEQUENCE_PREFIX) {
+        return 0;
+    }
+    i++;
+    seq_id = 0;
+    while (char_type[(uint8_t)command[i]] == NUMBER) {
+        seq_id = (seq_id * 10) + (command[i++] - '0');
+    }
+    *index = i;
+    return seq_id;
+}
 
-error_codes_te parse_command (void) 
+//***************************************************************************
+// read_schedule_time : read an optional "@t" or "@+t" in front of a command
+//
+// "t" is device time in uS since boot, "+t" is uS after the line was read.
+// Returns 0 if there is no time. The index is moved past the time.
+//
+static uint64_t read_schedule_time(uint32_t *index)
 {
-int32_t     count, mode, status;
+uint32_t    i;
+uint64_t    time;
+bool        relative;
+
+    i = *index;
+    while (char_type[(uint8_t)command[i]] == SEPARATOR) {
+        i++;
+    }
+    if (command[i] != SCHEDULE_PREFIX) {
+        return 0;
+    }
+    i++;
+    relative = false;
+    if (command[i] == RELATIVE_TIME_PREFIX) {
+        relative = true;
+        i++;
+    }
+    time = 0;
+    while (char_type[(uint8_t)command[i]] == NUMBER) {
+        time = (time * 10) + (command[i++] - '0');
+    }
+    *index = i;
+    if (relative == true) {
+        time += line_time;
+    }
+    return time;
+}
+
+//***************************************************************************
+// run_command_line : parse a line of one or more ';' separated commands
+//
+// A line with more than one command gets a single reply line with the
+// individual replies separated by ';' (see "print_reply"). A line starting
+// with ATOMIC_PREFIX turns all its moves into SYNC moves which are released
+// together once every command on the line has been queued. Any command may
+// start with "#id" to get a "done id status" line when its move ends,
+// and then "@t" to run it at a given device time (not on atomic lines).
+//
+static void run_command_line(void)
+{
+error_codes_te          status;
+int32_t                 token, slot;
+uint32_t                cmd_start, nos_cmds;
+bool                    atomic;
+struct reply_batch_s    *batch;
+
+    atomic = false;
+    cmd_start = 0;
+    if (command[0] == ATOMIC_PREFIX) {
+        atomic = true;
+        cmd_start = 1;
+    }
+    batch = NULL;
+    reply_context.batch = NULL;
+    nos_cmds = 0;
+    do {
+        sequence_id = read_sequence_id(&cmd_start);
+        schedule_time = read_schedule_time(&cmd_start);
+        status = parse_command(&cmd_start);
+        if ((status == OK) && (atomic == true) && (schedule_time != 0)) {
+            status = SCHEDULE_NOT_ALLOWED;
+        }
+        if ((nos_cmds++ == 0) && ((atomic == true) || (cmd_start != 0))) {
+            batch = begin_reply_batch();
+        }
+        if (batch != NULL) {
+            slot = add_reply_batch_slot(batch);
+            if (slot < 0) {
+                break;      // reply slots used up : ignore rest of line
+            }
+            reply_context.batch = batch;
+            reply_context.batch_slot = slot;
+            if ((cmd_start != 0) && (slot == (MAX_CMDS_PER_LINE - 1))) {
+                status = TOO_MANY_COMMANDS;
+                cmd_start = 0;
+            }
+        }
+        if (status != OK) {
+            print_error(UNDEFINED_PORT, status);
+            continue;
+        }
+        token = string_to_token(commands, &command[arg_pt[0]]);
+        if (atomic == true) {
+            make_move_sync(token);
+        }
+        execute_command(token);
+    } while ((cmd_start != 0) && (end_of_line(cmd_start) == false));
+
+    if (atomic == true) {
+        release_atomic_moves();
+    }
+    if (batch != NULL) {
+        end_reply_batch(batch);
+    }
+    reply_context.batch = NULL;
+}
+
+//***************************************************************************
+// Get, parse, and execute UART received command
+
+void Task_run_cmd(void *p) 
+{
+error_codes_te          status;
+static int32_t          token;
+EventBits_t             event_bits;
+
+    vTaskSetThreadLocalStoragePointer(NULL, REPLY_CONTEXT_TLS_INDEX, &reply_context);
+    status = OK;
+    FOREVER {
+        event_bits = xEventGroupWaitBits(eventgroup_uart_IO,
+                                         ((1 << LINE_AVAILABLE) | (1 << FRAME_AVAILABLE)),
+                                         pdFALSE,       // bits cleared by reader
+                                         pdFALSE,       // either transport
+                                         portMAX_DELAY);
+        if (event_bits & (1 << FRAME_AVAILABLE)) {
+            line_time = time_us_64();
+            sequence_id = 0;
+            schedule_time = 0;
+            status = read_binary_command(&token);
+            if (status != OK) {
+                print_error(int_parameters[PORT_INDEX], status);
+                continue;
+            }
+            execute_command(token);
+        } else {
+            reply_context.transport = TRANSPORT_ASCII;
+            reply_context.batch = NULL;
+            character_count = uart_readline(command);
+            line_time = time_us_64();
+            run_command_line();
+        }
+    }
+}
+
+//***************************************************************************
+// parse_command : analyse command string and convert arguments
+//
+// Single pass over the command string driven by "lexer_table[mode][char type]"
+// (rom_data.c). Each argument is labelled WORD, INTEGER, REAL or STRING
+// and numbers are converted as the digits are scanned; reals are held as
+// an integer plus a count of fractional digits until the argument ends.
+// Scan stops at the first error, at the END character or at a ';'
+// command separator. "cmd_start" gives the scan start and is returned as
+// the start of the next command on the line, or 0 if there is none.
+// A number whose digits (fraction included) overflow an int32_t is
+// rejected with PARAMETER_OUTWITH_LIMITS.
+//
+// modes as scan progresses : U=undefined, I=integer, R=real, W=word, S=string
+//
+
+static const int32_t power_of_10[MAX_FRACTION_DIGITS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+error_codes_te parse_command (uint32_t *cmd_start) 
+{
+uint32_t    count, mode, fraction_digits;
+int32_t     value;
+bool        negative;
 uint8_t     character_type;
+const struct lexer_entry_s  *transition;
 
     argc = 0;
     mode = MODE_U;
-    status = OK;
-    for (count=0 ; count <= character_count ; count++) {
-        character_type = char_type[command[count]];
-        switch (character_type) {
-            case LETTER :
-                switch(mode) {
-                    case MODE_U :
-                        mode = MODE_W;
-                        arg_pt[argc] = count;
-                        break;
-                    case MODE_I :
-                    case MODE_R :
-                        status = LETTER_ERROR;
-                        break;
-                    case MODE_W :   
-                    case MODE_S :
-                        break;
-                }
+    value = 0;
+    negative = false;
+    fraction_digits = 0;
+    count = *cmd_start;
+    *cmd_start = 0;
+    for ( ; count <= character_count ; count++) {
+        character_type = char_type[(uint8_t)command[count]];
+        transition = &lexer_table[mode][character_type];
+        switch (transition->action) {
+            case LEX_NONE :
                 break;
 
-            case QUOTE :
-                switch(mode) {
-                    case MODE_U :
-                        mode = MODE_S;
-                        arg_pt[argc] = count + 1;   // skip '"' character
-                        break;
-                    case MODE_I :
-                    case MODE_R :
-                    case MODE_W :
-                        status = QUOTE_ERROR;
-                        break;
-                    case MODE_S :   // end of string
-                        arg_type[argc++] = MODE_S;
-                        command[count] = STRING_NULL;  // put terminator on string
-                        mode = MODE_U;
-                        break;
+            case LEX_START_WORD :
+            case LEX_START_NUMBER :
+            case LEX_START_STRING :
+                if (argc >= MAX_ARGC) {
+                    return BAD_NOS_PARAMETERS;
                 }
-                break;
-
-            case NUMBER :
-                switch(mode) {
-                    case MODE_U :
-                        mode = MODE_I;
-                        arg_pt[argc] = count;
-                        break;
-                    case MODE_I :
-                    case MODE_R :
-                    case MODE_W :
-                    case MODE_S :
-                        break;
+                arg_pt[argc] = count;
+                if (transition->action == LEX_START_STRING) {
+                    arg_pt[argc] = count + 1;   // skip '"' character
+                }
+                value = 0;
+                fraction_digits = 0;
+                negative = (command[count] == MINUS);
+                if (character_type == NUMBER) {
+                    value = command[count] - CHAR_0;
                 }
                 break;
 
-            case SEPARATOR :
-                switch(mode) {
-                    case MODE_U :
-                    case MODE_S :
-                        break;
-                    case MODE_W :
-                    case MODE_I :
-                    case MODE_R :
-                        arg_type[argc++] = mode;
-                        command[count] = STRING_NULL;
-                        mode = MODE_U;
-                        break;
+            case LEX_DIGIT :
+                if (value > ((INT32_MAX - (command[count] - CHAR_0)) / 10)) {
+                    return PARAMETER_OUTWITH_LIMITS;    // number too long for int32_t
                 }
+                value = (value * 10) + (command[count] - CHAR_0);
                 break;
 
-            case DOT :
-                switch(mode) {
-                    case MODE_I :
-                        mode = MODE_R;
-                    case MODE_R :
-                    case MODE_U :
-                        status = DOT_ERROR;  // extra point in real value
-                    case MODE_W :
-                    case MODE_S :
-                        break;
-                }
+            case LEX_POINT :
+                fraction_digits = 0;
                 break;
 
-            case PLUSMINUS :
-                switch(mode) {
-                    case MODE_U :
-                        mode = MODE_I;
-                        arg_pt[argc] = count;
-                        break;
-                    case MODE_I :
-                    case MODE_R :
-                        status = PLUSMINUS_ERROR;
-                        break;
-                    case MODE_W :
-                    case MODE_S :
-                        break;
+            case LEX_FRACTION_DIGIT :
+                if (fraction_digits < MAX_FRACTION_DIGITS) {
+                    if (value > ((INT32_MAX - (command[count] - CHAR_0)) / 10)) {
+                        return PARAMETER_OUTWITH_LIMITS;
+                    }
+                    value = (value * 10) + (command[count] - CHAR_0);
+                    fraction_digits++;
                 }
                 break;
 
-            case END :
-                switch(mode) {
-                    case MODE_U :
-                        break;
-                    case MODE_I :
-                    case MODE_R :
-                    case MODE_W :
-                    case MODE_S :
-                        arg_type[argc++] = mode;
-                        return status;
-                        break;
+            case LEX_END_ARG :
+            case LEX_END_LINE :
+            case LEX_END_COMMAND :
+                if (mode != MODE_U) {
+                    if (negative == true) {
+                        value = -value;
+                    }
+                    if (mode == MODE_I) {
+                        int_parameters[argc] = value;
+                    } else if (mode == MODE_R) {
+                        int_parameters[argc] = value / power_of_10[fraction_digits];
+                    }
+                    arg_type[argc++] = mode;
+                    command[count] = STRING_NULL;  // terminate argument string
                 }
-                break;
-        }   // end of SWITCH
-    }  // end of FOR
-    return status;
-}
+                if (transition->action == LEX_END_ARG) {
+                    break;
+                }
+                if (transition->action == LEX_END_COMMAND) {
+                    *cmd_start = count + 1;     // next command on this line
+                }
+                if ((argc == 0) || (arg_type[0] != MODE_W)) {
+                    return BAD_COMMAND;
+                }
+                return OK;
 
-//***************************************************************************
-// convert_tokens : convert relevant tokens to numerical values
-//
-error_codes_te convert_tokens(void) 
-{
-    if ((arg_type[0] != MODE_W) || (char_type[command[0]] != LETTER)) {
-        return BAD_COMMAND;
-    }
-    for (uint32_t i=0 ; i <= argc ; i++) {
-        switch (arg_type[i]) {
-            case MODE_I :  // save as integer and float
-                int_parameters[i] = ASCII_to_int(&command[arg_pt[i]]);
-                float_parameters[i] = (float)int_parameters[i];
-                break;
-            case MODE_R :
-                float_parameters[i] = ASCII_to_float(&command[arg_pt[i]]);
-                break;
+            case LEX_LETTER_ERROR :
+                return LETTER_ERROR;
+            case LEX_DOT_ERROR :
+                return DOT_ERROR;
+            case LEX_PLUSMINUS_ERROR :
+                return PLUSMINUS_ERROR;
+            case LEX_QUOTE_ERROR :
+                return QUOTE_ERROR;
         }
+        mode = transition->next_mode;
     }
-    return OK;
+    return BAD_COMMAND;     // no END character
 }
 
 //***************************************************************************
 error_codes_te check_command(int32_t cmd_token)
+{
+    return check_limits(cmd_token, argc, int_parameters, arg_type);
+}
+
+//***************************************************************************
+// check_limits : test argument count, port and parameters against "cmd_limits"
+//
+// "types" gives the parsed mode of each argument, NULL if all are integers.
+// Reals are checked by their truncated value, which is the value a handler
+// sees in "int_parameters[]", so a real cannot slip past an index limit.
+//
+static error_codes_te check_limits(int32_t cmd_token, uint32_t nos_args, const int32_t *parameters, const uint32_t *types)
 {
 error_codes_te status;
 uint32_t i, span;
 
     status = OK;
 
-    if ((argc < cmd_limits[cmd_token].p_limits[0].parameter_min) || 
-                (argc > cmd_limits[cmd_token].p_limits[0].parameter_max)) {
+    if ((cmd_token < 0) || (cmd_token >= NOS_COMMANDS)) {
+        return BAD_COMMAND;
+    }
+    if ((nos_args < cmd_limits[cmd_token].p_limits[0].parameter_min) || 
+                (nos_args > cmd_limits[cmd_token].p_limits[0].parameter_max)) {
         status = BAD_NOS_PARAMETERS;
-    } else if ((int_parameters[1] < cmd_limits[cmd_token].p_limits[1].parameter_min) || 
-                (int_parameters[1] > cmd_limits[cmd_token].p_limits[1].parameter_max)) {
+    } else if ((parameters[1] < cmd_limits[cmd_token].p_limits[1].parameter_min) || 
+                (parameters[1] > cmd_limits[cmd_token].p_limits[1].parameter_max)) {
         status = BAD_PORT_NUMBER;
     } else {
-        for (i = 2 ; i<argc ; i++) {
-            if (arg_type[i] == MODE_I) {
+        for (i = 2 ; i<nos_args ; i++) {
+            if ((types == NULL) || (types[i] == MODE_I) || (types[i] == MODE_R)) {
                 span = cmd_limits[cmd_token].p_limits[i].parameter_min + cmd_limits[cmd_token].p_limits[i].parameter_max;
                 if (span == 0) {
                     continue;       // ignore check for this parameter
                 }
-                if ((int_parameters[i] < cmd_limits[cmd_token].p_limits[i].parameter_min) || 
-                              (int_parameters[i] > cmd_limits[cmd_token].p_limits[i].parameter_max)) {
+                if ((parameters[i] < cmd_limits[cmd_token].p_limits[i].parameter_min) || 
+                              (parameters[i] > cmd_limits[cmd_token].p_limits[i].parameter_max)) {
                     status = PARAMETER_OUTWITH_LIMITS;
                     break;
                 }
@@ -629,3 +1290,54 @@ uint32_t i, span;
 
 
 
+
+//***************************************************************************
+// read_binary_command : load a binary frame into the parsed data slots
+//
+// Opcode is a TOKENIZER_* value. Port and parameters are loaded into
+// int_parameters[] exactly as "parse_command" would for an ASCII
+// command so that "check_command" and the handlers are shared.
+//
+error_codes_te read_binary_command(int32_t *cmd_token)
+{
+uint8_t                 frame[MAX_FRAME_SIZE];
+uint32_t                frame_length;
+struct binary_command_s bin_cmd;
+error_codes_te          status;
+
+    reply_context.transport = TRANSPORT_BINARY;
+    reply_context.batch     = NULL;
+    reply_context.opcode    = TOKENIZER_ERROR;
+    reply_context.sequence  = 0;
+    int_parameters[PORT_INDEX] = UNDEFINED_PORT;
+
+    frame_length = uart_read_frame(frame);
+    if (frame_length == 0) {
+        return BAD_FRAME_LENGTH;
+    }
+    status = binary_unpack_frame(frame, frame_length, &bin_cmd);
+    reply_context.opcode   = bin_cmd.opcode;
+    reply_context.sequence = bin_cmd.sequence;
+    int_parameters[PORT_INDEX] = bin_cmd.port;
+    if (status != OK) {
+        return status;
+    }
+    if (bin_cmd.opcode >= NOS_COMMANDS) {
+        return BAD_COMMAND;
+    }
+
+    command[0] = STRING_NULL;       // no string arguments in binary frames
+    argc = bin_cmd.nos_parameters + 2;
+    arg_pt[0] = 0;
+    arg_type[0] = MODE_W;
+    int_parameters[0] = bin_cmd.opcode;
+    arg_pt[PORT_INDEX] = 0;
+    arg_type[PORT_INDEX] = MODE_I;
+    for (uint32_t i = 0; i < bin_cmd.nos_parameters; i++) {
+        arg_pt[i + 2] = 0;
+        arg_type[i + 2] = MODE_I;
+        int_parameters[i + 2] = bin_cmd.parameters[i];
+    }
+    *cmd_token = bin_cmd.opcode;
+    return OK;
+}
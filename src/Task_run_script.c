@@ -0,0 +1,33 @@
+/**
+ * @file Task_run_script.c
+ * @author Jim Herd
+ * @brief Run "script" commands and step the running scripts
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "system.h"
+#include "externs.h"
+#include "sys_routines.h"
+#include "cmd_queues.h"
+#include "scripts.h"
+
+#include "pico/stdlib.h"
+
+#include "FreeRTOS.h"
+
+void Task_run_script(void *p) 
+{
+TickType_t  wait_ticks;
+uint32_t    start_time, end_time;
+
+    init_scripts();
+    wait_ticks = portMAX_DELAY;
+    FOREVER {       // wake for a script command or when a script is due to run
+        receive_command(CMD_QUEUE_SCRIPT, wait_ticks);
+        start_time = time_us_32();
+        wait_ticks = run_scripts();
+        end_time = time_us_32();
+        update_task_execution_time(TASK_RUN_SCRIPT, start_time, end_time);
+    }
+}
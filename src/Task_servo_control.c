@@ -11,6 +11,8 @@
 #include "uart_IO.h"
 #include "sys_routines.h"
 #include "PCA9685.h"
+#include "trajectory.h"
+#include "cmd_queues.h"
 
 #include  "Pico_IO.h"
 
@@ -19,15 +21,89 @@
 
 #include "FreeRTOS.h"
 
+#if ((TASK_SERVO_CONTROL_FREQUENCY % 10) != 0) || (TASK_SERVO_CONTROL_FREQUENCY > PCA9685_servo_frequency)
+    #error "Servo task rate must be a multiple of 10Hz and no faster than the PWM frame rate"
+#endif
+
+//==============================================================================
+/**
+ * @brief Run one servo task tick for one servo
+ * 
+ * @param servo_no 
+ * @note
+ *      Separate from the task loop so that moves can be stepped through 
+ *      tick by tick, e.g. by a host simulation of the servo task.
+ */
+void servo_tick(uint32_t servo_no)
+{
+struct servo_data_s  *servo_data_pt;
+int32_t     delta_angle, travel_time_count;
+q16_t       fixed_angle;
+
+    servo_data_pt = &servo_data[servo_no];
+    switch (servo_data_pt->state) {
+        case DISABLED :
+            PCA9685_set_zero(servo_no);    
+            break;
+        case DORMANT :
+            break;        // do nothing
+        case DELAY :
+            servo_data_pt->counter--;   // count down for delay
+            if (servo_data_pt->counter == 0) {
+                servo_data_pt->state = DORMANT;
+            }
+            break;
+        case MOVE :
+            if (servo_data_pt->sync == true) {
+                break;
+            }
+            delta_angle = servo_data_pt->angle_target - servo_data_pt->angle;
+            PCA9685_set_servo(servo_no, servo_data_pt->angle_target);
+            if (servo_data_pt->state != MOVE) {
+                break;      // MOTOR stopped
+            }
+            travel_time_count = ((abs(delta_angle) * servo_data_pt->mS_per_degree) / TASK_SERVO_CONTROL_FREQUENCY_TICK_COUNT) + 1;
+            servo_data_pt->counter = travel_time_count; 
+            servo_data_pt->gradient = (delta_angle == 0) ? 0 : q16_ratio(delta_angle, travel_time_count);  // estimated slew
+            servo_data_pt->state = DELAY;
+            break;
+        case TIMED_MOVE :
+            if (servo_data_pt->sync == true) {
+                break;
+            }
+            if (servo_data_pt->counter == servo_data_pt->t_end) {
+                servo_data_pt->state = DORMANT;
+                PCA9685_set_servo(servo_no, servo_data_pt->angle_target);   // end exactly on target
+            } else {
+                fixed_angle = q16_mul_int(servo_data_pt->gradient, servo_data_pt->counter) + servo_data_pt->y_intercept;
+                PCA9685_set_servo_fixed(servo_no, fixed_angle);     // one rounding, not two truncations
+                servo_data_pt->counter++;
+            }
+            break;
+        case TRAJECTORY_MOVE :
+            if (servo_data_pt->sync == true) {
+                break;
+            }
+            if (trajectory_step(&servo_data_pt->trajectory, &fixed_angle) == true) {
+                servo_data_pt->state = DORMANT;
+            }
+            PCA9685_set_servo_fixed(servo_no, fixed_angle);
+            break;
+        default :
+            break;
+    }
+    if ((servo_data_pt->state == DORMANT) || (servo_data_pt->state == DISABLED)) {
+        print_move_done(&servo_data_pt->seq_id, OK);   // no-op if no "#id" : MOTOR at 0 ends DISABLED
+    }
+}
+
+//==============================================================================
 void Task_servo_control(void *p) {
 
 TickType_t  xLastWakeTime;
 BaseType_t  xWasDelayed;
 uint32_t    start_time, end_time;
 uint32_t    sample_count;
-int32_t     angle, delta_angle, travel_time_count;
-
-servo_states_te      RC_state;
 
     init_PCA9685_servo_IO();
     for (uint8_t i = 0; i < NOS_SERVOS ; i++) {
@@ -44,45 +120,13 @@ servo_states_te      RC_state;
         //START_PULSE;
         start_time = time_us_32();
         sample_count++;
+        while (receive_command(CMD_QUEUE_SERVO, 0) == true) {
+            ;       // apply any new servo commands before this update
+        }
         for (uint32_t i = 0; i < NOS_SERVOS; i++) {
-            switch (servo_data[i].state) {
-                case DISABLED :
-                    PCA9685_set_zero(i);    
-                    break;
-                case DORMANT :
-                    break;        // do nothing
-                case DELAY :
-                    servo_data[i].counter--;   // count down for delay
-                    if (servo_data[i].counter == 0) {
-                        servo_data[i].state = DORMANT;
-                    }
-                    break;
-                case MOVE :
-                    if (servo_data[i].sync == true) {
-                        break;
-                    }
-                    PCA9685_set_servo(i, servo_data[i].angle);
-                    delta_angle = abs(servo_data[i].angle - servo_data[i].angle_target);
-                    travel_time_count = ((delta_angle * servo_data[i].mS_per_degree) / TASK_SERVO_CONTROL_FREQUENCY_TICK_COUNT) + 1;
-                    servo_data[i].counter = travel_time_count; 
-                    servo_data[i].state = DELAY;
-                    break;
-                case TIMED_MOVE :
-                    if (servo_data[i].sync == true) {
-                        break;
-                    }
-                    if (servo_data[i].counter == servo_data[i].t_end) {
-                        servo_data[i].state = DORMANT;
-                    } else {
-                        angle = (int32_t)(servo_data[i].gradient * (float)servo_data[i].counter) + servo_data[i].y_intercept;
-                        PCA9685_set_servo(i, angle);
-                        servo_data[i].counter++;
-                    }
-                    break;
-                default :
-                    break;
-            }
+            servo_tick(i);
         }
+        PCA9685_flush();        // one I2C burst per run of changed channels
 
         end_time = time_us_32();
         update_task_execution_time(TASK_SERVO_CONTROL, start_time, end_time);   
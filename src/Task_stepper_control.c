@@ -8,19 +8,25 @@
 
 #include "system.h"
 #include "externs.h"
+#include "cmd_queues.h"
+#include "sys_routines.h"
+#include "stepper_pio.h"
+#include "stepper_queue.h"
 
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
+#include "hardware/timer.h"
 
 #include "FreeRTOS.h"
+#include "task.h"
 
 //==============================================================================
 // Global data
 //==============================================================================
 
 struct stepper_data_s     stepper_data[NOS_STEPPERS] = {
-     {200, 5, 2, 0, GP17, GP16, GP19, GP18, CLOCKWISE, false, 160, false, 2000, -30, +30, 0,0, OK, STATE_SM_DORMANT,0,0,0,0,0,0}
-//    {200, 1, 2, 0, GP17, GP16, GP19, GP18, CLOCKWISE, true, 100, false, 200, -30, +30, 0,0, OK, STATE_SM_DORMANT,0,0,0,0,0,0}
+     {200, 5, 2, 0, GP17, GP16, GP19, GP18, CLOCKWISE, false, 160, 1000, 4000, 40000, 500, 100, 20, false, 2000, -30, +30, 0, false, OK, STATE_SM_DORMANT,0,0,0}
+//    {200, 1, 2, 0, GP17, GP16, GP19, GP18, CLOCKWISE, true, 100, 1000, 4000, 40000, 500, 100, 20, false, 200, -30, +30, 0, false, OK, STATE_SM_DORMANT,0,0,0}
 };
 
 //==============================================================================
@@ -33,251 +39,470 @@ void do_step(uint32_t stepper_id);
 void set_SM_direction(uint32_t stepper_id, sm_direction direction);
 void  init_stepper_motor_data(void);
 
-struct repeating_timer timer;
+//==============================================================================
+// Deadline heap : steppers waiting for service, soonest first
+//==============================================================================
+
+static uint32_t     stepper_heap[NOS_STEPPERS];
+static uint32_t     heap_size;
+static int32_t      heap_position[NOS_STEPPERS];    // -1 = not waiting
+static uint64_t     stepper_deadline[NOS_STEPPERS]; // uS since boot
+static uint32_t     stepper_alarm;
+
+static void heap_swap(uint32_t a, uint32_t b)
+{
+uint32_t    temp;
+
+    temp = stepper_heap[a];
+    stepper_heap[a] = stepper_heap[b];
+    stepper_heap[b] = temp;
+    heap_position[stepper_heap[a]] = a;
+    heap_position[stepper_heap[b]] = b;
+}
+
+static void heap_sift_up(uint32_t pos)
+{
+    while ((pos > 0) && (stepper_deadline[stepper_heap[pos]] < stepper_deadline[stepper_heap[(pos - 1) / 2]])) {
+        heap_swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void heap_sift_down(uint32_t pos)
+{
+uint32_t    child;
+
+    FOREVER {
+        child = (2 * pos) + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (((child + 1) < heap_size) && (stepper_deadline[stepper_heap[child + 1]] < stepper_deadline[stepper_heap[child]])) {
+            child++;
+        }
+        if (stepper_deadline[stepper_heap[pos]] <= stepper_deadline[stepper_heap[child]]) {
+            break;
+        }
+        heap_swap(pos, child);
+        pos = child;
+    }
+}
+
+/**
+ * @brief set (or move) the deadline of a stepper (interrupts off)
+ */
+static void heap_schedule(uint32_t stepper_no, uint64_t deadline)
+{
+    stepper_deadline[stepper_no] = deadline;
+    if (heap_position[stepper_no] < 0) {
+        stepper_heap[heap_size] = stepper_no;
+        heap_position[stepper_no] = heap_size;
+        heap_size++;
+    }
+    heap_sift_up(heap_position[stepper_no]);
+    heap_sift_down(heap_position[stepper_no]);
+}
+
+/**
+ * @brief remove and return the stepper with the soonest deadline (interrupts off)
+ */
+static uint32_t heap_pop(void)
+{
+uint32_t    stepper_no;
+
+    stepper_no = stepper_heap[0];
+    heap_size--;
+    if (heap_size != 0) {
+        heap_swap(0, heap_size);
+        heap_sift_down(0);
+    }
+    heap_position[stepper_no] = -1;
+    return stepper_no;
+}
+
+/**
+ * @brief point the hardware alarm at the soonest deadline (interrupts off)
+ * 
+ * @note    No alarm is set, and so no interrupts occur, when no stepper
+ *          is waiting.
+ */
+static void set_stepper_alarm(void)
+{
+    if (heap_size == 0) {
+        hardware_alarm_cancel(stepper_alarm);
+        return;
+    }
+    if (hardware_alarm_set_target(stepper_alarm, from_us_since_boot(stepper_deadline[stepper_heap[0]])) == true) {
+        hardware_alarm_force_irq(stepper_alarm);     // already due
+    }
+}
 
 //==============================================================================
 //==============================================================================
 // Interrupt routines
 /**
- * @brief regular timer interrupt to manage stepper motors
+ * @brief limit switches now closed, as latch bits (move start)
  * 
- * @param t         Pointer to timer structure
- * @return true 
- * @return false 
+ * @note    Edges are caught by "limit_switch_callback", but a switch
+ *          already closed when a move starts gives no edge.
+ */
+static uint32_t limit_switch_levels(struct stepper_data_s *sm_ptr)
+{
+uint32_t        latch;
+
+    latch = 0;
+    if (gpio_get(sm_ptr->L_limit_pin) == ASSERTED_LOW) {
+        latch |= L_LIMIT_LATCH;
+    }
+    if (gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW) {
+        latch |= R_LIMIT_LATCH;
+    }
+    return latch;
+}
+
+/**
+ * @brief start all steppers of a coordinated move together
+ * 
+ * @note    DMA channels of the group are started by a single register
+ *          write, so the PIO state machines get their first segments
+ *          within a few cycles of each other.
+ */
+static void start_coordinated_moves(void)
+{
+struct stepper_data_s  *sm_ptr;
+uint32_t        stepper_mask;
+
+    stepper_mask = 0;
+    for (uint32_t i=0; i<NOS_STEPPERS; i++) {
+        sm_ptr = &stepper_data[i];
+        if ((sm_ptr->coordinated == false) || (sm_ptr->state != STATE_SM_INIT)) {
+            continue;
+        }
+        sm_ptr->coordinated = false;
+        if (sm_ptr->calibrated == false) {
+            sm_ptr->error = MOVE_ON_UNCALIBRATED_MOTOR;
+            sm_ptr->state = STATE_SM_FAULT;
+            continue;
+        }
+        sm_ptr->limit_latch = 0;
+        if (limit_switch_levels(sm_ptr) != 0) {
+            sm_ptr->calibrated = false;
+            sm_ptr->error = LIMIT_SWITCH_ERROR;
+            sm_ptr->state = STATE_SM_FAULT;
+            continue;
+        }
+        stepper_mask |= (1u << i);
+        sm_ptr->state = STATE_SM_RUNNING;
+    }
+    stepper_pio_start_group(stepper_mask);
+}
+
+/**
+ * @brief Limit switch edge : latch the position, and end a run of moves
+ * 
+ * @note    A run, or a homing move, is halted within microseconds of the
+ *          edge with its step count exact, so "current_step_count" is the
+ *          position at the edge. Single calibration steps are counted when
+ *          made, so only the position is latched and the state machine
+ *          stops. Only the first edge of each switch sets the position, so
+ *          bounce can't move it.
+ */
+static void limit_switch_callback(uint gpio, uint32_t events)
+{
+UBaseType_t     saved_state;
+struct stepper_data_s  *sm_ptr;
+uint32_t        latch;
+
+    saved_state = taskENTER_CRITICAL_FROM_ISR();
+    for (uint32_t i=0; i<NOS_STEPPERS; i++) {
+        sm_ptr = &stepper_data[i];
+        if (gpio == sm_ptr->L_limit_pin) {
+            latch = L_LIMIT_LATCH;
+        } else if (gpio == sm_ptr->R_limit_pin) {
+            latch = R_LIMIT_LATCH;
+        } else {
+            continue;
+        }
+        if ((sm_ptr->limit_latch & latch) == 0) {
+            if (sm_ptr->state == STATE_SM_RUNNING) {
+                sm_ptr->current_step_count += stepper_pio_halt(i);
+                sm_ptr->calibrated = false;         // stopped off its planned path
+                sm_ptr->error = LIMIT_SWITCH_ERROR;   // set before state : read by task
+                sm_ptr->state = STATE_SM_FAULT;
+            } else if (sm_ptr->state == STATE_SM_CALIB_RUN) {
+                sm_ptr->current_step_count += stepper_pio_halt(i);
+                sm_ptr->state = STATE_SM_CALIB_EDGE;
+            }
+            sm_ptr->limit_step_count = sm_ptr->current_step_count;
+        }
+        sm_ptr->limit_latch |= latch;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved_state);
+}
+
+/**
+ * @brief hand a homing move to the task to load (interrupt context)
+ * 
+ * @param sm_ptr        stepper
+ * @param nos_steps     +ve clockwise
+ * @param home_switch   latch bit of the switch that ends the move (0 = none)
+ * @param speed         speed limit, steps/sec (0 = motor "max_speed")
+ * @param next          state after the move
+ */
+static void start_homing_move(struct stepper_data_s *sm_ptr, int32_t nos_steps, uint32_t home_switch,
+                              int32_t speed, sm_profile_exec_state_te next)
+{
+    sm_ptr->temp_count  = nos_steps;
+    sm_ptr->home_switch = home_switch;
+    sm_ptr->home_speed  = speed;
+    sm_ptr->calib_next  = next;
+    sm_ptr->state       = STATE_SM_CALIB_LOAD;
+}
+
+/**
+ * @brief single steps at "home_slow_speed" until a switch closes
+ * 
+ * @note    Fails if the switch is still closed after the backoff.
+ */
+static void start_homing_steps(uint32_t i, sm_direction direction, uint32_t home_switch,
+                               sm_profile_exec_state_te next)
+{
+struct stepper_data_s  *sm_ptr;
+
+    sm_ptr = &stepper_data[i];
+    sm_ptr->limit_latch = limit_switch_levels(sm_ptr);
+    if ((sm_ptr->limit_latch & home_switch) != 0) {
+        sm_ptr->error = STEPPER_CALIBRATE_FAIL;     // backoff too short
+        sm_ptr->state = STATE_SM_DORMANT;
+        return;
+    }
+    set_SM_direction(i, direction);
+    sm_ptr->temp_count  = (2 * sm_ptr->home_backoff) + 2;     // search limit
+    sm_ptr->home_switch = home_switch;
+    sm_ptr->calib_next  = next;
+    sm_ptr->state       = STATE_SM_CALIB_SLOW;
+}
+
+/**
+ * @brief Mealy state machine to drive a stepper motor
+ * 
+ * @param i         stepper motor
+ * @return uint32_t time (uS) until this stepper next needs service,
+ *                  or STEPPER_IDLE if it is waiting for a command
  * 
  * @notes
  *      
  *  1.  Set error if attempt to move an uncalibrated motor.
- *  2.  Mealy state machine to drive stepper motors
+ *  2.  Steps of moves are timed by the PIO. Service is only needed to
+ *      start a move and see the move finish. Limit switches are watched
+ *      by "limit_switch_callback".
+ *  3.  Calibration homes on each switch with a fast profile move, a
+ *      backoff and slow single steps timed by the service deadline.
+ *      Homing moves are loaded by the task, in state CALIB_LOAD.
  *      
  */
-bool repeating_timer_callback(struct repeating_timer *t) 
+static uint32_t stepper_service(uint32_t i) 
 {
 struct stepper_data_s  *sm_ptr;
-error_codes_te  status;
-
-    // START_PULSE; 
-    for (uint32_t i=0; i<NOS_STEPPERS; i++) {
-        sm_ptr = &stepper_data[i];
-        switch (sm_ptr->state) {
-            case STATE_SM_DORMANT:
-                break;    // do nothing
-            case STATE_SM_SYNC :
-                break;    // hold until run sync command is initiated
-            case STATE_SM_INIT:       // run once at the begining of a sm_profile move
-                if (sm_ptr->calibrated == false) {
-                    sm_ptr->error = MOVE_ON_UNCALIBRATED_MOTOR;
-                    break;
-                }
-                while (sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_command_type  == SM_SKIP) {
-                    sm_ptr->cmd_index++;
-                }
-                if (sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_command_type  == SM_END) {
-                    sm_ptr->state = STATE_SM_DORMANT;
-                    break;    
-                }
-                if (sm_ptr->state == SM_COAST) {
-                    sm_ptr->cmd_step_cnt = sm_ptr->coast_step_count;
-                } else {
-                    sm_ptr->cmd_step_cnt = sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_cmd_step_cnt;
-                }
-                set_SM_direction(i, sm_ptr->direction);
-                sm_ptr->state = STATE_SM_RUNNING;  // update state
-                break;
+uint32_t        next_uS;
 
-            case STATE_SM_RUNNING :
-                if (sm_ptr->calibrated == false) {
-                    sm_ptr->error = MOVE_ON_UNCALIBRATED_MOTOR;
-                    break;
-                }
-        // Check if active delay is complete
-                if (sm_ptr->current_step_delay_count != 0) {
-                    sm_ptr->current_step_delay_count--;  
-                    break;   // delay time incomplete so wait for next timer interrupt
-                }
-        // check if more steps at this speed are required
-                if (sm_ptr->cmd_step_cnt != 0) {
-                // check for unexpected trigerring of a limit switch
-                    if (gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW || gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW) {
-                        sm_ptr->state = STATE_SM_FAULT;   // a limit switch has been activated
-                        sm_ptr->error = LIMIT_SWITCH_ERROR;
-                        break;
-                    }
-                    sm_ptr->current_step_delay_count = sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_delay;
-                    do_step(i);
-                    if (sm_ptr->direction == CLOCKWISE) {
-                        sm_ptr->current_step_count++;
-                    } else {
-                        sm_ptr->current_step_count--;
-                    }
-                    sm_ptr->cmd_step_cnt--; 
-                    break;
-                }
-        // Move onto next command
-            // jump over any SKIP (NOOP) commands
-                sm_ptr->cmd_index++;    // point to next command
-                while (sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_command_type  == SM_SKIP) {
-                    sm_ptr->cmd_index++;
-                }
-            // check for end of profile execution
-                if (sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_command_type  == SM_END) {
-                    sm_ptr->state = STATE_SM_DORMANT;   // stepper motor move complete
-                    break;    
-                }
-            // implement new command
-                if (sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_command_type == SM_COAST) {
-                    sm_ptr->cmd_step_cnt = sm_ptr->coast_step_count;
-                } else {
-                    sm_ptr->cmd_step_cnt = sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_cmd_step_cnt;
-                }
-                // check for unexpected trigerring of a limit switch
-                if (gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW || gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW) {
-                    sm_ptr->state = STATE_SM_FAULT;   // a limit switch has been activated
-                    sm_ptr->error = LIMIT_SWITCH_ERROR;
-                    break;
-                }
-                sm_ptr->current_step_delay_count = sequences[sm_ptr->sm_profile].cmds[sm_ptr->cmd_index].sm_delay;
-                do_step(i);
-                if (sm_ptr->direction == CLOCKWISE) {
-                    sm_ptr->current_step_count++;   
-                } else {
-                    sm_ptr->current_step_count--;
-                }
-                sm_ptr->cmd_step_cnt--; 
-                break;
-            case STATE_SM_UNCALIBRATED :
-                sm_ptr->temp_count = MAX_STEPS;
-                set_SM_direction(i, CLOCKWISE);
-                sm_ptr->state = STATE_SM_CALIB_S0;
-                break;
-            case STATE_SM_CALIB_S0 : // ensure motor is not triggering LEFT limit switch
-                if (gpio_get(sm_ptr->L_limit_pin) == ASSERTED_LOW) {
-                    do_step(i); // and stay in this state until clear of LEFT limit switch
-                    sm_ptr->temp_count--;
-                    if (sm_ptr->temp_count <= 0) {
-                        sm_ptr->error = STEPPER_CALIBRATE_FAIL;
-                        sm_ptr->state = STATE_SM_DORMANT;
-                        break;
-                    }
-                } else {
-                    set_SM_direction(i, ANTI_CLOCKWISE);
-                    sm_ptr->state = STATE_SM_CALIB_S1;
-                }
+    sm_ptr = &stepper_data[i];
+    next_uS = 0;        // transitions run again at once
+    switch (sm_ptr->state) {
+        case STATE_SM_DORMANT:
+            next_uS = STEPPER_IDLE;
+            break;    // do nothing
+        case STATE_SM_SYNC :
+            next_uS = STEPPER_IDLE;
+            break;    // hold until run sync command is initiated
+        case STATE_SM_INIT:       // run once at the begining of a move
+            if (sm_ptr->calibrated == false) {
+                sm_ptr->error = MOVE_ON_UNCALIBRATED_MOTOR;
+                sm_ptr->state = STATE_SM_FAULT;
                 break;
-    // states S1,S2,S3 to move to RIGHT limit
-            case STATE_SM_CALIB_S1 :
-                do_step(i);
-                if (CALIBRATE_SPEED_DELAY != 0) {
-                    sm_ptr->current_step_delay_count = CALIBRATE_SPEED_DELAY;
-                    sm_ptr->state = STATE_SM_CALIB_S2;
-                } else {
-                    sm_ptr->state = STATE_SM_CALIB_S3;
-                }
+            }
+            sm_ptr->limit_latch = 0;
+            if (limit_switch_levels(sm_ptr) != 0) {
+                sm_ptr->calibrated = false;
+                sm_ptr->error = LIMIT_SWITCH_ERROR;
+                sm_ptr->state = STATE_SM_FAULT;
                 break;
-            case STATE_SM_CALIB_S2 :   // delay until next pulse
-                sm_ptr->current_step_delay_count--;
-                if (sm_ptr->current_step_delay_count == 0) {
-                    sm_ptr->state = STATE_SM_CALIB_S3;  // delay complete
-                } 
+            }
+            if (sm_ptr->coordinated == true) {
+                start_coordinated_moves();      // whole group in one go
+                next_uS = STEPPER_POLL_uS;
                 break;
-            case STATE_SM_CALIB_S3 :
-                if(gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW) {  // wrong direction
-                    sm_ptr->state = STATE_SM_CALIB_S1;  // restart calibration
-                    continue;
-                }
-                if (gpio_get(sm_ptr->L_limit_pin) == ASSERTED_LOW) {
-                    sm_ptr->current_step_count = 0;
-                    sm_ptr->temp_count = MAX_STEPS;
-                    set_SM_direction(i, CLOCKWISE);
-                    sm_ptr->state = STATE_SM_CALIB_S4;
-                } else {
-                    sm_ptr->state = STATE_SM_CALIB_S1;
-                }
+            }
+            stepper_pio_start(i);   // segments already loaded by the task
+            sm_ptr->state = STATE_SM_RUNNING;  // update state
+            next_uS = STEPPER_POLL_uS;
+            break;
+
+        case STATE_SM_RUNNING :     // limit switch edges end the run in "limit_switch_callback"
+    // check for end of queued moves : PIO has run out of segments
+            if (stepper_pio_done(i) == true) {
+                sm_ptr->current_step_count += sm_ptr->queue.sent_steps;
+                sm_ptr->state = STATE_SM_DORMANT;   // stepper motor move complete
                 break;
-    // states S4,S5,S6 to move to LEFT limit
-            case STATE_SM_CALIB_S4 :
-                do_step(i);
-                sm_ptr->current_step_count++;
+            }
+            next_uS = STEPPER_POLL_uS;
+            break;
+        case STATE_SM_UNCALIBRATED :
+            sm_ptr->temp_count = MAX_STEPS;
+            set_SM_direction(i, CLOCKWISE);
+            sm_ptr->state = STATE_SM_CALIB_S0;
+            break;
+        case STATE_SM_CALIB_S0 : // ensure motor is not triggering LEFT limit switch
+            if (gpio_get(sm_ptr->L_limit_pin) == ASSERTED_LOW) {
+                do_step(i); // and stay in this state until clear of LEFT limit switch
                 sm_ptr->temp_count--;
                 if (sm_ptr->temp_count <= 0) {
                     sm_ptr->error = STEPPER_CALIBRATE_FAIL;
                     sm_ptr->state = STATE_SM_DORMANT;
                     break;
                 }
-                if (CALIBRATE_SPEED_DELAY != 0) {
-                    sm_ptr->current_step_delay_count = CALIBRATE_SPEED_DELAY;
-                    sm_ptr->state = STATE_SM_CALIB_S5;
-                } else {
-                    sm_ptr->state = STATE_SM_CALIB_S6;
-                }
-                break;
-            case STATE_SM_CALIB_S5 :
-                sm_ptr->current_step_delay_count--;
-                if (sm_ptr->current_step_delay_count == 0) {
-                    sm_ptr->state = STATE_SM_CALIB_S6;  // delay complete
-                } 
-                break;
-            case STATE_SM_CALIB_S6 :
-                if (gpio_get(sm_ptr->R_limit_pin) == ASSERTED_LOW) {
-                    sm_ptr->state = STATE_SM_CALIB_S7;
-                } else {
-                    sm_ptr->state = STATE_SM_CALIB_S4;
-                }
-                break;
-    // Prepare to move to initial position
-            case STATE_SM_CALIB_S7 :
-                sm_ptr->max_step_count = sm_ptr->current_step_count;
-                sm_ptr->calibrated = true;
-                set_SM_direction(i, ANTI_CLOCKWISE);
-            //    sm_ptr->temp_count = sm_ptr->max_step_count - sm_ptr->init_step_position;
-                sm_ptr->temp_count = sm_ptr->max_step_count / 2;
-                sm_ptr->state = STATE_SM_CALIB_S8;
+                next_uS = CALIBRATE_CLEAR_PERIOD_uS;
+            } else {
+                sm_ptr->state = STATE_SM_CALIB_HOME_L;
+            }
+            break;
+// home on LEFT limit switch : origin
+        case STATE_SM_CALIB_HOME_L :
+            start_homing_move(sm_ptr, -MAX_STEPS, L_LIMIT_LATCH, sm_ptr->home_fast_speed, STATE_SM_CALIB_BACKOFF_L);
+            break;
+        case STATE_SM_CALIB_BACKOFF_L :
+            start_homing_move(sm_ptr, +sm_ptr->home_backoff, 0, sm_ptr->home_fast_speed, STATE_SM_CALIB_SLOW_L);
+            break;
+        case STATE_SM_CALIB_SLOW_L :
+            start_homing_steps(i, ANTI_CLOCKWISE, L_LIMIT_LATCH, STATE_SM_CALIB_ORIGIN);
+            break;
+        case STATE_SM_CALIB_ORIGIN :
+            sm_ptr->current_step_count = 0;     // no steps made since the edge
+            sm_ptr->state = STATE_SM_CALIB_HOME_R;
+            break;
+// home on RIGHT limit switch : travel
+        case STATE_SM_CALIB_HOME_R :
+            start_homing_move(sm_ptr, +MAX_STEPS, R_LIMIT_LATCH, sm_ptr->home_fast_speed, STATE_SM_CALIB_BACKOFF_R);
+            break;
+        case STATE_SM_CALIB_BACKOFF_R :
+            start_homing_move(sm_ptr, -sm_ptr->home_backoff, 0, sm_ptr->home_fast_speed, STATE_SM_CALIB_SLOW_R);
+            break;
+        case STATE_SM_CALIB_SLOW_R :
+            start_homing_steps(i, CLOCKWISE, R_LIMIT_LATCH, STATE_SM_CALIB_END);
+            break;
+// move to initial position at full speed
+        case STATE_SM_CALIB_END :
+            sm_ptr->max_step_count = sm_ptr->limit_step_count;  // position at switch edge
+            sm_ptr->calibrated = true;
+        //    start_homing_move(sm_ptr, (sm_ptr->init_step_position - sm_ptr->current_step_count), 0, 0, STATE_SM_CALIB_DONE);
+            start_homing_move(sm_ptr, ((sm_ptr->max_step_count / 2) - sm_ptr->current_step_count), 0, 0, STATE_SM_CALIB_DONE);
+            break;
+// calibrate complete
+        case STATE_SM_CALIB_DONE :
+            sm_ptr->error = OK;
+            sm_ptr->state = STATE_SM_DORMANT;
+            break;
+// homing move : loaded by the task, ended early by a switch edge
+        case STATE_SM_CALIB_LOAD :
+            next_uS = STEPPER_IDLE;     // task loads the PIO and wakes the stepper
+            break;
+        case STATE_SM_CALIB_START :
+            sm_ptr->limit_latch = limit_switch_levels(sm_ptr);    // closed switches give no edge
+            if ((sm_ptr->limit_latch & sm_ptr->home_switch) != 0) {
+                sm_ptr->state = sm_ptr->calib_next;     // already there
                 break;
-    // states S8,S9,S10 to move to initial position             
-            case STATE_SM_CALIB_S8 :
-                do_step(i);
-                sm_ptr->current_step_count--;
-                sm_ptr->temp_count--;
-                if (sm_ptr->temp_count <= 0) {
-                    sm_ptr->error = OK;
+            }
+            stepper_pio_start(i);
+            sm_ptr->state = STATE_SM_CALIB_RUN;
+            next_uS = STEPPER_POLL_uS;
+            break;
+        case STATE_SM_CALIB_RUN :
+            if (stepper_pio_done(i) == true) {
+                sm_ptr->current_step_count += sm_ptr->queue.sent_steps;
+                if (sm_ptr->home_switch != 0) {
+                    sm_ptr->error = STEPPER_CALIBRATE_FAIL;     // switch not found
                     sm_ptr->state = STATE_SM_DORMANT;
                     break;
                 }
-                if (CALIBRATE_SPEED_DELAY != 0) {
-                    sm_ptr->current_step_delay_count = CALIBRATE_SPEED_DELAY;
-                    sm_ptr->state = STATE_SM_CALIB_S9;
-                } else {
-                    sm_ptr->state = STATE_SM_CALIB_S10;
-                }
-                break;
-            case STATE_SM_CALIB_S9 :
-                sm_ptr->current_step_delay_count--;
-                if (sm_ptr->current_step_delay_count == 0) {
-                    sm_ptr->state = STATE_SM_CALIB_S10;  // delay complete
-                } 
-                break;
-            case STATE_SM_CALIB_S10 :
-                if (sm_ptr->temp_count == 0) {
-                    sm_ptr->state = STATE_SM_CALIB_S11;
-                }  else {
-                    sm_ptr->state = STATE_SM_CALIB_S8;
-                }
+                sm_ptr->state = sm_ptr->calib_next;
                 break;
-    // calibrate complete
-            case STATE_SM_CALIB_S11 :
-                sm_ptr->error = OK;
+            }
+            next_uS = STEPPER_POLL_uS;
+            break;
+        case STATE_SM_CALIB_EDGE :
+            if ((sm_ptr->limit_latch & sm_ptr->home_switch) == 0) {
+                sm_ptr->error = STEPPER_CALIBRATE_FAIL;     // wrong switch
                 sm_ptr->state = STATE_SM_DORMANT;
                 break;
-                
-            case STATE_SM_FAULT :
+            }
+            sm_ptr->state = sm_ptr->calib_next;
+            break;
+        case STATE_SM_CALIB_SLOW :
+            if ((sm_ptr->limit_latch & sm_ptr->home_switch) != 0) {
+                sm_ptr->state = sm_ptr->calib_next;
                 break;
-            default :
-                sm_ptr->error = UNKNOWN_STEPPER_MOTOR_STATE;
+            }
+            sm_ptr->temp_count--;
+            if (sm_ptr->temp_count < 0) {
+                sm_ptr->error = STEPPER_CALIBRATE_FAIL;
+                sm_ptr->state = STATE_SM_DORMANT;
                 break;
+            }
+            if (sm_ptr->direction == CLOCKWISE) {
+                sm_ptr->current_step_count++;
+            } else {
+                sm_ptr->current_step_count--;
+            }
+            do_step(i);
+            next_uS = 1000000 / sm_ptr->home_slow_speed;
+            break;
+            
+        case STATE_SM_FAULT :
+            next_uS = STEPPER_IDLE;
+            break;
+        default :
+            sm_ptr->error = UNKNOWN_STEPPER_MOTOR_STATE;
+            next_uS = STEPPER_IDLE;
+            break;
+    }
+    return next_uS;
+}
+
+/**
+ * @brief Hardware alarm : service every stepper whose deadline has passed
+ */
+static void stepper_alarm_callback(uint alarm_num)
+{
+UBaseType_t     saved_state;
+uint32_t        stepper_no, next_uS;
+uint64_t        now;
+
+    saved_state = taskENTER_CRITICAL_FROM_ISR();
+    stepper_stats.alarms++;
+    now = time_us_64();
+    while ((heap_size != 0) && (stepper_deadline[stepper_heap[0]] <= now)) {
+        stepper_no = heap_pop();
+        next_uS = stepper_service(stepper_no);
+        if (next_uS != STEPPER_IDLE) {
+            heap_schedule(stepper_no, (now + next_uS));
         }
+        now = time_us_64();
     }
-    // STOP_PULSE;
-    return true;
+    set_stepper_alarm();
+    taskEXIT_CRITICAL_FROM_ISR(saved_state);
+}
+
+/**
+ * @brief Run the state machine of a stepper now (task context)
+ * 
+ * @param stepper_no    stepper given a new state by a command
+ */
+void stepper_wake(uint32_t stepper_no)
+{
+    taskENTER_CRITICAL();
+    heap_schedule(stepper_no, time_us_64());
+    set_stepper_alarm();
+    taskEXIT_CRITICAL();
 }
 
 //==============================================================================
@@ -295,9 +520,45 @@ void Task_stepper_control(void *p)
      //   calibrate_stepper(i);  //disable : do calibrate command from Pi computer
     }
 
-    add_repeating_timer_us(1000, repeating_timer_callback, NULL, &timer);
-    FOREVER {
-        vTaskDelay(1000);    // all the work is done in the callback routine
+    for (uint32_t i=0; i<NOS_STEPPERS; i++) {
+        heap_position[i] = -1;
+    }
+    heap_size = 0;
+    stepper_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(stepper_alarm, stepper_alarm_callback);
+    FOREVER {       // motion is done by the alarm callback : task runs stepper commands
+        receive_command(CMD_QUEUE_STEPPER, STEPPER_DONE_POLL_TICKS);
+        for (uint32_t n=0; n<STEPPER_CMD_QUEUE_LENGTH; n++) {  // queue waiting moves before starting any
+            if (receive_command(CMD_QUEUE_STEPPER, 0) == false) {
+                break;
+            }
+        }
+        for (uint32_t i=0; i<NOS_STEPPERS; i++) {   // start queued moves, report moves ended by the callback
+            sm_ptr = &stepper_data[i];
+            if ((sm_ptr->state == STATE_SM_FAULT) || (sm_ptr->error != OK)) {
+                stepper_queue_flush(i);         // after a fault or failed calibration
+            }
+            if (sm_ptr->state == STATE_SM_CALIB_LOAD) {
+                stepper_queue_flush(i);
+                sm_ptr->queue.speed_limit = sm_ptr->home_speed;
+                stepper_queue_add(i, sm_ptr->temp_count, 0);
+                stepper_pio_load(i);
+                sm_ptr->state = STATE_SM_CALIB_START;
+                stepper_wake(i);
+            }
+            if ((sm_ptr->state == STATE_SM_DORMANT) && (sm_ptr->queue.count != 0)) {
+                stepper_pio_load(i);
+                sm_ptr->state = STATE_SM_INIT;
+                stepper_wake(i);
+            }
+            stepper_pio_service(i);
+            if ((sm_ptr->state == STATE_SM_DORMANT) || (sm_ptr->state == STATE_SM_FAULT)) {
+                stepper_queue_report(i, 0, true);
+                print_move_done(&sm_ptr->seq_id, sm_ptr->error);
+            } else {
+                stepper_queue_report(i, stepper_pio_sent_segments(i), false);
+            }
+        }
     }
 }
 
@@ -408,12 +669,7 @@ void TMC2208_interface_init(void)
 {
     for (uint32_t i=0 ; i < NOS_STEPPERS ; i++) {
 
-        gpio_init(stepper_data[i].step_pin);
-        gpio_set_dir(stepper_data[i].step_pin, GPIO_OUT);
-        gpio_pull_down(stepper_data[i].step_pin); 
-
-        gpio_init(stepper_data[i].direction_pin);
-        gpio_set_dir(stepper_data[i].direction_pin, GPIO_OUT);
+        gpio_pull_down(stepper_data[i].step_pin);       // pins are driven by PIO
         gpio_pull_down(stepper_data[i].direction_pin);
         
         gpio_init(stepper_data[i].L_limit_pin);
@@ -424,20 +680,23 @@ void TMC2208_interface_init(void)
         gpio_set_dir(stepper_data[i].R_limit_pin, GPIO_IN);
         gpio_pull_up(stepper_data[i].R_limit_pin);
 
+        gpio_set_irq_enabled_with_callback(stepper_data[i].L_limit_pin, GPIO_IRQ_EDGE_FALL, true, limit_switch_callback);
+        gpio_set_irq_enabled(stepper_data[i].R_limit_pin, GPIO_IRQ_EDGE_FALL, true);
+
     }
+    stepper_pio_init();
 }
 
 //==============================================================================
 /**
  * @brief generate a short single step pulse 
  * 
- * @param stepper_id   index of selected stepper motor move sm_profile
+ * @param stepper_id   index of selected stepper motor
+ * @note  Pulse is timed by the PIO, in the direction of the last "set_SM_direction"
  */
 void inline do_step(uint32_t stepper_id)
 {
-    gpio_put(stepper_data[stepper_id].step_pin, ON);
-    busy_wait_us(1); 
-    gpio_put(stepper_data[stepper_id].step_pin, OFF);
+    stepper_pio_step(stepper_id, stepper_data[stepper_id].direction);
 }
 
 /**
@@ -445,17 +704,11 @@ void inline do_step(uint32_t stepper_id)
  * 
  * @param   stepper_id      active stepper motor
  * @param   direction       CLOCKWISE or ANTI_CLOCKWISE
+ * @note    "flip_direction" is applied when the DIR pin is driven
  */
 void inline set_SM_direction(uint32_t stepper_id, sm_direction direction)
 {
-    if (stepper_data[stepper_id].flip_direction == true) {
-        if (direction == CLOCKWISE) {
-            direction = ANTI_CLOCKWISE;
-        } else {
-            direction = CLOCKWISE;
-        }
-    }
-    gpio_put(stepper_data[stepper_id].direction_pin, direction);
+    stepper_data[stepper_id].direction = direction;
 }
 
 /**
@@ -474,7 +727,7 @@ error_codes_te  status;
         sm_ptr = &stepper_data[i];
         sm_ptr->max_step_count = sm_ptr->steps_per_rev + sm_ptr->gearbox_ratio;
         sm_ptr->steps_per_degree 
-            = (float)(sm_ptr->steps_per_rev * sm_ptr->gearbox_ratio * sm_ptr->microstep_value) / 360.0;
+            = q16_ratio((sm_ptr->steps_per_rev * sm_ptr->gearbox_ratio * sm_ptr->microstep_value), 360);
     }
 }
 
@@ -0,0 +1,23 @@
+/**
+ * @file Task_sys_control.c
+ * @author Jim Herd
+ * @brief Run system commands (sys, get, ping, set, switch)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "system.h"
+#include "externs.h"
+#include "sys_routines.h"
+#include "cmd_queues.h"
+
+#include "pico/stdlib.h"
+
+#include "FreeRTOS.h"
+
+void Task_sys_control(void *p) 
+{
+    FOREVER {
+        receive_command(CMD_QUEUE_SYS, portMAX_DELAY);
+    }
+}
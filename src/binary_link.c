@@ -0,0 +1,203 @@
+/**
+ * @file    binary_link.c
+ * @author  Jim Herd
+ * @brief   COBS framed binary command transport on UART0
+ * @note
+ *      Runs alongside the ASCII command parser. The UART receive scan
+ *      routes any FRAME_DELIMITER bracketed data into a frame buffer
+ *      rather than the line buffer, so each frame is detected on its own
+ *      and existing ASCII hosts are unaffected. A frame must start with a
+ *      delimiter as well as end with one (see "system.h").
+ *
+ *      Frame layout is defined in "system.h". Parameters are copied
+ *      straight into the int_parameters[] slots used by the ASCII path,
+ *      so both transports share "check_command" and the command handlers.
+ */
+
+#include    "pico/stdlib.h"
+
+#include    "system.h"
+#include    "binary_link.h"
+#include    "uart_IO.h"
+
+//==============================================================================
+// CRC-16/CCITT-FALSE (poly 0x1021) : 4-bit table keeps ROM use small
+//==============================================================================
+
+static const uint16_t crc16_nibble_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+uint16_t crc16_ccitt(const uint8_t *data, uint32_t length)
+{
+uint16_t    crc;
+
+    crc = CRC16_INIT;
+    while (length-- != 0) {
+        crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
+
+//==============================================================================
+/**
+ * @brief   Consistent Overhead Byte Stuffing encode
+ *
+ * @param in        raw data
+ * @param length    number of raw bytes (< 254)
+ * @param out       encoded data (length + 1 bytes), contains no zero bytes
+ * @return uint32_t number of encoded bytes
+ */
+uint32_t cobs_encode(const uint8_t *in, uint32_t length, uint8_t *out)
+{
+uint32_t    read_index, write_index, code_index;
+uint8_t     code;
+
+    read_index  = 0;
+    write_index = 1;
+    code_index  = 0;
+    code        = 1;
+    while (read_index < length) {
+        if (in[read_index] == 0) {
+            out[code_index] = code;
+            code_index = write_index++;
+            code = 1;
+        } else {
+            out[write_index++] = in[read_index];
+            code++;
+        }
+        read_index++;
+    }
+    out[code_index] = code;
+    return write_index;
+}
+
+//==============================================================================
+/**
+ * @brief   Consistent Overhead Byte Stuffing decode
+ *
+ * @param in        encoded data (delimiters removed)
+ * @param length    number of encoded bytes
+ * @param out       decoded data
+ * @return int32_t  number of decoded bytes, or -1 if encoding is invalid
+ */
+int32_t cobs_decode(const uint8_t *in, uint32_t length, uint8_t *out)
+{
+uint32_t    read_index, write_index, i;
+uint8_t     code;
+
+    read_index  = 0;
+    write_index = 0;
+    while (read_index < length) {
+        code = in[read_index];
+        if ((code == 0) || ((read_index + code) > length)) {
+            return -1;
+        }
+        read_index++;
+        for (i = 1; i < code; i++) {
+            out[write_index++] = in[read_index++];
+        }
+        if ((code != 0xFF) && (read_index != length)) {
+            out[write_index++] = 0;
+        }
+    }
+    return write_index;
+}
+
+//==============================================================================
+/**
+ * @brief   Decode and validate a received frame
+ *
+ * @param frame     COBS encoded frame (delimiters removed)
+ * @param length    number of encoded bytes
+ * @param bin_cmd   unpacked header and parameters
+ * @return error_codes_te
+ * @note
+ *      Header fields are unpacked before the CRC test so that an error
+ *      reply can echo the sequence number of a damaged frame.
+ */
+error_codes_te binary_unpack_frame(const uint8_t *frame, uint32_t length, struct binary_command_s *bin_cmd)
+{
+uint8_t     raw[MAX_FRAME_SIZE];
+int32_t     raw_length, param_bytes;
+uint16_t    crc;
+const uint8_t   *param_pt;
+
+    bin_cmd->opcode         = TOKENIZER_ERROR;
+    bin_cmd->sequence       = 0;
+    bin_cmd->port           = 0;
+    bin_cmd->nos_parameters = 0;
+
+    raw_length = cobs_decode(frame, length, raw);
+    if (raw_length < 0) {
+        return BAD_FRAME_ENCODING;
+    }
+    if (raw_length < (FRAME_HEADER_SIZE + FRAME_CRC_SIZE)) {
+        return BAD_FRAME_LENGTH;
+    }
+    bin_cmd->opcode   = raw[0];
+    bin_cmd->sequence = raw[1];
+    bin_cmd->port     = raw[2];
+
+    crc = raw[raw_length - 2] | (raw[raw_length - 1] << 8);
+    if (crc != crc16_ccitt(raw, raw_length - FRAME_CRC_SIZE)) {
+        return BAD_FRAME_CRC;
+    }
+    param_bytes = raw_length - (FRAME_HEADER_SIZE + FRAME_CRC_SIZE);
+    if (((param_bytes & 0x3) != 0) || ((param_bytes >> 2) > (MAX_ARGC - 2))) {
+        return BAD_FRAME_LENGTH;
+    }
+    bin_cmd->nos_parameters = param_bytes >> 2;
+    param_pt = &raw[FRAME_HEADER_SIZE];
+    for (uint32_t i = 0; i < bin_cmd->nos_parameters; i++) {
+        bin_cmd->parameters[i] = (int32_t)(param_pt[0] | (param_pt[1] << 8) |
+                                          (param_pt[2] << 16) | ((uint32_t)param_pt[3] << 24));
+        param_pt += 4;
+    }
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief   Encode and send a reply frame
+ *
+ * @param context       opcode and sequence number of the command
+ * @param port          port number (UNDEFINED_PORT is sent as 0xFF)
+ * @param status        command status
+ * @param nos_values    number of additional reply values
+ * @param values        reply values
+ */
+void binary_send_reply(const struct reply_context_s *context, int32_t port, int32_t status, uint32_t nos_values, const int32_t *values)
+{
+uint8_t     raw[REPLY_HEADER_SIZE + (MAX_REPLY_VALUES * 4) + FRAME_CRC_SIZE];
+uint8_t     encoded[sizeof(raw) + 3];
+uint32_t    raw_length, encoded_length;
+uint16_t    crc;
+
+    if (nos_values > MAX_REPLY_VALUES) {
+        nos_values = MAX_REPLY_VALUES;
+    }
+    raw[0] = context->opcode;
+    raw[1] = context->sequence;
+    raw[2] = (uint8_t)port;
+    raw[3] = status & 0xFF;
+    raw[4] = (status >> 8) & 0xFF;
+    raw_length = REPLY_HEADER_SIZE;
+    for (uint32_t i = 0; i < nos_values; i++) {
+        raw[raw_length++] =  values[i]        & 0xFF;
+        raw[raw_length++] = (values[i] >> 8)  & 0xFF;
+        raw[raw_length++] = (values[i] >> 16) & 0xFF;
+        raw[raw_length++] = (values[i] >> 24) & 0xFF;
+    }
+    crc = crc16_ccitt(raw, raw_length);
+    raw[raw_length++] = crc & 0xFF;
+    raw[raw_length++] = (crc >> 8) & 0xFF;
+
+    encoded[0] = FRAME_DELIMITER;
+    encoded_length = cobs_encode(raw, raw_length, &encoded[1]) + 1;
+    encoded[encoded_length++] = FRAME_DELIMITER;
+    uart_putbytes(encoded, encoded_length);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file    cmd_queues.c
+ * @author  Jim Herd
+ * @brief   Per-subsystem command execution queues
+ * @note
+ *      "Task_run_cmd" parses commands and posts them to the queue of the
+ *      subsystem task that runs them. Depth and latency counters are kept
+ *      for each queue and can be read with the "get" QUEUE_INFO command.
+ */
+
+#include    "pico/stdlib.h"
+
+#include    "FreeRTOS.h"
+#include    "queue.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "cmd_queues.h"
+
+//==============================================================================
+// Queue data
+//==============================================================================
+
+struct cmd_queue_s  cmd_queues[NOS_CMD_QUEUES] = {
+    [CMD_QUEUE_SYS]      = {NULL, SYS_CMD_QUEUE_LENGTH},
+    [CMD_QUEUE_SERVO]    = {NULL, SERVO_CMD_QUEUE_LENGTH},
+    [CMD_QUEUE_STEPPER]  = {NULL, STEPPER_CMD_QUEUE_LENGTH},
+    [CMD_QUEUE_NEOPIXEL] = {NULL, NEOPIXEL_CMD_QUEUE_LENGTH},
+    [CMD_QUEUE_DISPLAY]  = {NULL, DISPLAY_CMD_QUEUE_LENGTH},
+    [CMD_QUEUE_SCRIPT]   = {NULL, SCRIPT_CMD_QUEUE_LENGTH},
+};
+
+//==============================================================================
+/**
+ * @brief Create the command queues
+ * @note  Must be called before the scheduler is started
+ */
+void init_cmd_queues(void)
+{
+    for (uint32_t i = 0; i < NOS_CMD_QUEUES; i++) {
+        cmd_queues[i].queue = xQueueCreate(cmd_queues[i].length, sizeof(struct cmd_message_s));
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Post a parsed command to a subsystem queue
+ * 
+ * @param queue_index   subsystem queue
+ * @param cmd           command message (copied)
+ * @return error_codes_te   CMD_QUEUE_FULL if the command cannot be queued
+ * @note
+ *      Does not wait. A subsystem that is stalled must not hold up the
+ *      command parser and so commands for other subsystems.
+ */
+error_codes_te post_command(cmd_queue_te queue_index, struct cmd_message_s *cmd)
+{
+struct cmd_queue_s  *queue_pt;
+uint32_t            depth;
+
+    queue_pt = &cmd_queues[queue_index];
+    cmd->queued_time = time_us_32();
+    if (xQueueSend(queue_pt->queue, cmd, 0) != pdPASS) {
+        return CMD_QUEUE_FULL;
+    }
+    depth = uxQueueMessagesWaiting(queue_pt->queue);
+    if (depth > queue_pt->max_depth) {
+        queue_pt->max_depth = depth;
+    }
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Wait for a command on a subsystem queue and run it
+ * 
+ * @param queue_index   subsystem queue
+ * @param wait_ticks    maximum wait (0 = poll)
+ * @return true         a command was run
+ * @return false        queue empty
+ */
+bool receive_command(cmd_queue_te queue_index, TickType_t wait_ticks)
+{
+struct cmd_queue_s      *queue_pt;
+struct cmd_message_s    cmd;
+uint32_t                latency;
+
+    queue_pt = &cmd_queues[queue_index];
+    if (xQueueReceive(queue_pt->queue, &cmd, wait_ticks) != pdPASS) {
+        return false;
+    }
+    latency = time_us_32() - cmd.queued_time;
+    queue_pt->last_latency_uS = latency;
+    if (latency > queue_pt->max_latency_uS) {
+        queue_pt->max_latency_uS = latency;
+    }
+    queue_pt->nos_cmds++;
+    run_command_message(&cmd);
+    return true;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file    cmd_scheduler.c
+ * @author  Jim Herd
+ * @brief   Run commands at a given device time
+ * @note
+ *      "@t cmd" holds a parsed command until device time t (uS since boot)
+ *      and then posts it to its subsystem queue. The host finds the
+ *      offset and drift of the device clock with "ping port value 1"
+ *      and can then send a whole sequence well ahead of time, so that
+ *      UART timing does not show up in the motion.
+ * 
+ *      Commands wait in a hashed timer wheel (1024uS slots), so that
+ *      scheduling and the 1kHz wheel tick cost the same however many
+ *      commands are waiting. Commands due before the end of the next wheel
+ *      tick are moved to a short time ordered list that is released by a
+ *      dedicated hardware alarm, giving release to within a few uS.
+ * 
+ *      Commands are released from interrupt level, so the receiving
+ *      task runs them as soon as it next reads its queue.
+ */
+
+#include    "pico/stdlib.h"
+#include    "hardware/timer.h"
+
+#include    "FreeRTOS.h"
+#include    "task.h"
+#include    "queue.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "cmd_queues.h"
+#include    "cmd_scheduler.h"
+
+#if ((WHEEL_SLOTS & WHEEL_MASK) != 0)
+    #error "WHEEL_SLOTS must be a power of two"
+#endif
+
+//==============================================================================
+// Scheduler data
+//==============================================================================
+
+static struct scheduled_cmd_s   scheduled_cmds[NOS_SCHEDULED_CMDS];
+static struct scheduled_cmd_s   *free_cmds;
+static struct scheduled_cmd_s   *wheel[WHEEL_SLOTS];
+static struct scheduled_cmd_s   *due_cmds;          // time ordered, due before "wheel_tick"
+static uint64_t                 wheel_tick;         // next wheel tick to be processed
+static uint32_t                 release_alarm;
+static struct repeating_timer   wheel_timer;
+
+struct schedule_stats_s         schedule_stats;
+
+//==============================================================================
+/**
+ * @brief Add a command to the time ordered due list
+ * @note
+ *      Called with interrupts disabled. Alarm is reset if the command is
+ *      now the first due.
+ */
+static void add_due_command(struct scheduled_cmd_s *entry)
+{
+struct scheduled_cmd_s  **link;
+
+    link = &due_cmds;
+    while ((*link != NULL) && ((*link)->due_uS <= entry->due_uS)) {
+        link = &(*link)->next;
+    }
+    entry->next = *link;
+    *link = entry;
+    if (due_cmds == entry) {
+        if (hardware_alarm_set_target(release_alarm, from_us_since_boot(entry->due_uS)) == true) {
+            hardware_alarm_force_irq(release_alarm);     // already due
+        }
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Hardware alarm : post all due commands to their queues
+ */
+static void release_alarm_callback(uint alarm_num)
+{
+UBaseType_t             saved_state;
+BaseType_t              task_woken;
+struct scheduled_cmd_s  *entry;
+uint64_t                now;
+uint32_t                lateness;
+
+    task_woken = pdFALSE;
+    saved_state = taskENTER_CRITICAL_FROM_ISR();
+    now = time_us_64();
+    while ((due_cmds != NULL) && (due_cmds->due_uS <= now)) {
+        entry = due_cmds;
+        due_cmds = entry->next;
+        lateness = (uint32_t)(now - entry->due_uS);
+        if (lateness > schedule_stats.max_lateness_uS) {
+            schedule_stats.max_lateness_uS = lateness;
+        }
+        entry->cmd.queued_time = (uint32_t)now;
+        if (xQueueSendFromISR(cmd_queues[entry->queue].queue, &entry->cmd, &task_woken) == pdPASS) {
+            schedule_stats.released++;
+        } else {
+            schedule_stats.queue_full++;
+        }
+        schedule_stats.pending--;
+        entry->next = free_cmds;
+        free_cmds = entry;
+        now = time_us_64();
+    }
+    if (due_cmds != NULL) {
+        if (hardware_alarm_set_target(alarm_num, from_us_since_boot(due_cmds->due_uS)) == true) {
+            hardware_alarm_force_irq(alarm_num);
+        }
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved_state);
+    portYIELD_FROM_ISR(task_woken);
+}
+
+//==============================================================================
+/**
+ * @brief Wheel tick : move commands due before end of next tick to due list
+ * @note
+ *      Catches up if ticks have been missed. Commands a revolution or
+ *      more ahead stay in their slot.
+ */
+static bool wheel_timer_callback(struct repeating_timer *t)
+{
+UBaseType_t             saved_state;
+struct scheduled_cmd_s  **link, *entry;
+uint64_t                now_tick;
+
+    saved_state = taskENTER_CRITICAL_FROM_ISR();
+    now_tick = time_us_64() >> WHEEL_TICK_SHIFT;
+    while (wheel_tick <= (now_tick + 1)) {
+        link = &wheel[wheel_tick & WHEEL_MASK];
+        while (*link != NULL) {
+            entry = *link;
+            if ((entry->due_uS >> WHEEL_TICK_SHIFT) <= wheel_tick) {
+                *link = entry->next;
+                add_due_command(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+        wheel_tick++;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved_state);
+    return true;
+}
+
+//==============================================================================
+/**
+ * @brief Set up command pool, wheel tick timer and release alarm
+ * @note  Call after "init_cmd_queues"
+ */
+void init_cmd_scheduler(void)
+{
+    free_cmds = NULL;
+    for (uint32_t i = 0; i < NOS_SCHEDULED_CMDS; i++) {
+        scheduled_cmds[i].next = free_cmds;
+        free_cmds = &scheduled_cmds[i];
+    }
+    for (uint32_t i = 0; i < WHEEL_SLOTS; i++) {
+        wheel[i] = NULL;
+    }
+    due_cmds = NULL;
+    wheel_tick = time_us_64() >> WHEEL_TICK_SHIFT;
+    release_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(release_alarm, release_alarm_callback);
+    add_repeating_timer_us(WHEEL_TICK_US, wheel_timer_callback, NULL, &wheel_timer);
+}
+
+//==============================================================================
+/**
+ * @brief Hold a command until its due time
+ * 
+ * @param queue_index   subsystem queue to receive command
+ * @param cmd           command message (copied)
+ * @param due_uS        device time (uS since boot)
+ * @return error_codes_te   SCHEDULE_FULL if all slots are in use
+ * @note
+ *      A command that is already due is posted at once and counted as late.
+ */
+error_codes_te schedule_command(cmd_queue_te queue_index, struct cmd_message_s *cmd, uint64_t due_uS)
+{
+struct scheduled_cmd_s  *entry;
+uint64_t                due_tick;
+
+    if (due_uS <= time_us_64()) {
+        schedule_stats.late++;
+        return post_command(queue_index, cmd);
+    }
+    taskENTER_CRITICAL();
+    entry = free_cmds;
+    if (entry != NULL) {
+        free_cmds = entry->next;
+    }
+    taskEXIT_CRITICAL();
+    if (entry == NULL) {
+        return SCHEDULE_FULL;
+    }
+    entry->due_uS = due_uS;
+    entry->queue  = queue_index;
+    entry->cmd    = *cmd;
+
+    due_tick = due_uS >> WHEEL_TICK_SHIFT;
+    taskENTER_CRITICAL();
+    schedule_stats.pending++;
+    if (due_tick < wheel_tick) {
+        add_due_command(entry);         // wheel has already passed this tick
+    } else {
+        entry->next = wheel[due_tick & WHEEL_MASK];
+        wheel[due_tick & WHEEL_MASK] = entry;
+    }
+    taskEXIT_CRITICAL();
+    return OK;
+}
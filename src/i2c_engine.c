@@ -0,0 +1,342 @@
+/**
+ * @file    i2c_engine.c
+ * @author  Jim Herd
+ * @brief   Interrupt driven I2C transfers on I2C_PORT
+ * @note
+ *      Transfers are queued and run one after another by the I2C
+ *      interrupt, which keeps the controller FIFO topped up and reads
+ *      any received bytes. A task submits a transfer and sleeps on a task
+ *      notification until it is done, so no CPU time is spent polling
+ *      the bus and tasks of the same priority keep running.
+ * 
+ *      A NAK or other abort ends the transfer with an error (the
+ *      controller sends the STOP). If a transfer does not finish in
+ *      I2C_TIMEOUT_TICKS, or ends in error with SDA held low on an idle
+ *      bus, the bus is recovered. SCL is clocked until a slave holding
+ *      SDA lets go, a STOP is sent and the controller is reset.
+ */
+
+#include    "pico/stdlib.h"
+#include    "hardware/i2c.h"
+#include    "hardware/irq.h"
+#include    "hardware/gpio.h"
+
+#include    "FreeRTOS.h"
+#include    "task.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "i2c_engine.h"
+
+#if ((I2C_QUEUE_SIZE & (I2C_QUEUE_SIZE - 1)) != 0)
+    #error "I2C_QUEUE_SIZE must be a power of two"
+#endif
+
+//==============================================================================
+// Engine data
+//==============================================================================
+
+static struct i2c_transfer_s    *active;            // transfer on the bus
+static struct i2c_transfer_s    *queued[I2C_QUEUE_SIZE];
+static uint32_t                 queue_in, queue_out;
+static uint32_t                 cmd_index;          // bytes/read commands given to controller
+static uint32_t                 rx_index;
+static uint32_t                 i2c_baudrate;
+
+struct i2c_stats_s              i2c_stats;
+
+//==============================================================================
+/**
+ * @brief Load controller FIFO with data and read commands
+ * @note
+ *      First read command has a RESTART if data was written, last
+ *      command has a STOP. TX_EMPTY interrupt is masked once all have
+ *      been loaded.
+ */
+static void i2c_fill_fifo(i2c_hw_t *hw)
+{
+uint32_t    total, data_cmd;
+
+    total = active->tx_length + active->rx_length;
+    while ((cmd_index < total) && (i2c_get_write_available(I2C_PORT) != 0)) {
+        if (cmd_index < active->tx_length) {
+            data_cmd = active->tx_data[cmd_index];
+        } else {
+            data_cmd = I2C_IC_DATA_CMD_CMD_BITS;        // read a byte
+            if ((cmd_index == active->tx_length) && (active->tx_length != 0)) {
+                data_cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+            }
+        }
+        if (cmd_index == (total - 1)) {
+            data_cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        }
+        hw->data_cmd = data_cmd;
+        cmd_index++;
+    }
+    if (cmd_index == total) {
+        hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Put a transfer on the bus
+ * @note  Called with I2C interrupt disabled or from the I2C interrupt
+ */
+static void i2c_start(struct i2c_transfer_s *transfer)
+{
+i2c_hw_t    *hw;
+
+    hw = i2c_get_hw(I2C_PORT);
+    active = transfer;
+    cmd_index = 0;
+    rx_index = 0;
+    hw->enable = 0;                 // target address can only be changed when disabled
+    hw->tar = transfer->address;
+    hw->enable = I2C_IC_ENABLE_ENABLE_BITS;
+    (void)hw->clr_intr;
+    hw->intr_mask = I2C_IC_INTR_MASK_M_TX_EMPTY_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS |
+                    I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+    i2c_fill_fifo(hw);
+}
+
+//==============================================================================
+/**
+ * @brief End active transfer and start the next one
+ * 
+ * @return struct i2c_transfer_s*   ended transfer : its task is to be notified
+ */
+static struct i2c_transfer_s *i2c_finish(int32_t status)
+{
+struct i2c_transfer_s   *transfer;
+
+    transfer = active;
+    active = NULL;
+    i2c_get_hw(I2C_PORT)->intr_mask = 0;
+    transfer->status = status;
+    if (queue_out != queue_in) {
+        i2c_start(queued[queue_out++ & (I2C_QUEUE_SIZE - 1)]);
+    }
+    return transfer;
+}
+
+//==============================================================================
+/**
+ * @brief I2C interrupt : FIFO refill, receive, abort and STOP detection
+ */
+static void i2c_irq_handler(void)
+{
+i2c_hw_t    *hw;
+uint32_t    intr_status, abort_source;
+BaseType_t  task_woken;
+struct i2c_transfer_s   *transfer;
+
+    task_woken = pdFALSE;
+    hw = i2c_get_hw(I2C_PORT);
+    intr_status = hw->intr_stat;
+    if (active == NULL) {
+        hw->intr_mask = 0;
+        (void)hw->clr_intr;
+        return;
+    }
+    if (intr_status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        abort_source = hw->tx_abrt_source;
+        (void)hw->clr_tx_abrt;
+        if (abort_source & (I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS | I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS)) {
+            active->status = I2C_NAK;
+            i2c_stats.naks++;
+        } else {
+            active->status = I2C_ABORT;
+            i2c_stats.aborts++;
+        }
+        cmd_index = active->tx_length + active->rx_length;   // nothing more to send
+        hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    }
+    while ((i2c_get_read_available(I2C_PORT) != 0) && (rx_index < active->rx_length)) {
+        active->rx_data[rx_index++] = (uint8_t)hw->data_cmd;
+    }
+    if (intr_status & I2C_IC_INTR_STAT_R_TX_EMPTY_BITS) {
+        i2c_fill_fifo(hw);
+    }
+    if (intr_status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        i2c_stats.transfers++;
+        transfer = i2c_finish((active->status == I2C_PENDING) ? OK : active->status);
+        if (transfer->notify_task != NULL) {
+            vTaskNotifyGiveIndexedFromISR(transfer->notify_task, I2C_NOTIFY_INDEX, &task_woken);
+        }
+    }
+    portYIELD_FROM_ISR(task_woken);
+}
+
+//==============================================================================
+/**
+ * @brief Set up controller and interrupt
+ * 
+ * @param baudrate  bus clock (Hz)
+ * @note  SDA/SCL pins are set up by the caller
+ */
+void i2c_engine_init(uint32_t baudrate)
+{
+    i2c_baudrate = baudrate;
+    active = NULL;
+    queue_in = 0;
+    queue_out = 0;
+    i2c_init(I2C_PORT, baudrate);
+    i2c_get_hw(I2C_PORT)->intr_mask = 0;
+    irq_set_exclusive_handler(I2C_IRQ, i2c_irq_handler);
+    irq_set_enabled(I2C_IRQ, true);
+}
+
+//==============================================================================
+/**
+ * @brief Queue a transfer
+ * 
+ * @param transfer      must stay in place until its status is not I2C_PENDING
+ * @return error_codes_te   I2C_QUEUE_FULL if the transfer cannot be queued
+ */
+error_codes_te i2c_submit(struct i2c_transfer_s *transfer)
+{
+error_codes_te  status;
+
+    status = OK;
+    transfer->status = I2C_PENDING;
+    irq_set_enabled(I2C_IRQ, false);
+    if (active == NULL) {
+        i2c_start(transfer);
+    } else if ((queue_in - queue_out) < I2C_QUEUE_SIZE) {
+        queued[queue_in++ & (I2C_QUEUE_SIZE - 1)] = transfer;
+    } else {
+        transfer->status = I2C_QUEUE_FULL;
+        status = I2C_QUEUE_FULL;
+    }
+    irq_set_enabled(I2C_IRQ, true);
+    return status;
+}
+
+//==============================================================================
+/**
+ * @brief Test for a slave holding SDA low on an idle bus
+ * @note
+ *      While a transfer is running SDA is low for much of the time, so
+ *      the line is only tested when nothing is active. A stalled
+ *      transfer is caught by its own timeout.
+ */
+static bool i2c_sda_stuck(void)
+{
+bool    stuck;
+
+    irq_set_enabled(I2C_IRQ, false);
+    stuck = (active == NULL) && (gpio_get(I2C_SDA) == 0);
+    irq_set_enabled(I2C_IRQ, true);
+    return stuck;
+}
+
+//==============================================================================
+/**
+ * @brief Sleep until a transfer is done
+ * 
+ * @param transfer      submitted with "notify_task" set to the calling task
+ * @return error_codes_te   transfer status
+ * @note
+ *      A NAK or abort has already been ended with a STOP and the next
+ *      queued transfer may be on the bus, so the error is just returned.
+ *      The bus is only recovered if SDA has been left stuck low, so a
+ *      slave that has lost its place cannot hold up later transfers.
+ */
+error_codes_te i2c_wait(struct i2c_transfer_s *transfer)
+{
+    while (transfer->status == I2C_PENDING) {
+        if (ulTaskNotifyTakeIndexed(I2C_NOTIFY_INDEX, pdTRUE, I2C_TIMEOUT_TICKS) == 0) {
+            if (transfer->status == I2C_PENDING) {
+                i2c_stats.timeouts++;
+                i2c_bus_recover();      // ends transfer with I2C_TIMEOUT
+            }
+        }
+    }
+    if ((transfer->status != OK) && (transfer->status != I2C_TIMEOUT) && i2c_sda_stuck()) {
+        i2c_bus_recover();
+    }
+    return transfer->status;
+}
+
+//==============================================================================
+/**
+ * @brief Write and/or read, sleeping until done
+ * 
+ * @param address       7-bit device address
+ * @param tx_data       bytes to write (tx_length may be 0)
+ * @param rx_data       read buffer (rx_length may be 0)
+ * @return error_codes_te 
+ */
+error_codes_te i2c_transfer(uint8_t address, const uint8_t *tx_data, uint32_t tx_length, uint8_t *rx_data, uint32_t rx_length)
+{
+struct i2c_transfer_s   transfer;
+error_codes_te          status;
+
+    transfer.address     = address;
+    transfer.tx_data     = tx_data;
+    transfer.tx_length   = tx_length;
+    transfer.rx_data     = rx_data;
+    transfer.rx_length   = rx_length;
+    transfer.notify_task = xTaskGetCurrentTaskHandle();
+    status = i2c_submit(&transfer);
+    if (status != OK) {
+        return status;
+    }
+    return i2c_wait(&transfer);
+}
+
+//==============================================================================
+/**
+ * @brief Free a stuck bus and reset the controller
+ * @note
+ *      Up to 9 SCL pulses let a slave finish a byte it is sending and
+ *      release SDA, then a STOP resets every slave's interface. The
+ *      active transfer ends with I2C_TIMEOUT if it is still pending,
+ *      queued transfers are then started.
+ */
+void i2c_bus_recover(void)
+{
+struct i2c_transfer_s   *transfer;
+uint32_t                half_bit_uS;
+
+    irq_set_enabled(I2C_IRQ, false);
+    i2c_stats.recoveries++;
+    i2c_deinit(I2C_PORT);
+    half_bit_uS = 5;                    // recover at 100kHz whatever the bus speed
+    gpio_set_function(I2C_SCL, GPIO_FUNC_SIO);
+    gpio_set_function(I2C_SDA, GPIO_FUNC_SIO);
+    gpio_put(I2C_SCL, 0);               // lines are driven low or left to pull-up
+    gpio_put(I2C_SDA, 0);
+    gpio_set_dir(I2C_SDA, GPIO_IN);
+    gpio_set_dir(I2C_SCL, GPIO_IN);
+    busy_wait_us_32(half_bit_uS);
+    for (uint32_t i = 0; (i < I2C_RECOVERY_CLOCKS) && (gpio_get(I2C_SDA) == 0); i++) {
+        gpio_set_dir(I2C_SCL, GPIO_OUT);
+        busy_wait_us_32(half_bit_uS);
+        gpio_set_dir(I2C_SCL, GPIO_IN);
+        busy_wait_us_32(half_bit_uS);
+    }
+    gpio_set_dir(I2C_SCL, GPIO_OUT);    // STOP : SDA low -> high while SCL high
+    gpio_set_dir(I2C_SDA, GPIO_OUT);
+    busy_wait_us_32(half_bit_uS);
+    gpio_set_dir(I2C_SCL, GPIO_IN);
+    busy_wait_us_32(half_bit_uS);
+    gpio_set_dir(I2C_SDA, GPIO_IN);
+    busy_wait_us_32(half_bit_uS);
+    gpio_set_function(I2C_SCL, GPIO_FUNC_I2C);
+    gpio_set_function(I2C_SDA, GPIO_FUNC_I2C);
+    i2c_init(I2C_PORT, i2c_baudrate);
+    i2c_get_hw(I2C_PORT)->intr_mask = 0;
+
+    if (active != NULL) {
+        transfer = i2c_finish((active->status == I2C_PENDING) ? I2C_TIMEOUT : active->status);
+        if ((transfer->notify_task != NULL) && (transfer->notify_task != xTaskGetCurrentTaskHandle())) {
+            xTaskNotifyGiveIndexed(transfer->notify_task, I2C_NOTIFY_INDEX);
+        }
+    } else if (queue_out != queue_in) {
+        i2c_start(queued[queue_out++ & (I2C_QUEUE_SIZE - 1)]);
+    }
+    irq_set_enabled(I2C_IRQ, true);
+}
@@ -10,6 +10,9 @@
 #include "sys_routines.h"
 #include "uart_IO.h"
 #include "neopixel.h"
+#include "cmd_queues.h"
+#include "cmd_scheduler.h"
+#include "i2c_engine.h"
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
@@ -31,10 +34,6 @@
 //==============================================================================
 // Global data
 //==============================================================================
-// set of print buffers
-
-char print_string_buffers[NOS_PRINT_STRING_BUFFERS][MAX_PRINT_STRING_LENGTH];
-
 struct task_data_s  task_data[NOS_TASKS];
 
 // FreeRTOS components handles
@@ -48,14 +47,17 @@ TaskHandle_t        taskhndl_Task_display_control;
 TaskHandle_t        taskhndl_Task_scan_touch_buttons;
 TaskHandle_t        taskhndl_Task_write_neopixels;
 TaskHandle_t        taskhndl_Task_scan_push_buttons;
+TaskHandle_t        taskhndl_Task_sys_control;
+TaskHandle_t        taskhndl_Task_run_script;
 
-QueueHandle_t       queue_print_string_buffers;
-QueueHandle_t       queue_free_buffers;
+QueueHandle_t       queue_free_batches;
 
 EventGroupHandle_t  eventgroup_uart_IO;
 
 SemaphoreHandle_t   gen4_uLCD_MUTEX_access;
 SemaphoreHandle_t   neopixel_data_MUTEX_access;
+SemaphoreHandle_t   uart_TX_MUTEX_access;
+SemaphoreHandle_t   uart_TX_space;
 
 //==============================================================================
 // System initiation
@@ -98,13 +100,13 @@ int main()
     gpio_set_dir(SWITCH_D_PIN, GPIO_IN);
     gpio_pull_up(SWITCH_D_PIN);
 
-// I2C Initialisation. Using it at 400Khz.
+// I2C Initialisation. Interrupt driven transfers at I2C_BAUDRATE (1MHz).
 
-    i2c_init(I2C_PORT, 400*1000);
     gpio_set_function(I2C_SDA, GPIO_FUNC_I2C);
     gpio_set_function(I2C_SCL, GPIO_FUNC_I2C);
     gpio_pull_up(I2C_SDA);
     gpio_pull_up(I2C_SCL);
+    i2c_engine_init(I2C_BAUDRATE);
 
     adc_init();
 
@@ -182,15 +184,33 @@ int main()
                 &taskhndl_Task_scan_push_buttons
     );
 
-    queue_print_string_buffers = xQueueCreate(NOS_PRINT_STRING_BUFFERS+1, sizeof(uint32_t));
-    queue_free_buffers   = xQueueCreate(NOS_PRINT_STRING_BUFFERS+1, sizeof(uint32_t));
-    
-    prime_free_buffer_queue();
+    xTaskCreate(Task_sys_control,
+                "Sys_command_task",
+                configMINIMAL_STACK_SIZE,
+                NULL,
+                TASK_PRIORITYBELOWNORMAL,
+                &taskhndl_Task_sys_control
+    );
+
+    xTaskCreate(Task_run_script,
+                "Run_script_task",
+                configMINIMAL_STACK_SIZE,
+                NULL,
+                TASK_PRIORITYLOW,
+                &taskhndl_Task_run_script
+    );
+
+    queue_free_batches = xQueueCreate(NOS_REPLY_BATCHES, sizeof(uint32_t));
+    prime_free_batch_queue();
+    init_cmd_queues();
+    init_cmd_scheduler();
 
     eventgroup_uart_IO = xEventGroupCreate (); 
 
     gen4_uLCD_MUTEX_access = xSemaphoreCreateMutex();
     neopixel_data_MUTEX_access = xSemaphoreCreateMutex();
+    uart_TX_MUTEX_access = xSemaphoreCreateMutex();
+    uart_TX_space = xSemaphoreCreateBinary();
 
 
     vTaskStartScheduler();
@@ -18,6 +18,7 @@
 // NUMBER    = 0->9
 // PLUSMINUS = '+' and '-'
 // DOT       = '.'
+// CMD_SEPARATOR = ';'  (between commands on one line)
 // TERM      = '\0'
 // END       = '\n'
 // OTHER     = all other characters in the 256 extended ASCII set
@@ -28,7 +29,7 @@ const uint8_t char_type[256] = {
     END    ,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER, SEPARATOR, END,     OTHER,  OTHER,     END,  OTHER,  OTHER,  // 00->0F
     OTHER  ,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,     OTHER,  OTHER,     OTHER,  OTHER,  OTHER,  // 10->1F
     SEPARATOR,  OTHER,  QUOTE,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER, PLUSMINUS,  SEPARATOR, PLUSMINUS,    DOT,  OTHER,  // 20->2F
-    NUMBER , NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER,  OTHER,     OTHER,  OTHER,     OTHER,  OTHER,  OTHER,  // 30->3F
+    NUMBER , NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER, NUMBER,  OTHER, CMD_SEPARATOR, OTHER,  OTHER,  OTHER,  OTHER,  // 30->3F
     OTHER  , LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER,    LETTER, LETTER,    LETTER, LETTER, LETTER,  // 40->4F
     LETTER , LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER,     OTHER,  OTHER,     OTHER,  OTHER, LETTER,  // 50->5F
     OTHER  , LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER, LETTER,    LETTER, LETTER,    LETTER, LETTER, LETTER,  // 40->4F
@@ -44,18 +45,42 @@ const uint8_t char_type[256] = {
      OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,  OTHER,     OTHER,  OTHER,     OTHER,  OTHER,  OTHER,  // F0->FF
 };
 
-const struct token_list_s commands[] = {
-    {"sys",     TOKENIZER_SYS},
-    {"servo",   TOKENIZER_SERVO},
-    {"stepper", TOKENIZER_STEPPER},
-    {"sync",    TOKENIZER_SYNC},
-    {"set",     TOKENIZER_SET},
-    {"get",     TOKENIZER_GET},
-    {"ping",    TOKENIZER_PING},
-    {"display", TOKENIZER_DISPLAY},
-    {"neopixel",TOKENIZER_NEOPIXEL},
-    {"switch",  TOKENIZER_SWITCH},
-    {"delay",   TOKENIZER_TDELAY},      // always last in list
+//==============================================================================
+// Command lexer transitions : [current mode][character type]
+//
+// Errors reproduce the original parser : letter or second sign in a number,
+// a second point in a real (or a point with no digits), and a quote inside
+// a word or number. A point in an integer converts it to a real.
+// ';' ends a command; the rest of the line is scanned by a later call.
+
+#define     LX(mode, action)   {mode, action}
+
+const struct lexer_entry_s lexer_table[NOS_MODES][NOS_CHAR_TYPES] = {
+//              LETTER                        NUMBER                          DOT                        PLUSMINUS                        END                       QUOTE                         SEPARATOR                CMD_SEPARATOR                OTHER
+    [MODE_U] = {LX(MODE_W, LEX_START_WORD),   LX(MODE_I, LEX_START_NUMBER),   LX(MODE_U, LEX_DOT_ERROR), LX(MODE_I, LEX_START_NUMBER),    LX(MODE_U, LEX_END_LINE), LX(MODE_S, LEX_START_STRING), LX(MODE_U, LEX_NONE),    LX(MODE_U, LEX_END_COMMAND), LX(MODE_U, LEX_NONE)},
+    [MODE_I] = {LX(MODE_I, LEX_LETTER_ERROR), LX(MODE_I, LEX_DIGIT),          LX(MODE_R, LEX_POINT),     LX(MODE_I, LEX_PLUSMINUS_ERROR), LX(MODE_U, LEX_END_LINE), LX(MODE_I, LEX_QUOTE_ERROR),  LX(MODE_U, LEX_END_ARG), LX(MODE_U, LEX_END_COMMAND), LX(MODE_I, LEX_NONE)},
+    [MODE_R] = {LX(MODE_R, LEX_LETTER_ERROR), LX(MODE_R, LEX_FRACTION_DIGIT), LX(MODE_R, LEX_DOT_ERROR), LX(MODE_R, LEX_PLUSMINUS_ERROR), LX(MODE_U, LEX_END_LINE), LX(MODE_R, LEX_QUOTE_ERROR),  LX(MODE_U, LEX_END_ARG), LX(MODE_U, LEX_END_COMMAND), LX(MODE_R, LEX_NONE)},
+    [MODE_W] = {LX(MODE_W, LEX_NONE),         LX(MODE_W, LEX_NONE),           LX(MODE_W, LEX_NONE),      LX(MODE_W, LEX_NONE),            LX(MODE_U, LEX_END_LINE), LX(MODE_W, LEX_QUOTE_ERROR),  LX(MODE_U, LEX_END_ARG), LX(MODE_U, LEX_END_COMMAND), LX(MODE_W, LEX_NONE)},
+    [MODE_S] = {LX(MODE_S, LEX_NONE),         LX(MODE_S, LEX_NONE),           LX(MODE_S, LEX_NONE),      LX(MODE_S, LEX_NONE),            LX(MODE_U, LEX_END_LINE), LX(MODE_U, LEX_END_ARG),      LX(MODE_S, LEX_NONE),    LX(MODE_S, LEX_NONE),        LX(MODE_S, LEX_NONE)},
+};
+
+//==============================================================================
+// Command keywords : indexed by token. Must match the KEYWORD_KEY cases in
+// "string_to_token" (tokenizer.c)
+
+const struct token_list_s commands[NOS_COMMANDS] = {
+    [TOKENIZER_SYS]      = {"sys",      TOKENIZER_SYS},
+    [TOKENIZER_SERVO]    = {"servo",    TOKENIZER_SERVO},
+    [TOKENIZER_STEPPER]  = {"stepper",  TOKENIZER_STEPPER},
+    [TOKENIZER_SYNC]     = {"sync",     TOKENIZER_SYNC},
+    [TOKENIZER_SET]      = {"set",      TOKENIZER_SET},
+    [TOKENIZER_GET]      = {"get",      TOKENIZER_GET},
+    [TOKENIZER_PING]     = {"ping",     TOKENIZER_PING},
+    [TOKENIZER_TDELAY]   = {"delay",    TOKENIZER_TDELAY},
+    [TOKENIZER_DISPLAY]  = {"display",  TOKENIZER_DISPLAY},
+    [TOKENIZER_NEOPIXEL] = {"neopixel", TOKENIZER_NEOPIXEL},
+    [TOKENIZER_SWITCH]   = {"switch",   TOKENIZER_SWITCH},
+    [TOKENIZER_SCRIPT]   = {"script",   TOKENIZER_SCRIPT},
 };
 
 struct error_list_s errors[] = {
@@ -73,19 +98,6 @@ struct error_list_s errors[] = {
     {BAD_STEPPER_COMMAND,  "unknown stepper motor command"},
 };
 
-//***************************************************************************
-// set of trapezoidal sm_profiles for stepper motor moves
-
- struct sm_profile_s  sequences[NOS_PROFILES] = {
-    { 7,
-        {   {SM_ACCEL,1,12},{SM_ACCEL,1,9},{SM_ACCEL,1,6,},    // fast speed
-            {SM_COAST,1,3},
-            {SM_DECEL,1,6},{SM_DECEL,1,9},{SM_DECEL,1,12},
-            {SM_END,0,0},
-        }
-    }
- };
-
 //***************************************************************************
 // General command limits : tested with "check_command" function
 // Specific limits may be tested in the command execution code
@@ -93,16 +105,17 @@ struct error_list_s errors[] = {
 struct command_limits_s    cmd_limits[NOS_COMMANDS] = {     
 // paramter        NOS_PAR     1        2       3          4         5
     [TOKENIZER_SYS].p_limits      = {{3, 3}, {0, 63}, {0, 4}},  
-    [TOKENIZER_SERVO].p_limits    = {{5, 6}, {0, 63}, {0, 8}, {0, 15}, {-90, +90}, {1, 1000}},   // servo
-    [TOKENIZER_STEPPER].p_limits  = {{4, 5}, {0, 63}, {0, 4}, {0, 0}, {-333, +333}},             // stepper
+    [TOKENIZER_SERVO].p_limits    = {{4, 7}, {0, 63}, {0, SPLINE_MOVE_SYNC}, {0, (NOS_SERVOS - 1)}, {-90, +90}, {0, 1000}, {0, TRAJ_TRAPEZOID}},   // servo
+    [TOKENIZER_STEPPER].p_limits  = {{4, 5}, {0, 63}, {0, SM_ABS_MOVE_COORD}, {0, (NOS_STEPPERS - 1)}, {-333, +333}},   // stepper
     [TOKENIZER_SYNC].p_limits     = {{2, 2}, {0, 63}, {0, 0}},                                    // sync
     [TOKENIZER_SET].p_limits      = {{0, 0}, {0,  0}, {0, 0}},                                    // config
-    [TOKENIZER_GET].p_limits      = {{3, 3}, {0, 63}, {0, 5}},                                    // info
-    [TOKENIZER_PING].p_limits     = {{3, 3}, {0, 63}, {-255, +255}},                             // ping,
+    [TOKENIZER_GET].p_limits      = {{3, 4}, {0, 63}, {0, 8}, {0, (NOS_CMD_QUEUES - 1)}},        // info
+    [TOKENIZER_PING].p_limits     = {{3, 4}, {0, 63}, {-255, +255}, {0, 1}},                     // ping,
     [TOKENIZER_TDELAY].p_limits   = {{3, 3}, {0, 63}, {0, 50000}},                               // delay
     [TOKENIZER_DISPLAY].p_limits  = {{4, 5}, {0, 63}, {0, 9}, {0, 0}, {0, 0}},                   // display
     [TOKENIZER_NEOPIXEL].p_limits = {{4, 8}, {0, 63}, {0, 4}, {0, 4}, {N_WHITE, N_BLACK}, {0, 50}, {N_WHITE, N_BLACK}, {0, 50}},   // neopixel
     [TOKENIZER_SWITCH].p_limits   = {{3, 3}, {0, 63}, {0, NOS_SWITCHES}},
+    [TOKENIZER_SCRIPT].p_limits   = {{3, 8}, {0, 63}, {0, 4}, {0, NOS_SCRIPTS}, {0, SCRIPT_SLOT_SIZE}},   // script
 };
 
 //==============================================================================
@@ -120,6 +133,41 @@ struct servo_data_s     servo_data[NOS_SERVOS] = {
     {DORMANT, false, MOTOR, 0, 0, 0, 45, false, -45, +45, 60, 10},
 };
 
+//==============================================================================
+// PCA9685 board addresses, and the board and channel of each servo
+
+const uint8_t   PCA9685_board_address[PCA9685_NOS_BOARDS] = {
+    PCA9685_BASE_ADDRESS,
+};
+
+const struct servo_channel_s    servo_channel_map[NOS_SERVOS] = {
+    [R_EYE_LR]   = {0, 0},
+    [R_EYE_UD]   = {0, 1},
+    [R_EYE_LID]  = {0, 2},
+    [R_EYE_BROW] = {0, 3},
+    [L_EYE_LR]   = {0, 4},
+    [L_EYE_UD]   = {0, 5},
+    [L_EYE_LID]  = {0, 6},
+    [L_EYE_BROW] = {0, 7},
+    [MOUTH]      = {0, 8},
+};
+
+//==============================================================================
+// servo nonlinearity correction : PWM counts added at -90, -45, 0, +45 
+// and +90 degrees (physical, after any flip). Linear between points.
+
+const int8_t    servo_correction[NOS_SERVOS][SERVO_CORRECTION_POINTS] = {
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+};
+
 //==============================================================================
 // Data relevant to the 8 commands used to communicate with the
 // 4D Systems Gen4 Diablo16 based display
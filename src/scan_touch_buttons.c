@@ -49,7 +49,7 @@ touch_button_data_ts  *obj_pt;
     vTaskDelay(4000);
     xLastWakeTime = xTaskGetTickCount ();
     FOREVER {
-        xWasDelayed = xTaskDelayUntil( &xLastWakeTime, TASK_SERVO_CONTROL_FREQUENCY_TICK_COUNT );
+        xWasDelayed = xTaskDelayUntil( &xLastWakeTime, TASK_SCAN_TOUCH_BUTTONS_FREQUENCY_TICK_COUNT );
         start_time = time_us_32();
 
         current_form = get_uLCD_active_form();
@@ -87,7 +87,6 @@ touch_button_data_ts  *obj_pt;
         }
         end_time = time_us_32();
         update_task_execution_time(TASK_SCAN_TOUCH_BUTTONS, start_time, end_time);  
-        vTaskDelay(TASK_SCAN_TOUCH_BUTTONS_FREQUENCY_TICK_COUNT); 
     }
 }
 
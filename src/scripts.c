@@ -0,0 +1,448 @@
+/**
+ * @file    scripts.c
+ * @author  Jim Herd
+ * @brief   Bytecode scripts stored in flash
+ * @note
+ *      A script is a sequence of ordinary commands plus waits, delays and
+ *      loops (format in "system.h"). Commands are checked and queued to
+ *      their subsystem tasks exactly as if they came from the host, so
+ *      scripts use the same handlers (set_servo_move, etc).
+ * 
+ *      Scripts are uploaded with "script <port> 0 ..." into a RAM copy of
+ *      the flash sector and written to flash with "script <port> 1", which
+ *      is refused while anything is moving. The host must stay quiet until
+ *      the save is acknowledged (see "script_save").
+ *      Running scripts always execute the flash copy. Up to
+ *      NOS_SCRIPT_RUNNERS scripts run at the same time in "Task_run_script".
+ */
+
+#include    <string.h>
+
+#include    "pico/stdlib.h"
+#include    "hardware/flash.h"
+#include    "hardware/sync.h"
+
+#include    "FreeRTOS.h"
+#include    "task.h"
+#include    "queue.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "scripts.h"
+#include    "sys_routines.h"
+
+#define     SCRIPT_FLASH_OFFSET     (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+#if ((NOS_SCRIPTS * SCRIPT_SLOT_SIZE) != FLASH_SECTOR_SIZE)
+    #error "Script slots must fill exactly one flash sector"
+#endif
+
+//==============================================================================
+// Script data
+//==============================================================================
+
+static uint8_t script_image[FLASH_SECTOR_SIZE];     // upload copy of flash sector
+static struct script_runner_s  script_runners[NOS_SCRIPT_RUNNERS];
+static int32_t last_error[NOS_SCRIPTS];
+
+static inline const uint8_t *script_slot(uint32_t script_id)
+{
+    return (const uint8_t *)(XIP_BASE + SCRIPT_FLASH_OFFSET + (script_id * SCRIPT_SLOT_SIZE));
+}
+
+static inline int32_t read_int16(const uint8_t *pt)
+{
+    return (int16_t)(pt[0] | (pt[1] << 8));
+}
+
+static inline uint32_t read_uint16(const uint8_t *pt)
+{
+    return (pt[0] | (pt[1] << 8));
+}
+
+//==============================================================================
+/**
+ * @brief Load upload copy from flash and clear all runners
+ */
+void init_scripts(void)
+{
+    memcpy(script_image, script_slot(0), FLASH_SECTOR_SIZE);
+    for (uint32_t i = 0; i < NOS_SCRIPT_RUNNERS; i++) {
+        script_runners[i].state = RUNNER_IDLE;
+    }
+    for (uint32_t i = 0; i < NOS_SCRIPTS; i++) {
+        last_error[i] = OK;
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Write part of a script slot in the upload copy
+ * 
+ * @param script_id     slot number
+ * @param offset        byte offset in slot, a multiple of 4 (slot starts with the code length)
+ * @param words         data, 4 bytes per word, least significant byte first
+ * @param nos_words     number of words
+ * @return error_codes_te 
+ */
+error_codes_te script_load(uint32_t script_id, uint32_t offset, const int32_t *words, uint32_t nos_words)
+{
+uint8_t     *pt;
+
+    if ((script_id >= NOS_SCRIPTS) || (offset > SCRIPT_SLOT_SIZE) || ((offset & 3) != 0)) {
+        return SCRIPT_BAD_ADDRESS;
+    }
+    if ((nos_words * 4) > (SCRIPT_SLOT_SIZE - offset)) {     // no wrap : offset checked above
+        return SCRIPT_BAD_ADDRESS;
+    }
+    pt = &script_image[(script_id * SCRIPT_SLOT_SIZE) + offset];
+    for (uint32_t i = 0; i < nos_words; i++) {
+        *pt++ =  words[i]        & 0xFF;
+        *pt++ = (words[i] >> 8)  & 0xFF;
+        *pt++ = (words[i] >> 16) & 0xFF;
+        *pt++ = (words[i] >> 24) & 0xFF;
+    }
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Test if an axis (or all axes of a type) is still moving
+ * @note
+ *      A move still waiting in the subsystem's command queue counts as
+ *      moving. "Task_run_script" runs below the servo and stepper tasks,
+ *      so it never sees a command taken from a queue but not yet run.
+ */
+static bool axis_busy(uint32_t axis_type, uint32_t axis_number)
+{
+uint32_t    first, last;
+
+    first = axis_number;
+    last  = axis_number;
+    if (axis_type == AXIS_SERVO) {
+        if (axis_number == ALL_AXES) {
+            first = 0;
+            last  = NOS_SERVOS - 1;
+        }
+        if (uxQueueMessagesWaiting(cmd_queues[CMD_QUEUE_SERVO].queue) != 0) {
+            return true;
+        }
+        for (uint32_t i = first; i <= last; i++) {
+            if ((servo_data[i].state == MOVE) || (servo_data[i].state == TIMED_MOVE) ||
+                (servo_data[i].state == TRAJECTORY_MOVE) || (servo_data[i].state == DELAY)) {
+                return true;
+            }
+        }
+    } else {
+        if (axis_number == ALL_AXES) {
+            first = 0;
+            last  = NOS_STEPPERS - 1;
+        }
+        if (uxQueueMessagesWaiting(cmd_queues[CMD_QUEUE_STEPPER].queue) != 0) {
+            return true;
+        }
+        for (uint32_t i = first; i <= last; i++) {
+            if ((stepper_data[i].state != STATE_SM_DORMANT) && (stepper_data[i].state != STATE_SM_FAULT)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//==============================================================================
+/**
+ * @brief Write the upload copy to flash
+ * @return error_codes_te   SERVO_BUSY/STEPPER_BUSY if anything is moving
+ * @note
+ *      All scripts are stopped first as they run from this sector.
+ *      Interrupts are off for the erase/program time (sector erase 45mS
+ *      typical, 400mS max) and code cannot be fetched from flash while
+ *      it is being written. Stepper segments are chained by DMA_IRQ_0 and
+ *      servo updates need the I2C interrupt, so a save is refused while
+ *      any axis is moving. The motion tasks share the priority of the
+ *      command task, so a move taken from its queue but not yet started
+ *      can be missed : hosts should wait for "done" before saving.
+ * 
+ *      The receive DMA keeps running but nothing scans its ring, which
+ *      holds about 22mS of data at 115200 baud. The host must send
+ *      nothing after a save command until its reply arrives.
+ */
+error_codes_te script_save(void)
+{
+uint32_t    interrupts;
+
+    if (axis_busy(AXIS_SERVO, ALL_AXES) == true) {
+        return SERVO_BUSY;
+    }
+    if (axis_busy(AXIS_STEPPER, ALL_AXES) == true) {
+        return STEPPER_BUSY;
+    }
+    script_stop(ALL_SCRIPTS);
+    interrupts = save_and_disable_interrupts();
+    flash_range_erase(SCRIPT_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(SCRIPT_FLASH_OFFSET, script_image, FLASH_SECTOR_SIZE);
+    restore_interrupts(interrupts);
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Start a script on a free runner
+ * 
+ * @param script_id         slot number
+ * @param parameters        values for OP_CMD parameter substitution
+ * @param nos_parameters    number of values (others are 0)
+ * @param seq_id            send "done <id> <status>" when script ends (0 = none)
+ * @return error_codes_te 
+ */
+error_codes_te script_start(uint32_t script_id, const int32_t *parameters, uint32_t nos_parameters, uint32_t seq_id)
+{
+struct script_runner_s  *runner;
+const uint8_t           *slot;
+uint32_t                length;
+
+    if (script_id >= NOS_SCRIPTS) {
+        return SCRIPT_EMPTY;
+    }
+    slot = script_slot(script_id);
+    length = read_uint16(slot);
+    if ((length == SCRIPT_EMPTY_LENGTH) || (length > (SCRIPT_SLOT_SIZE - SCRIPT_HEADER_SIZE))) {
+        return SCRIPT_EMPTY;
+    }
+    runner = NULL;
+    for (uint32_t i = 0; i < NOS_SCRIPT_RUNNERS; i++) {
+        if (script_runners[i].state == RUNNER_IDLE) {
+            runner = &script_runners[i];
+            break;
+        }
+    }
+    if (runner == NULL) {
+        return SCRIPT_NO_RUNNER;
+    }
+    runner->script_id  = script_id;
+    runner->code       = &slot[SCRIPT_HEADER_SIZE];
+    runner->length     = length;
+    runner->pc         = 0;
+    runner->time_point = xTaskGetTickCount();
+    runner->loop_depth = 0;
+    runner->seq_id     = seq_id;
+    runner->error      = OK;
+    for (uint32_t i = 0; i < NOS_SCRIPT_PARAMETERS; i++) {
+        runner->parameters[i] = (i < nos_parameters) ? parameters[i] : 0;
+    }
+    runner->state = RUNNER_RUNNING;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Finish a script : record status and send any "done" line
+ */
+static void end_script(struct script_runner_s *runner, int32_t status)
+{
+    runner->error = status;
+    runner->state = RUNNER_IDLE;
+    last_error[runner->script_id] = status;
+    print_move_done(&runner->seq_id, status);
+}
+
+//==============================================================================
+/**
+ * @brief Stop all running copies of a script
+ * 
+ * @param script_id     slot number or ALL_SCRIPTS
+ * @note
+ *      Moves already queued by the script are not cancelled.
+ */
+void script_stop(uint32_t script_id)
+{
+    for (uint32_t i = 0; i < NOS_SCRIPT_RUNNERS; i++) {
+        if ((script_runners[i].state == RUNNER_RUNNING) &&
+            ((script_id == ALL_SCRIPTS) || (script_runners[i].script_id == script_id))) {
+            end_script(&script_runners[i], OK);
+        }
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Report whether a script is running, its position and last error
+ */
+void script_status(uint32_t script_id, int32_t *running, int32_t *pc, int32_t *error)
+{
+    *running = 0;
+    *pc = 0;
+    *error = (script_id < NOS_SCRIPTS) ? last_error[script_id] : OK;
+    for (uint32_t i = 0; i < NOS_SCRIPT_RUNNERS; i++) {
+        if ((script_runners[i].state == RUNNER_RUNNING) && (script_runners[i].script_id == script_id)) {
+            *running = 1;
+            *pc = script_runners[i].pc;
+            *error = script_runners[i].error;
+            break;
+        }
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Build an OP_CMD command message and queue it
+ * 
+ * @return int32_t  OK (pc moved on), CMD_QUEUE_FULL (try again) or error
+ */
+static int32_t script_command(struct script_runner_s *runner)
+{
+const uint8_t           *code;
+uint32_t                nos_args, size, subst_mask;
+int32_t                 value, status;
+struct cmd_message_s    cmd;
+
+    code = &runner->code[runner->pc];
+    nos_args = code[2];
+    subst_mask = code[3];
+    size = 4 + (2 * nos_args);
+    if ((nos_args > (MAX_ARGC - 2)) || ((runner->pc + size) > runner->length)) {
+        return SCRIPT_BAD_OPCODE;
+    }
+    cmd.token = code[1];
+    cmd.argc  = nos_args + 2;
+    cmd.int_parameters[PRIMARY_CMD_INDEX] = cmd.token;
+    cmd.int_parameters[PORT_INDEX] = 0;
+    for (uint32_t i = 0; i < nos_args; i++) {
+        value = read_int16(&code[4 + (2 * i)]);
+        if ((subst_mask & (1 << i)) != 0) {
+            if ((value < 0) || (value >= NOS_SCRIPT_PARAMETERS)) {
+                return PARAMETER_OUTWITH_LIMITS;
+            }
+            value = runner->parameters[value];
+        }
+        cmd.int_parameters[i + 2] = value;
+    }
+    cmd.stage  = 0;
+    cmd.seq_id = 0;
+    cmd.string[0] = STRING_NULL;
+    cmd.reply.transport = TRANSPORT_NONE;   // scripts run silently
+    cmd.reply.batch = NULL;
+    status = post_script_command(&cmd);
+    if (status == OK) {
+        runner->pc += size;
+    }
+    return status;
+}
+
+//==============================================================================
+/**
+ * @brief Run one script until it has to wait
+ * 
+ * @param runner    running script
+ * @param now       current tick count
+ * @return TickType_t   ticks until the script needs to run again
+ */
+static TickType_t run_script(struct script_runner_s *runner, TickType_t now)
+{
+const uint8_t   *code;
+int32_t         status;
+TickType_t      target;
+struct script_loop_s    *loop;
+
+    code = runner->code;
+    for (uint32_t steps = 0; steps < MAX_SCRIPT_STEPS; steps++) {
+        if (runner->pc >= runner->length) {
+            end_script(runner, OK);
+            return portMAX_DELAY;
+        }
+        status = OK;
+        switch (code[runner->pc]) {
+            case OP_END :
+                end_script(runner, OK);
+                return portMAX_DELAY;
+            case OP_CMD :
+                status = script_command(runner);
+                if (status == CMD_QUEUE_FULL) {
+                    return 1;               // subsystem busy : retry next tick
+                }
+                break;
+            case OP_WAIT :
+                if (((runner->pc + 3) > runner->length) || (code[runner->pc + 1] > AXIS_STEPPER) ||
+                    ((code[runner->pc + 2] != ALL_AXES) &&
+                     (code[runner->pc + 2] >= ((code[runner->pc + 1] == AXIS_SERVO) ? NOS_SERVOS : NOS_STEPPERS)))) {
+                    status = SCRIPT_BAD_OPCODE;
+                    break;
+                }
+                if (axis_busy(code[runner->pc + 1], code[runner->pc + 2]) == true) {
+                    return SCRIPT_WAIT_POLL_TICKS;
+                }
+                runner->time_point = now;   // delays now count from end of motion
+                runner->pc += 3;
+                break;
+            case OP_DELAY :
+                if ((runner->pc + 3) > runner->length) {
+                    status = SCRIPT_BAD_OPCODE;
+                    break;
+                }
+                target = runner->time_point + pdMS_TO_TICKS(read_uint16(&code[runner->pc + 1]));
+                if ((int32_t)(target - now) > 0) {
+                    return (target - now);
+                }
+                runner->time_point = target;    // no drift over a sequence of delays
+                runner->pc += 3;
+                break;
+            case OP_LOOP :
+                if (((runner->pc + 3) > runner->length) || (runner->loop_depth >= MAX_SCRIPT_LOOP_DEPTH)) {
+                    status = SCRIPT_LOOP_ERROR;
+                    break;
+                }
+                loop = &runner->loops[runner->loop_depth++];
+                loop->count = read_uint16(&code[runner->pc + 1]);
+                runner->pc += 3;
+                loop->start_pc = runner->pc;
+                break;
+            case OP_NEXT :
+                if (runner->loop_depth == 0) {
+                    status = SCRIPT_LOOP_ERROR;
+                    break;
+                }
+                loop = &runner->loops[runner->loop_depth - 1];
+                if (loop->count == 0) {                 // forever
+                    runner->pc = loop->start_pc;
+                } else if (--loop->count != 0) {
+                    runner->pc = loop->start_pc;
+                } else {
+                    runner->loop_depth--;
+                    runner->pc++;
+                }
+                break;
+            default :
+                status = SCRIPT_BAD_OPCODE;
+                break;
+        }
+        if (status != OK) {
+            end_script(runner, status);
+            return portMAX_DELAY;
+        }
+    }
+    return 1;       // step limit reached : let other scripts run
+}
+
+//==============================================================================
+/**
+ * @brief Give each running script a turn
+ * 
+ * @return TickType_t   ticks until a script next needs to run
+ */
+TickType_t run_scripts(void)
+{
+TickType_t  now, wait_ticks, ticks;
+
+    now = xTaskGetTickCount();
+    wait_ticks = portMAX_DELAY;
+    for (uint32_t i = 0; i < NOS_SCRIPT_RUNNERS; i++) {
+        if (script_runners[i].state == RUNNER_RUNNING) {
+            ticks = run_script(&script_runners[i], now);
+            if (ticks < wait_ticks) {
+                wait_ticks = ticks;
+            }
+        }
+    }
+    return wait_ticks;
+}
@@ -0,0 +1,413 @@
+/**
+ * @file    step_profile.c
+ * @author  Jim Herd
+ * @brief   Stepper motor acceleration profiles
+ * @note
+ *      A move of D steps, entered at speed ve and left at speed vx, is
+ *      planned in time slices
+ *
+ *          Ta, Tja : slices of the ramp from ve to the peak speed vp,
+ *                    Tja of them at each end of the ramp with constant jerk
+ *          Tc, Tf  : slices, then PIO cycles, of cruise at vp
+ *          Tb, Tjb : slices of the ramp from vp to vx
+ *
+ *      A ramp is symmetric, so it covers (v1 + v2).T/2 steps. The planner
+ *      finds the highest peak speed whose shortest ramps fit in the move
+ *      and cruises for the rest of the distance. The cruise is a whole
+ *      number of slices plus a part slice, so every speed is exactly as
+ *      planned and a move can run on into the next at its exit speed.
+ *
+ *      A slice is generated by integrating jerk, acceleration and speed
+ *      over the slice in 32.32 fixed point, and the steps of the last slice
+ *      are whatever is left of D. Each slice becomes one (step count,
+ *      period) segment for the PIO. Periods are in PIO cycles and any
+ *      remainder is carried into the next segment, so no time is lost to
+ *      rounding.
+ */
+
+#include    <stdlib.h>
+
+#include    "pico/stdlib.h"
+
+#include    "system.h"
+#include    "step_profile.h"
+
+#define     F       ((int64_t)STEP_SLICES_PER_SEC)
+
+//==============================================================================
+/**
+ * @brief integer square root (floor)
+ */
+static uint64_t isqrt64(uint64_t value)
+{
+uint64_t    root, bit;
+
+    root = 0;
+    bit  = (uint64_t)1 << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= (root + bit)) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+static inline int64_t ceil_div(int64_t numerator, int64_t denominator)
+{
+    return (numerator + denominator - 1) / denominator;
+}
+
+/**
+ * @brief numerator/denominator as 32.32 fixed point (denominator < 2^47)
+ */
+static int64_t q32_div(int64_t numerator, int64_t denominator)
+{
+int64_t     quotient, remainder;
+bool        negative;
+
+    negative = (numerator < 0);
+    if (negative == true) {
+        numerator = -numerator;
+    }
+    quotient  = numerator / denominator;
+    remainder = numerator % denominator;
+    for (uint32_t i=0; i < 2; i++) {
+        remainder <<= 16;
+        quotient = (quotient << 16) + (remainder / denominator);
+        remainder %= denominator;
+    }
+    return (negative == true) ? -quotient : quotient;
+}
+
+//==============================================================================
+/**
+ * @brief shortest legal ramp for a change of speed
+ *
+ * @param change        speed change (steps/sec), either sign
+ * @param T             slices of ramp
+ * @param Tj            slices of constant jerk at each end of the ramp
+ */
+static void ramp_time(int64_t change, int64_t max_accel, int64_t max_jerk, int64_t *T, int64_t *Tj)
+{
+    change = llabs(change);
+    if (change == 0) {
+        *T = *Tj = 0;
+    } else if (max_jerk == 0) {
+        *Tj = 0;
+        *T  = ceil_div(change * F, max_accel);
+    } else if ((change * max_jerk) < (max_accel * max_accel)) {
+        *Tj = isqrt64(ceil_div(change * F * F, max_jerk));   // acceleration limit not reached
+        if ((*Tj * *Tj * max_jerk) < (change * F * F)) {
+            (*Tj)++;
+        }
+        *T = 2 * *Tj;
+    } else {
+        *Tj = ceil_div(max_accel * F, max_jerk);
+        *T  = *Tj + ceil_div(change * F, max_accel);
+    }
+}
+
+/**
+ * @brief distance of the shortest ramp between two speeds (steps x 2.F)
+ */
+static int64_t ramp_distance(int64_t from_speed, int64_t to_speed, int64_t max_accel, int64_t max_jerk)
+{
+int64_t     T, Tj;
+
+    ramp_time(to_speed - from_speed, max_accel, max_jerk, &T, &Tj);
+    return (from_speed + to_speed) * T;
+}
+
+//==============================================================================
+/**
+ * @brief fastest speed that can be reached from, or brought down to, a
+ *        speed within a distance
+ *
+ * @param speed         steps/sec at one end of the move
+ * @param distance      steps (magnitude)
+ * @return int32_t      steps/sec at the other end, no more than max_speed
+ */
+int32_t step_profile_reach(int32_t speed, int32_t distance, int32_t max_speed, int32_t max_accel, int32_t max_jerk)
+{
+int64_t     lo, hi, mid;
+
+    if (speed >= max_speed) {
+        return max_speed;
+    }
+    if (ramp_distance(speed, max_speed, max_accel, max_jerk) <= (2 * distance * F)) {
+        return max_speed;
+    }
+    lo = speed;         // always reachable
+    hi = max_speed;     // never reachable
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) / 2;
+        if (ramp_distance(speed, mid, max_accel, max_jerk) <= (2 * distance * F)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int32_t)lo;
+}
+
+//==============================================================================
+/**
+ * @brief fastest exit speed of a move, up to a limit
+ *
+ * @param entry_speed   steps/sec
+ * @param exit_limit    steps/sec : set by the moves that follow
+ * @param distance      steps (magnitude)
+ * @return int32_t      steps/sec
+ *
+ * @note    Slowing to a low speed takes almost as long as stopping, at a
+ *          higher mean speed, so it can need a little more distance. If
+ *          the limit falls in that gap the exit is taken from below it.
+ */
+int32_t step_profile_exit(int32_t entry_speed, int32_t exit_limit, int32_t distance, int32_t max_speed, int32_t max_accel, int32_t max_jerk)
+{
+int64_t     lo, hi, mid;
+
+    if (exit_limit > max_speed) {
+        exit_limit = max_speed;
+    }
+    if (exit_limit >= entry_speed) {
+        hi = step_profile_reach(entry_speed, distance, max_speed, max_accel, max_jerk);
+        return (hi < exit_limit) ? (int32_t)hi : exit_limit;
+    }
+    if (ramp_distance(entry_speed, exit_limit, max_accel, max_jerk) <= (2 * distance * F)) {
+        return exit_limit;
+    }
+    lo = 0;
+    hi = exit_limit;
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) / 2;
+        if (ramp_distance(entry_speed, mid, max_accel, max_jerk) <= (2 * distance * F)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int32_t)lo;
+}
+
+//==============================================================================
+/**
+ * @brief plan a time optimal move between two speeds
+ *
+ * @param profile       profile to initialise
+ * @param distance      steps (magnitude)
+ * @param entry_speed   steps/sec at start of move
+ * @param exit_speed    steps/sec at end of move
+ * @param max_speed     steps/sec
+ * @param max_accel     steps/sec/sec
+ * @param max_jerk      steps/sec/sec/sec : 0 for a trapezoidal profile
+ * @return error_codes_te
+ *
+ * @note    The move must be long enough to go from entry to exit speed
+ *          ("step_profile_exit" gives an exit speed that is).
+ */
+error_codes_te step_profile_plan(struct step_profile_s *profile, int32_t distance, int32_t entry_speed, int32_t exit_speed,
+                                 int32_t max_speed, int32_t max_accel, int32_t max_jerk)
+{
+int64_t     D, ve, vx, lo, hi, mid, remainder;
+int64_t     Ta, Tja, Tb, Tjb;
+
+    profile->distance    = distance;
+    profile->lead_distance = distance;
+    profile->entry_speed = entry_speed;
+    profile->exit_speed  = exit_speed;
+    profile->slice       = 0;
+    profile->position    = 0;
+    profile->Ta = profile->Tja = profile->Tc = profile->Tf = profile->Tb = profile->Tjb = profile->nos_slices = 0;
+    profile->peak = 0;
+    if ((distance == 0) && (entry_speed == 0) && (exit_speed == 0)) {
+        return OK;
+    }
+    if ((distance <= 0) || (distance > STEP_MAX_DISTANCE) || (max_speed <= 0) || (max_accel <= 0) || (max_jerk < 0)
+         || (entry_speed < 0) || (entry_speed > max_speed) || (exit_speed < 0) || (exit_speed > max_speed)) {
+        return PARAMETER_OUTWITH_LIMITS;
+    }
+    D  = distance;
+    ve = entry_speed;
+    vx = exit_speed;
+    //
+    // highest peak speed with ramps that fit in the move
+    //
+    lo = (ve > vx) ? ve : vx;
+    if (lo == 0) {
+        lo = 1;
+    }
+    if ((ramp_distance(ve, lo, max_accel, max_jerk) + ramp_distance(lo, vx, max_accel, max_jerk)) > (2 * D * F)) {
+        return PARAMETER_OUTWITH_LIMITS;        // too short to change speed
+    }
+    hi = max_speed;
+    if ((ramp_distance(ve, hi, max_accel, max_jerk) + ramp_distance(hi, vx, max_accel, max_jerk)) <= (2 * D * F)) {
+        lo = hi;
+    }
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) / 2;
+        if ((ramp_distance(ve, mid, max_accel, max_jerk) + ramp_distance(mid, vx, max_accel, max_jerk)) <= (2 * D * F)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    ramp_time(lo - ve, max_accel, max_jerk, &Ta, &Tja);
+    ramp_time(lo - vx, max_accel, max_jerk, &Tb, &Tjb);
+    //
+    // cruise for the rest : whole slices, then PIO cycles
+    //
+    remainder = (2 * D * F) - ((ve + lo) * Ta) - ((lo + vx) * Tb);
+    profile->Ta  = Ta;
+    profile->Tja = Tja;
+    profile->Tc  = remainder / (2 * lo);
+    profile->Tf  = ((remainder % (2 * lo)) * STEP_SLICE_CYCLES) / (2 * lo);
+    profile->Tb  = Tb;
+    profile->Tjb = Tjb;
+    profile->nos_slices = Ta + ((profile->Tf != 0) ? 1 : 0) + profile->Tc + Tb;
+    profile->peak = q32_div(lo, F);
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief plan a move that follows the timing of another
+ *
+ * @param profile       profile to initialise
+ * @param leader        planned move (start and end at rest) of the axis
+ *                      with most steps
+ * @param distance      steps (magnitude, no more than leader distance)
+ *
+ * @note    The leader's profile is generated as it is and each position
+ *          scaled by distance / leader distance, so this is the DDA of the
+ *          leader's path : each axis is within a step of the straight line
+ *          at every slice, and all finish together. Scaling the speeds
+ *          instead lets truncation in each axis drift off the line.
+ */
+void step_profile_follow(struct step_profile_s *profile, const struct step_profile_s *leader, int32_t distance)
+{
+    *profile = *leader;
+    profile->distance = distance;
+    profile->slice    = 0;
+    profile->position = 0;
+}
+
+//==============================================================================
+/**
+ * @brief set acceleration and jerk at a slice of a ramp
+ *
+ * @param change    speed change of ramp : steps/slice, 32.32
+ * @param u         slice from start of ramp
+ *
+ * @note    Each phase starts from its exact acceleration, so rounding in
+ *          the integration doesn't build up.
+ */
+static void ramp_slice(struct step_profile_s *profile, int64_t change, int64_t T, int64_t Tj, int64_t u)
+{
+int64_t     accel;
+
+    accel = change / (T - Tj);
+    if (u < Tj) {
+        if (u == 0) {
+            profile->a = 0;
+        }
+        profile->j = accel / Tj;
+    } else if (u < (T - Tj)) {
+        if (u == Tj) {
+            profile->a = accel;
+        }
+        profile->j = 0;
+    } else {
+        if (u == (T - Tj)) {
+            profile->a = accel;
+        }
+        profile->j = (Tj != 0) ? (-accel / Tj) : 0;
+    }
+}
+
+//==============================================================================
+/**
+ * @brief next (step count, period) segment of a move
+ *
+ * @param profile       planned move
+ * @param carry         PIO cycles not yet allocated to a step (kept from
+ *                      one move to the next)
+ * @param nos_steps     steps in segment
+ * @param period        PIO cycles per step
+ * @return true         segment generated
+ * @return false        move complete
+ *
+ * @note    Slices with no steps add their time to the next segment.
+ */
+bool step_profile_next(struct step_profile_s *profile, uint32_t *carry, uint32_t *nos_steps, uint32_t *period)
+{
+int64_t     s, Ta, cruise_end, position;
+uint32_t    steps, cycles;
+
+    Ta = profile->Ta;
+    cruise_end = profile->nos_slices - profile->Tb;
+    while (profile->slice < profile->nos_slices) {
+        s = profile->slice;
+        if (s == 0) {
+            profile->p = 0;
+            profile->v = q32_div(profile->entry_speed, F);
+        }
+        if (s == Ta) {
+            profile->v = profile->peak;
+            profile->a = profile->j = 0;
+        }
+        if (s < Ta) {
+            ramp_slice(profile, profile->peak - q32_div(profile->entry_speed, F), Ta, profile->Tja, s);
+        } else if (s >= cruise_end) {
+            ramp_slice(profile, q32_div(profile->exit_speed, F) - profile->peak, profile->Tb, profile->Tjb, s - cruise_end);
+        }
+        profile->slice++;
+        if ((s == Ta) && (profile->Tf != 0)) {
+            profile->p += (profile->v * profile->Tf) / STEP_SLICE_CYCLES;    // part slice of cruise
+            *carry += profile->Tf;
+            if (profile->slice < profile->nos_slices) {
+                continue;       // steps go out with the next slice
+            }
+        } else {
+            profile->p += profile->v + (profile->a / 2) + (profile->j / 6);
+            profile->v += profile->a + (profile->j / 2);
+            profile->a += profile->j;
+            *carry += STEP_SLICE_CYCLES;
+            if ((profile->slice == Ta) && (profile->Tf != 0) && ((Ta + 1) == profile->nos_slices)) {
+                continue;       // ... or with the slice before, if it is the last
+            }
+        }
+        if (profile->slice == profile->nos_slices) {
+            position = profile->distance;
+        } else {
+            position = profile->p >> 32;
+            if (profile->lead_distance != profile->distance) {
+                position = (((profile->p >> 16) * profile->distance) / profile->lead_distance) >> 16;    // follower : < 2^56
+            }
+            if (position > profile->distance) {
+                position = profile->distance;
+            }
+        }
+        if (position <= profile->position) {
+            continue;
+        }
+        steps = position - profile->position;
+        profile->position = position;
+        cycles = *carry / steps;
+        *carry -= cycles * steps;
+        if (cycles < STEPPER_MIN_PERIOD) {
+            cycles = STEPPER_MIN_PERIOD;
+        }
+        *nos_steps = steps;
+        *period    = cycles;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,480 @@
+/**
+ * @file    stepper_pio.c
+ * @author  Jim Herd
+ * @brief   PIO step pulse generation for stepper motors
+ * @note
+ *      Each stepper has a PIO state machine (see stepper.pio) that turns
+ *      (direction/step count, period) segments into STEP and DIR signals,
+ *      so step timing is exact to one PIO cycle and takes no CPU time.
+ * 
+ *      Segments reach the PIO FIFO by DMA from a buffer of two halves.
+ *      When the DMA finishes one half its interrupt starts the other, if
+ *      it is ready, and frees the half just sent. The stepper task refills
+ *      free halves from the move queue every poll. If the DMA finds no
+ *      ready half before the end of a move the PIO stalls with STEP low,
+ *      the underrun is counted, and the task restarts the DMA on its next
+ *      refill.
+ * 
+ *      A run of queued moves is complete when all segments have been sent
+ *      and the PIO has stalled on its empty FIFO (FDEBUG TXSTALL).
+ *
+ *      A run stopped early (limit switch) counts the steps it made from the
+ *      steps sent by DMA, less the segments left in the FIFO and the steps
+ *      left of the running segment. The last words sent are kept, as the
+ *      buffer half they came from may have been refilled.
+ */
+
+#include    "pico/stdlib.h"
+#include    "hardware/pio.h"
+#include    "hardware/dma.h"
+#include    "hardware/irq.h"
+
+#include    "FreeRTOS.h"
+#include    "task.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "stepper_queue.h"
+#include    "stepper_pio.h"
+
+#include    "stepper.pio.h"
+
+#define     FEED_WORDS      (2 * STEPPER_FEED_SEGMENTS)
+#define     FEED_TAIL_WORDS (8 + 2)     // joined TX FIFO and the running segment
+
+#if (STEPPER_MIN_PERIOD <= stepper_STEP_OVERHEAD)
+    #error "STEPPER_MIN_PERIOD must be longer than the PIO step overhead"
+#endif
+
+#if (FEED_WORDS < FEED_TAIL_WORDS)
+    #error "STEPPER_FEED_SEGMENTS must cover the PIO FIFO and a running segment"
+#endif
+
+//==============================================================================
+// Feed data
+//==============================================================================
+
+struct stepper_feed_s {
+    uint32_t    buffer[2][FEED_WORDS];
+    uint32_t    nos_words[2];       // words ready in each half (0 = free)
+    uint32_t    fill_half;          // next half to refill
+    uint32_t    send_half;          // half being (or next to be) sent
+    int32_t     half_steps[2];      // steps in each half, +ve clockwise
+    int32_t     sent_steps;         // steps of halves sent to the PIO FIFO
+    uint32_t    sent_segments;      // segments of those halves
+    uint32_t    tail[FEED_TAIL_WORDS];  // last words of those halves
+    uint32_t    tail_words;
+    bool        started;
+    bool        running;            // DMA transfer in progress
+    bool        finished;           // all segments of queued moves are in the buffer
+};
+
+static struct stepper_feed_s    stepper_feed[NOS_STEPPERS];
+static uint32_t                 stepper_pio_offset;
+
+struct stepper_stats_s          stepper_stats;
+
+//==============================================================================
+/**
+ * @brief send a buffer half to the PIO (interrupts off)
+ */
+static void feed_start(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+
+    feed = &stepper_feed[stepper_no];
+    STEPPER_PIO_UNIT->fdebug = (1u << (PIO_FDEBUG_TXSTALL_LSB + stepper_no));
+    dma_channel_transfer_from_buffer_now(STEPPER_DMA_CHANNEL + stepper_no,
+                                         feed->buffer[feed->send_half],
+                                         feed->nos_words[feed->send_half]);
+    feed->running = true;
+}
+
+//==============================================================================
+/**
+ * @brief   Steps of a segment from its first word, +ve clockwise
+ */
+static int32_t segment_steps(uint32_t stepper_no, uint32_t word)
+{
+int32_t     nos_steps;
+
+    nos_steps = (word >> 1) + 1;
+    if (((word & 1) ^ stepper_data[stepper_no].flip_direction) == ANTI_CLOCKWISE) {
+        return -nos_steps;
+    }
+    return nos_steps;
+}
+
+//==============================================================================
+/**
+ * @brief   Keep the last words of a buffer half sent to the PIO (interrupts off)
+ */
+static void feed_keep_tail(struct stepper_feed_s *feed, const uint32_t *words, uint32_t nos_words)
+{
+uint32_t    keep;
+
+    if (nos_words >= FEED_TAIL_WORDS) {
+        words += nos_words - FEED_TAIL_WORDS;
+        nos_words = FEED_TAIL_WORDS;
+        feed->tail_words = 0;
+    }
+    keep = FEED_TAIL_WORDS - nos_words;       // room for older words
+    if (feed->tail_words > keep) {
+        for (uint32_t i=0; i < keep; i++) {
+            feed->tail[i] = feed->tail[i + (feed->tail_words - keep)];
+        }
+        feed->tail_words = keep;
+    }
+    for (uint32_t i=0; i < nos_words; i++) {
+        feed->tail[feed->tail_words++] = words[i];
+    }
+}
+
+//==============================================================================
+// Interrupt  handler : end of a segment DMA transfer
+//==============================================================================
+
+static void stepper_dma_handler(void)
+{
+struct stepper_feed_s   *feed;
+uint32_t                channel;
+
+    for (uint32_t i=0; i < NOS_STEPPERS; i++) {
+        channel = STEPPER_DMA_CHANNEL + i;
+        if (dma_channel_get_irq0_status(channel) == false) {
+            continue;
+        }
+        dma_channel_acknowledge_irq0(channel);
+        feed = &stepper_feed[i];
+        feed->sent_steps += feed->half_steps[feed->send_half];
+        feed->sent_segments += feed->nos_words[feed->send_half] / 2;
+        feed_keep_tail(feed, feed->buffer[feed->send_half], feed->nos_words[feed->send_half]);
+        feed->nos_words[feed->send_half] = 0;
+        feed->send_half ^= 1;
+        if (feed->nos_words[feed->send_half] != 0) {
+            feed_start(i);
+        } else {
+            feed->running = false;
+            if (feed->finished == false) {
+                stepper_stats.underruns++;
+            }
+        }
+    }
+}
+
+//==============================================================================
+/**
+ * @brief   Refill free buffer halves from the move queue (task context)
+ */
+static void feed_fill(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+uint32_t                *buffer, words, nos_steps, period;
+int32_t                 half_steps;
+sm_direction            direction;
+bool                    more;
+
+    feed = &stepper_feed[stepper_no];
+    more = true;
+    while ((feed->finished == false) && (feed->nos_words[feed->fill_half] == 0)) {
+        buffer = feed->buffer[feed->fill_half];
+        half_steps = 0;
+        for (words = 0; words < FEED_WORDS; words += 2) {
+            more = stepper_queue_next(stepper_no, &nos_steps, &period, &direction);
+            if (more == false) {
+                break;
+            }
+            buffer[words]     = ((nos_steps - 1) << 1) | (direction ^ stepper_data[stepper_no].flip_direction);
+            buffer[words + 1] = period - stepper_STEP_OVERHEAD;
+            half_steps += (direction == CLOCKWISE) ? (int32_t)nos_steps : -(int32_t)nos_steps;
+            stepper_stats.segments++;
+        }
+        taskENTER_CRITICAL();
+            if (words != 0) {
+                feed->half_steps[feed->fill_half] = half_steps;
+                feed->nos_words[feed->fill_half] = words;
+                feed->fill_half ^= 1;
+            }
+            feed->finished = !more;
+        taskEXIT_CRITICAL();
+    }
+}
+
+//==============================================================================
+/**
+ * @brief   Load PIO program, one state machine and DMA channel per stepper
+ */
+void stepper_pio_init(void)
+{
+dma_channel_config  dma_config;
+uint32_t            channel;
+
+    stepper_pio_offset = pio_add_program(STEPPER_PIO_UNIT, &stepper_program);
+    for (uint32_t i=0; i < NOS_STEPPERS; i++) {
+        stepper_program_init(STEPPER_PIO_UNIT, i, stepper_pio_offset,
+                             stepper_data[i].step_pin, stepper_data[i].direction_pin,
+                             STEPPER_PIO_FREQUENCY);
+        channel = STEPPER_DMA_CHANNEL + i;
+        dma_channel_claim(channel);
+        dma_config = dma_channel_get_default_config(channel);
+        channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+        channel_config_set_read_increment(&dma_config, true);
+        channel_config_set_write_increment(&dma_config, false);
+        channel_config_set_dreq(&dma_config, pio_get_dreq(STEPPER_PIO_UNIT, i, true));
+        dma_channel_configure(channel, &dma_config,
+                              &STEPPER_PIO_UNIT->txf[i],
+                              NULL,
+                              0,
+                              false);
+        dma_channel_set_irq0_enabled(channel, true);
+        stepper_feed[i].finished = true;
+    }
+    irq_set_exclusive_handler(DMA_IRQ_0, stepper_dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+//==============================================================================
+/**
+ * @brief   Fill both buffer halves with the start of the queued moves
+ * 
+ * @param stepper_no    stepper (must be idle)
+ * @note    The moves are sent by "stepper_pio_start".
+ */
+void stepper_pio_load(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+
+    feed = &stepper_feed[stepper_no];
+    feed->nos_words[0]   = 0;
+    feed->nos_words[1]   = 0;
+    feed->fill_half      = 0;
+    feed->send_half      = 0;
+    feed->sent_steps     = 0;
+    feed->sent_segments  = 0;
+    feed->tail_words     = 0;
+    feed->started        = false;
+    feed->running        = false;
+    feed->finished       = false;
+    stepper_queue_begin(stepper_no);
+    feed_fill(stepper_no);
+}
+
+//==============================================================================
+/**
+ * @brief   Start sending a loaded move (interrupt context)
+ */
+void stepper_pio_start(uint32_t stepper_no)
+{
+    stepper_pio_start_group(1u << stepper_no);
+}
+
+/**
+ * @brief   Start sending loaded moves of several steppers together
+ * 
+ * @param stepper_mask  bit n set for stepper n
+ */
+void stepper_pio_start_group(uint32_t stepper_mask)
+{
+struct stepper_feed_s   *feed;
+uint32_t                channel, channel_mask;
+
+    channel_mask = 0;
+    for (uint32_t i=0; i < NOS_STEPPERS; i++) {
+        if ((stepper_mask & (1u << i)) == 0) {
+            continue;
+        }
+        feed = &stepper_feed[i];
+        feed->started = true;
+        if (feed->nos_words[feed->send_half] == 0) {
+            continue;       // empty move
+        }
+        channel = STEPPER_DMA_CHANNEL + i;
+        STEPPER_PIO_UNIT->fdebug = (1u << (PIO_FDEBUG_TXSTALL_LSB + i));
+        dma_channel_set_read_addr(channel, feed->buffer[feed->send_half], false);
+        dma_channel_set_trans_count(channel, feed->nos_words[feed->send_half], false);
+        feed->running = true;
+        channel_mask |= (1u << channel);
+    }
+    dma_start_channel_mask(channel_mask);
+}
+
+//==============================================================================
+/**
+ * @brief   Keep an active move supplied with segments (task context)
+ */
+void stepper_pio_service(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+
+    feed = &stepper_feed[stepper_no];
+    feed_fill(stepper_no);
+    taskENTER_CRITICAL();
+        if ((feed->started == true) && (feed->running == false) && (feed->nos_words[feed->send_half] != 0)) {
+            feed_start(stepper_no);         // recover from an underrun
+        }
+    taskEXIT_CRITICAL();
+}
+
+//==============================================================================
+/**
+ * @brief   Check for the last step of a move (interrupt context)
+ * 
+ * @return true     all segments sent and PIO idle
+ */
+bool stepper_pio_done(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+
+    feed = &stepper_feed[stepper_no];
+    if ((feed->finished == false) || (feed->running == true)) {
+        return false;
+    }
+    if (pio_sm_is_tx_fifo_empty(STEPPER_PIO_UNIT, stepper_no) == false) {
+        return false;
+    }
+    return ((STEPPER_PIO_UNIT->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + stepper_no))) != 0);
+}
+
+//==============================================================================
+/**
+ * @brief   Segments sent to the PIO FIFO since "stepper_pio_load"
+ */
+uint32_t stepper_pio_sent_segments(uint32_t stepper_no)
+{
+    return stepper_feed[stepper_no].sent_segments;
+}
+
+//==============================================================================
+/**
+ * @brief   Stop the segment DMA of a stepper (interrupt context)
+ * 
+ * @note    DMA channel interrupt is masked during the abort, as an abort can
+ *          raise a spurious completion interrupt (RP2040-E13).
+ */
+static void feed_abort(uint32_t stepper_no)
+{
+uint32_t    channel;
+
+    channel = STEPPER_DMA_CHANNEL + stepper_no;
+    dma_channel_set_irq0_enabled(channel, false);
+    dma_channel_abort(channel);
+    dma_channel_acknowledge_irq0(channel);
+    dma_channel_set_irq0_enabled(channel, true);
+}
+
+//==============================================================================
+/**
+ * @brief   Abandon a move immediately (interrupt context)
+ */
+void stepper_pio_stop(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+
+    feed_abort(stepper_no);
+
+    pio_sm_set_enabled(STEPPER_PIO_UNIT, stepper_no, false);
+    pio_sm_clear_fifos(STEPPER_PIO_UNIT, stepper_no);
+    pio_sm_restart(STEPPER_PIO_UNIT, stepper_no);
+    pio_sm_exec(STEPPER_PIO_UNIT, stepper_no, pio_encode_jmp(stepper_pio_offset));
+    pio_sm_set_pins_with_mask(STEPPER_PIO_UNIT, stepper_no, 0, (1u << stepper_data[stepper_no].step_pin));
+    pio_sm_set_enabled(STEPPER_PIO_UNIT, stepper_no, true);
+
+    feed = &stepper_feed[stepper_no];
+    feed->nos_words[0] = 0;
+    feed->nos_words[1] = 0;
+    feed->started  = false;         // no restart by a refill in progress
+    feed->running  = false;
+    feed->finished = true;
+}
+
+//==============================================================================
+/**
+ * @brief   Read reg-Y of a stopped state machine
+ * 
+ * @note    Sent through the RX FIFO, which is given back for the read.
+ *          Changing the FIFO join clears both FIFOs.
+ */
+static uint32_t read_pio_y(uint32_t stepper_no)
+{
+uint32_t    value;
+
+    hw_clear_bits(&STEPPER_PIO_UNIT->sm[stepper_no].shiftctrl, PIO_SM0_SHIFTCTRL_FJOIN_TX_BITS);
+    pio_sm_exec(STEPPER_PIO_UNIT, stepper_no, pio_encode_mov(pio_isr, pio_y));
+    pio_sm_exec(STEPPER_PIO_UNIT, stepper_no, pio_encode_push(false, false));
+    value = pio_sm_get(STEPPER_PIO_UNIT, stepper_no);
+    hw_set_bits(&STEPPER_PIO_UNIT->sm[stepper_no].shiftctrl, PIO_SM0_SHIFTCTRL_FJOIN_TX_BITS);
+    return value;
+}
+
+/**
+ * @brief   Abandon a run of moves and count the steps made (interrupt context)
+ * 
+ * @param stepper_no    stepper
+ * @return int32_t      steps made since "stepper_pio_load", +ve clockwise
+ * @note    STEP pulses end when the state machine is disabled, within a
+ *          PIO cycle of the call. Steps made are
+ * 
+ *              steps of the segments sent by DMA
+ *            - steps of segments still in the FIFO (a segment with only
+ *              its first word taken has made no steps)
+ *            - steps left of the running segment : reg-Y, and one more if
+ *              the PIO is at "step_loop" with STEP still low.
+ */
+int32_t stepper_pio_halt(uint32_t stepper_no)
+{
+struct stepper_feed_s   *feed;
+uint32_t                *half, nos_sent, nos_words, in_fifo, used, pc, word, left;
+int32_t                 steps;
+
+    pio_sm_set_enabled(STEPPER_PIO_UNIT, stepper_no, false);
+    feed_abort(stepper_no);
+
+    feed  = &stepper_feed[stepper_no];
+    half  = feed->buffer[feed->send_half];
+    steps = feed->sent_steps;
+    nos_sent = 0;
+    if (feed->running == true) {
+        nos_sent = (dma_channel_hw_addr(STEPPER_DMA_CHANNEL + stepper_no)->read_addr - (uint32_t)half) / sizeof(uint32_t);
+        for (uint32_t k=0; k < nos_sent; k += 2) {
+            steps += segment_steps(stepper_no, half[k]);
+        }
+    }
+    //
+    // words sent, oldest first, are "tail" then the start of "half"
+    //
+    nos_words = feed->tail_words + nos_sent;
+    in_fifo   = pio_sm_get_tx_fifo_level(STEPPER_PIO_UNIT, stepper_no);
+    used      = (in_fifo < nos_words) ? (nos_words - in_fifo) : 0;
+    for (uint32_t k = (used & ~1u); k < nos_words; k += 2) {
+        word = (k < feed->tail_words) ? feed->tail[k] : half[k - feed->tail_words];
+        steps -= segment_steps(stepper_no, word);
+    }
+    pc = pio_sm_get_pc(STEPPER_PIO_UNIT, stepper_no) - stepper_pio_offset;
+    if (((used & 1) == 0) && (used >= 2)
+          && (pc >= stepper_offset_step_loop) && (pc <= (stepper_offset_delay_loop + 1))) {
+        word = ((used - 2) < feed->tail_words) ? feed->tail[used - 2] : half[(used - 2) - feed->tail_words];
+        left = read_pio_y(stepper_no);
+        if ((pc == stepper_offset_step_loop) && (gpio_get(stepper_data[stepper_no].step_pin) == 0)) {
+            left++;
+        }
+        steps -= (segment_steps(stepper_no, word) < 0) ? -(int32_t)left : (int32_t)left;
+    }
+    stepper_pio_stop(stepper_no);
+    return steps;
+}
+
+//==============================================================================
+/**
+ * @brief   Single step outside a planned move (calibration)
+ * 
+ * @param stepper_no    idle stepper
+ * @param direction     CLOCKWISE or ANTI_CLOCKWISE
+ */
+void stepper_pio_step(uint32_t stepper_no, sm_direction direction)
+{
+    if (pio_sm_get_tx_fifo_level(STEPPER_PIO_UNIT, stepper_no) > (8 - 2)) {
+        return;     // joined FIFO full : previous steps still waiting
+    }
+    pio_sm_put(STEPPER_PIO_UNIT, stepper_no, (direction ^ stepper_data[stepper_no].flip_direction));
+    pio_sm_put(STEPPER_PIO_UNIT, stepper_no, (STEPPER_MIN_PERIOD - stepper_STEP_OVERHEAD));
+}
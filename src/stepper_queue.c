@@ -0,0 +1,308 @@
+/**
+ * @file    stepper_queue.c
+ * @author  Jim Herd
+ * @brief   Queue of stepper motor moves with look-ahead speed planning
+ * @note
+ *      Moves are added to a ring buffer per stepper by the command code,
+ *      and taken from it a segment at a time as the PIO buffer is refilled.
+ *      All of this runs in the stepper task; the interrupt routines only
+ *      see the finished segments.
+ *
+ *      The head move is planned when its first segment is needed. Its exit
+ *      speed is the fastest that
+ *
+ *          - it can reach from its entry speed,
+ *          - the next move can take : zero on a change of direction, and
+ *          - still lets each move behind it slow to the speed the one after
+ *            can take, down to a stop at the end of the queue.
+ *
+ *      Once planned, a move's speeds don't change. The limits each plan was
+ *      made against are kept with the moves, so a planned move can always
+ *      be followed, whatever is added behind it.
+ *
+ *      Each move carries the "#id" of its command. A move leaves the queue
+ *      up to two buffer halves before the PIO gets to it, so its ID waits
+ *      with the segment count at its end, and "done" is sent once the DMA
+ *      has passed that count, or for the last move, when the run ends.
+ *      Moves dropped by a fault are reported with the fault.
+ */
+
+#include    <stdlib.h>
+
+#include    "pico/stdlib.h"
+
+#include    "system.h"
+#include    "externs.h"
+#include    "sys_routines.h"
+#include    "step_profile.h"
+#include    "stepper_queue.h"
+
+//==============================================================================
+/**
+ * @brief   Speed limit where one move runs on into the next
+ */
+static int32_t junction_speed(const struct stepper_move_s *from, const struct stepper_move_s *to, int32_t max_speed)
+{
+    if ((from->steps == 0) || (to->steps == 0)) {
+        return 0;
+    }
+    if ((from->steps < 0) != (to->steps < 0)) {
+        return 0;           // change of direction
+    }
+    return max_speed;
+}
+
+//==============================================================================
+/**
+ * @brief   Send "done" for the oldest move whose segments have been generated
+ */
+static void sent_move_done(struct stepper_queue_s *queue, int32_t status)
+{
+    print_move_done(&queue->sent[queue->sent_head].seq_id, status);    // no-op if no "#id"
+    queue->sent_head = (queue->sent_head + 1) % STEPPER_QUEUE_DEPTH;
+    queue->sent_count--;
+}
+
+//==============================================================================
+/**
+ * @brief   Plan the head move from the moves queued behind it
+ *
+ * @return error_codes_te
+ */
+static error_codes_te plan_head_move(uint32_t stepper_no)
+{
+struct stepper_data_s   *sm_ptr;
+struct stepper_queue_s  *queue;
+struct stepper_move_s   *move, *previous;
+int32_t                 speed, junction, max_speed, limits[STEPPER_QUEUE_DEPTH];
+uint32_t                k;
+error_codes_te          status;
+
+    sm_ptr = &stepper_data[stepper_no];
+    queue  = &sm_ptr->queue;
+    max_speed = sm_ptr->max_speed;
+    if ((queue->speed_limit != 0) && (queue->speed_limit < max_speed)) {
+        max_speed = queue->speed_limit;     // homing
+    }
+    //
+    // backward pass : fastest speed into each move that lets the rest stop
+    //
+    speed = 0;
+    for (k = (queue->count - 1); k >= 1; k--) {
+        move     = &queue->moves[(queue->head + k) % STEPPER_QUEUE_DEPTH];
+        previous = &queue->moves[(queue->head + k - 1) % STEPPER_QUEUE_DEPTH];
+        speed = step_profile_reach(speed, abs(move->steps), max_speed, sm_ptr->max_accel, sm_ptr->max_jerk);
+        junction = junction_speed(previous, move, max_speed);
+        if (junction < speed) {
+            speed = junction;
+        }
+        limits[k] = speed;
+    }
+    //
+    // Ramps are whole slices, so a faster entry can need more distance to
+    // reach the same speed, and added moves can lower these limits. If the
+    // head can't then get down to them, keep the limits the head's entry
+    // speed was planned against : a move added since then starts from rest.
+    //
+    move = &queue->moves[queue->head];
+    if (queue->entry_speed <= step_profile_reach(speed, abs(move->steps), max_speed, sm_ptr->max_accel, sm_ptr->max_jerk)) {
+        for (k = 1; k < queue->count; k++) {
+            queue->moves[(queue->head + k) % STEPPER_QUEUE_DEPTH].entry_limit = limits[k];
+        }
+    }
+    speed = (queue->count > 1) ? queue->moves[(queue->head + 1) % STEPPER_QUEUE_DEPTH].entry_limit : 0;
+    speed = step_profile_exit(queue->entry_speed, speed, abs(move->steps),
+                              max_speed, sm_ptr->max_accel, sm_ptr->max_jerk);
+    status = step_profile_plan(&move->profile, abs(move->steps), queue->entry_speed, speed,
+                               max_speed, sm_ptr->max_accel, sm_ptr->max_jerk);
+    move->planned = true;
+    return status;
+}
+
+//==============================================================================
+/**
+ * @brief   Add a move to the end of the queue
+ *
+ * @param stepper_no    stepper
+ * @param nos_steps     +ve clockwise
+ * @param seq_id        "#id" of the move command (0 = none)
+ * @return error_codes_te   STEPPER_BUSY if the queue is full
+ */
+error_codes_te stepper_queue_add(uint32_t stepper_no, int32_t nos_steps, uint32_t seq_id)
+{
+struct stepper_queue_s  *queue;
+struct stepper_move_s   *move;
+
+    queue = &stepper_data[stepper_no].queue;
+    if (queue->count >= STEPPER_QUEUE_DEPTH) {
+        return STEPPER_BUSY;
+    }
+    queue->end_step_count = stepper_queue_end(stepper_no) + nos_steps;
+    move = &queue->moves[(queue->head + queue->count) % STEPPER_QUEUE_DEPTH];
+    move->steps       = nos_steps;
+    move->planned     = false;
+    move->entry_limit = 0;
+    move->seq_id      = seq_id;
+    queue->count++;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief   Step count at the end of all queued moves
+ */
+int32_t stepper_queue_end(uint32_t stepper_no)
+{
+struct stepper_data_s   *sm_ptr;
+
+    sm_ptr = &stepper_data[stepper_no];
+    if ((sm_ptr->queue.count == 0) && (sm_ptr->state != STATE_SM_RUNNING) && (sm_ptr->state != STATE_SM_INIT)) {
+        return sm_ptr->current_step_count;      // nothing queued or running
+    }
+    return sm_ptr->queue.end_step_count;
+}
+
+//==============================================================================
+/**
+ * @brief   Head move of the queue
+ *
+ * @note    Used to plan moves held for a "sync" command
+ */
+struct stepper_move_s *stepper_queue_head(uint32_t stepper_no)
+{
+    return &stepper_data[stepper_no].queue.moves[stepper_data[stepper_no].queue.head];
+}
+
+//==============================================================================
+/**
+ * @brief   Start a run of moves from rest (PIO about to be loaded)
+ *
+ * @note    Moves of the last run not yet reported have finished.
+ */
+void stepper_queue_begin(uint32_t stepper_no)
+{
+struct stepper_queue_s  *queue;
+
+    queue = &stepper_data[stepper_no].queue;
+    while (queue->sent_count != 0) {
+        sent_move_done(queue, OK);
+    }
+    queue->segments    = 0;
+    queue->entry_speed = 0;
+    queue->sent_steps  = 0;
+    queue->carry       = 0;
+}
+
+//==============================================================================
+/**
+ * @brief   Drop all queued moves (after a fault, or before a homing move)
+ *
+ * @note    Moves not yet reported end with the stepper error, or
+ *          MOVE_SUPERSEDED if there is none.
+ */
+void stepper_queue_flush(uint32_t stepper_no)
+{
+struct stepper_data_s   *sm_ptr;
+struct stepper_queue_s  *queue;
+int32_t                 status;
+
+    sm_ptr = &stepper_data[stepper_no];
+    queue  = &sm_ptr->queue;
+    status = (sm_ptr->error != OK) ? sm_ptr->error : MOVE_SUPERSEDED;
+    while (queue->sent_count != 0) {
+        sent_move_done(queue, status);
+    }
+    while (queue->count != 0) {
+        print_move_done(&queue->moves[queue->head].seq_id, status);
+        queue->head = (queue->head + 1) % STEPPER_QUEUE_DEPTH;
+        queue->count--;
+    }
+    queue->entry_speed = 0;
+    queue->speed_limit = 0;
+}
+
+//==============================================================================
+/**
+ * @brief   Next (step count, period) segment from the queue
+ *
+ * @param stepper_no    stepper
+ * @param nos_steps     steps in segment
+ * @param period        PIO cycles per step
+ * @param direction     CLOCKWISE or ANTI_CLOCKWISE
+ * @return true         segment generated
+ * @return false        queue empty
+ */
+bool stepper_queue_next(uint32_t stepper_no, uint32_t *nos_steps, uint32_t *period, sm_direction *direction)
+{
+struct stepper_data_s   *sm_ptr;
+struct stepper_queue_s  *queue;
+struct stepper_move_s   *move;
+uint32_t                move_time_mS;
+error_codes_te          status;
+
+    sm_ptr = &stepper_data[stepper_no];
+    queue  = &sm_ptr->queue;
+    while (queue->count != 0) {
+        move = &queue->moves[queue->head];
+        if (move->planned == false) {
+            status = plan_head_move(stepper_no);
+            if (status != OK) {
+                sm_ptr->error = status;     // reported when the move is done
+                stepper_queue_flush(stepper_no);
+                return false;
+            }
+        }
+        if (step_profile_next(&move->profile, &queue->carry, nos_steps, period) == true) {
+            *direction = (move->steps < 0) ? ANTI_CLOCKWISE : CLOCKWISE;
+            queue->segments++;
+            return true;
+        }
+        move_time_mS = (move->profile.nos_slices * STEP_SLICE_uS) / 1000;
+        if (move_time_mS > stepper_stats.max_move_mS) {
+            stepper_stats.max_move_mS = move_time_mS;
+        }
+        if (move->profile.exit_speed != 0) {
+            stepper_stats.blends++;
+        }
+        stepper_stats.moves++;
+        queue->sent_steps += move->steps;
+        queue->entry_speed = move->profile.exit_speed;
+        if (queue->sent_count == STEPPER_QUEUE_DEPTH) {
+            sent_move_done(queue, OK);      // many short moves : report the oldest early
+        }
+        queue->sent[(queue->sent_head + queue->sent_count) % STEPPER_QUEUE_DEPTH].seq_id   = move->seq_id;
+        queue->sent[(queue->sent_head + queue->sent_count) % STEPPER_QUEUE_DEPTH].segments = queue->segments;
+        queue->sent_count++;
+        queue->head = (queue->head + 1) % STEPPER_QUEUE_DEPTH;
+        queue->count--;
+    }
+    return false;
+}
+
+//==============================================================================
+/**
+ * @brief   Send "done" for moves whose segments have all reached the PIO
+ *
+ * @param stepper_no        stepper
+ * @param sent_segments     segments sent by DMA since the PIO was loaded
+ * @param run_ended         PIO stopped : every move sent has been made
+ * @note    Segments are counted a buffer half at a time and the PIO FIFO
+ *          holds the last few sent, so "done" for a move that runs on into
+ *          the next can be up to a half late or a few slices early. The
+ *          last move of a run waits until the run has ended.
+ */
+void stepper_queue_report(uint32_t stepper_no, uint32_t sent_segments, bool run_ended)
+{
+struct stepper_queue_s  *queue;
+
+    queue = &stepper_data[stepper_no].queue;
+    while (queue->sent_count != 0) {
+        if (run_ended == false) {
+            if ((queue->sent[queue->sent_head].segments > sent_segments)
+                  || ((queue->sent_count == 1) && (queue->count == 0))) {
+                break;
+            }
+        }
+        sent_move_done(queue, OK);
+    }
+}
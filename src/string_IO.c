@@ -23,12 +23,32 @@
  */
 void init_string_buffer(struct string_buffer *buff_pt) {
 
+    buff_pt->buffer = &buff_pt->store[0];
+    buff_pt->limit = MAX_STRING_SIZE - 3;
     buff_pt->char_pt = 0;
     buff_pt->buffer[MAX_STRING_SIZE - 1] = STRING_NULL;
     buff_pt->buffer[MAX_STRING_SIZE - 2] = NEWLINE;
     buff_pt->full = false;
 }
 
+//***************************************************************************
+/**
+ * @brief Format directly into memory owned by someone else
+ * 
+ * @param buff_pt   pointer to string buffer structure
+ * @param memory    destination (e.g. space reserved in the UART TX buffer)
+ * @param size      number of bytes available
+ * @note
+ *      No end markers are written, the caller uses "char_pt" as the length.
+ */
+void attach_string_buffer(struct string_buffer *buff_pt, char *memory, uint32_t size) {
+
+    buff_pt->buffer = memory;
+    buff_pt->limit = size;
+    buff_pt->char_pt = 0;
+    buff_pt->full = false;
+}
+
 //***************************************************************************
 /**
  * @brief Output a single character to buffer
@@ -43,7 +63,7 @@ void add_char_to_char_buffer(struct string_buffer *buff_pt, char ch) {
     if (buff_pt->full == false) {
         buff_pt->buffer[buff_pt->char_pt++] = ch;
     }
-    if (buff_pt->char_pt >= (MAX_STRING_SIZE - 3)) {
+    if (buff_pt->char_pt >= buff_pt->limit) {
         buff_pt->full = true;
     }
 }
@@ -103,61 +123,6 @@ char    temp_buff[12];
     return OK; 
 } 
 
-//***************************************************************************
-// ASCII_to_int : local version of atoi()
-//
-// String has already been checked therefore no need to test for errors
-
-int32_t ASCII_to_int(char *str) {
-
-int32_t result = 0;    // Initialize result
-int32_t sign = 1;      // Initialize sign as positive
-uint32_t char_pt = 0;  // Initialize index of first digit
-
-    if (*str == '\0') {
-        return 0;
-    }
-    if (str[0] == '-') {
-        sign = -1;
-        char_pt++; // Also update index of first digit
-    }
-    if (str[0] == '+') {
-        char_pt++;
-    }
-    for (; str[char_pt] != '\0'; ++char_pt) {
-        result = (result * 10) + (str[char_pt] - '0');
-    }
-    return sign * result;
-}
-
-//***************************************************************************
-// ASCII_to_float : local version of atof()
-//
-// String has already been checked therefore no need to test for errors
-// Saves 5K bytes of FLASH and therefore should be faster.
-
-float ASCII_to_float(const char *char_pt) {
-  float result = 0, fact = 1;
-    if (*char_pt == '-') {
-        char_pt++;
-        fact = -1;
-    };
-    for (uint32_t point_seen = 0; *char_pt == '\0'; char_pt++) {
-        if (*char_pt == '.') {
-            point_seen = 1;
-            continue;
-        }
-        uint32_t d = *char_pt - '0';
-//        if (d >= 0 && d <= 9) {
-            if (point_seen) {
-                fact = fact / 10.0f;
-            }
-        result = (result * 10.0f) + (float)d;
-//        };
-    };
-    return result * fact;
-};
-
 //***************************************************************************
 // int_to_ASCII : local version of itoa()
 //
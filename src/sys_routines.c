@@ -8,8 +8,12 @@
 #include "externs.h"
 #include "sys_routines.h"
 #include "uart_IO.h"
+#include "string_IO.h"
+#include "binary_link.h"
 
 
+#include <stdarg.h>
+
 #include "pico/stdlib.h"
 
 #include "hardware/watchdog.h"
@@ -58,7 +62,245 @@ uint32_t sm_delay;
  */
 void print_error(int32_t port, error_codes_te sys_error)
 {
-    print_string("%d %d\n", port, sys_error);
+    print_reply(port, sys_error, 0);
+}
+
+//==============================================================================
+// Replies to a multi-command line are collected into a single line.
+// Commands of a line may complete in different tasks, so each reply is
+// stored in its own slot and the line is sent by whichever task stores
+// the last reply after the line has been closed.
+
+struct reply_batch_s    reply_batches[NOS_REPLY_BATCHES];
+
+static struct reply_context_s   default_reply_context = {TRANSPORT_ASCII};
+
+/**
+ * @brief prime free batch queue with indices for all reply batches
+ */
+void prime_free_batch_queue(void)
+{
+    for (uint32_t i = 0; i < NOS_REPLY_BATCHES; i++) {
+        xQueueSend(queue_free_batches, &i, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief Get the reply context of the command being run by this task
+ */
+static struct reply_context_s *get_reply_context(void)
+{
+struct reply_context_s  *context;
+
+    context = pvTaskGetThreadLocalStoragePointer(NULL, REPLY_CONTEXT_TLS_INDEX);
+    if (context == NULL) {
+        context = &default_reply_context;
+    }
+    return context;
+}
+
+/**
+ * @brief Send the collected replies as one line
+ */
+static void send_reply_batch(struct reply_batch_s *batch)
+{
+char        *line;
+uint32_t    length;
+
+    line = uart_tx_reserve(MAX_PRINT_STRING_LENGTH);
+    length = 0;
+    for (uint32_t i = 0; i < batch->nos_cmds; i++) {
+        if ((length + batch->length[i] + 1) > (MAX_PRINT_STRING_LENGTH - 1)) {
+            break;      // no room : leave space for NEWLINE
+        }
+        if (i != 0) {
+            line[length++] = ';';
+        }
+        for (uint32_t j = 0; j < batch->length[i]; j++) {
+            line[length++] = batch->reply[i][j];
+        }
+    }
+    line[length++] = NEWLINE;
+    uart_tx_commit(length);
+}
+
+/**
+ * @brief Send batch if all replies are in, then free it
+ * @note
+ *      Test and set of "sent" is done in a critical section so that only
+ *      one task sends the line.
+ */
+static void complete_reply_batch(struct reply_batch_s *batch)
+{
+bool        send;
+uint32_t    batch_index;
+
+    taskENTER_CRITICAL();
+    send = (batch->closed == true) && (batch->sent == false) && (batch->nos_done == batch->nos_cmds);
+    if (send == true) {
+        batch->sent = true;
+    }
+    taskEXIT_CRITICAL();
+    if (send == true) {
+        send_reply_batch(batch);
+        batch_index = batch - &reply_batches[0];
+        xQueueSend(queue_free_batches, &batch_index, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief Get a free reply batch (waits if none free)
+ */
+struct reply_batch_s *begin_reply_batch(void)
+{
+uint32_t                batch_index;
+struct reply_batch_s    *batch;
+
+    xQueueReceive(queue_free_batches, &batch_index, portMAX_DELAY);
+    batch = &reply_batches[batch_index];
+    batch->nos_cmds = 0;
+    batch->nos_done = 0;
+    batch->closed   = false;
+    batch->sent     = false;
+    return batch;
+}
+
+/**
+ * @brief Reserve the reply slot for the next command of the line
+ * 
+ * @return int32_t  slot number, or -1 if the batch is full
+ */
+int32_t add_reply_batch_slot(struct reply_batch_s *batch)
+{
+int32_t     slot;
+
+    slot = -1;
+    taskENTER_CRITICAL();
+    if (batch->nos_cmds < MAX_CMDS_PER_LINE) {
+        slot = batch->nos_cmds++;
+        batch->length[slot] = 0;
+    }
+    taskEXIT_CRITICAL();
+    return slot;
+}
+
+/**
+ * @brief No more commands on this line : send when all replies are in
+ */
+void end_reply_batch(struct reply_batch_s *batch)
+{
+    batch->closed = true;
+    complete_reply_batch(batch);
+}
+
+/**
+ * @brief Send replies collected so far for the current command's line
+ * @note
+ *      Used before a command that does not return (e.g. reset)
+ */
+void flush_reply_batch(void)
+{
+struct reply_context_s  *context;
+
+    context = get_reply_context();
+    if (context->batch != NULL) {
+        send_reply_batch(context->batch);
+    }
+}
+
+//==============================================================================
+/**
+ * @brief Send command reply on the transport the command arrived on
+ * 
+ * @param port          port number
+ * @param status        command status
+ * @param nos_values    number of following int32_t reply values
+ * @param ...           reply values
+ * @note
+ *      ASCII replies have the format "port status value ...\n" and are
+ *      formatted straight into the UART TX buffer. For a multi-command
+ *      line the reply is formatted into the command's batch slot.
+ *      Reply context is held in a FreeRTOS thread local storage pointer
+ *      set by the task running the command.
+ */
+void print_reply(int32_t port, int32_t status, uint32_t nos_values, ...)
+{
+va_list     vargs;
+int32_t     values[MAX_REPLY_VALUES];
+struct string_buffer    ascii_reply;
+struct reply_context_s  *context;
+struct reply_batch_s    *batch;
+
+    if (nos_values > MAX_REPLY_VALUES) {
+        nos_values = MAX_REPLY_VALUES;
+    }
+    va_start(vargs, nos_values);
+    for (uint32_t i = 0; i < nos_values; i++) {
+        values[i] = va_arg(vargs, int32_t);
+    }
+    va_end(vargs);
+
+    context = get_reply_context();
+    if (context->transport == TRANSPORT_NONE) {
+        return;
+    }
+    if (context->transport == TRANSPORT_BINARY) {
+        binary_send_reply(context, port, status, nos_values, values);
+        return;
+    }
+    batch = context->batch;
+    if (batch != NULL) {
+        if (batch->length[context->batch_slot] != 0) {     // first reply only
+            return;
+        }
+        attach_string_buffer(&ascii_reply, batch->reply[context->batch_slot], MAX_BATCH_REPLY_SIZE);
+    } else {
+        attach_string_buffer(&ascii_reply, uart_tx_reserve(MAX_STRING_SIZE), MAX_STRING_SIZE - 1);
+    }
+    add_int_to_char_buffer(&ascii_reply, port, BASE_10, LOWER_CASE);
+    add_char_to_char_buffer(&ascii_reply, ' ');
+    add_int_to_char_buffer(&ascii_reply, status, BASE_10, LOWER_CASE);
+    for (uint32_t i = 0; i < nos_values; i++) {
+        add_char_to_char_buffer(&ascii_reply, ' ');
+        add_int_to_char_buffer(&ascii_reply, values[i], BASE_10, LOWER_CASE);
+    }
+    if (batch != NULL) {
+        batch->length[context->batch_slot] = ascii_reply.char_pt;
+        taskENTER_CRITICAL();
+        batch->nos_done++;
+        taskEXIT_CRITICAL();
+        complete_reply_batch(batch);
+        return;
+    }
+    ascii_reply.buffer[ascii_reply.char_pt++] = NEWLINE;   // space kept by attach size
+    uart_tx_commit(ascii_reply.char_pt);
+}
+
+//==============================================================================
+/**
+ * @brief Send an unsolicited "done <id> <status>" line for a finished move
+ * 
+ * @param seq_id    pending ID of the axis, cleared once sent (0 = none)
+ * @param status    OK, or the axis error (e.g. LIMIT_SWITCH_ERROR)
+ * @note
+ *      Called by the task that owns the axis, outside any command, so the
+ *      line always goes straight to the UART.
+ */
+void print_move_done(uint32_t *seq_id, int32_t status)
+{
+struct string_buffer    done_reply;
+
+    if (*seq_id == 0) {
+        return;
+    }
+    attach_string_buffer(&done_reply, uart_tx_reserve(MAX_STRING_SIZE), MAX_STRING_SIZE - 1);
+    add_string_to_char_buffer(&done_reply, "done ");
+    add_int_to_char_buffer(&done_reply, *seq_id, BASE_10, LOWER_CASE);
+    add_char_to_char_buffer(&done_reply, ' ');
+    add_int_to_char_buffer(&done_reply, status, BASE_10, LOWER_CASE);
+    done_reply.buffer[done_reply.char_pt++] = NEWLINE;
+    uart_tx_commit(done_reply.char_pt);
+    *seq_id = 0;
 }
 
 void software_reset(void)
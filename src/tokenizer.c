@@ -43,17 +43,50 @@
 #include <ctype.h>
 #include <stdlib.h>
 
-#define     NOS_STRING_CMDS     (TOKENIZER_TDELAY + 1)
+//==============================================================================
+// Keyword lookup key : length, first and last character. All command
+// keywords give a unique key, so the switch below selects the single
+// candidate keyword which is then confirmed with an exact compare.
 
-uint32_t string_to_token(struct token_list_s *tk_list, char *string)
+#define     KEYWORD_KEY(length, first, last)    (((length) << 16) | ((first) << 8) | (last))
+
+/**
+ * @brief Convert a command keyword into its token
+ * 
+ * @param tk_list   keyword table, indexed by token
+ * @param string    NULL terminated keyword
+ * @return uint32_t TOKENIZER_* value or TOKENIZER_ERROR
+ * @note
+ *      Constant time, exact match (no prefix matching).
+ */
+uint32_t string_to_token(const struct token_list_s *tk_list, const char *string)
 {
-    for (uint32_t i = 0; i < NOS_COMMANDS; i++) {     // NOS_STRING_CMDS
-        if (strncmp(string, tk_list->keyword, strlen(tk_list->keyword)) == 0) {
-            return tk_list->token;
-        }
-        tk_list++;
+uint32_t    length, token;
+
+    length = strlen(string);
+    if ((length == 0) || (length > MAX_KEYWORD_LENGTH)) {
+        return TOKENIZER_ERROR;
+    }
+    switch (KEYWORD_KEY(length, (uint8_t)string[0], (uint8_t)string[length - 1])) {
+        case KEYWORD_KEY(3, 's', 's') : token = TOKENIZER_SYS;      break;
+        case KEYWORD_KEY(5, 's', 'o') : token = TOKENIZER_SERVO;    break;
+        case KEYWORD_KEY(7, 's', 'r') : token = TOKENIZER_STEPPER;  break;
+        case KEYWORD_KEY(4, 's', 'c') : token = TOKENIZER_SYNC;     break;
+        case KEYWORD_KEY(3, 's', 't') : token = TOKENIZER_SET;      break;
+        case KEYWORD_KEY(3, 'g', 't') : token = TOKENIZER_GET;      break;
+        case KEYWORD_KEY(4, 'p', 'g') : token = TOKENIZER_PING;     break;
+        case KEYWORD_KEY(5, 'd', 'y') : token = TOKENIZER_TDELAY;   break;
+        case KEYWORD_KEY(7, 'd', 'y') : token = TOKENIZER_DISPLAY;  break;
+        case KEYWORD_KEY(8, 'n', 'l') : token = TOKENIZER_NEOPIXEL; break;
+        case KEYWORD_KEY(6, 's', 'h') : token = TOKENIZER_SWITCH;   break;
+        case KEYWORD_KEY(6, 's', 't') : token = TOKENIZER_SCRIPT;   break;
+        default :
+            return TOKENIZER_ERROR;
+    }
+    if (strcmp(string, tk_list[token].keyword) != 0) {
+        return TOKENIZER_ERROR;
     }
-    return TOKENIZER_ERROR;
+    return token;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -0,0 +1,385 @@
+/**
+ * @file    trajectory.c
+ * @author  Jim Herd
+ * @brief   Smooth servo trajectories
+ * @note
+ *      A move from angle A to angle B over T ticks is A + (B-A).f(s), where
+ *      s = t/T runs 0->1 and f(s) is the profile
+ * 
+ *          linear      : f = s
+ *          min-jerk    : f = 10s^3 - 15s^4 + 6s^5  (zero velocity and
+ *                        acceleration at both ends)
+ *          trapezoid   : constant acceleration for the first and last
+ *                        quarter of the move, constant velocity between
+ * 
+ *      A spline is a chain of cubic Hermite segments through a list of
+ *      waypoints. Tangents at inner points are Catmull-Rom (slope of the
+ *      line joining the neighbouring points) and are zero at the two ends,
+ *      so velocity is continuous through every waypoint.
+ * 
+ *      A blend is a single Hermite segment from the current position and
+ *      velocity of a servo to a new target, so that a move can be retargeted
+ *      part way through without a step in position or velocity.
+ * 
+ *      Evaluation is incremental : s steps by 1/T each tick and is forced
+ *      to exactly 1 on the last tick, so a move always ends on its target.
+ *      All arithmetic is Q16.16, with no divides in the per-tick path.
+ * 
+ *      The peak velocity of each profile, relative to a linear move of the
+ *      same time, is used to stretch a move to keep within a servo speed
+ *      limit.
+ */
+
+#include    <stdlib.h>
+
+#include    "pico/stdlib.h"
+
+#include    "system.h"
+#include    "trajectory.h"
+
+//==============================================================================
+// Profile constants
+//==============================================================================
+
+#define     TRAP_ACCEL_FRACTION     Q16(0.25)           // of move time
+#define     TRAP_ACCEL_GAIN         ((q16_t)174763)     // 8/3 : f = (8/3).s^2
+#define     TRAP_COAST_GAIN         ((q16_t)87381)      // 4/3 : coast velocity
+#define     TRAP_COAST_OFFSET       Q16(0.125)          // f = (4/3).(s - 1/8)
+
+// peak velocity / mean velocity of each profile
+
+static const q16_t peak_velocity_factor[] = {
+    [TRAJ_LINEAR]    = Q16(1),
+    [TRAJ_MIN_JERK]  = Q16(1.875),
+    [TRAJ_TRAPEZOID] = TRAP_COAST_GAIN,
+    [TRAJ_SPLINE]    = Q16(1.5),        // Hermite segment with zero end tangents
+    [TRAJ_BLEND]     = Q16(1.5),        // as spline, from rest (see trajectory_blend_limit_ticks)
+};
+
+//==============================================================================
+/**
+ * @brief Lengthen a move, if necessary, to keep within a speed limit
+ * 
+ * @param profile       trajectory shape
+ * @param delta_angle   degrees
+ * @param nos_ticks     requested time (servo task ticks)
+ * @param speed_limit   degrees/second (SERVO_SPEED_UNLIMITED = no limit)
+ * @return uint32_t     move time (ticks), at least 1
+ */
+uint32_t trajectory_limit_ticks(trajectory_profile_te profile, int32_t delta_angle, uint32_t nos_ticks, int32_t speed_limit)
+{
+int64_t     numerator, denominator;
+uint32_t    min_ticks;
+
+    if (nos_ticks == 0) {
+        nos_ticks = 1;
+    }
+    if (speed_limit <= SERVO_SPEED_UNLIMITED) {
+        return nos_ticks;
+    }
+    numerator   = (int64_t)abs(delta_angle) * peak_velocity_factor[profile] * TASK_SERVO_CONTROL_FREQUENCY;
+    denominator = (int64_t)speed_limit << Q16_SHIFT;
+    min_ticks   = (uint32_t)((numerator + denominator - 1) / denominator);
+    return (min_ticks > nos_ticks) ? min_ticks : nos_ticks;
+}
+
+//==============================================================================
+/**
+ * @brief Peak speed inside a blend (degrees/tick)
+ * @note
+ *      With end tangent 0 the velocity of a blend is
+ *      v(s) = (1 - s).(a.s + v0), where a = 6.delta/T - 3.v0. Its turning
+ *      point is at s = (a - v0)/2a, with v = v0 + (a - v0)^2/4a.
+ */
+static int64_t blend_peak_speed(q16_t delta, q16_t from_velocity, uint32_t nos_ticks)
+{
+int64_t     a, b;
+
+    a = ((6 * (int64_t)delta) / nos_ticks) - (3 * (int64_t)from_velocity);
+    b = a - from_velocity;
+    if ((a == 0) || ((b > 0) != (a > 0)) || (llabs(b) >= llabs(2 * a))) {
+        return 0;                   // turning point outside the blend
+    }
+    return llabs(from_velocity + ((b * b) / (4 * a)));
+}
+
+/**
+ * @brief Lengthen a blend, if necessary, to keep within a speed limit
+ * 
+ * @param delta         degrees to target (Q16.16)
+ * @param from_velocity degrees/tick at the start (Q16.16)
+ * @param nos_ticks     requested time (servo task ticks)
+ * @param speed_limit   degrees/second (SERVO_SPEED_UNLIMITED = no limit)
+ * @return uint32_t     blend time (ticks), at least 1
+ * @note
+ *      A blend that reverses a moving servo overshoots before it turns
+ *      back, so its peak speed depends on the start velocity as well as
+ *      the distance. As the blend lengthens the peak falls towards |v0|/3,
+ *      so a servo already well over the limit (e.g. limit lowered during
+ *      a move) is held to 2/3 of its start speed instead, which keeps the
+ *      blend short.
+ */
+uint32_t trajectory_blend_limit_ticks(q16_t delta, q16_t from_velocity, uint32_t nos_ticks, int32_t speed_limit)
+{
+int64_t     limit;
+uint32_t    lo, hi, mid;
+
+    if (nos_ticks == 0) {
+        nos_ticks = 1;
+    }
+    if (speed_limit <= SERVO_SPEED_UNLIMITED) {
+        return nos_ticks;
+    }
+    limit = q16_ratio(speed_limit, TASK_SERVO_CONTROL_FREQUENCY);
+    if ((2 * llabs(from_velocity)) > (3 * limit)) {
+        limit = (2 * llabs(from_velocity)) / 3;
+    }
+    if (blend_peak_speed(delta, from_velocity, nos_ticks) <= limit) {
+        return nos_ticks;
+    }
+    lo = nos_ticks;                 // too fast
+    hi = nos_ticks;
+    do {
+        lo = hi;
+        hi = (hi < (UINT32_MAX / 2)) ? (2 * hi) : UINT32_MAX;
+    } while ((blend_peak_speed(delta, from_velocity, hi) > limit) && (hi != UINT32_MAX));
+    while ((hi - lo) > 1) {
+        mid = lo + ((hi - lo) / 2);
+        if (blend_peak_speed(delta, from_velocity, mid) > limit) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+//==============================================================================
+// Spline helpers : point 0 is the start angle, point k is waypoint k-1
+
+static int32_t spline_point(struct trajectory_s *traj, uint32_t k)
+{
+    return (k == 0) ? traj->origin : traj->waypoints[k - 1].angle;
+}
+
+// velocity at point k (degrees/tick)
+
+static q16_t spline_tangent(struct trajectory_s *traj, uint32_t k)
+{
+    if ((k == 0) || (k == traj->nos_waypoints)) {
+        return 0;
+    }
+    return q16_ratio(spline_point(traj, k + 1) - spline_point(traj, k - 1),
+                     traj->waypoints[k - 1].ticks + traj->waypoints[k].ticks);
+}
+
+static void start_segment(struct trajectory_s *traj)
+{
+uint32_t    k;
+
+    k = traj->segment;
+    traj->nos_ticks = traj->waypoints[k].ticks;
+    traj->start     = int_to_q16(spline_point(traj, k));
+    traj->delta     = int_to_q16(spline_point(traj, k + 1) - spline_point(traj, k));
+    traj->m0        = q16_mul_int(spline_tangent(traj, k), traj->nos_ticks);
+    traj->m1        = q16_mul_int(spline_tangent(traj, k + 1), traj->nos_ticks);
+    traj->tick      = 0;
+    traj->s         = 0;
+    traj->ds        = q16_ratio(1, traj->nos_ticks);
+}
+
+// cubic Hermite basis : p0.h00 + m0.h10 + p1.h01 + m1.h11
+
+static q16_t hermite(struct trajectory_s *traj, q16_t s)
+{
+q16_t   s2, s3, h01, h10, h11;
+
+    s2  = q16_mul(s, s);
+    s3  = q16_mul(s2, s);
+    h01 = q16_mul_int(s2, 3) - q16_mul_int(s3, 2);
+    h10 = s3 - q16_mul_int(s2, 2) + s;
+    h11 = s3 - s2;
+    return traj->start + q16_mul(traj->delta, h01) + q16_mul(traj->m0, h10) + q16_mul(traj->m1, h11);
+}
+
+// fraction of a single move completed at normalised time s
+
+static q16_t profile_fraction(trajectory_profile_te profile, q16_t s)
+{
+q16_t   f;
+
+    switch (profile) {
+        case TRAJ_MIN_JERK :        // s^3.(10 + s.(-15 + 6s))
+            f = q16_mul(q16_mul_int(s, 6) - Q16(15), s) + Q16(10);
+            f = q16_mul(q16_mul(q16_mul(s, s), s), f);
+            break;
+        case TRAJ_TRAPEZOID :
+            if (s < TRAP_ACCEL_FRACTION) {
+                f = q16_mul(TRAP_ACCEL_GAIN, q16_mul(s, s));
+            } else if (s > (Q16_ONE - TRAP_ACCEL_FRACTION)) {
+                f = Q16_ONE - q16_mul(TRAP_ACCEL_GAIN, q16_mul(Q16_ONE - s, Q16_ONE - s));
+            } else {
+                f = q16_mul(TRAP_COAST_GAIN, s - TRAP_COAST_OFFSET);
+            }
+            break;
+        case TRAJ_LINEAR :
+        default :
+            f = s;
+            break;
+    }
+    return f;
+}
+
+//==============================================================================
+/**
+ * @brief Start a single move
+ * 
+ * @param traj          trajectory state of servo
+ * @param from_angle    degrees
+ * @param to_angle      degrees
+ * @param nos_ticks     move time (servo task ticks)
+ * @param profile       TRAJ_LINEAR, TRAJ_MIN_JERK or TRAJ_TRAPEZOID
+ */
+void trajectory_start(struct trajectory_s *traj, int32_t from_angle, int32_t to_angle, uint32_t nos_ticks, trajectory_profile_te profile)
+{
+    traj->profile   = profile;
+    traj->nos_ticks = (nos_ticks == 0) ? 1 : nos_ticks;
+    traj->start     = int_to_q16(from_angle);
+    traj->delta     = int_to_q16(to_angle - from_angle);
+    traj->position  = traj->start;
+    traj->velocity  = 0;
+    traj->tick      = 0;
+    traj->s         = 0;
+    traj->ds        = q16_ratio(1, traj->nos_ticks);
+}
+
+//==============================================================================
+/**
+ * @brief Start a move from a servo that is already moving
+ * 
+ * @param traj          trajectory state of servo
+ * @param from_angle    current position (degrees)
+ * @param from_velocity current velocity (degrees/tick)
+ * @param to_angle      new target (degrees)
+ * @param nos_ticks     move time (servo task ticks)
+ * @note
+ *      Arrives at rest on the target.
+ */
+void trajectory_blend(struct trajectory_s *traj, q16_t from_angle, q16_t from_velocity, int32_t to_angle, uint32_t nos_ticks)
+{
+    traj->profile   = TRAJ_BLEND;
+    traj->nos_ticks = (nos_ticks == 0) ? 1 : nos_ticks;
+    traj->start     = from_angle;
+    traj->delta     = int_to_q16(to_angle) - from_angle;
+    traj->m0        = q16_mul_int(from_velocity, traj->nos_ticks);
+    traj->m1        = 0;
+    traj->position  = from_angle;
+    traj->velocity  = from_velocity;
+    traj->tick      = 0;
+    traj->s         = 0;
+    traj->ds        = q16_ratio(1, traj->nos_ticks);
+}
+
+//==============================================================================
+/**
+ * @brief Append a point to the spline of a servo
+ * 
+ * @param traj          trajectory state of servo
+ * @param angle         degrees
+ * @param nos_ticks     time from previous point (servo task ticks)
+ * @return error_codes_te 
+ * 
+ * @note
+ *      The first point added after a spline has been run starts a new list.
+ */
+error_codes_te trajectory_add_waypoint(struct trajectory_s *traj, int32_t angle, uint32_t nos_ticks)
+{
+    if (traj->waypoints_used == true) {
+        traj->nos_waypoints  = 0;
+        traj->waypoints_used = false;
+    }
+    if (traj->nos_waypoints >= MAX_WAYPOINTS) {
+        return TOO_MANY_WAYPOINTS;
+    }
+    traj->waypoints[traj->nos_waypoints].angle = angle;
+    traj->waypoints[traj->nos_waypoints].ticks = (nos_ticks == 0) ? 1 : nos_ticks;
+    traj->nos_waypoints++;
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Start a spline move through the stored waypoints
+ * 
+ * @param traj          trajectory state of servo
+ * @param from_angle    current angle of servo (degrees)
+ * @param speed_limit   degrees/second (SERVO_SPEED_UNLIMITED = no limit)
+ * @return error_codes_te 
+ */
+error_codes_te trajectory_start_spline(struct trajectory_s *traj, int32_t from_angle, int32_t speed_limit)
+{
+    if ((traj->nos_waypoints == 0) || (traj->waypoints_used == true)) {
+        return NO_WAYPOINTS;
+    }
+    traj->profile        = TRAJ_SPLINE;
+    traj->origin         = from_angle;
+    traj->segment        = 0;
+    traj->waypoints_used = true;
+    traj->position       = int_to_q16(from_angle);
+    traj->velocity       = 0;
+    for (uint32_t k = 0; k < traj->nos_waypoints; k++) {
+        traj->waypoints[k].ticks = trajectory_limit_ticks(TRAJ_SPLINE, 
+                                        spline_point(traj, k + 1) - spline_point(traj, k),
+                                        traj->waypoints[k].ticks, speed_limit);
+    }
+    start_segment(traj);
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Advance a trajectory by one servo task tick
+ * 
+ * @param traj      trajectory state of servo
+ * @param angle     new angle (degrees, Q16.16)
+ * @return true     trajectory complete : "angle" is the final position
+ * @return false    still moving
+ */
+bool trajectory_step(struct trajectory_s *traj, q16_t *angle)
+{
+q16_t   s;
+bool    done;
+
+    traj->tick++;
+    if (traj->tick >= traj->nos_ticks) {
+        traj->s = Q16_ONE;
+    } else {
+        traj->s += traj->ds;
+    }
+    s = traj->s;
+    switch (traj->profile) {
+        case TRAJ_BLEND :
+            *angle = hermite(traj, s);
+            done   = (traj->tick >= traj->nos_ticks);
+            break;
+        case TRAJ_SPLINE :
+            *angle = hermite(traj, s);
+            done   = false;
+            if (traj->tick >= traj->nos_ticks) {
+                traj->segment++;
+                if (traj->segment < traj->nos_waypoints) {
+                    start_segment(traj);
+                } else {
+                    done = true;
+                }
+            }
+            break;
+        default :
+            *angle = traj->start + q16_mul(traj->delta, profile_fraction(traj->profile, s));
+            done   = (traj->tick >= traj->nos_ticks);
+            break;
+    }
+    traj->velocity = *angle - traj->position;
+    traj->position = *angle;
+    return done;
+}
@@ -1,5 +1,5 @@
 //==============================================================================
-// buffered_uart.c     interrupt driven UART routines
+// buffered_uart.c     DMA driven UART routines
 //==============================================================================
 
 #include    <stdio.h>
@@ -13,11 +13,13 @@
 #include    "hardware/gpio.h"
 #include    "hardware/uart.h"
 #include    "hardware/irq.h"
+#include    "hardware/dma.h"
 
 #include    "FreeRTOS.h"
 #include    "event_groups.h"
 #include    "timers.h"
 #include    "queue.h"
+#include    "semphr.h"
 
 #include    "system.h"
 #include    "externs.h"
@@ -30,83 +32,226 @@
 // System data
 //==============================================================================
 
-struct ring_buffer_s  ring_buffer_in, ring_buffer_out;
+struct ring_buffer_s  ring_buffer_in;
+struct line_queue_s   line_queue;
+struct uart_stats_s   uart_stats;
+struct frame_buffer_s frame_in;
 
-//==============================================================================
-// Interrupt  handler : Deal with UART Tx/Rx interrupts
-//==============================================================================
+// Receive DMA ring : address must be aligned to its size for DMA ring wrap
 
-static void uart_interrupt_handler(void) {
-
-   uint32_t data, ctrl = UART->mis;
-
-// Receive interrupt processing
-
-    if(ctrl & (UART_UARTMIS_RXMIS_BITS | UART_UARTIMSC_RTIM_BITS)) {
-        while (!(UART->fr & UART_UARTFR_RXFE_BITS)) {
-             data = UART->dr & 0xFF;                       // Read input (use only 8 bits of data)
-             if (data == RETURN) {
-                continue;           // ignore RETURN characters
-             }
-             if (data == TAB){
-                data = SPACE;       // replace TABs with SPACEs
-             }
-             ring_buffer_in.buffer[ring_buffer_in.in_pt++] = (char)data;  // store data
-             ring_buffer_in.count++;
-             if (ring_buffer_in.in_pt >= RING_BUFF_SIZE) {
-                ring_buffer_in.in_pt = 0;   // rotate in pointer to the beginning
-             }
-             if (data == NEWLINE) {     // set event flag if line of data received
-                xEventGroupSetBitsFromISR(eventgroup_uart_IO, (1 <<LINE_AVAILABLE), pdFALSE);
-             }
-        }
-    }
+static uint8_t rx_dma_ring[UART0_RX_DMA_RING_SIZE] __attribute__((aligned(UART0_RX_DMA_RING_SIZE)));
+static uint32_t rx_scan_pt;
+static uint32_t rx_dma_left;        // DMA transfer count when "rx_scan_pt" was set
+static uint32_t rx_line_start;      // ring index of the line being received
+static bool     rx_line_discard;    // current line has overflowed
 
-    // Interrupt if the TX FIFO is lower or equal to the empty TX FIFO threshold
-    // Transmit interrupt processing
-
-    if(ctrl & UART_UARTMIS_TXMIS_BITS) {
-        // // As long as the TX FIFO is not full or the buffer is not empty
-        while((!(UART->fr & UART_UARTFR_TXFF_BITS)) && (ring_buffer_out.count != 0)) {
-            UART->dr = ring_buffer_out.buffer[ring_buffer_out.out_pt++];    // Put character in TX FIFO
-            ring_buffer_out.count--;
-            if (ring_buffer_out.out_pt >= RING_BUFF_SIZE) {
-                ring_buffer_out.out_pt = 0;   // rotate in pointer to the beginning
-             }
-            if(ring_buffer_out.count == 0)	{  // Disable TX interrupt when the TX buffer is empty
-                hw_clear_bits(&UART->imsc, UART_UARTIMSC_TXIM_BITS);
-            } else {
-                hw_set_bits(&UART->imsc, UART_UARTIMSC_TXIM_BITS);
-            }
+// Transmit bip-buffer : region A is being sent, region B (from index 0)
+// collects replies once A reaches the end of the buffer
+
+struct tx_bip_buffer_s {
+    uint32_t    a_start, a_end;     // region A
+    uint32_t    b_end;              // region B is 0 -> b_end
+    bool        b_active;
+    uint32_t    reserve_pt;         // start of current reservation
+    uint32_t    dma_count;          // bytes of region A in flight (0 = DMA idle)
+    char        buffer[UART0_TX_BUFFER_SIZE];
+};
+
+static volatile struct tx_bip_buffer_s tx_bip;
+
+//==============================================================================
+// Interrupt  handler : end of a transmit DMA transfer
+//==============================================================================
+/**
+ * @brief   Release sent data and start on whatever has been committed since
+ */
+static void uart_tx_dma_handler(void) {
+
+BaseType_t  xHigherPriorityTaskWoken = pdFALSE;
+
+    dma_hw->ints1 = (1u << UART0_TX_DMA_CHANNEL);
+    tx_bip.a_start += tx_bip.dma_count;
+    tx_bip.dma_count = 0;
+    if (tx_bip.a_start == tx_bip.a_end) {
+        if (tx_bip.b_active == true) {     // A finished : B becomes A
+            tx_bip.a_start  = 0;
+            tx_bip.a_end    = tx_bip.b_end;
+            tx_bip.b_end    = 0;
+            tx_bip.b_active = false;
+        } else {
+            tx_bip.a_start = 0;
+            tx_bip.a_end   = 0;
         }
     }
+    uart_tx_start();
+    xSemaphoreGiveFromISR(uart_TX_space, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 //==============================================================================
 // Task code
 //==============================================================================
 /**
- * @brief   Task to manage printing to UART channel
+ * @brief   Task to collect UART input from the receive DMA ring
  * @note
- *          
+ *      Runs every UART0_RX_POLL_TICKS and scans all bytes written by
+ *      the DMA since the last scan. A quiet period of one scan interval
+ *      acts as the idle-line timeout, so no receive interrupts are used.
+ * 
+ *      Scans that find data add their bytes and time to "uart_stats",
+ *      giving the receive cost per KB (get UART_INFO). 1uS timer steps
+ *      average out over many scans.
+ *
+ *      The cost is a wake-up every scan with or without data. Once
+ *      UART0_RX_IDLE_SCANS scans have found nothing the interval drops
+ *      to UART0_RX_IDLE_POLL_TICKS, which delays the first command after
+ *      a quiet spell by up to that time. The ring fills in about 22mS at
+ *      115200 baud, so the longer interval still cannot lose data.
  */
 void Task_UART(void *p) {
 
-uint32_t    xLastWakeTime, start_time, end_time;
-uint32_t    string_index;
+uint32_t    xLastWakeTime, start_time, end_time, quiet_scans, received;
 
     uart0_sys_init();
 
+    quiet_scans = 0;
     xLastWakeTime = xTaskGetTickCount ();
     FOREVER {
-        xQueueReceive(queue_print_string_buffers, &string_index,  portMAX_DELAY);
+        if (quiet_scans < UART0_RX_IDLE_SCANS) {
+            vTaskDelayUntil(&xLastWakeTime, UART0_RX_POLL_TICKS);
+        } else {
+            vTaskDelayUntil(&xLastWakeTime, UART0_RX_IDLE_POLL_TICKS);
+        }
         start_time = time_us_32();
-        uart_Write_string_buffer (string_index);
+        received = uart_rx_scan();
         end_time = time_us_32();
+        if (received == 0) {
+            if (quiet_scans < UART0_RX_IDLE_SCANS) {
+                quiet_scans++;
+            }
+        } else {
+            quiet_scans = 0;
+            uart_stats.rx_bytes   += received;
+            uart_stats.rx_scan_uS += end_time - start_time;
+        }
         update_task_execution_time(TASK_UART, start_time, end_time);
     }
 }
 
+//==============================================================================
+/**
+ * @brief   Sort newly received bytes into line and frame buffers
+ * @note
+ *      Same rules as the original per-character interrupt handler, but
+ *      applied to a block of data. Characters of a line are stored in
+ *      "ring_buffer_in" and published with one (offset, length) entry in
+ *      "line_queue" when its NEWLINE arrives, so every line is seen by
+ *      the reader however many arrive together. A line that does not fit
+ *      (ring full, longer than MAX_STRING_LENGTH or no free queue entry)
+ *      is dropped whole and counted in "uart_stats".
+ * 
+ *      Bytes received are counted from the DMA transfer count rather than
+ *      the write address, so a DMA that has lapped the ring since the last
+ *      scan is seen. The ring then holds data from either side of the lost
+ *      bytes, so it is skipped, the line or frame in progress is dropped
+ *      and the overrun is counted.
+ *      The DMA transfer count is re-armed if it ever runs out.
+ * 
+ * @return uint32_t     bytes received since the last scan
+ */
+static uint32_t uart_rx_scan(void)
+{
+uint32_t    write_pt, in_pt, head, dma_left, received;
+uint8_t     data;
+bool        line_found;
+
+    dma_left = dma_hw->ch[UART0_RX_DMA_CHANNEL].transfer_count;
+    received = rx_dma_left - dma_left;
+    rx_dma_left = dma_left;
+    write_pt = (rx_scan_pt + received) & (UART0_RX_DMA_RING_SIZE - 1);
+    if (received >= UART0_RX_DMA_RING_SIZE) {
+        uart_stats.rx_ring_overruns++;
+        rx_scan_pt = write_pt;
+        rx_line_discard = true;                     // dropped at its NEWLINE
+        if (frame_in.state == FRAME_RECEIVE) {
+            frame_in.state = FRAME_DISCARD;
+            uart_stats.rx_dropped_frames++;
+        }
+    }
+    in_pt = ring_buffer_in.in_pt;
+    line_found = false;
+    while (rx_scan_pt != write_pt) {
+        data = rx_dma_ring[rx_scan_pt];
+        rx_scan_pt = (rx_scan_pt + 1) & (UART0_RX_DMA_RING_SIZE - 1);
+        if (frame_in.state != FRAME_IDLE) {           // inside a binary frame
+            if (data == FRAME_DELIMITER) {
+                if ((frame_in.state == FRAME_RECEIVE) && (frame_in.count != 0)) {
+                    frame_in.ready = true;
+                    xEventGroupSetBits(eventgroup_uart_IO, (1 << FRAME_AVAILABLE));
+                }
+                frame_in.state = FRAME_IDLE;
+            } else if ((frame_in.state == FRAME_RECEIVE) && (frame_in.count < MAX_FRAME_SIZE)) {
+                frame_in.buffer[frame_in.count++] = data;
+            } else if (frame_in.state == FRAME_RECEIVE) {
+                frame_in.state = FRAME_DISCARD;        // frame too long
+                uart_stats.rx_dropped_frames++;
+            }
+            continue;
+        }
+        if (data == FRAME_DELIMITER) {                // start of a binary frame
+            if (frame_in.ready == false) {
+                frame_in.count = 0;
+                frame_in.state = FRAME_RECEIVE;
+            } else {
+                frame_in.state = FRAME_DISCARD;        // previous frame not yet read
+                uart_stats.rx_dropped_frames++;
+            }
+            continue;
+        }
+        if (data == RETURN) {
+            continue;           // ignore RETURN characters
+        }
+        if (data == TAB){
+            data = SPACE;       // replace TABs with SPACEs
+        }
+        if (data == NEWLINE) {
+            head = line_queue.head;
+            if ((rx_line_discard == false) && ((head - line_queue.tail) < RX_LINE_QUEUE_SIZE)) {
+                line_queue.line[head & RX_LINE_QUEUE_MASK].offset = rx_line_start;
+                line_queue.line[head & RX_LINE_QUEUE_MASK].length = in_pt - rx_line_start;
+                ring_buffer_in.in_pt = in_pt;
+                __compiler_memory_barrier();
+                line_queue.head = head + 1;             // publish line
+                line_found = true;
+            } else {
+                uart_stats.rx_dropped_lines++;
+                in_pt = rx_line_start;                  // reuse space
+            }
+            rx_line_start = in_pt;
+            rx_line_discard = false;
+            continue;
+        }
+        if (rx_line_discard == true) {
+            continue;
+        }
+        if (((in_pt - ring_buffer_in.out_pt) >= RING_BUFF_SIZE) ||
+            ((in_pt - rx_line_start) >= (MAX_STRING_LENGTH - 1))) {
+            uart_stats.rx_overflows++;
+            rx_line_discard = true;
+            continue;
+        }
+        ring_buffer_in.buffer[in_pt++ & RING_BUFF_MASK] = (char)data;  // store data
+    }
+    if (line_found == true) {     // set event flag if line of data received
+        xEventGroupSetBits(eventgroup_uart_IO, (1 << LINE_AVAILABLE));
+    }
+    if (dma_channel_is_busy(UART0_RX_DMA_CHANNEL) == false) {
+        dma_channel_set_trans_count(UART0_RX_DMA_CHANNEL, UINT32_MAX, true);
+        rx_dma_left = UINT32_MAX;
+    }
+    return received;
+}
+
 //==============================================================================
 // uart routines
 //==============================================================================
@@ -115,12 +260,19 @@ uint32_t    string_index;
  */
 void uart0_sys_init(void)
 {
+dma_channel_config  dma_config;
+
     ring_buffer_in.in_pt   = 0;
     ring_buffer_in.out_pt  = 0;
-    ring_buffer_in.count   = 0;
-    ring_buffer_out.in_pt  = 0;
-    ring_buffer_out.out_pt = 0;
-    ring_buffer_out.count  = 0;
+    line_queue.head  = 0;
+    line_queue.tail  = 0;
+    frame_in.state   = FRAME_IDLE;
+    frame_in.count   = 0;
+    frame_in.ready   = false;
+    rx_scan_pt       = 0;
+    rx_dma_left      = UINT32_MAX;
+    rx_line_start    = 0;
+    rx_line_discard  = false;
 
     gpio_set_function(UART0_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART0_RX_PIN, GPIO_FUNC_UART);
@@ -130,10 +282,45 @@ void uart0_sys_init(void)
     uart_set_format(uart0, 8, 1, UART_PARITY_NONE);
     uart_set_fifo_enabled(uart0, true);
 
-    irq_set_exclusive_handler(UART_IRQ, uart_interrupt_handler);
-    irq_set_enabled(UART0_IRQ, true);
-
-    hw_set_bits(&UART->imsc, UART_UARTIMSC_RXIM_BITS | UART_UARTIMSC_RTIM_BITS);
+// Receive : UART data register into a circular ring, never completes in practice
+
+    dma_channel_claim(UART0_RX_DMA_CHANNEL);
+    dma_config = dma_channel_get_default_config(UART0_RX_DMA_CHANNEL);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, true);
+    channel_config_set_ring(&dma_config, true, UART0_RX_DMA_RING_BITS);
+    channel_config_set_dreq(&dma_config, DREQ_UART0_RX);
+    dma_channel_configure(UART0_RX_DMA_CHANNEL, &dma_config,
+                          rx_dma_ring,
+                          &UART->dr,
+                          UINT32_MAX,
+                          true);
+
+// Transmit : one bip-buffer region per transfer, interrupt when complete
+
+    dma_channel_claim(UART0_TX_DMA_CHANNEL);
+    dma_config = dma_channel_get_default_config(UART0_TX_DMA_CHANNEL);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&dma_config, true);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_dreq(&dma_config, DREQ_UART0_TX);
+    dma_channel_configure(UART0_TX_DMA_CHANNEL, &dma_config,
+                          &UART->dr,
+                          NULL,
+                          0,
+                          false);
+    tx_bip.a_start  = 0;
+    tx_bip.a_end    = 0;
+    tx_bip.b_end    = 0;
+    tx_bip.b_active = false;
+    tx_bip.dma_count = 0;
+
+    dma_channel_set_irq1_enabled(UART0_TX_DMA_CHANNEL, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, uart_tx_dma_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    hw_set_bits(&UART->dmacr, UART_UARTDMACR_TXDMAE_BITS | UART_UARTDMACR_RXDMAE_BITS);
 }
 
 //==============================================================================
@@ -142,233 +329,244 @@ void uart0_sys_init(void)
 /**
  * @brief Read a line of data from input ring buffer
  * 
- * @param string        pointer to string 
- * @return  int32_t     >0  number of characters in string
- *                      -1   error
+ * @param string        pointer to string (at least MAX_STRING_LENGTH bytes)
+ * @return  int32_t     >0  number of characters in string (including NULL)
  * @note
- *      Wait until line of data has been received in the input ring buffer.
+ *      Wait until a line descriptor is available in "line_queue".
  *      Task will not use CPU time during the wait period.
  *      No time-out on wait.
  * 
- *      Simple state machine to
- *          1. remove leading spaces
- *          2. ignore RETURN characters
- *          3. convert TAB character to a single SPACE
- *          4. replace NEWLINE with a STRING_NULL and exit
+ *      RETURNs and TABs have already been dealt with by the receive scan,
+ *      so leading spaces are skipped and the rest of the line is copied
+ *      in at most two blocks (the ring may wrap). LINE_AVAILABLE is left
+ *      set while further lines are queued.
  */
-
-typedef enum  {INIT, READ} line_read_states_te;
-
 int32_t uart_readline(char *string)
 {
-uint32_t    i, ch_count, event_bits;
-char        ch;
-line_read_states_te  state;
-
-    event_bits = xEventGroupWaitBits  ( 
-                        eventgroup_uart_IO,
-                        (1 << LINE_AVAILABLE),
-                        pdTRUE,        //  clear flag
-                        pdFALSE,        
-                        portMAX_DELAY);
-    state = INIT;
-    ch_count = 0;
-    for (i = 0; i < (MAX_STRING_LENGTH - 1) ; i++) {
-        ch = uart_getchar();
-        if (state == INIT) {
-            if ((ch == SPACE) || (ch == TAB) || (ch == RETURN)) { // ignore char
-                continue;    
-            } else if (ch == NEWLINE) {      // string complete
-                *string = STRING_NULL;
-                return (ch_count + 1);
-            } else {                         // load first character into buffer
-                *string++ = ch;
-                ch_count++;
-                state = READ;
-                continue;
-            }
-        }
-        if (state == READ) {
-            if (ch == NEWLINE) {
-                *string = STRING_NULL;
-                return (ch_count + 1);
-            } else if (ch == TAB) {
-                *string++ = SPACE;
-                ch_count++;
-            } else {
-                *string++ = ch;
-                ch_count++;
-                continue;
-            }
+uint32_t    tail, offset, length, first_part;
+
+    tail = line_queue.tail;
+    while (tail == line_queue.head) {
+        xEventGroupWaitBits(eventgroup_uart_IO,
+                            (1 << LINE_AVAILABLE),
+                            pdTRUE,        //  clear flag
+                            pdFALSE,
+                            portMAX_DELAY);
+    }
+    offset = line_queue.line[tail & RX_LINE_QUEUE_MASK].offset;
+    length = line_queue.line[tail & RX_LINE_QUEUE_MASK].length;
+    while ((length != 0) && (ring_buffer_in.buffer[offset & RING_BUFF_MASK] == SPACE)) {
+        offset++;
+        length--;
+    }
+    first_part = RING_BUFF_SIZE - (offset & RING_BUFF_MASK);
+    if (first_part >= length) {
+        memcpy(string, &ring_buffer_in.buffer[offset & RING_BUFF_MASK], length);
+    } else {
+        memcpy(string, &ring_buffer_in.buffer[offset & RING_BUFF_MASK], first_part);
+        memcpy(&string[first_part], &ring_buffer_in.buffer[0], (length - first_part));
+    }
+    string[length] = STRING_NULL;
+
+    ring_buffer_in.out_pt = offset + length;    // release line space
+    __compiler_memory_barrier();
+    line_queue.tail = tail + 1;
+    if (line_queue.tail == line_queue.head) {
+        xEventGroupClearBits(eventgroup_uart_IO, (1 << LINE_AVAILABLE));
+        if (line_queue.tail != line_queue.head) {       // line arrived meanwhile
+            xEventGroupSetBits(eventgroup_uart_IO, (1 << LINE_AVAILABLE));
         }
     }
-    *string = STRING_NULL;  // string has filled buffer
-    return (ch_count + 1);
+    return (length + 1);
 }
 
-#define     DEBUG_REPLY     'D'
-#define     CMD_REPLY       'C'
-#define     MAX_MAX_STRING_SIZE   128
+//==============================================================================
+/**
+ * @brief Copy a received binary frame out of the frame buffer
+ * 
+ * @param frame         buffer of at least MAX_FRAME_SIZE bytes
+ * @return uint32_t     number of COBS encoded bytes (0 if no frame)
+ * @note
+ *      Frame buffer is released for the next frame once copied.
+ */
+uint32_t uart_read_frame(uint8_t *frame)
+{
+uint32_t    count;
 
-struct string_buffer reply_buffer;
+    xEventGroupClearBits(eventgroup_uart_IO, (1 << FRAME_AVAILABLE));
+    taskENTER_CRITICAL();
+    count = 0;
+    if (frame_in.ready == true) {
+        count = frame_in.count;
+        for (uint32_t i = 0; i < count; i++) {
+            frame[i] = frame_in.buffer[i];
+        }
+        frame_in.ready = false;
+    }
+    taskEXIT_CRITICAL();
+    return count;
+}
 
 //==============================================================================
 /**
- * @brief 
+ * @brief   printf style output formatted straight into the TX buffer
  * 
  * @param format 
  * @param ... 
  */
 void print_string(const char *format, ...)
 {
-    init_string_buffer(&reply_buffer);
+struct string_buffer    string;
+uint32_t                length;
+
+    attach_string_buffer(&string, uart_tx_reserve(MAX_PRINT_STRING_LENGTH), MAX_PRINT_STRING_LENGTH);
     va_list vargs;
     va_start(vargs, format);
-    min_format_string(&reply_buffer, format, vargs);  // min_sprintf
+    min_format_string(&string, format, vargs);  // min_sprintf
     va_end(vargs);
-    uart_putstring(&reply_buffer.buffer[0]);
-}
-
-//==============================================================================
-/**
- * @brief   read a character from the input circular buffer
- * @return * char 
- * @note    Access to buffer count is protected in a critical region.
- *          This stops possible corruption by a uart interrupt.
- */
-char  uart_getchar(void)
-{
-char  ch;
-
-    taskENTER_CRITICAL();
-    if (ring_buffer_in.count != 0) {
-        ring_buffer_in.count--;
+    length = string.char_pt;
+    if ((length != 0) && (string.buffer[length - 1] == STRING_NULL)) {
+        length--;               // terminator is not sent
     }
-    ch = ring_buffer_in.buffer[ring_buffer_in.out_pt++];
-    if (ring_buffer_in.out_pt >= RING_BUFF_SIZE) {
-        ring_buffer_in.out_pt = 0;
-    }
-    taskEXIT_CRITICAL();
-    return ch;
+    uart_tx_commit(length);
 }
 
 //==============================================================================
 // UART output routines
 //==============================================================================
 /**
- * @brief Send string through buffered UART channel
+ * @brief Reserve contiguous space in the TX buffer
  * 
- * @param string 
+ * @param   size    number of bytes required (<= MAX_PRINT_STRING_LENGTH)
+ * @return  char*   where to write the data
  * @note
- *      get index of free buffer
- *      copy string to this buffer
- *      send this buffer to UART subsystem
- *      return buffer to free list
+ *      Replies may come from several tasks, so "uart_TX_MUTEX_access" is
+ *      held from here until "uart_tx_commit". The caller formats in place
+ *      and commits the number of bytes actually written. If there is no
+ *      room the task waits for the DMA to free some.
  */
-void uart_putstring(char *string)
+char *uart_tx_reserve(uint32_t size)
 {
-uint32_t    buffer_index;
-
-    xQueueReceive (queue_free_buffers, &buffer_index, portMAX_DELAY);
-    char* in_pt = &string[0];
-    char* out_pt = &print_string_buffers[buffer_index][0];
-    uint32_t string_length = strlen(string);
-    if (string_length >= MAX_PRINT_STRING_LENGTH) {
-        string_length = MAX_PRINT_STRING_LENGTH - 1;
-    }
-    for (uint32_t i=0 ; i < string_length ; i++) {
-        *out_pt++ = *in_pt++;
+bool        found;
+uint32_t    start;
+
+    xSemaphoreTake(uart_TX_MUTEX_access, portMAX_DELAY);
+    FOREVER {
+        found = true;
+        start = 0;
+        taskENTER_CRITICAL();
+        if (tx_bip.a_start == tx_bip.a_end) {
+            start = 0;                                  // buffer empty
+        } else if (tx_bip.b_active == true) {
+            start = tx_bip.b_end;
+            found = ((tx_bip.a_start - tx_bip.b_end) >= size);
+        } else if ((UART0_TX_BUFFER_SIZE - tx_bip.a_end) >= size) {
+            start = tx_bip.a_end;
+        } else {
+            found = (tx_bip.a_start >= size);           // start region B
+        }
+        tx_bip.reserve_pt = start;
+        taskEXIT_CRITICAL();
+        if (found == true) {
+            return (char *)&tx_bip.buffer[start];
+        }
+        uart_stats.tx_stalls++;
+        xSemaphoreTake(uart_TX_space, portMAX_DELAY);
     }
-    *out_pt = STRING_NULL;     // ensure string is null terminated
-    uart_Write_string_buffer(buffer_index);
-    xQueueSend(queue_free_buffers, &buffer_index, portMAX_DELAY);
 }
 
 //==============================================================================
 /**
- * @brief output NULL terminated string to uart
+ * @brief Queue the reserved data for sending
  * 
- * @param   buffer_index    buffer number
+ * @param   length  number of bytes written into the reservation
+ * @note
+ *      The DMA may have emptied region A since the reservation was made,
+ *      in which case the reservation simply becomes the new region A.
  */
-void uart_Write_string_buffer (uint32_t buffer_index)
+void uart_tx_commit(uint32_t length)
 {
-    char    *ptr, ch;
-
-    ptr = &print_string_buffers[buffer_index][0];
-    while((ch = *ptr++) != '\0') {
-        uart_putchar(ch);
+    taskENTER_CRITICAL();
+    if (length != 0) {
+        if (tx_bip.a_start == tx_bip.a_end) {
+            tx_bip.a_start = tx_bip.reserve_pt;
+            tx_bip.a_end   = tx_bip.reserve_pt + length;
+        } else if (tx_bip.reserve_pt == tx_bip.a_end) {
+            tx_bip.a_end += length;
+        } else {
+            tx_bip.b_end    = tx_bip.reserve_pt + length;
+            tx_bip.b_active = true;
+        }
+        uart_tx_start();
     }
+    taskEXIT_CRITICAL();
+    xSemaphoreGive(uart_TX_MUTEX_access);
 }
 
 //==============================================================================
 /**
- * @brief Output single character to uart or uart buffer
- * 
- * @param       c 
- * @return      true 
- * @return      false 
+ * @brief Start a DMA transfer of region A if the channel is idle
  * @note
- *      if buffer is empty AND harware FIFO is not full
- *          output character to hardware out register and exit
- *      else
- *          add character to buffer
- *          adjust in-pointer and character count
- *          enable uartTX interrupt
- *          exit
+ *      Called from a critical section or the DMA interrupt.
  */
-static bool uart_putchar (const char ch)
+static void uart_tx_start(void)
 {
-
-    if ((ring_buffer_out.count == 0) && !(UART->fr & UART_UARTFR_TXFF_BITS)) {
-        UART->dr = ch;  
-        return true;
-    } else {
-        taskENTER_CRITICAL();
-        ring_buffer_out.buffer[ring_buffer_out.in_pt++] = ch;
-        if (ring_buffer_out.in_pt >= RING_BUFF_SIZE) {
-            ring_buffer_out.in_pt = 0;
-        }
-        ring_buffer_out.count++;
-        taskEXIT_CRITICAL();
-        hw_set_bits(&UART->imsc, UART_UARTIMSC_TXIM_BITS);  // Enable transmit interrupt
-        return true;
+    if ((tx_bip.dma_count == 0) && (tx_bip.a_end != tx_bip.a_start)) {
+        tx_bip.dma_count = tx_bip.a_end - tx_bip.a_start;
+        dma_channel_transfer_from_buffer_now(UART0_TX_DMA_CHANNEL, &tx_bip.buffer[tx_bip.a_start], tx_bip.dma_count);
     }
 }
 
 //==============================================================================
 /**
- * @brief prime free buffer queue with indices for all free buffers
+ * @brief Send string through DMA driven UART channel
  * 
+ * @param string    NULL terminated string
  */
-void prime_free_buffer_queue(void)
+void uart_putstring(const char *string)
 {
-// struct string_buffer_s free_buffer_index;
+uint32_t    string_length;
 
-    for (uint32_t count = 0; count < NOS_PRINT_STRING_BUFFERS; count++) {
-        xQueueSend(queue_free_buffers, &count, portMAX_DELAY);
+    string_length = strlen(string);
+    if (string_length > MAX_PRINT_STRING_LENGTH) {
+        string_length = MAX_PRINT_STRING_LENGTH;
     }
-    return;
+    memcpy(uart_tx_reserve(string_length), string, string_length);
+    uart_tx_commit(string_length);
 }
 
 //==============================================================================
-
-static void uart_TxFlush (void)
+/**
+ * @brief Send a block of bytes (may include zero bytes) to uart
+ * 
+ * @param data      pointer to bytes
+ * @param count     number of bytes
+ */
+void uart_putbytes(const uint8_t *data, uint32_t count)
 {
-    hw_clear_bits(&UART->imsc, UART_UARTIMSC_TXIM_BITS);
-    ring_buffer_out.out_pt = 0;
-    ring_buffer_out.out_pt = 0;
-    ring_buffer_out.count = 0;
+    if (count > MAX_PRINT_STRING_LENGTH) {
+        count = MAX_PRINT_STRING_LENGTH;
+    }
+    memcpy(uart_tx_reserve(count), data, count);
+    uart_tx_commit(count);
 }
 
 //==============================================================================
 
 static void uart_RxFlush (void)
 {
-    while(!(UART->fr & UART_UARTFR_RXFE_BITS)) {
-        UART->dr;
-    }
+uint32_t    dma_left;
+
+    taskENTER_CRITICAL();
+    dma_left = dma_hw->ch[UART0_RX_DMA_CHANNEL].transfer_count;
+    rx_scan_pt = (rx_scan_pt + (rx_dma_left - dma_left)) & (UART0_RX_DMA_RING_SIZE - 1);
+    rx_dma_left = dma_left;
     ring_buffer_in.out_pt = 0;
     ring_buffer_in.in_pt = 0;
-    ring_buffer_out.count = 0;
+    line_queue.head = 0;
+    line_queue.tail = 0;
+    rx_line_start = 0;
+    rx_line_discard = false;
+    taskEXIT_CRITICAL();
 }
 
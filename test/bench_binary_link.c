@@ -0,0 +1,156 @@
+/**
+ * @file    bench_binary_link.c
+ * @brief   Servo update throughput : ASCII lines against binary frames
+ * @note
+ *      One servo move command and its status reply, both ways :
+ *
+ *          ASCII   "servo <port> 0 <servo> <angle>\n", reply "<port> <status>\n"
+ *          binary  the same command as a COBS frame with CRC16, reply frame
+ *
+ *      Wire figures are exact for UART0 at 115200 baud 8N1 (10 bits a byte)
+ *      with the link full duplex, so the busier direction sets the rate.
+ *      Host times are for the firmware's own decode and reply code built
+ *      for the host : they show the relative cost, not RP2040 times.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+#include    <math.h>
+
+#include    "system.h"
+#include    "binary_link.h"
+#include    "string_IO.h"
+#include    "tokenizer.h"
+#include    "host_test.h"
+
+#define     NOS_INPUTS      1024
+#define     NOS_PASSES      1000
+#define     BYTES_PER_SEC   (UART0_BAUD_RATE / 10)
+
+extern char        command[MAX_COMMAND_LENGTH];
+extern uint32_t    character_count;
+extern uint32_t    arg_pt[MAX_ARGC];
+extern int32_t     int_parameters[MAX_ARGC];
+extern const struct token_list_s    commands[NOS_COMMANDS];
+
+error_codes_te parse_command(uint32_t *cmd_start);
+
+static char         lines[NOS_INPUTS][MAX_COMMAND_LENGTH];
+static uint8_t      frames[NOS_INPUTS][MAX_FRAME_SIZE];
+static uint32_t     frame_lengths[NOS_INPUTS];
+static uint32_t     sent_length;
+static volatile int32_t     sink;
+
+void uart_putbytes(const uint8_t *data, uint32_t count)
+{
+    sent_length = count;
+}
+
+//==============================================================================
+
+static uint32_t make_frame(uint8_t *frame, int32_t port, int32_t servo, int32_t angle)
+{
+uint8_t     raw[FRAME_HEADER_SIZE + 12 + FRAME_CRC_SIZE];
+int32_t     parameters[3] = {ABS_MOVE, servo, angle};
+uint32_t    length;
+uint16_t    crc;
+
+    raw[0] = TOKENIZER_SERVO;
+    raw[1] = 1;
+    raw[2] = port;
+    length = FRAME_HEADER_SIZE;
+    for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t b = 0; b < 4; b++) {
+            raw[length++] = ((uint32_t)parameters[i] >> (8 * b)) & 0xFF;
+        }
+    }
+    crc = crc16_ccitt(raw, length);
+    raw[length++] = crc & 0xFF;
+    raw[length++] = crc >> 8;
+    return cobs_encode(raw, length, frame);
+}
+
+static uint32_t ascii_reply(char *buffer, int32_t port, int32_t status)
+{
+struct string_buffer    reply;
+
+    attach_string_buffer(&reply, buffer, MAX_STRING_SIZE - 1);
+    add_int_to_char_buffer(&reply, port, BASE_10, LOWER_CASE);
+    add_char_to_char_buffer(&reply, ' ');
+    add_int_to_char_buffer(&reply, status, BASE_10, LOWER_CASE);
+    reply.buffer[reply.char_pt++] = NEWLINE;
+    return reply.char_pt;
+}
+
+//==============================================================================
+
+int main(void)
+{
+struct binary_command_s     bin_cmd;
+struct reply_context_s      context = {TRANSPORT_BINARY, TOKENIZER_SERVO, 1, 0, NULL};
+char        reply[MAX_STRING_SIZE];
+uint32_t    cmd_start, ascii_cmd, ascii_rep, binary_cmd, binary_rep;
+double      start_nS, ascii_parse_nS, binary_parse_nS, ascii_reply_nS, binary_reply_nS;
+int32_t     total;
+
+    ascii_cmd = binary_cmd = 0;
+    for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+        sprintf(lines[i], "servo %u 0 %u %d", i % 64, i % NOS_SERVOS, (int32_t)test_random_range(181) - 90);
+        ascii_cmd += strlen(lines[i]) + 1;
+        frame_lengths[i] = make_frame(frames[i], i % 64, i % NOS_SERVOS, (int32_t)test_random_range(181) - 90);
+        binary_cmd += frame_lengths[i] + 2;
+    }
+    ascii_rep = ascii_reply(reply, 12, OK);
+    binary_send_reply(&context, 12, OK, 0, NULL);
+    binary_rep = sent_length;
+
+    printf("    wire bytes per update (mean)    command  reply   updates/S at %d baud\n", UART0_BAUD_RATE);
+    printf("    ASCII                           %5.1f    %3u     %5.0f\n", (double)ascii_cmd / NOS_INPUTS, ascii_rep,
+           BYTES_PER_SEC / fmax((double)ascii_cmd / NOS_INPUTS, ascii_rep));
+    printf("    binary                          %5.1f    %3u     %5.0f\n", (double)binary_cmd / NOS_INPUTS, binary_rep,
+           BYTES_PER_SEC / fmax((double)binary_cmd / NOS_INPUTS, binary_rep));
+
+    total = 0;
+    start_nS = test_time_nS();
+    for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {
+        for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+            strcpy(command, lines[i]);
+            character_count = strlen(command);
+            cmd_start = 0;
+            parse_command(&cmd_start);
+            total += string_to_token(commands, &command[arg_pt[0]]) + int_parameters[4];
+        }
+    }
+    ascii_parse_nS = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS);
+
+    start_nS = test_time_nS();
+    for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {
+        for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+            binary_unpack_frame(frames[i], frame_lengths[i], &bin_cmd);
+            total += bin_cmd.opcode + bin_cmd.parameters[2];
+        }
+    }
+    binary_parse_nS = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS);
+
+    start_nS = test_time_nS();
+    for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {
+        for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+            total += ascii_reply(reply, i % 64, -(int32_t)(i % 200));
+        }
+    }
+    ascii_reply_nS = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS);
+
+    start_nS = test_time_nS();
+    for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {
+        for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+            binary_send_reply(&context, i % 64, -(int32_t)(i % 200), 0, NULL);
+            total += sent_length;
+        }
+    }
+    binary_reply_nS = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS);
+    sink = total;
+
+    printf("    host decode : ASCII %6.1f nS, binary %6.1f nS    reply : ASCII %6.1f nS, binary %6.1f nS\n",
+           ascii_parse_nS, binary_parse_nS, ascii_reply_nS, binary_reply_nS);
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file    bench_calibration.c
+ * @brief   Model of stepper calibration time, old and new sequences
+ * @note
+ *      Host model, not a board measurement. The new sequence homes on each
+ *      limit switch with a fast profile move, a backoff and slow single
+ *      steps, then moves to the centre. The profile moves are run through
+ *      the real planner and generator ("step_profile.c") with the limits of
+ *      "stepper_data" in Task_stepper_control.c, and timed to the step that
+ *      closes the switch. Each profile move adds the task's load and end
+ *      of move polls.
+ *
+ *      The old sequence made one step every 5mS : to the origin, across to
+ *      the far switch, then back to the centre.
+ *
+ *      The motor starts "start" steps from the left switch, with "travel"
+ *      steps between the switches. Switch hysteresis is not modelled : the
+ *      slow re-approach takes "home_backoff" steps.
+ */
+
+#include    <stdlib.h>
+
+#include    "system.h"
+#include    "step_profile.h"
+#include    "host_test.h"
+
+#define     OLD_STEP_mS     5           // CALIBRATE_SPEED_DELAY of the old sequence
+
+// stepper_data[0] defaults
+
+#define     MAX_SPEED       1000        // steps/sec
+#define     MAX_ACCEL       4000        // steps/sec^2
+#define     MAX_JERK        40000       // steps/sec^3
+#define     HOME_FAST       500         // steps/sec
+#define     HOME_SLOW       100         // steps/sec
+#define     HOME_BACKOFF    20          // steps
+
+// task load (STEPPER_DONE_POLL_TICKS) and end of move check (STEPPER_POLL_uS)
+
+#define     POLL_mS         (STEPPER_DONE_POLL_TICKS + (STEPPER_POLL_uS / 1000.0))
+
+//==============================================================================
+// mS for a profile move of "nos_steps" to make its first "stop" steps
+
+static double move_mS(int32_t nos_steps, int32_t stop, int32_t max_speed)
+{
+struct step_profile_s   profile;
+uint32_t    carry, nos_segment, period;
+uint64_t    cycles;
+int32_t     made;
+
+    if (step_profile_plan(&profile, nos_steps, 0, 0, max_speed, MAX_ACCEL, MAX_JERK) != OK) {
+        printf("    %d steps at %d steps/sec : not planned\n", nos_steps, max_speed);
+        exit(1);
+    }
+    carry = 0;
+    cycles = 0;
+    made = 0;
+    while (step_profile_next(&profile, &carry, &nos_segment, &period) == true) {
+        for (uint32_t k = 0; k < nos_segment; k++) {
+            if (made >= stop) {
+                return (cycles * 1000.0) / STEPPER_PIO_FREQUENCY;
+            }
+            cycles += period;
+            made++;
+        }
+    }
+    return ((cycles + carry) * 1000.0) / STEPPER_PIO_FREQUENCY;
+}
+
+//==============================================================================
+
+int main(void)
+{
+static const int32_t    travels[] = {200, 500, 900};
+int32_t     travel, start, starts[3];
+double      old_mS, fast_L, backoff, slow, fast_R, centre, polls, new_mS;
+
+    printf("    travel start :   old mS :  fast_L backoff  slow  fast_R backoff  slow  centre polls :   new mS  new/old\n");
+    for (uint32_t t = 0; t < 3; t++) {
+        travel = travels[t];
+        starts[0] = 10;
+        starts[1] = travel / 2;
+        starts[2] = travel;
+        for (uint32_t s = 0; s < 3; s++) {
+            start   = starts[s];
+            old_mS  = OLD_STEP_mS * (start + travel + (travel / 2));
+            fast_L  = move_mS(MAX_STEPS, start, HOME_FAST);
+            backoff = move_mS(HOME_BACKOFF, HOME_BACKOFF, HOME_FAST);
+            slow    = (HOME_BACKOFF * 1000.0) / HOME_SLOW;
+            fast_R  = move_mS(MAX_STEPS, travel, HOME_FAST);
+            centre  = move_mS(travel / 2, travel / 2, MAX_SPEED);
+            polls   = 5 * POLL_mS;
+            new_mS  = fast_L + backoff + slow + fast_R + backoff + slow + centre + polls;
+            printf("    %6d %5d : %8.0f : %7.0f %7.0f %5.0f %7.0f %7.0f %5.0f %7.0f %5.0f : %8.0f  %6.2f\n",
+                   travel, start, old_mS, fast_L, backoff, slow, fast_R, backoff, slow, centre, polls,
+                   new_mS, new_mS / old_mS);
+        }
+    }
+    return 0;
+}
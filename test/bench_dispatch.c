@@ -0,0 +1,135 @@
+/**
+ * @file    bench_dispatch.c
+ * @brief   Per command cost of keyword lookup and handler dispatch
+ * @note
+ *      Keyword lookup : the original linear "string_to_token" (copied here
+ *      as "linear_to_token") against the firmware's keyed switch, both over
+ *      the "commands" table in rom_data.c, for an even mix of every command
+ *      keyword and some unknown words.
+ *
+ *      Dispatch : a switch on the token against a table of handler
+ *      pointers, as in "cmd_dispatch". The real handlers need the rest of
+ *      the firmware, so both call the same empty out of line handlers : the
+ *      figure is the cost of getting to a handler, nothing more.
+ *
+ *      Host figures, for the relative cost only.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "system.h"
+#include    "tokenizer.h"
+#include    "host_test.h"
+
+#define     NOS_INPUTS      4096
+#define     NOS_PASSES      2000
+
+extern const struct token_list_s    commands[NOS_COMMANDS];
+
+static const char   *unknown[] = {"servox", "step", "foo", "displays"};
+static const char   *words[NOS_INPUTS];
+static uint32_t     tokens[NOS_INPUTS];
+static volatile int32_t     sink;
+
+//==============================================================================
+// original lookup : first keyword that prefixes the word
+
+static uint32_t linear_to_token(const struct token_list_s *tk_list, const char *string)
+{
+    for (uint32_t i = 0; i < NOS_COMMANDS; i++) {
+        if (strncmp(string, tk_list->keyword, strlen(tk_list->keyword)) == 0) {
+            return tk_list->token;
+        }
+        tk_list++;
+    }
+    return TOKENIZER_ERROR;
+}
+
+//==============================================================================
+
+#define HANDLER(name)   static __attribute__((noinline)) int32_t name(int32_t p) { return p + __LINE__; }
+
+HANDLER(cmd_sys)    HANDLER(cmd_servo)   HANDLER(cmd_stepper) HANDLER(cmd_sync)
+HANDLER(cmd_set)    HANDLER(cmd_get)     HANDLER(cmd_ping)    HANDLER(cmd_tdelay)
+HANDLER(cmd_display) HANDLER(cmd_neopixel) HANDLER(cmd_switch) HANDLER(cmd_script)
+
+static int32_t (*const handlers[NOS_COMMANDS])(int32_t) = {
+    [TOKENIZER_SYS]      = cmd_sys,      [TOKENIZER_SERVO]    = cmd_servo,
+    [TOKENIZER_STEPPER]  = cmd_stepper,  [TOKENIZER_SYNC]     = cmd_sync,
+    [TOKENIZER_SET]      = cmd_set,      [TOKENIZER_GET]      = cmd_get,
+    [TOKENIZER_PING]     = cmd_ping,     [TOKENIZER_TDELAY]   = cmd_tdelay,
+    [TOKENIZER_DISPLAY]  = cmd_display,  [TOKENIZER_NEOPIXEL] = cmd_neopixel,
+    [TOKENIZER_SWITCH]   = cmd_switch,   [TOKENIZER_SCRIPT]   = cmd_script,
+};
+
+static __attribute__((noinline)) int32_t switch_dispatch(uint32_t token, int32_t p)
+{
+    switch (token) {
+        case TOKENIZER_SYS      : return cmd_sys(p);
+        case TOKENIZER_SERVO    : return cmd_servo(p);
+        case TOKENIZER_STEPPER  : return cmd_stepper(p);
+        case TOKENIZER_SYNC     : return cmd_sync(p);
+        case TOKENIZER_SET      : return cmd_set(p);
+        case TOKENIZER_GET      : return cmd_get(p);
+        case TOKENIZER_PING     : return cmd_ping(p);
+        case TOKENIZER_TDELAY   : return cmd_tdelay(p);
+        case TOKENIZER_DISPLAY  : return cmd_display(p);
+        case TOKENIZER_NEOPIXEL : return cmd_neopixel(p);
+        case TOKENIZER_SWITCH   : return cmd_switch(p);
+        case TOKENIZER_SCRIPT   : return cmd_script(p);
+        default                 : return 0;
+    }
+}
+
+static __attribute__((noinline)) int32_t table_dispatch(uint32_t token, int32_t p)
+{
+    if (token >= NOS_COMMANDS) {
+        return 0;
+    }
+    return handlers[token](p);
+}
+
+//==============================================================================
+
+#define TIME_LOOP(result, body)                                             \
+    do {                                                                    \
+        double  start_nS = test_time_nS();                                  \
+        int32_t total = 0;                                                  \
+        for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {                \
+            for (uint32_t i = 0; i < NOS_INPUTS; i++) {                     \
+                body;                                                       \
+            }                                                               \
+        }                                                                   \
+        sink = total;                                                       \
+        result = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS); \
+    } while (0)
+
+int main(void)
+{
+double      linear_nS, keyed_nS, switch_nS, table_nS;
+uint32_t    nos_mismatched;
+
+    nos_mismatched = 0;
+    for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+        if ((i % 8) == 7) {
+            words[i] = unknown[test_random_range(4)];
+        } else {
+            words[i] = commands[test_random_range(NOS_COMMANDS)].keyword;
+        }
+        tokens[i] = string_to_token(commands, words[i]);
+        if (tokens[i] != linear_to_token(commands, words[i])) {
+            nos_mismatched++;       // prefix matches such as "servox"
+        }
+    }
+
+    TIME_LOOP(linear_nS, total += linear_to_token(commands, words[i]));
+    TIME_LOOP(keyed_nS, total += string_to_token(commands, words[i]));
+    TIME_LOOP(switch_nS, total += switch_dispatch(tokens[i], i));
+    TIME_LOOP(table_nS, total += table_dispatch(tokens[i], i));
+
+    printf("    keyword lookup : linear %6.2f nS, keyed switch %6.2f nS    (%u of %u words looked up differently)\n",
+           linear_nS, keyed_nS, nos_mismatched, NOS_INPUTS);
+    printf("    dispatch       : switch %6.2f nS, handler table %6.2f nS\n", switch_nS, table_nS);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file    bench_fixed_point.c
+ * @brief   Time the Q16.16 motion paths against the float code they replaced
+ * @note
+ *      Host figures only. A desktop CPU has a hardware FPU, so this shows
+ *      the cost of the Q16 code itself, not the RP2040 saving : there every
+ *      float operation is a ROM library call. For the board, count the
+ *      float calls listed with each path.
+ */
+
+#include    <stdlib.h>
+
+#include    "fixed_point.h"
+#include    "host_test.h"
+
+#define     NOS_INPUTS      4096
+#define     NOS_PASSES      2000
+
+static int32_t      angles[NOS_INPUTS], deltas[NOS_INPUTS], ticks[NOS_INPUTS];
+static volatile int32_t     sink;
+
+static void report(const char *name, const char *float_calls, double float_nS, double q16_nS)
+{
+    printf("    %-22s float %6.2f nS, Q16 %6.2f nS    (float calls on RP2040 : %s)\n",
+           name, float_nS, q16_nS, float_calls);
+}
+
+#define TIME_LOOP(result, body)                                             \
+    do {                                                                    \
+        double  start_nS = test_time_nS();                                  \
+        int32_t total = 0;                                                  \
+        for (uint32_t pass = 0; pass < NOS_PASSES; pass++) {                \
+            for (uint32_t i = 0; i < NOS_INPUTS; i++) {                     \
+                body;                                                       \
+            }                                                               \
+        }                                                                   \
+        sink = total;                                                       \
+        result = (test_time_nS() - start_nS) / ((double)NOS_PASSES * NOS_INPUTS); \
+    } while (0)
+
+int main(void)
+{
+double      float_nS, q16_nS;
+float       float_gradient, float_steps_per_degree;
+q16_t       q16_gradient, q16_steps_per_degree;
+
+    for (uint32_t i = 0; i < NOS_INPUTS; i++) {
+        angles[i] = (int32_t)test_random_range(7200) - 3600;
+        deltas[i] = (int32_t)test_random_range(181) - 90;
+        ticks[i] = 1 + (int32_t)test_random_range(1000);
+    }
+    float_gradient = 0.37f;
+    q16_gradient = Q16(0.37);
+    float_steps_per_degree = 8888.889f;
+    q16_steps_per_degree = q16_ratio(3200000, 360);
+
+    TIME_LOOP(float_nS, total += (int32_t)(float_gradient * (float)ticks[i]) + (float)angles[i]);
+    TIME_LOOP(q16_nS, total += q16_to_int(q16_mul_int(q16_gradient, ticks[i])) + q16_to_int(int_to_q16(angles[i])));
+    report("servo tick", "i2f, fmul, f2i, fadd, f2i", float_nS, q16_nS);
+
+    TIME_LOOP(float_nS, total += (int32_t)(float_steps_per_degree * angles[i]));
+    TIME_LOOP(q16_nS, total += q16_mul_int_to_int(q16_steps_per_degree, angles[i]));
+    report("stepper angle->steps", "i2f, fmul, f2i", float_nS, q16_nS);
+
+    TIME_LOOP(float_nS, total += (int32_t)(((float)deltas[i] / (float)ticks[i]) * 65536.0f));
+    TIME_LOOP(q16_nS, total += q16_ratio(deltas[i], ticks[i]));
+    report("servo gradient", "2 i2f, fdiv", float_nS, q16_nS);
+    return 0;
+}
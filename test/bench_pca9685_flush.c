@@ -0,0 +1,134 @@
+/**
+ * @file    bench_pca9685_flush.c
+ * @brief   PCA9685 flush : bytes and bus time per servo tick
+ * @note
+ *      The servo tick of "Task_servo_control" (servo_tick on every servo,
+ *      then PCA9685_flush) runs on the real servo, PCA9685 and trajectory
+ *      code. The I2C engine is stubbed : each transfer advances a model
+ *      clock, read by "time_us_32", by its bus time at I2C_BAUDRATE, 9 bits
+ *      a byte plus START and STOP. The figures printed are the counters
+ *      reported by "get" PCA9685_FLUSH_INFO.
+ *
+ *      The bytes are those the firmware sends. The time is the model bus
+ *      time only : on a board, task switches and I2C engine latency add to
+ *      it, and have not been measured.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "system.h"
+#include    "PCA9685.h"
+#include    "i2c_engine.h"
+#include    "host_test.h"
+
+#define     NOS_TICKS       20000
+
+extern struct servo_data_s      servo_data[NOS_SERVOS];
+extern struct PCA9685_stats_s   PCA9685_stats;
+
+void servo_tick(uint32_t servo_no);
+
+static double       clock_uS;
+
+//==============================================================================
+// stubs : I2C transfers take their bus time
+
+static void bus_time(uint32_t tx_length, uint32_t rx_length)
+{
+uint32_t    bits;
+
+    bits = (9 * (1 + tx_length)) + 2;                   // address, data, START + STOP
+    if (rx_length != 0) {
+        bits += (9 * (1 + rx_length)) + 1;              // repeated START, address, data
+    }
+    clock_uS += (bits * 1000000.0) / I2C_BAUDRATE;
+}
+
+uint32_t time_us_32(void)
+{
+    return (uint32_t)clock_uS;
+}
+
+error_codes_te i2c_transfer(uint8_t address, const uint8_t *tx_data, uint32_t tx_length, uint8_t *rx_data, uint32_t rx_length)
+{
+    if (rx_data != NULL) {
+        memset(rx_data, 0, rx_length);
+    }
+    bus_time(tx_length, rx_length);
+    return OK;
+}
+
+error_codes_te i2c_submit(struct i2c_transfer_s *transfer)
+{
+    return OK;
+}
+
+error_codes_te i2c_wait(struct i2c_transfer_s *transfer)
+{
+    bus_time(transfer->tx_length, transfer->rx_length);
+    return OK;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+void print_move_done(uint32_t *seq_id, int32_t status)
+{
+}
+
+//==============================================================================
+
+static void report(const char *name)
+{
+uint32_t    nos_flushes;
+
+    nos_flushes = (PCA9685_stats.flushes == 0) ? 1 : PCA9685_stats.flushes;
+    printf("    %-22s %6u flushes : bytes mean %3u max %3u (budget %u), uS mean %4u max %4u, %u deferred\n",
+           name, PCA9685_stats.flushes,
+           PCA9685_stats.flush_bytes / nos_flushes, PCA9685_stats.max_flush_bytes, PCA9685_FLUSH_BUDGET,
+           PCA9685_stats.flush_uS / nos_flushes, PCA9685_stats.max_flush_uS,
+           PCA9685_stats.flushes_deferred);
+}
+
+// every servo in "moving" on min-jerk moves, a new target as each ends
+
+static void run(const char *name, uint32_t moving)
+{
+int32_t     range;
+
+    for (uint32_t i = 0; i < NOS_SERVOS; i++) {
+        servo_data[i].state = DORMANT;
+    }
+    servo_data[MOUTH].state = DISABLED;
+    memset(&PCA9685_stats, 0, sizeof(PCA9685_stats));
+    for (uint32_t tick = 0; tick < NOS_TICKS; tick++) {
+        for (uint32_t i = 0; i < moving; i++) {
+            if ((i != MOUTH) && (servo_data[i].state == DORMANT)) {
+                range = servo_data[i].angle_max;
+                set_servo_profile_move(i, (int32_t)test_random_range((2 * range) + 1) - range,
+                                       5 + test_random_range(20), TRAJ_MIN_JERK, false);
+            }
+        }
+        for (uint32_t i = 0; i < NOS_SERVOS; i++) {
+            servo_tick(i);
+        }
+        PCA9685_flush();
+    }
+    report(name);
+}
+
+int main(void)
+{
+    init_PCA9685_servo_IO();
+    run("idle", 0);
+    run("1 servo moving", 1);
+    run("all servos moving", NOS_SERVOS);
+    return 0;
+}
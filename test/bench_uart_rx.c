@@ -0,0 +1,94 @@
+/**
+ * @file    bench_uart_rx.c
+ * @brief   Receive DMA path : scan time per KB of command lines
+ * @note
+ *      "uart_rx_scan" is static, so uart_IO.c is built into this file.
+ *      The DMA is modelled by writing the ring and counting down the
+ *      channel transfer count. Each scan gets the bytes that arrive in one
+ *      UART0_RX_POLL_TICKS tick at UART0_BAUD_RATE, and the lines found
+ *      are taken as "uart_readline" would take them.
+ *
+ *      The firmware keeps the same figure from its own scans, reported as
+ *      the last value of "get" UART_INFO. This host figure shows the work
+ *      per byte on a desktop CPU, not the RP2040 time.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "../src/uart_IO.c"
+
+#include    "host_test.h"
+
+#define     NOS_KB          20000
+#define     BYTES_PER_TICK  ((UART0_BAUD_RATE / 10) / 1000)     // 1mS tick
+
+EventGroupHandle_t  eventgroup_uart_IO;
+dma_hw_t            *dma_hw;
+static uint32_t     nos_lines;
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t bits) { return bits; }
+bool dma_channel_is_busy(uint channel) { return true; }
+void dma_channel_set_trans_count(uint channel, uint32_t count, bool trigger) { }
+void __compiler_memory_barrier(void) { __asm__ volatile ("" ::: "memory"); }
+
+static const char   *lines[] = {
+    "servo 12 0 3 -45\n", "stepper 3 1 0 120\n", "#17 servo 5 4 2 30 20 1\n",
+    "get 9 4\n", "ping 1 42 1\n", "servo 1 2 7 10 15\n",
+};
+
+//==============================================================================
+
+static void dma_write(const char *data, uint32_t count)
+{
+static uint32_t     write_pt;
+
+    for (uint32_t i = 0; i < count; i++) {
+        rx_dma_ring[write_pt] = data[i];
+        write_pt = (write_pt + 1) & (UART0_RX_DMA_RING_SIZE - 1);
+    }
+    dma_hw->ch[UART0_RX_DMA_CHANNEL].transfer_count -= count;
+}
+
+static void read_lines(void)
+{
+    while (line_queue.tail != line_queue.head) {
+        ring_buffer_in.out_pt = line_queue.line[line_queue.tail & RX_LINE_QUEUE_MASK].offset
+                              + line_queue.line[line_queue.tail & RX_LINE_QUEUE_MASK].length;
+        line_queue.tail++;
+        nos_lines++;
+    }
+}
+
+int main(void)
+{
+static dma_hw_t     dma_model;
+static char         stream[NOS_KB * 1024 + 64];
+uint32_t    length, pt, count;
+double      start_nS, scan_nS;
+
+    dma_hw = &dma_model;
+    dma_hw->ch[UART0_RX_DMA_CHANNEL].transfer_count = UINT32_MAX;
+    rx_dma_left = UINT32_MAX;
+
+    length = 0;
+    while (length < (NOS_KB * 1024)) {
+        strcpy(&stream[length], lines[test_random_range(sizeof(lines) / sizeof(lines[0]))]);
+        length += strlen(&stream[length]);
+    }
+    length = NOS_KB * 1024;
+
+    scan_nS = 0;
+    for (pt = 0; pt < length; pt += count) {
+        count = ((length - pt) < BYTES_PER_TICK) ? (length - pt) : BYTES_PER_TICK;
+        dma_write(&stream[pt], count);
+        start_nS = test_time_nS();
+        uart_rx_scan();
+        scan_nS += test_time_nS() - start_nS;
+        read_lines();
+    }
+    printf("    %u KB in %u byte scans : %u lines, %.2f uS/KB scan time (host), %u dropped, %u overflows\n",
+           NOS_KB, BYTES_PER_TICK, nos_lines, (scan_nS / 1000) / NOS_KB,
+           uart_stats.rx_dropped_lines, uart_stats.rx_overflows);
+    return 0;
+}
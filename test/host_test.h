@@ -0,0 +1,58 @@
+/**
+ * @file    host_test.h
+ * @brief   Checks, random numbers and timing for the host tests
+ */
+
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include    <stdio.h>
+#include    <stdint.h>
+#include    <time.h>
+
+static uint32_t     test_checks, test_failures;
+
+#define CHECK(cond, ...)                                            \
+    do {                                                            \
+        test_checks++;                                              \
+        if (!(cond)) {                                              \
+            if (test_failures++ < 20) {                             \
+                printf("FAIL %s:%d : ", __FILE__, __LINE__);        \
+                printf(__VA_ARGS__);                                \
+                printf("\n");                                       \
+            }                                                       \
+        }                                                           \
+    } while (0)
+
+static inline int test_result(const char *name)
+{
+    printf("%-20s %u checks, %u failures\n", name, test_checks, test_failures);
+    return (test_failures == 0) ? 0 : 1;
+}
+
+// xorshift32 : same sequence on every host, so failures repeat
+
+static uint32_t     test_seed = 2463534242u;
+
+static inline uint32_t test_random(void)
+{
+    test_seed ^= test_seed << 13;
+    test_seed ^= test_seed >> 17;
+    test_seed ^= test_seed << 5;
+    return test_seed;
+}
+
+static inline uint32_t test_random_range(uint32_t n)       // 0 -> n-1
+{
+    return test_random() % n;
+}
+
+static inline double test_time_nS(void)
+{
+struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1e9) + now.tv_nsec;
+}
+
+#endif  /* __HOST_TEST_H__ */
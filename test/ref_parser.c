@@ -0,0 +1,189 @@
+/**
+ * @file    ref_parser.c
+ * @brief   Original two pass command parser, kept as a reference for tests
+ * @note
+ *      "parse_command", "convert_tokens" and "ASCII_to_int" as they were
+ *      before the single pass lexer, with the globals renamed and passed
+ *      in. Only integer conversion is kept : the original DOT case made
+ *      every real a DOT_ERROR, so real values never reached conversion.
+ */
+
+#include    "system.h"
+#include    "ref_parser.h"
+
+extern const uint8_t char_type[256];
+
+static int32_t ref_ASCII_to_int(char *str) {
+
+int32_t result = 0;    // Initialize result
+int32_t sign = 1;      // Initialize sign as positive
+uint32_t char_pt = 0;  // Initialize index of first digit
+
+    if (*str == '\0') {
+        return 0;
+    }
+    if (str[0] == '-') {
+        sign = -1;
+        char_pt++; // Also update index of first digit
+    }
+    if (str[0] == '+') {
+        char_pt++;
+    }
+    for (; str[char_pt] != '\0'; ++char_pt) {
+        result = (result * 10) + (str[char_pt] - '0');
+    }
+    return sign * result;
+}
+
+static error_codes_te ref_parse_command(struct ref_parse_s *p, uint32_t character_count)
+{
+int32_t     count, mode, status;
+uint8_t     character_type;
+
+    p->argc = 0;
+    mode = MODE_U;
+    status = OK;
+    for (count=0 ; count <= character_count ; count++) {
+        character_type = char_type[(uint8_t)p->command[count]];
+        switch (character_type) {
+            case LETTER :
+                switch(mode) {
+                    case MODE_U :
+                        mode = MODE_W;
+                        p->arg_pt[p->argc] = count;
+                        break;
+                    case MODE_I :
+                    case MODE_R :
+                        status = LETTER_ERROR;
+                        break;
+                    case MODE_W :
+                    case MODE_S :
+                        break;
+                }
+                break;
+
+            case QUOTE :
+                switch(mode) {
+                    case MODE_U :
+                        mode = MODE_S;
+                        p->arg_pt[p->argc] = count + 1;   // skip '"' character
+                        break;
+                    case MODE_I :
+                    case MODE_R :
+                    case MODE_W :
+                        status = QUOTE_ERROR;
+                        break;
+                    case MODE_S :   // end of string
+                        p->arg_type[p->argc++] = MODE_S;
+                        p->command[count] = STRING_NULL;  // put terminator on string
+                        mode = MODE_U;
+                        break;
+                }
+                break;
+
+            case NUMBER :
+                switch(mode) {
+                    case MODE_U :
+                        mode = MODE_I;
+                        p->arg_pt[p->argc] = count;
+                        break;
+                    case MODE_I :
+                    case MODE_R :
+                    case MODE_W :
+                    case MODE_S :
+                        break;
+                }
+                break;
+
+            case SEPARATOR :
+                switch(mode) {
+                    case MODE_U :
+                    case MODE_S :
+                        break;
+                    case MODE_W :
+                    case MODE_I :
+                    case MODE_R :
+                        p->arg_type[p->argc++] = mode;
+                        p->command[count] = STRING_NULL;
+                        mode = MODE_U;
+                        break;
+                }
+                break;
+
+            case DOT :
+                switch(mode) {
+                    case MODE_I :
+                        mode = MODE_R;
+                    case MODE_R :
+                    case MODE_U :
+                        status = DOT_ERROR;  // extra point in real value
+                    case MODE_W :
+                    case MODE_S :
+                        break;
+                }
+                break;
+
+            case PLUSMINUS :
+                switch(mode) {
+                    case MODE_U :
+                        mode = MODE_I;
+                        p->arg_pt[p->argc] = count;
+                        break;
+                    case MODE_I :
+                    case MODE_R :
+                        status = PLUSMINUS_ERROR;
+                        break;
+                    case MODE_W :
+                    case MODE_S :
+                        break;
+                }
+                break;
+
+            case END :
+                switch(mode) {
+                    case MODE_U :
+                        break;
+                    case MODE_I :
+                    case MODE_R :
+                    case MODE_W :
+                    case MODE_S :
+                        p->arg_type[p->argc++] = mode;
+                        return status;
+                        break;
+                }
+                break;
+        }   // end of SWITCH
+    }  // end of FOR
+    return status;
+}
+
+static error_codes_te ref_convert_tokens(struct ref_parse_s *p)
+{
+    if ((p->arg_type[0] != MODE_W) || (char_type[(uint8_t)p->command[0]] != LETTER)) {
+        return BAD_COMMAND;
+    }
+    for (uint32_t i=0 ; i < p->argc ; i++) {
+        if (p->arg_type[i] == MODE_I) {
+            p->int_parameters[i] = ref_ASCII_to_int(&p->command[p->arg_pt[i]]);
+        }
+    }
+    return OK;
+}
+
+//==============================================================================
+/**
+ * @brief Parse a line (no NEWLINE) the way the original firmware did
+ */
+error_codes_te ref_parse(struct ref_parse_s *p, const char *line)
+{
+error_codes_te  status;
+uint32_t        length;
+
+    length = strlen(line);
+    memcpy(p->command, line, length + 1);
+    status = ref_parse_command(p, length);
+    if (status != OK) {
+        return status;
+    }
+    return ref_convert_tokens(p);
+}
@@ -0,0 +1,21 @@
+/**
+ * @file    ref_parser.h
+ * @brief   Original two pass command parser, kept as a reference for tests
+ */
+
+#ifndef __REF_PARSER_H__
+#define __REF_PARSER_H__
+
+#include    <string.h>
+
+#include    "system.h"
+
+struct ref_parse_s {
+    char        command[MAX_COMMAND_LENGTH];
+    uint32_t    argc, arg_pt[MAX_ARGC], arg_type[MAX_ARGC];
+    int32_t     int_parameters[MAX_ARGC];
+};
+
+error_codes_te ref_parse(struct ref_parse_s *p, const char *line);
+
+#endif  /* __REF_PARSER_H__ */
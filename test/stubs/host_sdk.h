@@ -0,0 +1,181 @@
+/**
+ * @file    host_sdk.h
+ * @brief   Pico SDK and FreeRTOS declarations for host builds of the tests
+ * @note
+ *      Declarations only, enough for firmware modules to compile with a
+ *      host compiler. Tests link with --gc-sections, so only code they
+ *      reach must link, and they define any SDK calls that code makes.
+ */
+
+#ifndef HOST_SDK_H
+#define HOST_SDK_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+typedef unsigned int uint;
+typedef struct { volatile uint32_t dr, rsr, fr, ilpr, ibrd, fbrd, lcr_h, cr, ifls, imsc, ris, mis, icr, dmacr; } uart_hw_t;
+typedef struct uart_inst uart_inst_t;
+extern uart_inst_t *uart0, *uart1;
+#define uart0 uart0
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+#define UART_UARTFR_RXFE_BITS 0x10
+#define UART_UARTFR_TXFF_BITS 0x20
+#define UART_UARTFR_BUSY_BITS 0x08
+#define UART_UARTFR_TXFE_BITS 0x80
+#define UART_UARTMIS_RXMIS_BITS 0x10
+#define UART_UARTMIS_TXMIS_BITS 0x20
+#define UART_UARTMIS_RTMIS_BITS 0x40
+#define UART_UARTIMSC_RXIM_BITS 0x10
+#define UART_UARTIMSC_TXIM_BITS 0x20
+#define UART_UARTIMSC_RTIM_BITS 0x40
+#define UART_UARTDMACR_RXDMAE_BITS 1
+#define UART_UARTDMACR_TXDMAE_BITS 2
+#define UART_UARTICR_RTIC_BITS 0x40
+#define UART_PARITY_NONE 0
+#define GPIO_FUNC_UART 2
+#define GPIO_FUNC_I2C 3
+#define GPIO_FUNC_PIO0 6
+#define GPIO_OUT 1
+#define GPIO_IN 0
+#define GPIO_IRQ_EDGE_FALL 4
+#define GPIO_IRQ_EDGE_RISE 8
+#define PICO_DEFAULT_LED_PIN 25
+#define PICO_ERROR_GENERIC -1
+#define PICO_ERROR_TIMEOUT -2
+uint uart_init(uart_inst_t*, uint); void uart_set_hw_flow(uart_inst_t*, bool, bool); void uart_set_format(uart_inst_t*, uint, uint, int);
+void uart_set_fifo_enabled(uart_inst_t*, bool); uart_hw_t *uart_get_hw(uart_inst_t*); uint uart_get_index(uart_inst_t*);
+bool uart_is_readable(uart_inst_t*); char uart_getc(uart_inst_t*); void uart_putc_raw(uart_inst_t*, char); void uart_write_blocking(uart_inst_t*, const uint8_t*, size_t);
+bool uart_is_readable_within_us(uart_inst_t*, uint32_t); void uart_read_blocking(uart_inst_t*, uint8_t*, size_t);
+#define UART_DREQ_NUM(u, tx) 20
+#define DREQ_UART0_TX 20
+#define DREQ_UART0_RX 21
+#define DREQ_I2C0_TX 32
+#define DREQ_I2C0_RX 33
+void gpio_set_function(uint, int); void gpio_init(uint); void gpio_set_dir(uint, bool); void gpio_put(uint, bool); bool gpio_get(uint);
+void gpio_pull_up(uint); void gpio_pull_down(uint); uint32_t gpio_get_all(void); void gpio_set_mask(uint32_t); void gpio_clr_mask(uint32_t); void gpio_disable_pulls(uint);
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+void gpio_set_irq_enabled_with_callback(uint, uint32_t, bool, gpio_irq_callback_t); void gpio_set_irq_enabled(uint, uint32_t, bool);
+void gpio_add_raw_irq_handler_masked(uint32_t, void (*)(void)); void gpio_acknowledge_irq(uint, uint32_t); uint32_t gpio_get_irq_event_mask(uint);
+typedef void (*irq_handler_t)(void);
+void irq_set_exclusive_handler(uint, irq_handler_t); void irq_set_enabled(uint, bool);
+void hw_set_bits(volatile uint32_t*, uint32_t); void hw_clear_bits(volatile uint32_t*, uint32_t);
+void stdio_init_all(void); uint32_t time_us_32(void); uint64_t time_us_64(void); void busy_wait_us(uint32_t); void busy_wait_us_32(uint32_t); void sleep_ms(uint32_t);
+typedef uint64_t absolute_time_t; absolute_time_t get_absolute_time(void);
+typedef struct i2c_inst i2c_inst_t; extern i2c_inst_t *i2c0, *i2c1;
+typedef struct { volatile uint32_t con, tar, sar, pad0, data_cmd, ss_scl_hcnt, ss_scl_lcnt, fs_scl_hcnt, fs_scl_lcnt, pad1[2], intr_stat, intr_mask, raw_intr_stat, rx_tl, tx_tl, clr_intr, clr_rx_under, clr_rx_over, clr_tx_over, clr_rd_req, clr_tx_abrt, clr_rx_done, clr_activity, clr_stop_det, clr_start_det, clr_gen_call, enable, status, txflr, rxflr, sda_hold, tx_abrt_source, slv_data_nack_only, dma_cr, dma_tdlr, dma_rdlr; } i2c_hw_t;
+i2c_hw_t *i2c_get_hw(i2c_inst_t*); uint i2c_hw_index(i2c_inst_t*);
+#define I2C0_IRQ 23
+#define I2C_IC_DATA_CMD_STOP_BITS 0x200
+#define I2C_IC_DATA_CMD_RESTART_BITS 0x400
+#define I2C_IC_DATA_CMD_CMD_BITS 0x100
+#define I2C_IC_INTR_MASK_M_TX_ABRT_BITS 0x40
+#define I2C_IC_INTR_MASK_M_STOP_DET_BITS 0x200
+#define I2C_IC_INTR_STAT_R_TX_ABRT_BITS 0x40
+#define I2C_IC_INTR_STAT_R_STOP_DET_BITS 0x200
+#define I2C_IC_DMA_CR_TDMAE_BITS 2
+#define I2C_IC_ENABLE_ENABLE_BITS 1
+#define I2C_IC_ENABLE_ABORT_BITS 2
+#define I2C_IC_INTR_MASK_M_TX_EMPTY_BITS 0x10
+#define I2C_IC_INTR_MASK_M_RX_FULL_BITS 0x4
+#define I2C_IC_INTR_STAT_R_TX_EMPTY_BITS 0x10
+#define I2C_IC_INTR_STAT_R_RX_FULL_BITS 0x4
+#define GPIO_FUNC_SIO 5
+size_t i2c_get_write_available(i2c_inst_t*); size_t i2c_get_read_available(i2c_inst_t*);
+#define I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS 1
+#define I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS 8
+int i2c_write_blocking(i2c_inst_t*, uint8_t, const uint8_t*, size_t, bool); int i2c_read_blocking(i2c_inst_t*, uint8_t, uint8_t*, size_t, bool);
+int i2c_write_timeout_us(i2c_inst_t*, uint8_t, const uint8_t*, size_t, bool, uint); int i2c_read_timeout_us(i2c_inst_t*, uint8_t, uint8_t*, size_t, bool, uint);
+uint i2c_init(i2c_inst_t*, uint); void i2c_deinit(i2c_inst_t*); uint i2c_set_baudrate(i2c_inst_t*, uint);
+typedef struct { volatile uint32_t clkdiv, execctrl, shiftctrl, addr, instr, pinctrl; } pio_sm_hw_t; typedef struct pio_hw { volatile uint32_t ctrl, fstat, fdebug, flevel, txf[4], rxf[4]; pio_sm_hw_t sm[4]; } pio_hw_t; typedef pio_hw_t *PIO; extern pio_hw_t *pio0, *pio1; extern pio_hw_t *pio0_hw;
+typedef struct { uint32_t a; } pio_sm_config; typedef struct { const uint16_t *instructions; uint8_t length; int8_t origin; } pio_program_t;
+uint pio_add_program(PIO, const pio_program_t*); void pio_sm_put_blocking(PIO, uint, uint32_t); void pio_sm_put(PIO, uint, uint32_t); bool pio_sm_is_tx_fifo_full(PIO, uint);
+void pio_sm_set_enabled(PIO, uint, bool); void pio_sm_init(PIO, uint, uint, const pio_sm_config*); void pio_gpio_init(PIO, uint); void pio_sm_set_consecutive_pindirs(PIO, uint, uint, uint, bool);
+void sm_config_set_sideset_pins(pio_sm_config*, uint); void sm_config_set_set_pins(pio_sm_config*, uint, uint); void sm_config_set_out_pins(pio_sm_config*, uint, uint);
+void sm_config_set_clkdiv(pio_sm_config*, float); void sm_config_set_fifo_join(pio_sm_config*, int); void sm_config_set_out_shift(pio_sm_config*, bool, bool, uint);
+void sm_config_set_wrap(pio_sm_config*, uint, uint); void sm_config_set_sideset(pio_sm_config*, uint, bool, bool); pio_sm_config pio_get_default_sm_config(void);
+bool pio_sm_is_tx_fifo_empty(PIO, uint); uint pio_sm_get_tx_fifo_level(PIO, uint); void pio_sm_clear_fifos(PIO, uint); void pio_sm_restart(PIO, uint); void pio_sm_exec(PIO, uint, uint);
+uint pio_get_dreq(PIO, uint, bool); int pio_claim_unused_sm(PIO, bool);
+#define PIO_FIFO_JOIN_TX 1
+#define DREQ_PIO0_TX0 0
+#define DREQ_PIO0_TX1 1
+typedef struct { uint32_t ctrl; } dma_channel_config;
+dma_channel_config dma_channel_get_default_config(uint); void channel_config_set_transfer_data_size(dma_channel_config*, int); void channel_config_set_read_increment(dma_channel_config*, bool);
+void channel_config_set_write_increment(dma_channel_config*, bool); void channel_config_set_dreq(dma_channel_config*, uint); void channel_config_set_ring(dma_channel_config*, bool, uint);
+void dma_channel_configure(uint, const dma_channel_config*, volatile void*, const volatile void*, uint, bool); void dma_channel_set_read_addr(uint, const volatile void*, bool);
+void dma_channel_set_write_addr(uint, volatile void*, bool); void dma_channel_set_trans_count(uint, uint32_t, bool); void dma_channel_transfer_from_buffer_now(uint, const volatile void*, uint32_t);
+bool dma_channel_is_busy(uint); int dma_claim_unused_channel(bool); void dma_channel_set_irq0_enabled(uint, bool); void dma_channel_set_irq1_enabled(uint, bool);
+void dma_channel_acknowledge_irq0(uint); void dma_channel_acknowledge_irq1(uint); bool dma_channel_get_irq0_status(uint); bool dma_channel_get_irq1_status(uint); void dma_channel_abort(uint); void dma_channel_start(uint);
+typedef struct { volatile uint32_t read_addr, write_addr, transfer_count, ctrl_trig; } dma_channel_hw_t; dma_channel_hw_t *dma_channel_hw_addr(uint);
+#define DMA_SIZE_8 0
+#define DMA_SIZE_16 1
+#define DMA_SIZE_32 2
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+void irq_set_priority(uint, uint8_t); void irq_add_shared_handler(uint, irq_handler_t, uint8_t);
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+uint32_t clock_get_hz(int); enum { clk_sys = 5 };
+void adc_init(void); void watchdog_enable(uint32_t, bool);
+typedef struct repeating_timer { int64_t delay_us; void *user_data; } repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer*);
+bool add_repeating_timer_us(int64_t, repeating_timer_callback_t, void*, struct repeating_timer*); bool add_repeating_timer_ms(int32_t, repeating_timer_callback_t, void*, struct repeating_timer*); bool cancel_repeating_timer(struct repeating_timer*);
+typedef int32_t alarm_id_t; typedef int64_t (*alarm_callback_t)(alarm_id_t, void*);
+alarm_id_t add_alarm_in_us(uint64_t, alarm_callback_t, void*, bool); alarm_id_t add_alarm_at(absolute_time_t, alarm_callback_t, void*, bool); bool cancel_alarm(alarm_id_t);
+void hardware_alarm_force_irq(uint); int hardware_alarm_claim_unused(bool); void hardware_alarm_set_callback(uint, void (*)(uint)); bool hardware_alarm_set_target(uint, absolute_time_t); void hardware_alarm_cancel(uint);
+absolute_time_t from_us_since_boot(uint64_t); uint64_t to_us_since_boot(absolute_time_t); absolute_time_t delayed_by_us(absolute_time_t, uint64_t);
+void multicore_launch_core1(void (*)(void));
+uint32_t save_and_disable_interrupts(void); void restore_interrupts(uint32_t); void __dmb(void); void __compiler_memory_barrier(void);
+void flash_range_erase(uint32_t, size_t); void flash_range_program(uint32_t, const uint8_t*, size_t);
+#define FLASH_SECTOR_SIZE 4096u
+#define FLASH_PAGE_SIZE 256u
+#define PICO_FLASH_SIZE_BYTES (2*1024*1024)
+#define XIP_BASE 0x10000000
+#define __not_in_flash_func(x) x
+#define __time_critical_func(x) x
+/* FreeRTOS */
+typedef void *TaskHandle_t; typedef void *QueueHandle_t; typedef void *SemaphoreHandle_t; typedef void *EventGroupHandle_t; typedef void *TimerHandle_t; typedef void *StreamBufferHandle_t; typedef void *QueueSetHandle_t; typedef void *QueueSetMemberHandle_t;
+typedef uint32_t TickType_t; typedef long BaseType_t; typedef unsigned long UBaseType_t; typedef uint32_t StackType_t; typedef uint32_t EventBits_t;
+#define configSTACK_DEPTH_TYPE size_t
+#define configMINIMAL_STACK_SIZE 256
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define pdMS_TO_TICKS(x) (x)
+#define taskENTER_CRITICAL() do{}while(0)
+#define taskEXIT_CRITICAL() do{}while(0)
+#define taskENTER_CRITICAL_FROM_ISR() 0
+#define taskEXIT_CRITICAL_FROM_ISR(x) (void)(x)
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define configASSERT(x)
+#define tskIDLE_PRIORITY 0
+#define eSetBits 1
+#define eIncrement 2
+#define eNoAction 0
+#define eSetValueWithOverwrite 3
+void vTaskDelay(TickType_t); BaseType_t xTaskDelayUntil(TickType_t*, TickType_t); void vTaskDelayUntil(TickType_t*, TickType_t); TickType_t xTaskGetTickCount(void); TickType_t xTaskGetTickCountFromISR(void);
+BaseType_t xTaskCreate(void (*)(void*), const char*, configSTACK_DEPTH_TYPE, void*, UBaseType_t, TaskHandle_t*); void vTaskStartScheduler(void); void vTaskDelete(TaskHandle_t); TaskHandle_t xTaskGetCurrentTaskHandle(void);
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t); BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t); BaseType_t xQueueSendToBack(QueueHandle_t, const void*, TickType_t); BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+BaseType_t xQueueSendFromISR(QueueHandle_t, const void*, BaseType_t*); BaseType_t xQueueReceiveFromISR(QueueHandle_t, void*, BaseType_t*); UBaseType_t uxQueueMessagesWaiting(QueueHandle_t); UBaseType_t uxQueueSpacesAvailable(QueueHandle_t); BaseType_t xQueuePeek(QueueHandle_t, void*, TickType_t); BaseType_t xQueueReset(QueueHandle_t);
+SemaphoreHandle_t xSemaphoreCreateMutex(void); SemaphoreHandle_t xSemaphoreCreateBinary(void); BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t); BaseType_t xSemaphoreGive(SemaphoreHandle_t); BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t, BaseType_t*);
+EventGroupHandle_t xEventGroupCreate(void); EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t); BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t, EventBits_t, BaseType_t*); EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t); EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+BaseType_t xTaskNotifyGive(TaskHandle_t); void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*); uint32_t ulTaskNotifyTake(BaseType_t, TickType_t); BaseType_t xTaskNotify(TaskHandle_t, uint32_t, int); BaseType_t xTaskNotifyFromISR(TaskHandle_t, uint32_t, int, BaseType_t*); BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t*, TickType_t);
+BaseType_t xTaskNotifyGiveIndexed(TaskHandle_t, UBaseType_t); uint32_t ulTaskNotifyTakeIndexed(UBaseType_t, BaseType_t, TickType_t); void vTaskNotifyGiveIndexedFromISR(TaskHandle_t, UBaseType_t, BaseType_t*);
+TaskHandle_t xTaskGetCurrentTaskHandle(void); void vTaskSuspendAll(void); BaseType_t xTaskResumeAll(void);
+QueueSetHandle_t xQueueCreateSet(UBaseType_t); BaseType_t xQueueAddToSet(QueueSetMemberHandle_t, QueueSetHandle_t); QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t, TickType_t);
+TimerHandle_t xTimerCreate(const char*, TickType_t, UBaseType_t, void*, void (*)(TimerHandle_t)); BaseType_t xTimerStart(TimerHandle_t, TickType_t);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t, BaseType_t, void*); void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t, BaseType_t);
+typedef struct dma_hw_s { dma_channel_hw_t ch[12]; volatile uint32_t intr, inte0, intf0, ints0, pad, inte1, intf1, ints1; } dma_hw_t;
+extern dma_hw_t *dma_hw;
+void dma_channel_claim(uint);
+#define PIO_FDEBUG_TXSTALL_LSB 24
+void pio_sm_set_pins_with_mask(PIO, uint, uint32_t, uint32_t); uint pio_encode_jmp(uint);
+void dma_start_channel_mask(uint32_t);
+
+uint8_t pio_sm_get_pc(PIO, uint); uint32_t pio_sm_get(PIO, uint); enum pio_src_dest { pio_pins, pio_x, pio_y, pio_null, pio_pindirs, pio_exec_mov, pio_status, pio_pc, pio_isr, pio_osr, pio_exec_out };
+uint pio_encode_mov(enum pio_src_dest, enum pio_src_dest); uint pio_encode_push(bool, bool);
+#define PIO_SM0_SHIFTCTRL_FJOIN_TX_BITS 0x40000000u
+#endif
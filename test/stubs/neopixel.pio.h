@@ -0,0 +1,2 @@
+#include "host_sdk.h"
+extern const pio_program_t neopixel_program; static inline void neopixel_program_init(PIO p, uint sm, uint off, uint pin, float f, uint b){}
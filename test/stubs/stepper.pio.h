@@ -0,0 +1,6 @@
+#include "host_sdk.h"
+#define stepper_STEP_HIGH 2
+#define stepper_STEP_OVERHEAD 4
+extern const pio_program_t stepper_program; static inline void stepper_program_init(PIO p, uint sm, uint off, uint step_pin, uint dir_pin, float f){}
+#define stepper_offset_step_loop 4u
+#define stepper_offset_delay_loop 5u
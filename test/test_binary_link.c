@@ -0,0 +1,197 @@
+/**
+ * @file    test_binary_link.c
+ * @brief   COBS and CRC16 round trips of the binary command transport
+ * @note
+ *      "frame_raw" then "cobs_encode" is the host side encoder of a command
+ *      frame, laid out as in "system.h". Every frame must decode through the
+ *      firmware's "binary_unpack_frame" to the fields it was built from, and
+ *      a frame with any single bit flipped before encoding must fail its CRC.
+ *      Replies from "binary_send_reply" are captured from "uart_putbytes"
+ *      and decoded the same way.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "system.h"
+#include    "binary_link.h"
+#include    "host_test.h"
+
+#define     NOS_SAMPLES     200000
+#define     MAX_RAW         253         // largest raw block COBS encodes in one code
+
+static uint8_t      sent[2 * MAX_FRAME_SIZE];
+static uint32_t     sent_length;
+
+void uart_putbytes(const uint8_t *data, uint32_t count)
+{
+    memcpy(sent, data, count);
+    sent_length = count;
+}
+
+//==============================================================================
+// host encoder : raw frame with CRC, then COBS
+
+static uint32_t frame_raw(uint8_t *raw, uint8_t opcode, uint8_t sequence, uint8_t port,
+                          uint32_t nos_parameters, const int32_t *parameters)
+{
+uint32_t    length;
+uint16_t    crc;
+
+    raw[0] = opcode;
+    raw[1] = sequence;
+    raw[2] = port;
+    length = FRAME_HEADER_SIZE;
+    for (uint32_t i = 0; i < nos_parameters; i++) {
+        for (uint32_t b = 0; b < 4; b++) {
+            raw[length++] = ((uint32_t)parameters[i] >> (8 * b)) & 0xFF;
+        }
+    }
+    crc = crc16_ccitt(raw, length);
+    raw[length++] = crc & 0xFF;
+    raw[length++] = crc >> 8;
+    return length;
+}
+
+//==============================================================================
+
+static void crc_check_value(void)
+{
+    CHECK(crc16_ccitt((const uint8_t *)"123456789", 9) == 0x29B1, "CRC-16/CCITT-FALSE check value");
+    CHECK(crc16_ccitt(NULL, 0) == CRC16_INIT, "CRC of no data");
+}
+
+static void cobs_round_trip(void)
+{
+uint8_t     raw[MAX_RAW], encoded[MAX_RAW + 4], decoded[MAX_RAW + 4];
+uint32_t    length, encoded_length, zeros;
+int32_t     decoded_length;
+
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        length = test_random_range(MAX_RAW + 1);
+        zeros = test_random_range(4);           // none, few, many or all zero bytes
+        for (uint32_t i = 0; i < length; i++) {
+            raw[i] = (test_random_range(4) < zeros) ? 0 : (uint8_t)test_random();
+        }
+        encoded_length = cobs_encode(raw, length, encoded);
+        CHECK(encoded_length == (length + 1), "%u bytes encoded to %u", length, encoded_length);
+        CHECK(memchr(encoded, FRAME_DELIMITER, encoded_length) == NULL, "%u bytes : delimiter in encoded data", length);
+        decoded_length = cobs_decode(encoded, encoded_length, decoded);
+        CHECK(decoded_length == (int32_t)length, "%u bytes decoded to %d", length, decoded_length);
+        CHECK(memcmp(raw, decoded, length) == 0, "%u bytes : decoded data differs", length);
+    }
+    // a run of 254 non-zero bytes has code 0xFF and no zero after it
+    encoded[0] = 0xFF;
+    memset(&encoded[1], 0x11, 254);
+    encoded[255] = 0x02;
+    encoded[256] = 0x22;
+    decoded_length = cobs_decode(encoded, 257, decoded);
+    CHECK((decoded_length == 255) && (decoded[253] == 0x11) && (decoded[254] == 0x22), "0xFF code decoded to %d bytes", decoded_length);
+    CHECK(cobs_decode((const uint8_t *)"\x03\x01", 2, decoded) < 0, "code past the end accepted");
+    CHECK(cobs_decode((const uint8_t *)"\x00\x01", 2, decoded) < 0, "zero code accepted");
+}
+
+//==============================================================================
+
+static void command_frames(void)
+{
+uint8_t     raw[MAX_FRAME_SIZE], encoded[MAX_FRAME_SIZE + 1];
+int32_t     parameters[MAX_ARGC - 2];
+uint32_t    nos_parameters, raw_length, encoded_length, bit, nos_frames;
+uint8_t     opcode, sequence, port;
+uint16_t    crc;
+struct binary_command_s     bin_cmd;
+error_codes_te              status;
+
+    nos_frames = 0;
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        opcode = test_random_range(NOS_COMMANDS);
+        sequence = (uint8_t)test_random();
+        port = test_random_range(64);
+        nos_parameters = test_random_range(MAX_ARGC - 1);
+        for (uint32_t i = 0; i < nos_parameters; i++) {
+            parameters[i] = (test_random_range(4) == 0) ? (int32_t)test_random() : ((int32_t)test_random_range(2001) - 1000);
+        }
+        raw_length = frame_raw(raw, opcode, sequence, port, nos_parameters, parameters);
+        encoded_length = cobs_encode(raw, raw_length, encoded);
+        if (encoded_length > MAX_FRAME_SIZE) {
+            continue;           // too long for the receive buffer
+        }
+        nos_frames++;
+        status = binary_unpack_frame(encoded, encoded_length, &bin_cmd);
+        CHECK(status == OK, "frame of %u parameters : status %d", nos_parameters, status);
+        CHECK((bin_cmd.opcode == opcode) && (bin_cmd.sequence == sequence) && (bin_cmd.port == port),
+              "header %u %u %u unpacked as %u %u %u", opcode, sequence, port, bin_cmd.opcode, bin_cmd.sequence, bin_cmd.port);
+        CHECK(bin_cmd.nos_parameters == nos_parameters, "%u parameters unpacked as %u", nos_parameters, bin_cmd.nos_parameters);
+        CHECK(memcmp(bin_cmd.parameters, parameters, nos_parameters * sizeof(int32_t)) == 0, "parameters differ");
+
+        bit = test_random_range(8 * raw_length);
+        raw[bit / 8] ^= 1 << (bit % 8);
+        encoded_length = cobs_encode(raw, raw_length, encoded);
+        status = binary_unpack_frame(encoded, encoded_length, &bin_cmd);
+        CHECK(status == BAD_FRAME_CRC, "bit %u of %u flipped : status %d", bit, 8 * raw_length, status);
+    }
+    printf("    %u command frames round tripped, each with a flipped bit detected\n", nos_frames);
+
+    raw_length = frame_raw(raw, TOKENIZER_PING, 1, 2, 1, parameters);
+    encoded_length = cobs_encode(raw, raw_length - 1, encoded);
+    CHECK(binary_unpack_frame(encoded, encoded_length, &bin_cmd) == BAD_FRAME_CRC, "truncated frame accepted");
+    encoded_length = cobs_encode(raw, FRAME_HEADER_SIZE, encoded);
+    CHECK(binary_unpack_frame(encoded, encoded_length, &bin_cmd) == BAD_FRAME_LENGTH, "frame without CRC accepted");
+    raw_length = frame_raw(raw, TOKENIZER_PING, 1, 2, 0, parameters) - FRAME_CRC_SIZE;
+    raw[raw_length++] = 0x55;           // one byte of a parameter
+    crc = crc16_ccitt(raw, raw_length);
+    raw[raw_length++] = crc & 0xFF;
+    raw[raw_length++] = crc >> 8;
+    encoded_length = cobs_encode(raw, raw_length, encoded);
+    CHECK(binary_unpack_frame(encoded, encoded_length, &bin_cmd) == BAD_FRAME_LENGTH, "part parameter accepted");
+}
+
+//==============================================================================
+
+static void reply_frames(void)
+{
+struct reply_context_s  context;
+int32_t     values[MAX_REPLY_VALUES], status, got;
+uint8_t     raw[2 * MAX_FRAME_SIZE];
+uint32_t    nos_values;
+int32_t     raw_length;
+uint16_t    crc;
+
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        context.transport = TRANSPORT_BINARY;
+        context.opcode = test_random_range(NOS_COMMANDS);
+        context.sequence = (uint8_t)test_random();
+        nos_values = test_random_range(MAX_REPLY_VALUES + 1);
+        status = (int32_t)test_random_range(400) - 200;
+        for (uint32_t i = 0; i < nos_values; i++) {
+            values[i] = (int32_t)test_random();
+        }
+        binary_send_reply(&context, test_random_range(64), status, nos_values, values);
+        CHECK((sent[0] == FRAME_DELIMITER) && (sent[sent_length - 1] == FRAME_DELIMITER), "reply not bracketed by delimiters");
+        CHECK(memchr(&sent[1], FRAME_DELIMITER, sent_length - 2) == NULL, "delimiter inside a reply");
+        raw_length = cobs_decode(&sent[1], sent_length - 2, raw);
+        CHECK(raw_length == (int32_t)(REPLY_HEADER_SIZE + (4 * nos_values) + FRAME_CRC_SIZE), "reply of %u values : %d bytes",
+              nos_values, raw_length);
+        if (raw_length < (REPLY_HEADER_SIZE + FRAME_CRC_SIZE)) {
+            continue;
+        }
+        crc = raw[raw_length - 2] | (raw[raw_length - 1] << 8);
+        CHECK(crc == crc16_ccitt(raw, raw_length - FRAME_CRC_SIZE), "reply CRC");
+        CHECK((raw[0] == context.opcode) && (raw[1] == context.sequence), "reply does not echo opcode and sequence");
+        CHECK((int16_t)(raw[3] | (raw[4] << 8)) == status, "status %d sent as %d", status, (int16_t)(raw[3] | (raw[4] << 8)));
+        for (uint32_t i = 0; i < nos_values; i++) {
+            got = (int32_t)(raw[5 + (4 * i)] | (raw[6 + (4 * i)] << 8) | (raw[7 + (4 * i)] << 16) | ((uint32_t)raw[8 + (4 * i)] << 24));
+            CHECK(got == values[i], "value %u : %d sent as %d", i, values[i], got);
+        }
+    }
+}
+
+int main(void)
+{
+    crc_check_value();
+    cobs_round_trip();
+    command_frames();
+    reply_frames();
+    return test_result("test_binary_link");
+}
@@ -0,0 +1,181 @@
+/**
+ * @file    test_coordinated.c
+ * @brief   Host simulation of coordinated stepper moves
+ * @note
+ *      Groups of axes with random distances and limits are planned the way
+ *      "plan_coordinated_stepper_moves" does it : the axis with most steps
+ *      leads, with each limit the tightest of every axis's limit scaled by
+ *      leader steps / axis steps, and the other axes follow its timing.
+ *      Every axis is then generated slice by slice to check that
+ *
+ *          - each axis is within a step of the straight line at every
+ *            slice boundary
+ *          - all axes finish on the same slice, and at the same PIO cycle
+ *          - every step is sent
+ *          - speed, acceleration and jerk of each axis stay inside that
+ *            axis's own limits
+ */
+
+#include    <stdlib.h>
+#include    <math.h>
+
+#include    "system.h"
+#include    "step_profile.h"
+#include    "host_test.h"
+
+#define     NOS_GROUPS      2000
+#define     NOS_AXES        3
+#define     MAX_SLICES      200000
+#define     F               ((double)STEP_SLICES_PER_SEC)
+#define     Q32             4294967296.0
+
+struct axis_s {
+    int32_t     steps, max_speed, max_accel, max_jerk;
+    struct step_profile_s   profile;
+    uint32_t    carry;
+    uint64_t    cycles;
+    int32_t     *position;          // at each slice boundary
+};
+
+static int32_t  positions[NOS_AXES][MAX_SLICES + 1];
+
+static int32_t random_int(int32_t min, int32_t max)
+{
+    return min + (int32_t)test_random_range((uint32_t)(max - min + 1));
+}
+
+// as "scaled_stepper_limit" in Task_run_cmd.c
+
+static int64_t scaled_limit(int64_t leader_limit, int32_t axis_limit, int32_t leader_steps, int32_t axis_steps)
+{
+int64_t     limit;
+
+    limit = ((int64_t)axis_limit * leader_steps) / axis_steps;
+    if ((leader_limit == 0) || (limit < leader_limit)) {
+        return limit;
+    }
+    return leader_limit;
+}
+
+//==============================================================================
+
+static bool plan_group(struct axis_s *axes)
+{
+struct axis_s   *leader;
+int64_t         max_speed, max_accel, max_jerk;
+
+    leader = &axes[0];
+    for (uint32_t i = 1; i < NOS_AXES; i++) {
+        if (axes[i].steps > leader->steps) {
+            leader = &axes[i];
+        }
+    }
+    max_speed = max_accel = INT32_MAX;
+    max_jerk = 0;
+    for (uint32_t i = 0; i < NOS_AXES; i++) {
+        max_speed = scaled_limit(max_speed, axes[i].max_speed, leader->steps, axes[i].steps);
+        max_accel = scaled_limit(max_accel, axes[i].max_accel, leader->steps, axes[i].steps);
+        if (axes[i].max_jerk != 0) {
+            max_jerk = scaled_limit(max_jerk, axes[i].max_jerk, leader->steps, axes[i].steps);
+        }
+    }
+    if (step_profile_plan(&leader->profile, leader->steps, 0, 0, (int32_t)max_speed, (int32_t)max_accel, (int32_t)max_jerk) != OK) {
+        return false;
+    }
+    for (uint32_t i = 0; i < NOS_AXES; i++) {
+        if (&axes[i] != leader) {
+            step_profile_follow(&axes[i].profile, &leader->profile, axes[i].steps);
+        }
+    }
+    return true;
+}
+
+// run one axis to the end, recording its position at each slice boundary
+
+static void generate(struct axis_s *axis)
+{
+struct step_profile_s   *profile;
+uint32_t    nos_steps, period, last_slice;
+double      scale, v_limit, a_limit, j_limit;
+
+    profile = &axis->profile;
+    scale = (double)axis->steps / profile->lead_distance;    // generator runs in leader steps
+    v_limit = ((axis->max_speed / F) * Q32 * 1.000001) + 2;
+    a_limit = ((axis->max_accel / (F * F)) * Q32 * 1.000001) + 2;
+    j_limit = ((axis->max_jerk / (F * F * F)) * Q32 * 1.000001) + 2;
+    axis->carry = 0;
+    axis->cycles = 0;
+    axis->position[0] = 0;
+    last_slice = 0;
+    while (step_profile_next(profile, &axis->carry, &nos_steps, &period) == true) {
+        while (last_slice < (profile->slice - 1)) {
+            last_slice++;
+            axis->position[last_slice] = axis->position[last_slice - 1];    // slices with no steps
+        }
+        last_slice = profile->slice;
+        axis->position[last_slice] = profile->position;
+        axis->cycles += (uint64_t)nos_steps * period;
+        CHECK((fabs((double)profile->v) * scale) <= v_limit, "axis %d steps : speed over limit at slice %u", axis->steps, profile->slice);
+        CHECK((fabs((double)profile->a) * scale) <= a_limit, "axis %d steps : acceleration over limit at slice %u", axis->steps, profile->slice);
+        if (axis->max_jerk != 0) {
+            CHECK((fabs((double)profile->j) * scale) <= j_limit, "axis %d steps : jerk over limit at slice %u", axis->steps, profile->slice);
+        }
+    }
+    while (last_slice < profile->nos_slices) {
+        last_slice++;
+        axis->position[last_slice] = axis->position[last_slice - 1];
+    }
+}
+
+//==============================================================================
+
+int main(void)
+{
+struct axis_s   axes[NOS_AXES];
+uint32_t        leader, nos_slices, planned, longest;
+double          line, deviation, max_deviation;
+
+    max_deviation = 0;
+    planned = longest = 0;
+    for (uint32_t n = 0; n < NOS_GROUPS; n++) {
+        for (uint32_t i = 0; i < NOS_AXES; i++) {
+            axes[i].steps     = random_int(10, 5000);
+            axes[i].max_speed = random_int(200, 10000);
+            axes[i].max_accel = random_int(500, 50000);
+            axes[i].max_jerk  = (test_random_range(3) == 0) ? 0 : random_int(5000, 1000000);
+            axes[i].position  = positions[i];
+        }
+        if (plan_group(axes) == false) {
+            CHECK(false, "group %u not planned", n);
+            continue;
+        }
+        planned++;
+        nos_slices = axes[0].profile.nos_slices;
+        if (nos_slices > MAX_SLICES) {
+            continue;
+        }
+        longest = (nos_slices > longest) ? nos_slices : longest;
+        leader = 0;
+        for (uint32_t i = 0; i < NOS_AXES; i++) {
+            generate(&axes[i]);
+            leader = (axes[i].steps > axes[leader].steps) ? i : leader;
+        }
+        for (uint32_t i = 0; i < NOS_AXES; i++) {
+            CHECK(axes[i].profile.nos_slices == nos_slices, "group %u : axis %u ends on slice %u, not %u",
+                  n, i, axes[i].profile.nos_slices, nos_slices);
+            CHECK(axes[i].position[nos_slices] == axes[i].steps, "group %u : axis %u sent %d of %d steps",
+                  n, i, axes[i].position[nos_slices], axes[i].steps);
+            CHECK((axes[i].cycles + axes[i].carry) == (axes[leader].cycles + axes[leader].carry),
+                  "group %u : axis %u ends at a different PIO cycle", n, i);
+            for (uint32_t s = 0; s <= nos_slices; s++) {
+                line = ((double)axes[i].steps * axes[leader].position[s]) / axes[leader].steps;
+                deviation = fabs(axes[i].position[s] - line);
+                max_deviation = fmax(max_deviation, deviation);
+                CHECK(deviation < 1.0, "group %u : axis %u is %.3f steps off the line at slice %u", n, i, deviation, s);
+            }
+        }
+    }
+    printf("    %u groups of %u axes, up to %u slices : largest deviation from the line %.3f steps\n",
+           planned, NOS_AXES, longest, max_deviation);
+    return test_result("test_coordinated");
+}
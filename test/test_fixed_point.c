@@ -0,0 +1,158 @@
+/**
+ * @file    test_fixed_point.c
+ * @brief   Accuracy of the Q16.16 helpers and the motion paths that use them
+ * @note
+ *      Each Q16 result is compared against the exact value in double, and
+ *      the motion paths also against the float code they replaced. Errors
+ *      are in the units the firmware uses : degrees for servo angles and
+ *      steps for stepper moves.
+ */
+
+#include    <stdlib.h>
+#include    <math.h>
+
+#include    "fixed_point.h"
+#include    "host_test.h"
+
+#define     NOS_SAMPLES     200000
+
+static int32_t random_int(int32_t min, int32_t max)
+{
+    return min + (int32_t)test_random_range((uint32_t)(max - min + 1));
+}
+
+//==============================================================================
+
+static void conversions(void)
+{
+q16_t       value;
+double      real;
+
+    CHECK(int_to_q16(32767) == (32767 * Q16_ONE), "int_to_q16(32767)");
+    CHECK(int_to_q16(32768) == INT32_MAX, "int_to_q16(32768) not saturated");
+    CHECK(int_to_q16(-32768) == (-32768 * Q16_ONE), "int_to_q16(-32768)");
+    CHECK(int_to_q16(-32769) == INT32_MIN, "int_to_q16(-32769) not saturated");
+    CHECK(int_to_q16(1000000) == INT32_MAX, "int_to_q16(1000000) not saturated");
+
+    CHECK(q16_to_int(INT32_MAX) == 32767, "q16_to_int(INT32_MAX)");
+    CHECK(q16_to_int(INT32_MIN) == -32768, "q16_to_int(INT32_MIN)");
+    CHECK(q16_round(INT32_MAX) == 32768, "q16_round(INT32_MAX)");
+    CHECK(q16_round(INT32_MIN) == -32768, "q16_round(INT32_MIN)");
+
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        value = (q16_t)test_random();
+        real = (double)value / Q16_ONE;
+        CHECK(q16_to_int(value) == (int32_t)trunc(real), "q16_to_int(%d) = %d, %f", value, q16_to_int(value), real);
+        CHECK(q16_round(value) == (int32_t)round(real), "q16_round(%d) = %d, %f", value, q16_round(value), real);
+    }
+}
+
+static void arithmetic(void)
+{
+int32_t     numerator, denominator, a_int, b_int;
+q16_t       a, b;
+double      error, max_ratio, max_mul;
+
+    max_ratio = max_mul = 0;
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        numerator = random_int(-32767, 32767);
+        denominator = random_int(1, 100000);
+        error = fabs(((double)q16_ratio(numerator, denominator) / Q16_ONE) - ((double)numerator / denominator));
+        max_ratio = fmax(max_ratio, error);
+        CHECK(error < (1.0 / Q16_ONE), "q16_ratio(%d, %d) error %g", numerator, denominator, error);
+
+        a_int = random_int(-180, 180);
+        b_int = random_int(-180, 180);
+        a = int_to_q16(a_int) + (q16_t)test_random_range(Q16_ONE);
+        b = int_to_q16(b_int) + (q16_t)test_random_range(Q16_ONE);
+        error = fabs(((double)q16_mul(a, b) / Q16_ONE) - (((double)a / Q16_ONE) * ((double)b / Q16_ONE)));
+        max_mul = fmax(max_mul, error);
+        CHECK(error < (1.0 / Q16_ONE), "q16_mul(%d, %d) error %g", a, b, error);
+    }
+    printf("    q16_ratio max error %.2e, q16_mul max error %.2e (1 LSB = %.2e)\n",
+           max_ratio, max_mul, 1.0 / Q16_ONE);
+}
+
+//==============================================================================
+// Stepper move : steps = steps_per_degree x angle
+//
+// steps_per_degree is (steps/rev x gearbox x microstep) / 360, as in
+// "init_stepper_motor_data". Up to 200 x 100 x 16 gives 3,200,000 steps/rev.
+
+static void stepper_steps(void)
+{
+static const int32_t    steps_per_rev[] = {48, 200, 400};
+static const int32_t    gearbox[] = {1, 5, 27, 100};
+static const int32_t    microstep[] = {1, 2, 4, 8, 16};
+int32_t     total, angle, q16_steps, float_steps;
+q16_t       q16_steps_per_degree;
+float       float_steps_per_degree;
+double      exact, q16_error, float_error, max_q16, max_float;
+
+    max_q16 = max_float = 0;
+    for (uint32_t n = 0; n < NOS_SAMPLES; n++) {
+        total = steps_per_rev[test_random_range(3)] * gearbox[test_random_range(4)] * microstep[test_random_range(5)];
+        angle = random_int(-3600, 3600);
+        q16_steps_per_degree = q16_ratio(total, 360);
+        float_steps_per_degree = (float)total / 360.0;
+        q16_steps = q16_mul_int_to_int(q16_steps_per_degree, angle);
+        float_steps = (int32_t)(float_steps_per_degree * angle);
+        exact = ((double)total * angle) / 360.0;
+        q16_error = fabs(q16_steps - exact);
+        float_error = fabs(float_steps - exact);
+        max_q16 = fmax(max_q16, q16_error);
+        max_float = fmax(max_float, float_error);
+        // 1 step for truncation, plus 1/65536 per degree of rounding in steps/degree
+        CHECK(q16_error < (1.0 + (abs(angle) / (double)Q16_ONE)), "%d steps/rev, %d degrees : %d steps, exact %f",
+              total, angle, q16_steps, exact);
+    }
+    printf("    stepper steps max error : Q16 %.3f, float %.3f steps\n", max_q16, max_float);
+}
+
+//==============================================================================
+// Servo TIMED_MOVE : angle = gradient x counter + intercept, once per tick
+
+static void servo_timed_move(void)
+{
+int32_t     start, target, nos_ticks, q16_angle, float_angle;
+q16_t       q16_gradient, q16_intercept;
+float       float_gradient, float_intercept;
+double      exact, max_q16, max_float;
+uint32_t    ticks;
+
+    ticks = 0;
+    max_q16 = max_float = 0;
+    for (uint32_t n = 0; n < 20000; n++) {
+        start = random_int(-90, 90);
+        target = random_int(-90, 90);
+        nos_ticks = random_int(1, 1000);
+        q16_gradient = q16_ratio(target - start, nos_ticks);
+        q16_intercept = int_to_q16(start);
+        float_gradient = (float)(target - start) / (float)nos_ticks;
+        float_intercept = (float)start;
+        for (int32_t counter = 0; counter < nos_ticks; counter++) {
+            q16_angle = q16_round(q16_mul_int(q16_gradient, counter) + q16_intercept);     // as PCA9685_set_servo_fixed
+            float_angle = (int32_t)(float_gradient * (float)counter) + float_intercept;
+            exact = start + (((double)(target - start) * counter) / nos_ticks);
+            // 1/2 degree for rounding, plus gradient truncation (< 1 LSB) times counter
+            CHECK(fabs(q16_angle - exact) <= (0.5 + ((double)counter / Q16_ONE)), "%d -> %d in %d ticks, tick %d : %d, exact %f",
+                  start, target, nos_ticks, counter, q16_angle, exact);
+            max_q16 = fmax(max_q16, fabs(q16_angle - exact));
+            max_float = fmax(max_float, fabs(float_angle - exact));
+            ticks++;
+        }
+    }
+    printf("    servo ticks : %u, max angle error : Q16 %.3f, float %.3f degrees\n",
+           ticks, max_q16, max_float);
+}
+
+//==============================================================================
+
+int main(void)
+{
+    conversions();
+    arithmetic();
+    stepper_steps();
+    servo_timed_move();
+    return test_result("test_fixed_point");
+}
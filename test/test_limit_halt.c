@@ -0,0 +1,293 @@
+/**
+ * @file    test_limit_halt.c
+ * @brief   Steps made by a stepper run halted at a random PIO cycle
+ * @note
+ *      "stepper_pio_halt" finds the steps a stopped run made from the words
+ *      sent by DMA, the TX FIFO level, reg-Y and the program counter. Here
+ *      the real "stepper_pio.c" drives a cycle model of the stepper.pio
+ *      program, its joined TX FIFO and the DMA channel, with random DMA
+ *      pacing and interrupt latency. Each run is halted at a random cycle
+ *      and the count returned is compared with the STEP pulses the model
+ *      actually made.
+ *
+ *      The data sheet does not say whether the program counter points at
+ *      the side-set instruction or the next one during its delay cycle, so
+ *      both are run.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "system.h"
+#include    "stepper_pio.h"
+#include    "stepper_queue.h"
+#include    "stepper.pio.h"
+#include    "host_test.h"
+
+#define     NOS_RUNS        20000
+#define     MAX_SEGMENTS    300
+#define     FIFO_DEPTH      8           // joined TX FIFO
+
+struct stepper_data_s   stepper_data[NOS_STEPPERS];
+
+pio_hw_t    pio0_model, pio1_model;
+pio_hw_t    *pio0 = &pio0_model, *pio1 = &pio1_model, *pio0_hw = &pio0_model;
+dma_hw_t    dma_model;
+dma_hw_t    *dma_hw = &dma_model;
+const pio_program_t     stepper_program;
+
+//==============================================================================
+// PIO state machine 0 : stepper.pio, one instruction per cycle
+
+static struct {
+    uint32_t    fifo[FIFO_DEPTH];
+    uint32_t    level;
+    uint32_t    pc, osr, x, y, isr, rx;
+    bool        delay;              // in the [1] delay of "mov x, osr"
+    bool        pc_moved;           // PC is at the next instruction during the delay
+    bool        enabled, joined;
+    uint32_t    step_pin, dir;
+    int32_t     steps;              // STEP pulses made, +ve clockwise
+} sm;
+
+static bool pull(uint32_t *reg)
+{
+    if (sm.level == 0) {
+        return false;       // stall
+    }
+    *reg = sm.fifo[0];
+    memmove(sm.fifo, &sm.fifo[1], --sm.level * sizeof(uint32_t));
+    return true;
+}
+
+static void pio_cycle(void)
+{
+    if (sm.enabled == false) {
+        return;
+    }
+    if (sm.delay == true) {
+        sm.delay = false;
+        sm.pc = stepper_offset_delay_loop;
+        return;
+    }
+    switch (sm.pc) {
+        case 0 :                                    // pull block
+            if (pull(&sm.osr) == true) {
+                sm.pc = 1;
+            }
+            break;
+        case 1 :                                    // out pins, 1
+            sm.dir = sm.osr & 1;
+            sm.osr >>= 1;
+            sm.pc = 2;
+            break;
+        case 2 :                                    // out y, 31
+            sm.y = sm.osr & 0x7FFFFFFF;
+            sm.pc = 3;
+            break;
+        case 3 :                                    // pull block
+            if (pull(&sm.osr) == true) {
+                sm.pc = stepper_offset_step_loop;
+            }
+            break;
+        case stepper_offset_step_loop :             // mov x, osr side 1 [1]
+            sm.x = sm.osr;
+            sm.step_pin = 1;
+            sm.steps += ((sm.dir ^ stepper_data[0].flip_direction) == CLOCKWISE) ? 1 : -1;
+            sm.delay = true;
+            if (sm.pc_moved == true) {
+                sm.pc = stepper_offset_delay_loop;
+            }
+            break;
+        case stepper_offset_delay_loop :            // jmp x-- delay_loop side 0
+            sm.step_pin = 0;
+            sm.pc = (sm.x != 0) ? stepper_offset_delay_loop : (stepper_offset_delay_loop + 1);
+            sm.x--;
+            break;
+        case stepper_offset_delay_loop + 1 :        // jmp y-- step_loop
+            sm.pc = (sm.y != 0) ? stepper_offset_step_loop : 0;
+            sm.y--;
+            break;
+    }
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) { return 0; }
+uint pio_get_dreq(PIO pio, uint sm_no, bool is_tx) { return 0; }
+void pio_sm_set_enabled(PIO pio, uint sm_no, bool enabled) { sm.enabled = enabled; }
+void pio_sm_clear_fifos(PIO pio, uint sm_no) { sm.level = 0; }
+void pio_sm_restart(PIO pio, uint sm_no) { }
+uint8_t pio_sm_get_pc(PIO pio, uint sm_no) { return sm.pc; }
+uint32_t pio_sm_get(PIO pio, uint sm_no) { return sm.rx; }
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm_no) { return (sm.joined == true) ? sm.level : 0; }
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm_no) { return sm.level == 0; }
+void pio_sm_put(PIO pio, uint sm_no, uint32_t data) { sm.fifo[sm.level++] = data; }
+void pio_sm_set_pins_with_mask(PIO pio, uint sm_no, uint32_t values, uint32_t mask) { sm.step_pin = 0; }
+bool gpio_get(uint gpio) { return sm.step_pin; }
+
+uint pio_encode_jmp(uint address) { return 0x1000 | address; }
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) { return 0x2000 | (dest << 4) | src; }
+uint pio_encode_push(bool if_full, bool block) { return 0x3000; }
+
+void pio_sm_exec(PIO pio, uint sm_no, uint instruction)
+{
+    if ((instruction & 0xF000) == 0x1000) {
+        sm.pc = instruction & 0xFFF;
+        sm.delay = false;
+    } else if (instruction == (0x2000 | (pio_isr << 4) | pio_y)) {
+        sm.isr = sm.y;
+    } else if (instruction == 0x3000) {
+        CHECK(sm.joined == false, "push with the FIFOs joined");
+        sm.rx = sm.isr;
+    }
+}
+
+// FJOIN_TX is the only shiftctrl bit written : changing it empties the FIFOs
+
+void hw_clear_bits(volatile uint32_t *address, uint32_t mask) { sm.joined = false; sm.level = 0; }
+void hw_set_bits(volatile uint32_t *address, uint32_t mask) { sm.joined = true; sm.level = 0; }
+
+//==============================================================================
+// DMA channel : one word to the FIFO on some cycles that it has room
+
+static struct {
+    bool        active, irq_pending, irq_enabled;
+    uint32_t    count;
+    uint32_t    *read;
+    int32_t     irq_latency;
+    irq_handler_t   handler;
+    dma_channel_hw_t    hw;
+} dma;
+
+dma_channel_config dma_channel_get_default_config(uint channel) { dma_channel_config config = {0}; return config; }
+void channel_config_set_transfer_data_size(dma_channel_config *c, int size) { }
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) { }
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) { }
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) { }
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) { }
+void dma_channel_claim(uint channel) { }
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) { dma.irq_enabled = enabled; }
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) { dma.handler = handler; }
+void irq_set_enabled(uint num, bool enabled) { }
+void dma_channel_abort(uint channel) { dma.active = false; }
+void dma_channel_acknowledge_irq0(uint channel) { dma.irq_pending = false; }
+bool dma_channel_get_irq0_status(uint channel) { return dma.irq_pending; }
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) { dma.read = (uint32_t *)read_addr; }
+void dma_channel_set_trans_count(uint channel, uint32_t count, bool trigger) { dma.count = count; }
+void dma_start_channel_mask(uint32_t mask) { dma.active = (mask != 0) && (dma.count > 0); }
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t count)
+{
+    dma.read = (uint32_t *)read_addr;
+    dma.count = count;
+    dma.active = (count > 0);
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel)
+{
+    dma.hw.read_addr = (uint32_t)(uintptr_t)dma.read;
+    dma.hw.transfer_count = dma.count;
+    return &dma.hw;
+}
+
+static void dma_cycle(void)
+{
+    if ((dma.active == true) && (sm.level < FIFO_DEPTH) && (test_random_range(3) != 0)) {
+        sm.fifo[sm.level++] = *dma.read++;
+        if (--dma.count == 0) {
+            dma.active = false;
+            dma.irq_pending = true;
+            dma.irq_latency = test_random_range(40);
+        }
+    }
+    if ((dma.irq_pending == true) && (dma.irq_enabled == true) && (dma.irq_latency-- <= 0)) {
+        dma.handler();
+    }
+}
+
+//==============================================================================
+// move queue : random segments
+
+static uint32_t     nos_segments, next_segment;
+static uint32_t     segment_steps[MAX_SEGMENTS], segment_period[MAX_SEGMENTS];
+static sm_direction segment_direction[MAX_SEGMENTS];
+
+void stepper_queue_begin(uint32_t stepper_no)
+{
+    next_segment = 0;
+}
+
+bool stepper_queue_next(uint32_t stepper_no, uint32_t *nos_steps, uint32_t *period, sm_direction *direction)
+{
+    if (next_segment >= nos_segments) {
+        return false;
+    }
+    *nos_steps = segment_steps[next_segment];
+    *period    = segment_period[next_segment];
+    *direction = segment_direction[next_segment];
+    next_segment++;
+    return true;
+}
+
+static void random_run(uint32_t run)
+{
+    stepper_data[0].flip_direction = test_random_range(2);
+    nos_segments = 1 + test_random_range(MAX_SEGMENTS);
+    for (uint32_t k = 0; k < nos_segments; k++) {
+        segment_steps[k]  = 1 + ((test_random_range(4) != 0) ? test_random_range(3) : test_random_range(40));
+        segment_period[k] = STEPPER_MIN_PERIOD + test_random_range((test_random_range(2) != 0) ? 10 : 200);
+        if (test_random_range(5) == 0) {
+            segment_direction[k] = ANTI_CLOCKWISE;          // reversals inside a run
+        } else {
+            segment_direction[k] = ((run & 1) != 0) ? ANTI_CLOCKWISE : CLOCKWISE;
+        }
+    }
+}
+
+//==============================================================================
+
+static void halt_runs(bool pc_moved)
+{
+uint32_t    halt_cycle, service_cycles, nos_bad;
+int32_t     steps;
+
+    nos_bad = 0;
+    for (uint32_t run = 0; run < NOS_RUNS; run++) {
+        random_run(run);
+        memset(&sm, 0, sizeof(sm));
+        sm.enabled  = true;
+        sm.joined   = true;
+        sm.pc_moved = pc_moved;
+        dma.active = dma.irq_pending = false;
+        stepper_pio_load(0);
+        stepper_pio_start(0);
+
+        halt_cycle = test_random_range((test_random_range(2) != 0) ? 3000 : 200000);
+        service_cycles = 50 + test_random_range(3000);          // task refill poll
+        for (uint32_t cycle = 0; cycle < halt_cycle; cycle++) {
+            dma_cycle();
+            pio_cycle();
+            if ((cycle % service_cycles) == 0) {
+                stepper_pio_service(0);
+            }
+            if (stepper_pio_done(0) == true) {
+                break;
+            }
+        }
+        steps = stepper_pio_halt(0);
+        if (steps != sm.steps) {
+            nos_bad++;
+        }
+        CHECK(steps == sm.steps, "run %u, PC %u : %d steps counted, %d made", run, sm.pc, steps, sm.steps);
+    }
+    printf("    %u halts, PC %s during the step pulse delay : %u miscounted\n",
+           NOS_RUNS, (pc_moved == true) ? "at the next instruction" : "held", nos_bad);
+}
+
+int main(void)
+{
+    stepper_pio_init();
+    halt_runs(false);
+    halt_runs(true);
+    return test_result("test_limit_halt");
+}
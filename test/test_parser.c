@@ -0,0 +1,237 @@
+/**
+ * @file    test_parser.c
+ * @brief   Differential fuzz of "parse_command" against the original parser
+ * @note
+ *      Random command lines of words, signed integers, strings, separators
+ *      and stray characters go through both parsers. Where the original
+ *      accepts a line the new parser must give the same arguments; where
+ *      it rejects one the new parser must reject it too. The one intended
+ *      difference is a single point in a number, which the original always
+ *      rejected : such reals are checked against strtod() instead.
+ *      Numbers that overflow an int32_t must be rejected.
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "system.h"
+#include    "host_test.h"
+#include    "ref_parser.h"
+
+#define     NOS_FUZZ_LINES      200000
+
+extern char        command[MAX_COMMAND_LENGTH];
+extern uint32_t    character_count;
+extern uint32_t    argc, arg_pt[MAX_ARGC], arg_type[MAX_ARGC];
+extern int32_t     int_parameters[MAX_ARGC];
+
+error_codes_te parse_command(uint32_t *cmd_start);
+
+//==============================================================================
+
+static error_codes_te new_parse(const char *line)
+{
+uint32_t    cmd_start;
+
+    strcpy(command, line);
+    character_count = strlen(line);
+    cmd_start = 0;
+    return parse_command(&cmd_start);
+}
+
+static void append(char *line, const char *text)
+{
+    strcat(line, text);
+}
+
+static void append_random(char *line, const char *alphabet, uint32_t min, uint32_t max)
+{
+uint32_t    length, end;
+
+    length = min + test_random_range(max - min + 1);
+    end = strlen(line);
+    for (uint32_t i = 0; i < length; i++) {
+        line[end++] = alphabet[test_random_range(strlen(alphabet))];
+    }
+    line[end] = '\0';
+}
+
+static void random_argument(char *line)
+{
+    switch (test_random_range(6)) {
+        case 0 :        // word
+            append_random(line, "abcxyzABC_", 1, 1);
+            append_random(line, "abcxyz_019.+-", 0, 6);
+            break;
+        case 1 :        // integer
+        case 2 :
+            if (test_random_range(3) == 0) {
+                append_random(line, "+-", 1, 1);
+            }
+            append_random(line, "0123456789", 1, 9);
+            break;
+        case 3 :        // string
+            append(line, "\"");
+            append_random(line, "ab 09,.+-", 0, 8);
+            if (test_random_range(8) != 0) {
+                append(line, "\"");
+            }
+            break;
+        case 4 :        // number with a stray character
+            append_random(line, "0123456789", 1, 4);
+            append_random(line, "a+-\".", 1, 1);
+            append_random(line, "0123456789", 0, 3);
+            break;
+        default :       // anything from the alphabet
+            append_random(line, "ab09+-\"., \t", 1, 6);
+            break;
+    }
+}
+
+// text of a WORD or STRING argument, which either parser may leave unterminated at END
+
+static void argument_text(const char *cmd, uint32_t start, uint32_t type, char *text)
+{
+uint32_t    i;
+
+    for (i = 0; (cmd[start + i] != '\0') && (i < (MAX_COMMAND_LENGTH - 1)); i++) {
+        if ((type == MODE_S) && (cmd[start + i] == '"')) {
+            break;
+        }
+        if ((type == MODE_W) && (strchr(" ,\t", cmd[start + i]) != NULL)) {
+            break;
+        }
+        text[i] = cmd[start + i];
+    }
+    text[i] = '\0';
+}
+
+static bool has_real(void)
+{
+    for (uint32_t i = 0; i < argc; i++) {
+        if (arg_type[i] == MODE_R) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//==============================================================================
+
+static void fuzz_against_reference(void)
+{
+struct ref_parse_s  ref;
+error_codes_te      ref_status, new_status;
+char                line[MAX_COMMAND_LENGTH], ref_text[MAX_COMMAND_LENGTH], new_text[MAX_COMMAND_LENGTH];
+uint32_t            nos_args, compared, reals;
+
+    compared = reals = 0;
+    for (uint32_t n = 0; n < NOS_FUZZ_LINES; n++) {
+        line[0] = '\0';
+        append_random(line, "abcxyz", 1, 1);
+        append_random(line, "abcxyz", 0, 6);
+        nos_args = test_random_range(MAX_ARGC - 1);
+        for (uint32_t i = 0; i < nos_args; i++) {
+            append_random(line, " ,\t", 1, 2);
+            random_argument(line);
+        }
+        if (test_random_range(4) == 0) {
+            append_random(line, " ,", 1, 2);
+        }
+        ref_status = ref_parse(&ref, line);
+        new_status = new_parse(line);
+        if (ref_status != OK) {
+            if ((new_status == OK) && (ref_status == DOT_ERROR) && has_real()) {
+                reals++;        // intended difference : checked in "real_values"
+                continue;
+            }
+            CHECK(new_status != OK, "[%s] reference %d, new OK", line, ref_status);
+            continue;
+        }
+        compared++;
+        CHECK(new_status == OK, "[%s] reference OK, new %d", line, new_status);
+        if (new_status != OK) {
+            continue;
+        }
+        CHECK(argc == ref.argc, "[%s] argc %u, reference %u", line, argc, ref.argc);
+        for (uint32_t i = 0; (i < argc) && (i < ref.argc); i++) {
+            CHECK(arg_type[i] == ref.arg_type[i], "[%s] arg %u type %u, reference %u", line, i, arg_type[i], ref.arg_type[i]);
+            if (ref.arg_type[i] == MODE_I) {
+                CHECK(int_parameters[i] == ref.int_parameters[i], "[%s] arg %u = %d, reference %d",
+                      line, i, int_parameters[i], ref.int_parameters[i]);
+            } else {
+                argument_text(ref.command, ref.arg_pt[i], ref.arg_type[i], ref_text);
+                argument_text(command, arg_pt[i], arg_type[i], new_text);
+                CHECK(strcmp(ref_text, new_text) == 0, "[%s] arg %u \"%s\", reference \"%s\"", line, i, new_text, ref_text);
+            }
+        }
+    }
+    printf("    %u lines : %u accepted by both, %u reals accepted by new parser only\n",
+           NOS_FUZZ_LINES, compared, reals);
+}
+
+//==============================================================================
+
+static void real_values(void)
+{
+char        line[MAX_COMMAND_LENGTH], number[32];
+uint32_t    int_digits, fraction_digits;
+int32_t     expected;
+
+    for (uint32_t n = 0; n < 20000; n++) {
+        number[0] = '\0';
+        if (test_random_range(2) == 0) {
+            append(number, "-");
+        }
+        int_digits = 1 + test_random_range(4);      // a number cannot start with '.'
+        fraction_digits = test_random_range(7 - int_digits);
+        append_random(number, "0123456789", int_digits, int_digits);
+        append(number, ".");
+        append_random(number, "0123456789", fraction_digits, fraction_digits + 3);
+        snprintf(line, sizeof(line), "servo 0 %s", number);
+        expected = (int32_t)strtod(number, NULL);
+        CHECK(new_parse(line) == OK, "[%s] rejected", line);
+        CHECK(arg_type[2] == MODE_R, "[%s] type %u", line, arg_type[2]);
+        CHECK(int_parameters[2] == expected, "[%s] = %d, strtod %d", line, int_parameters[2], expected);
+    }
+}
+
+static void overflow(void)
+{
+static const struct {
+    const char      *line;
+    error_codes_te  status;
+    int32_t         value;
+} cases[] = {
+    {"servo 0 2147483647",          OK,                         2147483647},
+    {"servo 0 -2147483647",         OK,                         -2147483647},
+    {"servo 0 2147483648",          PARAMETER_OUTWITH_LIMITS,   0},
+    {"servo 0 99999999999999999",   PARAMETER_OUTWITH_LIMITS,   0},
+    {"servo 0 -9999999999",         PARAMETER_OUTWITH_LIMITS,   0},
+    {"servo 0 2147.483647",         OK,                         2147},
+    {"servo 0 21474.83647",         OK,                         21474},
+    {"servo 0 21474.836470",        PARAMETER_OUTWITH_LIMITS,   0},         // 6 fraction digits still count
+    {"servo 0 2147.4836470",        OK,                         2147},      // 7th fraction digit ignored
+    {"servo 0 214748.3648",         PARAMETER_OUTWITH_LIMITS,   0},
+    {"servo 0 1.1234567891234",     OK,                         1},
+};
+error_codes_te  status;
+
+    for (uint32_t i = 0; i < (sizeof(cases) / sizeof(cases[0])); i++) {
+        status = new_parse(cases[i].line);
+        CHECK(status == cases[i].status, "[%s] status %d, expected %d", cases[i].line, status, cases[i].status);
+        if ((status == OK) && (cases[i].status == OK)) {
+            CHECK(int_parameters[2] == cases[i].value, "[%s] = %d", cases[i].line, int_parameters[2]);
+        }
+    }
+}
+
+//==============================================================================
+
+int main(void)
+{
+    fuzz_against_reference();
+    real_values();
+    overflow();
+    return test_result("test_parser");
+}
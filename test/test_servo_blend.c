@@ -0,0 +1,277 @@
+/**
+ * @file    test_servo_blend.c
+ * @brief   Host simulation of servo moves retargeted part way through
+ * @note
+ *      "servo_tick" is run tick by tick on the real servo, PCA9685 and
+ *      trajectory code, with the I2C engine stubbed out. The angle sent to
+ *      the PCA9685 each tick is captured by wrapping "PCA9685_set_servo"
+ *      and "PCA9685_set_servo_fixed" (-Wl,--wrap).
+ *
+ *      A new move sent to a moving servo must take over from the present
+ *      position and velocity. The blend is a cubic Hermite segment, so
+ *      acceleration may step but velocity may not : the change of output
+ *      per tick at the retarget must be no larger than anywhere in the
+ *      blend. The move must still end at rest on the new target and
+ *      report "done".
+ */
+
+#include    <stdlib.h>
+#include    <string.h>
+#include    <math.h>
+
+#include    "system.h"
+#include    "PCA9685.h"
+#include    "i2c_engine.h"
+#include    "host_test.h"
+
+#define     SERVO           1           // +/-45 degrees, 10mS/degree slew
+#define     MAX_TICKS       2000
+
+extern struct servo_data_s  servo_data[NOS_SERVOS];
+
+void servo_tick(uint32_t servo_no);
+
+static double       output[MAX_TICKS];  // degrees sent at each tick
+static uint32_t     tick, nos_done;
+
+//==============================================================================
+// stubs and wrappers
+
+error_codes_te i2c_transfer(uint8_t address, const uint8_t *tx_data, uint32_t tx_length, uint8_t *rx_data, uint32_t rx_length)
+{
+    if (rx_data != NULL) {
+        memset(rx_data, 0, rx_length);
+    }
+    return OK;
+}
+
+error_codes_te i2c_submit(struct i2c_transfer_s *transfer)
+{
+    return OK;
+}
+
+error_codes_te i2c_wait(struct i2c_transfer_s *transfer)
+{
+    return OK;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+void print_move_done(uint32_t *seq_id, int32_t status)
+{
+    if (*seq_id != 0) {
+        nos_done++;
+        *seq_id = 0;
+    }
+}
+
+error_codes_te __real_PCA9685_set_servo_fixed(uint32_t servo_no, q16_t angle);
+
+error_codes_te __wrap_PCA9685_set_servo_fixed(uint32_t servo_no, q16_t angle)
+{
+    if ((servo_no == SERVO) && (tick < MAX_TICKS)) {
+        output[tick] = (double)angle / Q16_ONE;
+    }
+    return __real_PCA9685_set_servo_fixed(servo_no, angle);
+}
+
+error_codes_te __wrap_PCA9685_set_servo(uint32_t servo_no, int32_t angle)
+{
+    return __wrap_PCA9685_set_servo_fixed(servo_no, int_to_q16(angle));
+}
+
+//==============================================================================
+
+static void start(int32_t angle)
+{
+    servo_data[SERVO].state = DORMANT;
+    servo_data[SERVO].sync  = false;
+    servo_data[SERVO].angle = angle;
+    servo_data[SERVO].speed_value = SERVO_SPEED_UNLIMITED;
+    servo_data[SERVO].seq_id = 0;
+    nos_done = 0;
+    tick = 0;
+    output[0] = angle;
+}
+
+// run to rest, returning the tick that the move ended on
+
+static uint32_t run(uint32_t nos_ticks)
+{
+    for (uint32_t i = 0; (i < nos_ticks) && (tick < (MAX_TICKS - 1)); i++) {
+        tick++;
+        output[tick] = output[tick - 1];        // held unless the servo is set
+        servo_tick(SERVO);
+        if (servo_data[SERVO].state == DORMANT) {
+            break;
+        }
+    }
+    return tick;
+}
+
+static double velocity(uint32_t t)
+{
+    return output[t] - output[t - 1];
+}
+
+// largest change of velocity per tick over ticks first..last
+
+static double max_acceleration(uint32_t first, uint32_t last)
+{
+double      max;
+
+    max = 0;
+    for (uint32_t t = first; t <= last; t++) {
+        max = fmax(max, fabs(velocity(t) - velocity(t - 1)));
+    }
+    return max;
+}
+
+// the turn is the last tick of the first move, the blend runs from the next
+
+static void check_blend(const char *name, int32_t target, uint32_t turn, uint32_t end)
+{
+double      step, blend_accel;
+
+    step = fabs(velocity(turn + 1) - velocity(turn));
+    blend_accel = max_acceleration(turn + 2, end);
+    printf("    %-12s at %6.3f deg/tick : velocity change %.3f at the turn, up to %.3f in the blend\n",
+           name, velocity(turn), step, blend_accel);
+    CHECK(step <= (blend_accel + 0.001), "%s : step in velocity %.3f at the turn", name, step);
+    CHECK(output[end] == target, "%s : ends at %.3f, not %d", name, output[end], target);
+    CHECK(fabs(velocity(end)) <= (blend_accel + 0.001), "%s : still moving at %.3f deg/tick at the end", name, velocity(end));
+    CHECK(nos_done == 1, "%s : %u done messages", name, nos_done);
+}
+
+//==============================================================================
+// Min-jerk move 0 -> 40 in 2S, reversed to -30 at half way (peak speed)
+
+static void retarget_trajectory(void)
+{
+uint32_t    turn, end;
+
+    start(0);
+    CHECK(set_servo_profile_move(SERVO, 40, 20, TRAJ_MIN_JERK, false) == OK, "profile move");
+    turn = run(50);
+    servo_data[SERVO].seq_id = 1;
+    CHECK(set_servo_profile_move(SERVO, -30, 20, TRAJ_MIN_JERK, false) == OK, "retarget refused");
+    end = run(MAX_TICKS);
+    check_blend("min-jerk", -30, turn, end);
+}
+
+//==============================================================================
+// Timed move 0 -> 40 in 3S, sent on to 10 after 1S
+
+static void retarget_timed(void)
+{
+uint32_t    turn, end;
+
+    start(0);
+    CHECK(set_servo_speed_move(SERVO, TIMED_MOVE, 40, 30, false) == OK, "timed move");
+    turn = run(50);
+    servo_data[SERVO].seq_id = 2;
+    CHECK(set_servo_speed_move(SERVO, TIMED_MOVE, 10, 20, false) == OK, "retarget refused");
+    end = run(MAX_TICKS);
+    check_blend("timed", 10, turn, end);
+}
+
+//==============================================================================
+// ABS_MOVE 0 -> 40 : output goes straight to 40 and the servo slews at
+// 10mS/degree. Sent to -20 after 0.2S, the blend starts from where the servo
+// is estimated to be (about 20 degrees), not from 40.
+
+static void retarget_abs_move(void)
+{
+uint32_t    turn, end;
+double      estimate;
+
+    start(0);
+    CHECK(set_servo_move(SERVO, MOVE, 40, false) == OK, "abs move");
+    turn = run(10);
+    estimate = 40 - ((double)servo_data[SERVO].gradient * servo_data[SERVO].counter / Q16_ONE);
+    servo_data[SERVO].seq_id = 3;
+    CHECK(set_servo_move(SERVO, MOVE, -20, false) == OK, "retarget refused");
+    end = run(MAX_TICKS);
+    printf("    abs move with the servo near %.1f degrees : blend starts at %.2f\n", estimate, output[turn + 1]);
+    CHECK(fabs(output[turn + 1] - estimate) <= 2.0, "abs : blend starts at %.2f, servo near %.2f", output[turn + 1], estimate);
+    CHECK(output[end] == -20, "abs : ends at %.3f", output[end]);
+    CHECK(nos_done == 1, "abs : %u done messages", nos_done);
+}
+
+//==============================================================================
+// Speed limit holds through a blend. A min-jerk move at its 60 deg/S limit
+// is reversed at peak speed : the blend overshoots, and must come back no
+// faster than the limit. A servo already moving well over a limit set
+// during the move comes back at no more than 2/3 of its speed.
+
+static double fastest_back(uint32_t turn, uint32_t end)
+{
+double      fastest;
+
+    fastest = 0;
+    for (uint32_t t = turn + 1; t <= end; t++) {
+        fastest = fmax(fastest, -velocity(t));      // towards the new target
+    }
+    return fastest;
+}
+
+static void retarget_speed_limit(void)
+{
+uint32_t    turn, end;
+double      limit, fastest;
+
+    limit = 60.0 / TASK_SERVO_CONTROL_FREQUENCY;
+    start(-40);
+    servo_data[SERVO].speed_value = 60;     // deg/S
+    CHECK(set_servo_profile_move(SERVO, 40, 10, TRAJ_MIN_JERK, false) == OK, "profile move");
+    turn = run(62);
+    servo_data[SERVO].seq_id = 4;
+    CHECK(set_servo_profile_move(SERVO, -40, 5, TRAJ_MIN_JERK, false) == OK, "retarget refused");
+    end = run(MAX_TICKS);
+    fastest = fastest_back(turn, end);
+    printf("    reversed at %.2f deg/tick, limit %.2f : fastest back %.2f\n", velocity(turn), limit, fastest);
+    CHECK(fastest <= (limit + 0.001), "speed limit : %.3f deg/tick back", fastest);
+    check_blend("speed limit", -40, turn, end);
+
+    start(-40);
+    CHECK(set_servo_profile_move(SERVO, 40, 10, TRAJ_MIN_JERK, false) == OK, "profile move");
+    turn = run(25);
+    servo_data[SERVO].speed_value = 60;     // set during the move
+    servo_data[SERVO].seq_id = 5;
+    CHECK(set_servo_profile_move(SERVO, -40, 5, TRAJ_MIN_JERK, false) == OK, "retarget refused");
+    end = run(MAX_TICKS);
+    fastest = fastest_back(turn, end);
+    printf("    reversed at %.2f deg/tick, limit %.2f : fastest back %.2f\n", velocity(turn), limit, fastest);
+    CHECK(fastest <= (((2 * velocity(turn)) / 3) + 0.001), "limit lowered : %.3f deg/tick back", fastest);
+    check_blend("limit set", -40, turn, end);
+}
+
+//==============================================================================
+// held for sync : still SERVO_BUSY
+
+static void busy_sync(void)
+{
+    start(0);
+    CHECK(set_servo_profile_move(SERVO, 30, 10, TRAJ_MIN_JERK, false) == OK, "profile move");
+    run(10);
+    CHECK(set_servo_profile_move(SERVO, 0, 10, TRAJ_MIN_JERK, true) == SERVO_BUSY, "sync move accepted on a moving servo");
+    run(MAX_TICKS);
+}
+
+int main(void)
+{
+    init_PCA9685_servo_IO();
+    retarget_trajectory();
+    retarget_timed();
+    retarget_abs_move();
+    retarget_speed_limit();
+    busy_sync();
+    return test_result("test_servo_blend");
+}
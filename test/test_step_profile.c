@@ -0,0 +1,170 @@
+/**
+ * @file    test_step_profile.c
+ * @brief   Stepper profiles are within limits and take the minimum time
+ * @note
+ *      For random moves, the planned time is compared with the exact
+ *      minimum time of a continuous profile under the same speed,
+ *      acceleration and jerk limits : the fastest such profile cruises at
+ *      the highest peak speed whose ramps fit in the move, so the minimum
+ *      is found by scanning peak speeds. The plan may only lose the whole
+ *      slices that its ramps are rounded up to.
+ *
+ *      Each move is then generated segment by segment to check that all
+ *      steps are sent, in the planned time, with speed, acceleration and
+ *      jerk inside their limits at every slice.
+ */
+
+#include    <stdlib.h>
+#include    <math.h>
+
+#include    "system.h"
+#include    "step_profile.h"
+#include    "host_test.h"
+
+#define     NOS_MOVES       3000
+#define     F               ((double)STEP_SLICES_PER_SEC)
+#define     Q32             4294967296.0
+
+static int32_t random_int(int32_t min, int32_t max)
+{
+    return min + (int32_t)test_random_range((uint32_t)(max - min + 1));
+}
+
+//==============================================================================
+// Continuous reference, in seconds and steps
+
+static double ramp_seconds(double change, double max_accel, double max_jerk)
+{
+    change = fabs(change);
+    if (max_jerk == 0) {
+        return change / max_accel;
+    }
+    if ((change * max_jerk) < (max_accel * max_accel)) {
+        return 2 * sqrt(change / max_jerk);
+    }
+    return (change / max_accel) + (max_accel / max_jerk);
+}
+
+// minimum move time, or -1 if the move is too short to change speed
+
+static double minimum_seconds(double D, double ve, double vx, double max_speed, double max_accel, double max_jerk)
+{
+double      v, Ta, Tb, ramps, best;
+
+    best = -1;
+    for (v = fmax(fmax(ve, vx), 1); v <= max_speed; v += fmax(1, max_speed / 20000)) {
+        Ta = ramp_seconds(v - ve, max_accel, max_jerk);
+        Tb = ramp_seconds(v - vx, max_accel, max_jerk);
+        ramps = (((ve + v) * Ta) + ((v + vx) * Tb)) / 2;
+        if (ramps > D) {
+            break;      // ramps only grow with v
+        }
+        if ((best < 0) || ((Ta + Tb + ((D - ramps) / v)) < best)) {
+            best = Ta + Tb + ((D - ramps) / v);
+        }
+    }
+    return best;
+}
+
+//==============================================================================
+
+static void check_move(int32_t D, int32_t ve, int32_t vx, int32_t max_speed, int32_t max_accel, int32_t max_jerk,
+                       double *max_excess)
+{
+struct step_profile_s   profile;
+uint32_t    carry, nos_steps, period, total_steps, slack;
+uint64_t    cycles, planned_cycles;
+double      planned, minimum, v_limit, a_limit, j_limit;
+
+    CHECK(step_profile_plan(&profile, D, ve, vx, max_speed, max_accel, max_jerk) == OK,
+          "plan D=%d ve=%d vx=%d vmax=%d amax=%d jmax=%d", D, ve, vx, max_speed, max_accel, max_jerk);
+    planned_cycles = ((uint64_t)(profile.Ta + profile.Tc + profile.Tb) * STEP_SLICE_CYCLES) + profile.Tf;
+    planned = (double)planned_cycles / STEPPER_PIO_FREQUENCY;
+    minimum = minimum_seconds(D, ve, vx, max_speed, max_accel, max_jerk);
+    if (minimum < 0) {
+        return;         // fits only with rounding of the discrete ramps
+    }
+    // each ramp rounds up to whole slices : 1 without jerk, 2 with
+    slack = (max_jerk == 0) ? 2 : 4;
+    CHECK(planned <= (minimum + ((slack + 0.01) / F)), "D=%d ve=%d vx=%d vmax=%d amax=%d jmax=%d : %.6fS, minimum %.6fS",
+          D, ve, vx, max_speed, max_accel, max_jerk, planned, minimum);
+    CHECK(planned >= (minimum - (1.0 / F)), "D=%d ve=%d vx=%d : %.6fS faster than limits allow (%.6fS)",
+          D, ve, vx, planned, minimum);
+    *max_excess = fmax(*max_excess, (planned - minimum) * F);
+
+    // generate : steps/slice, steps/slice^2, steps/slice^3 in 32.32
+    v_limit = (max_speed / F) * Q32 * 1.000001;
+    a_limit = (max_accel / (F * F)) * Q32 * 1.000001 + 2;
+    j_limit = (max_jerk / (F * F * F)) * Q32 * 1.000001 + 2;
+    carry = 0;
+    total_steps = 0;
+    cycles = 0;
+    while (step_profile_next(&profile, &carry, &nos_steps, &period) == true) {
+        total_steps += nos_steps;
+        cycles += (uint64_t)nos_steps * period;
+        CHECK(fabs((double)profile.v) <= v_limit, "D=%d slice %u : speed over limit", D, profile.slice);
+        CHECK(fabs((double)profile.a) <= a_limit, "D=%d slice %u : acceleration %g over %g", D, profile.slice,
+              fabs((double)profile.a), a_limit);
+        if (max_jerk != 0) {
+            CHECK(fabs((double)profile.j) <= j_limit, "D=%d slice %u : jerk over limit", D, profile.slice);
+        }
+    }
+    CHECK(total_steps == (uint32_t)D, "D=%d : %u steps sent", D, total_steps);
+    // the carry left over is time after the last step
+    CHECK((cycles + carry) == planned_cycles, "D=%d : %lu + %u cycles, planned %lu", D,
+          (unsigned long)cycles, carry, (unsigned long)planned_cycles);
+}
+
+static void random_moves(void)
+{
+int32_t     D, ve, vx, max_speed, max_accel, max_jerk;
+double      max_excess_trap, max_excess_scurve;
+uint32_t    nos_trap, nos_scurve;
+
+    max_excess_trap = max_excess_scurve = 0;
+    nos_trap = nos_scurve = 0;
+    for (uint32_t n = 0; n < NOS_MOVES; n++) {
+        max_speed = random_int(100, 20000);
+        max_accel = random_int(100, 100000);
+        max_jerk  = (test_random_range(3) == 0) ? 0 : random_int(1000, 2000000);
+        D         = random_int(1, 50000);
+        ve        = 0;
+        vx        = 0;
+        if (test_random_range(2) == 0) {
+            ve = random_int(0, max_speed);
+            vx = step_profile_exit(ve, random_int(0, max_speed), D, max_speed, max_accel, max_jerk);
+            if ((ve > vx) && (step_profile_reach(vx, D, max_speed, max_accel, max_jerk) < ve)) {
+                continue;       // too short to slow down : the queue never plans this
+            }
+        }
+        if (max_jerk == 0) {
+            check_move(D, ve, vx, max_speed, max_accel, max_jerk, &max_excess_trap);
+            nos_trap++;
+        } else {
+            check_move(D, ve, vx, max_speed, max_accel, max_jerk, &max_excess_scurve);
+            nos_scurve++;
+        }
+    }
+    printf("    %u trapezoidal moves : at most %.2f slices over the minimum time\n", nos_trap, max_excess_trap);
+    printf("    %u S-curve moves     : at most %.2f slices over the minimum time\n", nos_scurve, max_excess_scurve);
+}
+
+//==============================================================================
+// Known case : 0 -> 0, 10000 steps, 5000 steps/S, 20000 steps/S/S, no jerk
+// Ramps 0.25S and 625 steps each, cruise 8750 steps in 1.75S : 2.25S
+
+static void known_move(void)
+{
+struct step_profile_s   profile;
+
+    CHECK(step_profile_plan(&profile, 10000, 0, 0, 5000, 20000, 0) == OK, "known move");
+    CHECK((profile.Ta == 250) && (profile.Tb == 250), "ramps %u, %u slices", profile.Ta, profile.Tb);
+    CHECK((profile.Tc == 1750) && (profile.Tf == 0), "cruise %u slices + %u cycles", profile.Tc, profile.Tf);
+}
+
+int main(void)
+{
+    known_move();
+    random_moves();
+    return test_result("test_step_profile");
+}